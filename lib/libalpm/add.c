@@ -23,6 +23,7 @@
 #include <string.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -110,11 +111,451 @@ int SYMEXPORT alpm_add_pkg(alpm_handle_t *handle, alpm_pkg_t *pkg)
 	return 0;
 }
 
+/* Verified extraction: per-file SHA-256 digests parsed from the package's
+ * mtree manifest, checked against a digest computed from the bytes as they
+ * stream to disk. The .MTREE archive entry precedes the package files, so
+ * the map is built from the just-extracted database copy before any file
+ * it covers is reached. libarchive's mtree reader does not expose the
+ * checksum keywords (see the placeholder note in pacman's check.c), so the
+ * digest lines are parsed directly. */
+
+struct mtree_digest {
+	char *path; /* without the leading "./" */
+	char sha256[65];
+};
+
+struct mtree_digests {
+	struct mtree_digest *entries; /* sorted by path */
+	size_t count;
+};
+
+static int mtree_digest_cmp(const void *a, const void *b)
+{
+	const struct mtree_digest *d1 = a, *d2 = b;
+	return strcmp(d1->path, d2->path);
+}
+
+/* decode the \ooo octal escapes mtree uses for special path characters */
+static void mtree_path_unescape(char *path)
+{
+	char *src = path, *dst = path;
+	while(*src) {
+		if(src[0] == '\\' && src[1] >= '0' && src[1] <= '3'
+				&& src[2] >= '0' && src[2] <= '7'
+				&& src[3] >= '0' && src[3] <= '7') {
+			*dst++ = (char)(((src[1] - '0') << 6)
+					| ((src[2] - '0') << 3) | (src[3] - '0'));
+			src += 4;
+		} else {
+			*dst++ = *src++;
+		}
+	}
+	*dst = '\0';
+}
+
+static void mtree_digests_free(struct mtree_digests *digests)
+{
+	size_t n;
+	if(digests == NULL) {
+		return;
+	}
+	for(n = 0; n < digests->count; n++) {
+		free(digests->entries[n].path);
+	}
+	free(digests->entries);
+	free(digests);
+}
+
+/* Parse newpkg's freshly extracted database mtree into a sorted
+ * path -> sha256 map. Returns NULL if the manifest cannot be read, in
+ * which case extraction proceeds unverified. */
+static struct mtree_digests *mtree_digests_load(alpm_handle_t *handle,
+		alpm_pkg_t *newpkg)
+{
+	const char *dbpath = _alpm_db_path(handle->db_local);
+	char *mtfile = NULL, *data = NULL, *line, *next;
+	struct archive *mtree = NULL;
+	struct archive_entry *mt_entry;
+	struct mtree_digests *digests = NULL;
+	size_t maxsize = 0, cursize = 0, entries_size = 0;
+	size_t len;
+	int ok = 0;
+
+	if(dbpath == NULL) {
+		return NULL;
+	}
+	len = strlen(dbpath) + strlen(newpkg->name) + strlen(newpkg->version) + 8;
+	MALLOC(mtfile, len, return NULL);
+	snprintf(mtfile, len, "%s%s-%s/mtree", dbpath, newpkg->name, newpkg->version);
+
+	if((mtree = archive_read_new()) == NULL) {
+		free(mtfile);
+		return NULL;
+	}
+	_alpm_archive_read_support_filter_all(mtree);
+	archive_read_support_format_raw(mtree);
+	if(_alpm_archive_read_open_file(mtree, mtfile, ALPM_BUFFER_SIZE) != ARCHIVE_OK
+			|| archive_read_next_header(mtree, &mt_entry) != ARCHIVE_OK) {
+		goto cleanup;
+	}
+
+	while(1) {
+		ssize_t size;
+		if(!_alpm_greedy_grow((void **)&data, &maxsize,
+					cursize + ALPM_BUFFER_SIZE + 1)) {
+			goto cleanup;
+		}
+		size = archive_read_data(mtree, data + cursize, ALPM_BUFFER_SIZE);
+		if(size < 0) {
+			goto cleanup;
+		}
+		if(size == 0) {
+			break;
+		}
+		cursize += size;
+	}
+	data[cursize] = '\0';
+
+	CALLOC(digests, 1, sizeof(*digests), goto cleanup);
+
+	for(line = data; line; line = next) {
+		char *end, *kw;
+		struct mtree_digest *digest;
+
+		next = strchr(line, '\n');
+		if(next) {
+			*next++ = '\0';
+		}
+		/* only full path entries can carry a file digest; /set lines and
+		 * comments never do */
+		if(line[0] != '.' || line[1] != '/') {
+			continue;
+		}
+		end = line + strcspn(line, " \t");
+		if(*end == '\0') {
+			continue;
+		}
+		*end = '\0';
+		if((kw = strstr(end + 1, "sha256digest=")) == NULL) {
+			continue;
+		}
+		kw += strlen("sha256digest=");
+		if(strspn(kw, "0123456789abcdef") < 64) {
+			continue;
+		}
+
+		if(!_alpm_greedy_grow((void **)&digests->entries, &entries_size,
+					(digests->count + 1) * sizeof(*digests->entries))) {
+			goto cleanup;
+		}
+		digest = &digests->entries[digests->count];
+		STRDUP(digest->path, line + 2, goto cleanup);
+		mtree_path_unescape(digest->path);
+		memcpy(digest->sha256, kw, 64);
+		digest->sha256[64] = '\0';
+		digests->count++;
+	}
+
+	qsort(digests->entries, digests->count, sizeof(*digests->entries),
+			mtree_digest_cmp);
+	ok = 1;
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"loaded %zu file digests from mtree of %s\n",
+			digests->count, newpkg->name);
+
+cleanup:
+	if(!ok) {
+		mtree_digests_free(digests);
+		digests = NULL;
+	}
+	if(mtree) {
+		_alpm_archive_read_free(mtree);
+	}
+	free(data);
+	free(mtfile);
+	return digests;
+}
+
+static const char *mtree_digest_lookup(struct mtree_digests *digests,
+		const char *entryname)
+{
+	struct mtree_digest key, *found;
+	if(digests == NULL || digests->count == 0) {
+		return NULL;
+	}
+	key.path = (char *)entryname;
+	found = bsearch(&key, digests->entries, digests->count,
+			sizeof(*digests->entries), mtree_digest_cmp);
+	return found ? found->sha256 : NULL;
+}
+
+/* Double-buffered extraction pipeline: a reader thread decompresses data
+ * blocks ahead of the calling thread, which flushes them to disk, so
+ * decompression and writes overlap for large files. The read and write
+ * archives are each driven by exactly one thread. Blocks are copied out of
+ * libarchive's internal buffer since it is only valid until the next read. */
+
+#define EXTRACT_PIPELINE_BLOCKS 8
+#define EXTRACT_PIPELINE_MIN_SIZE (1 * 1024 * 1024)
+
+struct extract_block {
+	char *data;
+	size_t capacity;
+	size_t size;
+	int64_t offset;
+};
+
+struct extract_pipeline {
+	struct archive *archive;
+	struct extract_block blocks[EXTRACT_PIPELINE_BLOCKS];
+	size_t head;       /* next slot the reader fills */
+	size_t tail;       /* next slot the writer drains */
+	size_t queued;
+	int read_ret;      /* final archive_read_data_block() status */
+	int done;          /* reader has finished */
+	int abort;         /* writer failed, reader should stop */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *extract_pipeline_reader(void *arg)
+{
+	struct extract_pipeline *pipeline = arg;
+	int ret;
+	const void *buf;
+	size_t size;
+	int64_t offset;
+
+	while((ret = archive_read_data_block(pipeline->archive,
+					&buf, &size, &offset)) == ARCHIVE_OK) {
+		struct extract_block *block;
+		int stop = 0;
+
+		pthread_mutex_lock(&pipeline->lock);
+		while(pipeline->queued == EXTRACT_PIPELINE_BLOCKS && !pipeline->abort) {
+			pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+		}
+		stop = pipeline->abort;
+		block = &pipeline->blocks[pipeline->head];
+		pthread_mutex_unlock(&pipeline->lock);
+		if(stop) {
+			break;
+		}
+
+		/* the slot is exclusively ours until 'queued' is bumped */
+		if(block->capacity < size) {
+			/* a 'break' in the action would only leave the macro's
+			 * internal loop, so flag the failure and test it after */
+			REALLOC(block->data, size, ret = ARCHIVE_FATAL);
+			if(ret == ARCHIVE_FATAL) {
+				break;
+			}
+			block->capacity = size;
+		}
+		memcpy(block->data, buf, size);
+		block->size = size;
+		block->offset = offset;
+
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->head = (pipeline->head + 1) % EXTRACT_PIPELINE_BLOCKS;
+		pipeline->queued++;
+		pthread_cond_broadcast(&pipeline->cond);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->read_ret = ret;
+	pipeline->done = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+/* Feed a data block to the streaming digest, dropping the digest when
+ * the block leaves a hole: the manifest digest covers the whole file,
+ * which a sparse representation does not. */
+static void extract_digest_block(_alpm_digest_ctx_t **digest,
+		const void *buf, size_t size, int64_t offset, int64_t *next_offset)
+{
+	if(*digest == NULL) {
+		return;
+	}
+	if(offset != *next_offset) {
+		_alpm_digest_free(*digest);
+		*digest = NULL;
+		return;
+	}
+	_alpm_digest_update(*digest, buf, size);
+	*next_offset = offset + size;
+}
+
+static int extract_pipelined(alpm_handle_t *handle, struct archive *archive,
+		struct archive_entry *entry, struct archive *archive_writer,
+		_alpm_digest_ctx_t **digest)
+{
+	struct extract_pipeline pipeline;
+	pthread_t reader;
+	size_t n;
+	int64_t next_offset = 0;
+	int ret, overall;
+
+	overall = archive_write_header(archive_writer, entry);
+	if(overall < ARCHIVE_WARN) {
+		archive_set_error(archive, archive_errno(archive_writer),
+				"%s", archive_error_string(archive_writer));
+		return overall;
+	}
+
+#ifdef HAVE_FALLOCATE
+	if(handle->preallocate && archive_entry_size(entry) > 0) {
+		/* the header write above created the file; reserve its full
+		 * extent before streaming data in so large files stay
+		 * unfragmented. Best effort - a read-only mode or a filesystem
+		 * without extent support just skips it. */
+		int prealloc_fd = open(archive_entry_pathname(entry),
+				O_WRONLY | O_CLOEXEC);
+		if(prealloc_fd >= 0) {
+			fallocate(prealloc_fd, FALLOC_FL_KEEP_SIZE, 0,
+					archive_entry_size(entry));
+			close(prealloc_fd);
+		}
+	}
+#else
+	(void)handle;
+#endif
+
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.archive = archive;
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.cond, NULL);
+
+	if(pthread_create(&reader, NULL, extract_pipeline_reader, &pipeline) != 0) {
+		/* no worker available - fall back to a serial copy loop */
+		const void *buf;
+		size_t size;
+		int64_t offset;
+		while((ret = archive_read_data_block(archive, &buf, &size, &offset)) == ARCHIVE_OK) {
+			extract_digest_block(digest, buf, size, offset, &next_offset);
+			if(archive_write_data_block(archive_writer, buf, size, offset) < ARCHIVE_OK) {
+				archive_set_error(archive, archive_errno(archive_writer),
+						"%s", archive_error_string(archive_writer));
+				ret = ARCHIVE_FATAL;
+				break;
+			}
+		}
+		if(ret != ARCHIVE_EOF && ret < overall) {
+			overall = ret;
+		}
+		goto finish;
+	}
+
+	while(1) {
+		struct extract_block *block;
+
+		pthread_mutex_lock(&pipeline.lock);
+		while(pipeline.queued == 0 && !pipeline.done) {
+			pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+		}
+		if(pipeline.queued == 0) {
+			/* reader finished and everything is flushed */
+			pthread_mutex_unlock(&pipeline.lock);
+			break;
+		}
+		block = &pipeline.blocks[pipeline.tail];
+		pthread_mutex_unlock(&pipeline.lock);
+
+		extract_digest_block(digest, block->data, block->size,
+				block->offset, &next_offset);
+		ret = archive_write_data_block(archive_writer,
+				block->data, block->size, block->offset);
+
+		pthread_mutex_lock(&pipeline.lock);
+		if(ret < ARCHIVE_OK) {
+			archive_set_error(archive, archive_errno(archive_writer),
+					"%s", archive_error_string(archive_writer));
+			if(ret < overall) {
+				overall = ret;
+			}
+			pipeline.abort = 1;
+			pthread_cond_broadcast(&pipeline.cond);
+			pthread_mutex_unlock(&pipeline.lock);
+			break;
+		}
+		pipeline.tail = (pipeline.tail + 1) % EXTRACT_PIPELINE_BLOCKS;
+		pipeline.queued--;
+		pthread_cond_broadcast(&pipeline.cond);
+		pthread_mutex_unlock(&pipeline.lock);
+	}
+
+	pthread_join(reader, NULL);
+	if(!pipeline.abort && pipeline.read_ret != ARCHIVE_EOF
+			&& pipeline.read_ret < overall) {
+		overall = pipeline.read_ret;
+	}
+
+finish:
+	ret = archive_write_finish_entry(archive_writer);
+	if(ret < overall) {
+		archive_set_error(archive, archive_errno(archive_writer),
+				"%s", archive_error_string(archive_writer));
+		overall = ret;
+	}
+
+	for(n = 0; n < EXTRACT_PIPELINE_BLOCKS; n++) {
+		free(pipeline.blocks[n].data);
+	}
+	pthread_cond_destroy(&pipeline.cond);
+	pthread_mutex_destroy(&pipeline.lock);
+	return overall;
+}
+
+/* Serial copy loop used instead of archive_read_extract2() when a file's
+ * bytes also have to pass through the streaming digest. */
+static int extract_hashed(struct archive *archive,
+		struct archive_entry *entry, struct archive *archive_writer,
+		_alpm_digest_ctx_t **digest)
+{
+	const void *buf;
+	size_t size;
+	int64_t offset, next_offset = 0;
+	int ret, overall;
+
+	overall = archive_write_header(archive_writer, entry);
+	if(overall < ARCHIVE_WARN) {
+		archive_set_error(archive, archive_errno(archive_writer),
+				"%s", archive_error_string(archive_writer));
+		return overall;
+	}
+
+	while((ret = archive_read_data_block(archive, &buf, &size, &offset)) == ARCHIVE_OK) {
+		extract_digest_block(digest, buf, size, offset, &next_offset);
+		if(archive_write_data_block(archive_writer, buf, size, offset) < ARCHIVE_OK) {
+			archive_set_error(archive, archive_errno(archive_writer),
+					"%s", archive_error_string(archive_writer));
+			ret = ARCHIVE_FATAL;
+			break;
+		}
+	}
+	if(ret != ARCHIVE_EOF && ret < overall) {
+		overall = ret;
+	}
+
+	ret = archive_write_finish_entry(archive_writer);
+	if(ret < overall) {
+		archive_set_error(archive, archive_errno(archive_writer),
+				"%s", archive_error_string(archive_writer));
+		overall = ret;
+	}
+	return overall;
+}
+
 static int perform_extraction(alpm_handle_t *handle, struct archive *archive,
-		struct archive_entry *entry, const char *filename)
+		struct archive_entry *entry, const char *filename,
+		const char *expected_digest)
 {
 	int ret;
 	struct archive *archive_writer;
+	_alpm_digest_ctx_t *digest = NULL;
 	const int archive_flags = ARCHIVE_EXTRACT_OWNER |
 	                          ARCHIVE_EXTRACT_PERM |
 	                          ARCHIVE_EXTRACT_TIME |
@@ -133,7 +574,19 @@ static int perform_extraction(alpm_handle_t *handle, struct archive *archive,
 
 	archive_write_disk_set_options(archive_writer, archive_flags);
 
-	ret = archive_read_extract2(archive, entry, archive_writer);
+	if(expected_digest && archive_entry_filetype(entry) == AE_IFREG) {
+		digest = _alpm_digest_new();
+	}
+
+	if(handle->worker_threads > 1
+			&& archive_entry_filetype(entry) == AE_IFREG
+			&& archive_entry_size(entry) >= EXTRACT_PIPELINE_MIN_SIZE) {
+		ret = extract_pipelined(handle, archive, entry, archive_writer, &digest);
+	} else if(digest) {
+		ret = extract_hashed(archive, entry, archive_writer, &digest);
+	} else {
+		ret = archive_read_extract2(archive, entry, archive_writer);
+	}
 
 	archive_write_free(archive_writer);
 
@@ -147,8 +600,32 @@ static int perform_extraction(alpm_handle_t *handle, struct archive *archive,
 		alpm_logaction(handle, ALPM_CALLER_PREFIX,
 				"error: could not extract %s (%s)\n",
 				filename, archive_error_string(archive));
+		_alpm_digest_free(digest);
 		return 1;
 	}
+
+	if(digest) {
+		char *md5sum = NULL, *sha256sum = NULL;
+		int mismatch = 1;
+		if(_alpm_digest_final(digest, &md5sum, &sha256sum) == 0) {
+			mismatch = strcmp(sha256sum, expected_digest) != 0;
+		}
+		free(md5sum);
+		free(sha256sum);
+		if(mismatch) {
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("%s failed mtree validation during extraction\n"), filename);
+			alpm_logaction(handle, ALPM_CALLER_PREFIX,
+					"error: %s failed mtree validation during extraction\n", filename);
+			return 1;
+		}
+	}
+
+	if(archive_entry_filetype(entry) == AE_IFREG) {
+		_alpm_counter_add(handle, &handle->counters.files_extracted, 1);
+		_alpm_counter_add(handle, &handle->counters.bytes_extracted,
+				archive_entry_size(entry));
+	}
 	return 0;
 }
 
@@ -165,10 +642,12 @@ static int try_rename(alpm_handle_t *handle, const char *src, const char *dest)
 }
 
 static int extract_db_file(alpm_handle_t *handle, struct archive *archive,
-		struct archive_entry *entry, alpm_pkg_t *newpkg, const char *entryname)
+		struct archive_entry *entry, alpm_pkg_t *newpkg, const char *entryname,
+		struct mtree_digests **digests)
 {
 	char filename[PATH_MAX]; /* the actual file we're extracting */
 	const char *dbfile = NULL;
+	int ret;
 	if(strcmp(entryname, ".INSTALL") == 0) {
 		dbfile = "install";
 	} else if(strcmp(entryname, ".CHANGELOG") == 0) {
@@ -184,11 +663,21 @@ static int extract_db_file(alpm_handle_t *handle, struct archive *archive,
 	archive_entry_set_perm(entry, 0644);
 	snprintf(filename, PATH_MAX, "%s%s-%s/%s",
 			_alpm_db_path(handle->db_local), newpkg->name, newpkg->version, dbfile);
-	return perform_extraction(handle, archive, entry, filename);
+	ret = perform_extraction(handle, archive, entry, filename, NULL);
+	if(ret == 0 && strcmp(entryname, ".MTREE") == 0
+			&& handle->verify_extraction && digests && *digests == NULL) {
+		if((*digests = mtree_digests_load(handle, newpkg)) == NULL) {
+			_alpm_log(handle, ALPM_LOG_WARNING,
+					_("could not read mtree of %s, extraction will not be verified\n"),
+					newpkg->name);
+		}
+	}
+	return ret;
 }
 
 static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
-		struct archive_entry *entry, alpm_pkg_t *newpkg, alpm_pkg_t *oldpkg)
+		struct archive_entry *entry, alpm_pkg_t *newpkg, alpm_pkg_t *oldpkg,
+		struct mtree_digests **digests)
 {
 	const char *entryname = archive_entry_pathname(entry);
 	mode_t entrymode = archive_entry_mode(entry);
@@ -201,7 +690,7 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 	size_t filename_len;
 
 	if(*entryname == '.') {
-		return extract_db_file(handle, archive, entry, newpkg, entryname);
+		return extract_db_file(handle, archive, entry, newpkg, entryname, digests);
 	}
 
 	if (!alpm_filelist_contains(&newpkg->files, entryname)) {
@@ -324,7 +813,8 @@ static int extract_single_file(alpm_handle_t *handle, struct archive *archive,
 	}
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "extracting %s\n", filename);
-	if(perform_extraction(handle, archive, entry, filename)) {
+	if(perform_extraction(handle, archive, entry, filename,
+				digests ? mtree_digest_lookup(*digests, entryname) : NULL)) {
 		errors++;
 		return errors;
 	}
@@ -416,6 +906,7 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 {
 	int i, ret = 0, errors = 0;
 	int is_upgrade = 0;
+	struct mtree_digests *digests = NULL;
 	alpm_pkg_t *oldpkg = NULL;
 	alpm_db_t *db = handle->db_local;
 	alpm_trans_t *trans = handle->trans;
@@ -526,13 +1017,15 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 		while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
 			const char *entryname = archive_entry_pathname(entry);
 			if(entryname[0] == '.') {
-				errors += extract_db_file(handle, archive, entry, newpkg, entryname);
+				errors += extract_db_file(handle, archive, entry, newpkg, entryname,
+						NULL);
 			} else {
 				archive_read_data_skip(archive);
 			}
 		}
 	} else {
 		_alpm_log(handle, ALPM_LOG_DEBUG, "extracting files\n");
+		TRACE_BEGIN(handle, ALPM_TRACE_EXTRACT, newpkg->name);
 
 		/* call PROGRESS once with 0 percent, as we sort-of skip that here */
 		PROGRESS(handle, progress, newpkg->name, 0, pkg_count, pkg_current);
@@ -556,10 +1049,13 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 			PROGRESS(handle, progress, newpkg->name, percent, pkg_count, pkg_current);
 
 			/* extract the next file from the archive */
-			errors += extract_single_file(handle, archive, entry, newpkg, oldpkg);
+			errors += extract_single_file(handle, archive, entry, newpkg, oldpkg,
+					&digests);
 		}
+		TRACE_END(handle, ALPM_TRACE_EXTRACT, newpkg->name);
 	}
 
+	mtree_digests_free(digests);
 	_alpm_archive_read_free(archive);
 	close(fd);
 
@@ -592,6 +1088,26 @@ static int commit_single_pkg(alpm_handle_t *handle, alpm_pkg_t *newpkg,
 	/* make an install date (in UTC) */
 	newpkg->installdate = time(NULL);
 
+	if(handle->durability) {
+		/* one barrier for the whole extracted batch, instead of per-file
+		 * syncs; the db entry written below must not claim files that
+		 * have not reached the disk */
+		_alpm_log(handle, ALPM_LOG_DEBUG, "syncing extracted files to disk\n");
+		TRACE_BEGIN(handle, ALPM_TRACE_EXTRACT, "sync barrier");
+#ifdef HAVE_SYNCFS
+		int rootfd = open(handle->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(rootfd >= 0) {
+			syncfs(rootfd);
+			close(rootfd);
+		} else {
+			sync();
+		}
+#else
+		sync();
+#endif
+		TRACE_END(handle, ALPM_TRACE_EXTRACT, "sync barrier");
+	}
+
 	_alpm_log(handle, ALPM_LOG_DEBUG, "updating database\n");
 	_alpm_log(handle, ALPM_LOG_DEBUG, "adding database entry '%s'\n", newpkg->name);
 
@@ -73,6 +73,21 @@ alpm_handle_t SYMEXPORT *alpm_initialize(const char *root, const char *dbpath,
 #ifdef HAVE_LIBCURL
 	curl_global_init(CURL_GLOBAL_ALL);
 	myhandle->curlm = curl_multi_init();
+	/* let payloads multiplex over one connection per mirror when the
+	 * server speaks HTTP/2 */
+	curl_multi_setopt(myhandle->curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	/* connection setup and TLS negotiation dominate small fetches on
+	 * high-latency links; share DNS entries, TLS sessions and live
+	 * connections across all transfers. Every transfer runs on the
+	 * caller's thread, so the share needs no lock callbacks. */
+	myhandle->curlsh = curl_share_init();
+	if(myhandle->curlsh) {
+		curl_share_setopt(myhandle->curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(myhandle->curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		/* a no-op before curl 7.57, which pools connections per easy
+		 * handle lifetime instead */
+		curl_share_setopt(myhandle->curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	}
 #endif
 
 #ifdef ENABLE_NLS
@@ -111,6 +126,7 @@ int SYMEXPORT alpm_release(alpm_handle_t *myhandle)
 
 #ifdef HAVE_LIBCURL
 	curl_multi_cleanup(myhandle->curlm);
+	curl_share_cleanup(myhandle->curlsh);
 	curl_global_cleanup();
 #endif
 
@@ -117,7 +117,9 @@ typedef enum _alpm_errno_t {
 	ALPM_ERR_EXTERNAL_DOWNLOAD,
 	ALPM_ERR_GPGME,
 	/* Missing compile-time features */
-	ALPM_ERR_MISSING_CAPABILITY_SIGNATURES
+	ALPM_ERR_MISSING_CAPABILITY_SIGNATURES,
+	/* Read-only mode */
+	ALPM_ERR_HANDLE_READONLY
 } alpm_errno_t;
 
 /** Returns the current error code from the handle. */
@@ -281,6 +283,12 @@ typedef struct _alpm_file_t {
 typedef struct _alpm_filelist_t {
 	size_t count;
 	alpm_file_t *files;
+	/** @private single allocation backing all file names, or NULL when
+	 * each name is individually allocated */
+	char *names;
+	/** @private hash index built lazily on the first membership query,
+	 * see alpm_filelist_contains() */
+	void *hashes;
 } alpm_filelist_t;
 
 /** Local package or package file backup entry */
@@ -570,6 +578,33 @@ typedef union _alpm_event_t {
 /** Event callback. */
 typedef void (*alpm_cb_event)(alpm_event_t *);
 
+/**
+ * Phases reported by the tracing callback.
+ */
+typedef enum _alpm_trace_phase_t {
+	/** Populating a package database cache. */
+	ALPM_TRACE_DB_POPULATE = 1,
+	/** Resolving the dependencies of a target. */
+	ALPM_TRACE_RESOLVEDEPS,
+	/** Checking targets for file conflicts. */
+	ALPM_TRACE_FILECONFLICTS,
+	/** Downloading a batch of files. */
+	ALPM_TRACE_DOWNLOAD,
+	/** Extracting a package archive. */
+	ALPM_TRACE_EXTRACT,
+	/** One-time signing backend (GPGME) initialization. */
+	ALPM_TRACE_SIGNING_INIT
+} alpm_trace_phase_t;
+
+/** Tracing callback, called at the beginning (begin = 1) and end
+ * (begin = 0) of instrumented phases. detail names the object being
+ * operated on (database or package name) and may be NULL; timestamp is
+ * read from a monotonic clock in nanoseconds. No work is done unless a
+ * callback is registered, so tracing can stay enabled in production.
+ */
+typedef void (*alpm_cb_trace)(alpm_trace_phase_t phase, int begin,
+		const char *detail, int64_t timestamp);
+
 /**
  * Type of questions.
  * Unlike the events or progress enumerations, this enum has bitmask values
@@ -762,6 +797,41 @@ typedef int (*alpm_cb_fetch)(const char *url, const char *localpath,
  */
 char *alpm_fetch_pkgurl(alpm_handle_t *handle, const char *url);
 
+/** Result of benchmarking a single mirror. */
+typedef struct _alpm_mirror_bench_t {
+	/** Server URL as registered with the database */
+	char *server;
+	/** Observed throughput in bytes per second */
+	double speed;
+	/** Observed time to first byte in seconds */
+	double latency;
+	/** Whether the probe succeeded; speed and latency are only
+	 * meaningful when set */
+	int ok;
+} alpm_mirror_bench_t;
+
+/** Benchmark the mirrors of a database with parallel ranged probes.
+ * Each server in the database's list is asked for the leading bytes of
+ * the database file simultaneously, and the measured throughput and
+ * latency are returned so frontends can order mirrors by real
+ * performance. The measurements also seed the downloader's internal
+ * mirror scheduler.
+ * @param handle the context handle
+ * @param db the database whose servers should be probed
+ * @param results location to store the list of (alpm_mirror_bench_t *),
+ * sorted fastest first; free entries with alpm_mirror_bench_free() and
+ * the list with alpm_list_free()
+ * @return 0 on success, -1 on error (pm_errno is set accordingly,
+ * including when every probe failed)
+ */
+int alpm_mirrors_benchmark(alpm_handle_t *handle, alpm_db_t *db,
+		alpm_list_t **results);
+
+/** Free a mirror benchmark result.
+ * @param bench the result to free
+ */
+void alpm_mirror_bench_free(alpm_mirror_bench_t *bench);
+
 /** @addtogroup alpm_api_options Options
  * Libalpm option getters and setters
  * @{
@@ -802,6 +872,11 @@ alpm_cb_progress alpm_option_get_progresscb(alpm_handle_t *handle);
 /** Sets the callback used for operation progress. */
 int alpm_option_set_progresscb(alpm_handle_t *handle, alpm_cb_progress cb);
 
+/** Returns the callback used for phase tracing. */
+alpm_cb_trace alpm_option_get_tracecb(alpm_handle_t *handle);
+/** Sets the callback used for phase tracing. */
+int alpm_option_set_tracecb(alpm_handle_t *handle, alpm_cb_trace cb);
+
 /** Returns the root of the destination filesystem. Read-only. */
 const char *alpm_option_get_root(alpm_handle_t *handle);
 
@@ -915,6 +990,32 @@ int alpm_option_set_arch(alpm_handle_t *handle, const char *arch);
 int alpm_option_get_checkspace(alpm_handle_t *handle);
 int alpm_option_set_checkspace(alpm_handle_t *handle, int checkspace);
 
+/** Returns whether the handle is in read-only mode. */
+int alpm_option_get_readonly(alpm_handle_t *handle);
+/** Puts the handle in read-only mode.
+ * A read-only handle never takes the database lock and refuses to
+ * initialize transactions, so queries can run concurrently with a
+ * writer; use alpm_db_snapshot_check() to detect a writer landing
+ * mid-read. */
+int alpm_option_set_readonly(alpm_handle_t *handle, int readonly);
+
+/** Returns whether extraction barriers are enabled. */
+int alpm_option_get_durability(alpm_handle_t *handle);
+/** Enables filesystem barriers between extraction and database update.
+ * When set, a package's extracted files are synced to disk in one
+ * batch (no per-file sync) before its local database entry is written,
+ * so the database never records files that have not reached the disk. */
+int alpm_option_set_durability(alpm_handle_t *handle, int durability);
+
+/** Returns whether file preallocation is enabled. */
+int alpm_option_get_preallocate(alpm_handle_t *handle);
+/** Enables preallocation of download and extraction target files.
+ * When the final size is known (Content-Length, archive entry size),
+ * the full extent is reserved before any data is written, which avoids
+ * fragmenting large files on extent- and CoW-based filesystems. Only
+ * effective on platforms with fallocate(2). */
+int alpm_option_set_preallocate(alpm_handle_t *handle, int preallocate);
+
 const char *alpm_option_get_dbext(alpm_handle_t *handle);
 int alpm_option_set_dbext(alpm_handle_t *handle, const char *dbext);
 
@@ -938,6 +1039,113 @@ int alpm_option_set_disable_dl_timeout(alpm_handle_t *handle, unsigned short dis
  */
 int alpm_option_set_parallel_downloads(alpm_handle_t *handle, unsigned int num_streams);
 
+/** Sets number of worker threads used by parallel library phases such as
+ * package integrity checking. If the function is not called then the default
+ * value of '1' thread (i.e. sequential processing) is used. Passing '0'
+ * sizes the pool to the number of CPUs available to the calling process,
+ * honoring affinity masks and cgroup cpuset restrictions.
+ * @param handle the context handle
+ * @param num_threads number of worker threads, or 0 to autodetect
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_worker_threads(alpm_handle_t *handle, unsigned int num_threads);
+
+/** Returns the number of worker threads used by parallel library phases.
+ * @param handle the context handle
+ * @return number of worker threads
+ */
+unsigned int alpm_option_get_worker_threads(alpm_handle_t *handle);
+
+/** Performance counters accumulated by the library.
+ * All fields count monotonically from handle initialization (or the last
+ * \link alpm_reset_counters() \endlink) and include work done on worker
+ * threads.
+ */
+typedef struct _alpm_counters_t {
+	/** Bytes read and checksummed while validating or loading packages */
+	int64_t bytes_hashed;
+	/** Regular files written to disk during package extraction */
+	int64_t files_extracted;
+	/** Bytes of regular files written during package extraction */
+	int64_t bytes_extracted;
+	/** Named lookups against the package caches */
+	int64_t cache_lookups;
+	/** Named lookups that found a package */
+	int64_t cache_hits;
+} alpm_counters_t;
+
+/** Copies a snapshot of the library's performance counters.
+ * Per-phase timing is not duplicated here; the
+ * \link alpm_option_set_tracecb() trace callback \endlink already
+ * timestamps phase boundaries.
+ * @param handle the context handle
+ * @param counters storage the current counter values are copied into
+ * @return 0 on success, -1 on error
+ */
+int alpm_get_counters(alpm_handle_t *handle, alpm_counters_t *counters);
+
+/** Resets all performance counters to zero.
+ * @param handle the context handle
+ * @return 0 on success, -1 on error
+ */
+int alpm_reset_counters(alpm_handle_t *handle);
+
+/** Enables or disables the single-file journal of the local database.
+ * When enabled, libalpm keeps an append-only replica of the local
+ * database next to it and populates the package cache from it in one
+ * sequential read instead of opening each package's database entry.
+ * The per-package entries remain the canonical store; a journal that
+ * does not match them is ignored and rebuilt. Disabled by default.
+ * @param handle the context handle
+ * @param enable 0 for disabled, anything else for enabled
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_localdb_journal(alpm_handle_t *handle, int enable);
+
+/** Returns whether the single-file journal of the local database is enabled.
+ * @param handle the context handle
+ * @return 0 if disabled, 1 if enabled, -1 on error
+ */
+int alpm_option_get_localdb_journal(alpm_handle_t *handle);
+
+/** Enables or disables verified extraction.
+ * When enabled, the SHA-256 digest of every regular file is computed
+ * from the bytes streamed to disk during package installation and
+ * checked against the package's mtree manifest, so an install is
+ * integrity-verified without re-reading anything afterwards. A file
+ * whose digest does not match its manifest entry is treated as an
+ * extraction error. Disabled by default.
+ * @param handle the context handle
+ * @param enable 0 for disabled, anything else for enabled
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_verify_extraction(alpm_handle_t *handle, int enable);
+
+/** Returns whether verified extraction is enabled.
+ * @param handle the context handle
+ * @return 0 if disabled, 1 if enabled, -1 on error
+ */
+int alpm_option_get_verify_extraction(alpm_handle_t *handle);
+
+/** Enables or disables differential sync database downloads.
+ * When enabled, a database refresh first asks each server for a binary
+ * delta from the locally cached database revision and replays it into a
+ * byte-identical copy of the current database, so signatures keep
+ * verifying. Servers that do not publish deltas, or any mismatch while
+ * applying one, silently fall back to the full download.
+ * Disabled by default.
+ * @param handle the context handle
+ * @param enable 0 for disabled, anything else for enabled
+ * @return 0 on success, -1 on error
+ */
+int alpm_option_set_db_deltas(alpm_handle_t *handle, int enable);
+
+/** Returns whether differential sync database downloads are enabled.
+ * @param handle the context handle
+ * @return 0 if disabled, 1 if enabled, -1 on error
+ */
+int alpm_option_get_db_deltas(alpm_handle_t *handle);
+
 /** @} */
 
 /** @addtogroup alpm_api_databases Database Functions
@@ -1005,6 +1213,39 @@ int alpm_db_get_siglevel(alpm_db_t *db);
  */
 int alpm_db_get_valid(alpm_db_t *db);
 
+/** Check that a database is unchanged since its package cache was loaded.
+ * Lockless readers use this to detect a writer modifying the database
+ * behind their back: a mismatch means any data read so far may be
+ * inconsistent and should be discarded.
+ * @param db pointer to the package database
+ * @return 0 if unchanged, -1 if modified or not yet loaded (pm_errno is
+ * set accordingly)
+ */
+int alpm_db_snapshot_check(alpm_db_t *db);
+
+/** Revalidate a database against its on-disk state.
+ * If the database is unchanged since its package cache was loaded, the
+ * parsed cache is kept and this is nearly free. Otherwise all cached
+ * data is dropped and reloaded lazily on next access; any package or
+ * group pointers previously obtained from the database become invalid.
+ * Long-running frontends can call this instead of cycling
+ * alpm_release()/alpm_initialize() to pick up external changes.
+ * @param db pointer to the package database
+ * @return 0 if the cache was kept, 1 if it was dropped, -1 on error
+ * (pm_errno is set accordingly)
+ */
+int alpm_db_refresh(alpm_db_t *db);
+
+/** Revalidate every registered database against its on-disk state.
+ * Calls alpm_db_refresh() on the local database and each registered
+ * sync database; only databases that changed on disk lose their parsed
+ * caches.
+ * @param handle the context handle
+ * @return the number of databases whose caches were dropped, or -1 on
+ * error (pm_errno is set accordingly)
+ */
+int alpm_dbs_refresh(alpm_handle_t *handle);
+
 /** @name Accessors to the list of servers for a database.
  * @{
  */
@@ -1081,6 +1322,32 @@ alpm_pkg_t *alpm_db_get_pkg(alpm_db_t *db, const char *name);
  */
 alpm_list_t *alpm_db_get_pkgcache(alpm_db_t *db);
 
+/** Load the package caches of all registered sync databases at once.
+ * Each database parses independently, so the loads are spread across the
+ * \link alpm_option_set_worker_threads() worker threads \endlink and a
+ * multi-repository operation waits only for the largest database instead
+ * of the sum. Databases that are already loaded are skipped; a database
+ * that fails to load here reports its error again on first direct access.
+ * @param handle the context handle
+ * @return 0 on success, -1 if any database failed to load (pm_errno is
+ * set accordingly)
+ */
+int alpm_dbs_populate_async(alpm_handle_t *handle);
+
+/** Find the owners of a path using the local database's owner index.
+ * The index is maintained on install/remove; if it is missing or out of
+ * date this function fails and the caller should fall back to scanning
+ * package filelists.
+ * @param db pointer to the local package database
+ * @param path path to look up, relative to the installation root
+ * @param owners location to store the list of owning packages; the list
+ * must be freed by the caller (not its contents)
+ * @return 0 if the index was consulted (owners may still be empty),
+ * -1 if no usable index is available
+ */
+int alpm_db_find_file_owners(alpm_db_t *db, const char *path,
+		alpm_list_t **owners);
+
 /** Get a group entry from a package database.
  * @param db pointer to the package database to get the group from
  * @param name of the group
@@ -1150,6 +1417,25 @@ int alpm_db_get_usage(alpm_db_t *db, int *usage);
 int alpm_pkg_load(alpm_handle_t *handle, const char *filename, int full,
 		int level, alpm_pkg_t **pkg);
 
+/** Load several package files at once.
+ * Loads are sharded across the handle's worker threads; results are
+ * delivered in argument order. Any key imports the signatures require
+ * are handled up front on the calling thread.
+ * @param handle the context handle
+ * @param count number of package files
+ * @param filenames locations of the package tarballs
+ * @param full whether to stop each load after metadata is read or
+ * continue through the full archive
+ * @param levels per-file signature checking levels
+ * @param pkgs array of count package pointers; pkgs[i] receives the
+ * package loaded from filenames[i], or NULL if that load failed
+ * @return 0 if every package loaded, -1 otherwise (pm_errno is set to
+ * the first failure's error code)
+ */
+int alpm_pkg_load_many(alpm_handle_t *handle, size_t count,
+		const char * const *filenames, int full, const int *levels,
+		alpm_pkg_t **pkgs);
+
 /** Find a package in a list by name.
  * @param haystack a list of alpm_pkg_t
  * @param needle the package name
@@ -1163,6 +1449,20 @@ alpm_pkg_t *alpm_pkg_find(alpm_list_t *haystack, const char *needle);
  */
 int alpm_pkg_free(alpm_pkg_t *pkg);
 
+/** Release lazily loaded package data.
+ * Packages backed by the local database read their filelist from disk on
+ * first access and then cache it for the lifetime of the handle. This
+ * drops that cached data again so a long-running handle's memory usage
+ * tracks its actual working set; the data is transparently re-read from
+ * the database on next access. Any file or backup lists previously
+ * returned for the package become invalid. Packages from other sources
+ * are left untouched.
+ * @param pkg package pointer
+ * @return 0 on success, -1 if the package's storage is currently shared
+ * with another package and nothing could be released
+ */
+int alpm_pkg_evict(alpm_pkg_t *pkg);
+
 /** Check the integrity (with md5) of a package from the sync cache.
  * @param pkg package pointer
  * @return 0 on success, -1 on error (pm_errno is set accordingly)
@@ -0,0 +1,102 @@
+/*
+ *  arena.c
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* libalpm */
+#include "arena.h"
+#include "util.h"
+
+#define ARENA_SLAB_SIZE (16 * 1024)
+/* keep every returned pointer suitably aligned for any object */
+#define ARENA_ALIGN (sizeof(void *) * 2)
+
+struct arena_slab {
+	struct arena_slab *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+struct __alpm_arena_t {
+	struct arena_slab *slabs;
+};
+
+_alpm_arena_t *_alpm_arena_new(void)
+{
+	_alpm_arena_t *arena;
+	CALLOC(arena, 1, sizeof(_alpm_arena_t), return NULL);
+	return arena;
+}
+
+void *_alpm_arena_alloc(_alpm_arena_t *arena, size_t size)
+{
+	struct arena_slab *slab;
+	void *ptr;
+
+	if(arena == NULL || size == 0) {
+		return NULL;
+	}
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	slab = arena->slabs;
+	if(slab == NULL || slab->size - slab->used < size) {
+		size_t slabsize = size > ARENA_SLAB_SIZE ? size : ARENA_SLAB_SIZE;
+		MALLOC(slab, sizeof(struct arena_slab) + slabsize, return NULL);
+		slab->used = 0;
+		slab->size = slabsize;
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+	}
+
+	ptr = slab->data + slab->used;
+	slab->used += size;
+	return ptr;
+}
+
+char *_alpm_arena_strdup(_alpm_arena_t *arena, const char *str)
+{
+	char *copy;
+	size_t len;
+
+	if(str == NULL) {
+		return NULL;
+	}
+
+	len = strlen(str) + 1;
+	if((copy = _alpm_arena_alloc(arena, len)) == NULL) {
+		return NULL;
+	}
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void _alpm_arena_free(_alpm_arena_t *arena)
+{
+	struct arena_slab *slab, *next;
+	if(arena == NULL) {
+		return;
+	}
+	for(slab = arena->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	free(arena);
+}
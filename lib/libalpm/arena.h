@@ -0,0 +1,37 @@
+/*
+ *  arena.h
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_ARENA_H
+#define ALPM_ARENA_H
+
+#include <stddef.h>
+
+/* A bump allocator for allocations that share one lifetime. Objects come
+ * out of large slabs and are never freed individually; releasing the
+ * arena returns everything in a handful of free() calls, regardless of
+ * how many objects were taken from it. Used for transaction-lifetime
+ * scratch so hundreds of transactions in one process do not churn the
+ * heap into fragments. */
+typedef struct __alpm_arena_t _alpm_arena_t;
+
+_alpm_arena_t *_alpm_arena_new(void);
+void *_alpm_arena_alloc(_alpm_arena_t *arena, size_t size);
+char *_alpm_arena_strdup(_alpm_arena_t *arena, const char *str);
+void _alpm_arena_free(_alpm_arena_t *arena);
+
+#endif /* ALPM_ARENA_H */
@@ -27,6 +27,7 @@
 /* libalpm */
 #include "backup.h"
 #include "alpm_list.h"
+#include "package.h"
 #include "log.h"
 #include "util.h"
 
@@ -53,18 +54,71 @@ int _alpm_split_backup(const char *string, alpm_backup_t **backup)
 	return 0;
 }
 
+/* backup lists with at least this many entries get a hash set so the
+ * per-file query during extraction does not rescan the whole list */
+#define BACKUP_INDEX_THRESHOLD 16
+
+/* Build an open-addressed hash set over the package's backup entries.
+ * Lookup failures leave the index unset and fall back to the list scan. */
+static void backup_index_build(alpm_pkg_t *pkg, const alpm_list_t *backups,
+		size_t count)
+{
+	const alpm_list_t *lp;
+	size_t size = 16;
+
+	while(size < count * 2) {
+		size *= 2;
+	}
+
+	CALLOC(pkg->backup_index, size, sizeof(alpm_backup_t *), return);
+	pkg->backup_index_size = size;
+
+	for(lp = backups; lp; lp = lp->next) {
+		alpm_backup_t *backup = lp->data;
+		size_t position = _alpm_hash_sdbm(backup->name) & (size - 1);
+
+		while(pkg->backup_index[position] != NULL) {
+			position = (position + 1) & (size - 1);
+		}
+		pkg->backup_index[position] = backup;
+	}
+}
+
 /* Look for a filename in a alpm_pkg_t.backup list. If we find it,
  * then we return the full backup entry.
  */
 alpm_backup_t *_alpm_needbackup(const char *file, alpm_pkg_t *pkg)
 {
-	const alpm_list_t *lp;
+	const alpm_list_t *lp, *backups;
 
 	if(file == NULL || pkg == NULL) {
 		return NULL;
 	}
 
-	for(lp = alpm_pkg_get_backup(pkg); lp; lp = lp->next) {
+	backups = alpm_pkg_get_backup(pkg);
+
+	if(pkg->backup_index == NULL) {
+		size_t count = alpm_list_count(backups);
+		if(count >= BACKUP_INDEX_THRESHOLD) {
+			backup_index_build(pkg, backups, count);
+		}
+	}
+
+	if(pkg->backup_index) {
+		size_t size = pkg->backup_index_size;
+		size_t position = _alpm_hash_sdbm(file) & (size - 1);
+		alpm_backup_t *backup;
+
+		while((backup = pkg->backup_index[position]) != NULL) {
+			if(strcmp(file, backup->name) == 0) {
+				return backup;
+			}
+			position = (position + 1) & (size - 1);
+		}
+		return NULL;
+	}
+
+	for(lp = backups; lp; lp = lp->next) {
 		alpm_backup_t *backup = lp->data;
 
 		if(strcmp(file, backup->name) == 0) {
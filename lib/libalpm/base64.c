@@ -30,12 +30,24 @@
  *  * remove "polarssl/config.h" include
  *  * change include from "polarssl/base64.h" to "base64.h"
  *  * removal of SELF_TEST code
+ *  * addition of a runtime-dispatched SSSE3/AVX2/NEON bulk decode path in
+ *    base64_decode; the scalar loop is kept for whitespace, padding and
+ *    machines without the required instructions
  */
 
 #include <stdint.h>
+#include <string.h>
 
 #include "base64.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_DECODE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define BASE64_DECODE_NEON 1
+#include <arm_neon.h>
+#endif
+
 #if 0
 static const unsigned char base64_enc_map[64] =
 {
@@ -131,6 +143,234 @@ int base64_encode( unsigned char *dst, size_t *dlen,
 }
 #endif
 
+
+/*
+ * Vectorized bulk decoding of the strict base64 alphabet, based on the
+ * nibble-classification scheme by Wojciech Mula. Each 16 input characters
+ * produce 12 output bytes. A block containing anything outside [A-Za-z0-9+/]
+ * (padding, line breaks, garbage) stops the bulk pass; the scalar loop in
+ * base64_decode picks up from there, so behaviour is unchanged.
+ *
+ * The classification tables below assign each character class a bit (lut_hi,
+ * indexed by the high nibble) and each low nibble the set of classes it is
+ * invalid for (lut_lo); a non-zero AND of the two lookups flags a character
+ * outside the alphabet. lut_roll holds the value to add to a character to
+ * turn it into its 6-bit index, selected by high nibble (with '/' shifted
+ * down one slot to disambiguate it from other 0x2X characters).
+ */
+
+#if defined(BASE64_DECODE_X86)
+
+__attribute__((target("ssse3")))
+static size_t base64_decode_blocks_ssse3( unsigned char *dst,
+        const unsigned char *src, size_t slen )
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A );
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0 );
+    const __m128i mask_0F = _mm_set1_epi8( 0x0F );
+    const __m128i mask_2F = _mm_set1_epi8( 0x2F );
+    size_t consumed = 0;
+
+    while( slen - consumed >= 16 )
+    {
+        const __m128i str = _mm_loadu_si128( (const __m128i *)( src + consumed ) );
+        const __m128i hi_nibbles = _mm_and_si128( _mm_srli_epi32( str, 4 ), mask_0F );
+        const __m128i lo_nibbles = _mm_and_si128( str, mask_0F );
+        const __m128i lo = _mm_shuffle_epi8( lut_lo, lo_nibbles );
+        const __m128i hi = _mm_shuffle_epi8( lut_hi, hi_nibbles );
+        const __m128i eq_2F = _mm_cmpeq_epi8( str, mask_2F );
+        const __m128i roll = _mm_shuffle_epi8( lut_roll,
+                _mm_add_epi8( eq_2F, hi_nibbles ) );
+        __m128i merged, packed;
+        unsigned char block[16];
+
+        if( _mm_movemask_epi8( _mm_cmpgt_epi8( _mm_and_si128( lo, hi ),
+                        _mm_setzero_si128() ) ) != 0 )
+            break;
+
+        /* convert characters to 6-bit indices and pack 4x6 -> 3x8 bits */
+        merged = _mm_maddubs_epi16( _mm_add_epi8( str, roll ),
+                _mm_set1_epi32( 0x01400140 ) );
+        packed = _mm_madd_epi16( merged, _mm_set1_epi32( 0x00011000 ) );
+        packed = _mm_shuffle_epi8( packed, _mm_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 ) );
+
+        _mm_storeu_si128( (__m128i *)block, packed );
+        memcpy( dst, block, 12 );
+        dst += 12;
+        consumed += 16;
+    }
+
+    return consumed;
+}
+
+__attribute__((target("avx2")))
+static size_t base64_decode_blocks_avx2( unsigned char *dst,
+        const unsigned char *src, size_t slen )
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A );
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0 );
+    const __m256i mask_0F = _mm256_set1_epi8( 0x0F );
+    const __m256i mask_2F = _mm256_set1_epi8( 0x2F );
+    size_t consumed = 0;
+
+    while( slen - consumed >= 32 )
+    {
+        const __m256i str = _mm256_loadu_si256( (const __m256i *)( src + consumed ) );
+        const __m256i hi_nibbles = _mm256_and_si256( _mm256_srli_epi32( str, 4 ), mask_0F );
+        const __m256i lo_nibbles = _mm256_and_si256( str, mask_0F );
+        const __m256i lo = _mm256_shuffle_epi8( lut_lo, lo_nibbles );
+        const __m256i hi = _mm256_shuffle_epi8( lut_hi, hi_nibbles );
+        const __m256i eq_2F = _mm256_cmpeq_epi8( str, mask_2F );
+        const __m256i roll = _mm256_shuffle_epi8( lut_roll,
+                _mm256_add_epi8( eq_2F, hi_nibbles ) );
+        __m256i merged, packed;
+        unsigned char block[32];
+
+        if( !_mm256_testz_si256( lo, hi ) )
+            break;
+
+        merged = _mm256_maddubs_epi16( _mm256_add_epi8( str, roll ),
+                _mm256_set1_epi32( 0x01400140 ) );
+        packed = _mm256_madd_epi16( merged, _mm256_set1_epi32( 0x00011000 ) );
+        packed = _mm256_shuffle_epi8( packed, _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 ) );
+        packed = _mm256_permutevar8x32_epi32( packed,
+                _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 7, 7 ) );
+
+        _mm256_storeu_si256( (__m256i *)block, packed );
+        memcpy( dst, block, 24 );
+        dst += 24;
+        consumed += 32;
+    }
+
+    /* sweep up a possible 16-character tail */
+    return consumed + base64_decode_blocks_ssse3( dst, src + consumed,
+            slen - consumed );
+}
+
+static size_t base64_decode_blocks_scalar( unsigned char *dst,
+        const unsigned char *src, size_t slen )
+{
+    (void)dst; (void)src; (void)slen;
+    return 0;
+}
+
+static size_t base64_decode_blocks_pick( unsigned char *dst,
+        const unsigned char *src, size_t slen );
+
+static size_t (*base64_decode_blocks)( unsigned char *,
+        const unsigned char *, size_t ) = base64_decode_blocks_pick;
+
+/* one-time CPU feature detection; rebinding the pointer is idempotent so a
+ * race between threads merely repeats the (cheap) cpuid-based probe */
+static size_t base64_decode_blocks_pick( unsigned char *dst,
+        const unsigned char *src, size_t slen )
+{
+    if( __builtin_cpu_supports( "avx2" ) )
+        base64_decode_blocks = base64_decode_blocks_avx2;
+    else if( __builtin_cpu_supports( "ssse3" ) )
+        base64_decode_blocks = base64_decode_blocks_ssse3;
+    else
+        base64_decode_blocks = base64_decode_blocks_scalar;
+
+    return base64_decode_blocks( dst, src, slen );
+}
+
+#elif defined(BASE64_DECODE_NEON)
+
+static size_t base64_decode_blocks_neon( unsigned char *dst,
+        const unsigned char *src, size_t slen )
+{
+    const uint8_t lut_lo_bytes[16] = {
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A };
+    const uint8_t lut_hi_bytes[16] = {
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 };
+    const uint8_t lut_roll_bytes[16] = {
+        0, 16, 19, 4, 256 - 65, 256 - 65, 256 - 71, 256 - 71,
+        0, 0, 0, 0, 0, 0, 0, 0 };
+    const uint8_t pack_idx_bytes[16] = {
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 255, 255, 255, 255 };
+    const uint8x16_t lut_lo = vld1q_u8( lut_lo_bytes );
+    const uint8x16_t lut_hi = vld1q_u8( lut_hi_bytes );
+    const uint8x16_t lut_roll = vld1q_u8( lut_roll_bytes );
+    const uint8x16_t pack_idx = vld1q_u8( pack_idx_bytes );
+    size_t consumed = 0;
+
+    while( slen - consumed >= 16 )
+    {
+        const uint8x16_t str = vld1q_u8( src + consumed );
+        const uint8x16_t hi_nibbles = vshrq_n_u8( str, 4 );
+        const uint8x16_t lo_nibbles = vandq_u8( str, vdupq_n_u8( 0x0F ) );
+        const uint8x16_t lo = vqtbl1q_u8( lut_lo, lo_nibbles );
+        const uint8x16_t hi = vqtbl1q_u8( lut_hi, hi_nibbles );
+        const uint8x16_t eq_2F = vceqq_u8( str, vdupq_n_u8( 0x2F ) );
+        const uint8x16_t roll = vqtbl1q_u8( lut_roll,
+                vaddq_u8( hi_nibbles, eq_2F ) );
+        uint8x16_t vals;
+        uint16x8_t merged;
+        uint32x4_t packed;
+        unsigned char block[16];
+
+        if( vmaxvq_u8( vandq_u8( lo, hi ) ) != 0 )
+            break;
+
+        /* convert characters to 6-bit indices and pack 4x6 -> 3x8 bits */
+        vals = vaddq_u8( str, roll );
+        merged = vorrq_u16(
+                vshlq_n_u16( vandq_u16( vreinterpretq_u16_u8( vals ),
+                        vdupq_n_u16( 0x00FF ) ), 6 ),
+                vshrq_n_u16( vreinterpretq_u16_u8( vals ), 8 ) );
+        packed = vorrq_u32(
+                vshlq_n_u32( vandq_u32( vreinterpretq_u32_u16( merged ),
+                        vdupq_n_u32( 0x0000FFFF ) ), 12 ),
+                vshrq_n_u32( vreinterpretq_u32_u16( merged ), 16 ) );
+
+        vst1q_u8( block, vqtbl1q_u8( vreinterpretq_u8_u32( packed ), pack_idx ) );
+        memcpy( dst, block, 12 );
+        dst += 12;
+        consumed += 16;
+    }
+
+    return consumed;
+}
+
+#define base64_decode_blocks base64_decode_blocks_neon
+
+#else
+
+static size_t base64_decode_blocks( unsigned char *dst,
+        const unsigned char *src, size_t slen )
+{
+    (void)dst; (void)src; (void)slen;
+    return 0;
+}
+
+#endif /* BASE64_DECODE_X86 / BASE64_DECODE_NEON */
+
 /*
  * Decode a base64-formatted buffer
  */
@@ -173,7 +413,15 @@ int base64_decode( unsigned char *dst, size_t *dlen,
         return( POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL );
     }
 
-   for( j = 3, n = x = 0, p = dst; i > 0; i--, src++ )
+    /* bulk-decode the leading whitespace- and padding-free portion; the
+     * scalar loop below continues from wherever the vector path stopped */
+    p = dst;
+    n = base64_decode_blocks( p, src, i );
+    p += ( n / 4 ) * 3;
+    src += n;
+    i -= n;
+
+   for( j = 3, n = x = 0; i > 0; i--, src++ )
    {
         if( *src == '\r' || *src == '\n' )
             continue;
@@ -24,8 +24,11 @@
 #include <errno.h>
 #include <string.h>
 #include <stdint.h> /* intmax_t */
+#include <inttypes.h> /* PRIu64 */
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h> /* PATH_MAX */
 
 /* libarchive */
@@ -43,11 +46,22 @@
 #include "package.h"
 #include "deps.h"
 #include "filelist.h"
+#include "thread.h"
 
 /* local database format version */
 size_t ALPM_LOCAL_DB_VERSION = 9;
 
 static int local_db_read(alpm_pkg_t *info, int inforeq);
+static int read_desc_from(alpm_pkg_t *info, FILE *fp);
+static void write_desc(FILE *fp, alpm_pkg_t *info);
+static void write_files(FILE *fp, alpm_pkg_t *info);
+static int local_db_journal_load(alpm_db_t *db, const char *dbpath);
+static int local_db_journal_rebuild(alpm_db_t *db);
+static void local_db_journal_append(alpm_db_t *db, alpm_pkg_t *info, int type);
+static void local_db_journal_invalidate(alpm_db_t *db);
+
+#define LJOURNAL_UPSERT 1
+#define LJOURNAL_REMOVE 2
 
 #define LAZY_LOAD(info) \
 	do { \
@@ -237,44 +251,336 @@ static int _cache_changelog_close(const alpm_pkg_t UNUSED *pkg, void *fp)
 	return fclose((FILE *)fp);
 }
 
+/* Binary mtree cache.
+ *
+ * Parsing the gzip'd mtree with libarchive dominates repeated integrity
+ * checks (-Qkk), so the records of the first parse are serialized into a
+ * compact "mtree.cache" sidecar in the package's db directory, keyed by
+ * the mtree file's mtime. Later opens synthesize archive entries
+ * straight from those records without touching the mtree parser. The
+ * cache is host-local and host-endian; anything that fails to load or
+ * verify simply falls back to parsing the mtree. */
+
+#define MTREE_CACHE_MAGIC 0x74435441u /* "ATCt" */
+#define MTREE_CACHE_VERSION 1
+
+struct mtree_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t mtree_mtime;
+	uint64_t count;
+};
+
+/* fixed record head, followed by pathlen then linklen bytes (both
+ * NUL-terminated when present) */
+struct mtree_cache_record {
+	uint32_t pathlen;
+	uint32_t linklen; /* 0 = not a symlink */
+	uint32_t mode;    /* full mode including the file type bits */
+	int64_t uid;
+	int64_t gid;
+	int64_t size;
+	int64_t mtime;
+};
+
+struct mtree_cache_reader {
+	struct archive *owner; /* handle given to the caller, identity only */
+	struct archive_entry *entry; /* reused for each record */
+	char *data;
+	size_t len;
+	size_t pos;
+	uint64_t count;
+	uint64_t served;
+};
+
+static struct archive *mtree_open_archive(alpm_pkg_t *pkg, const char *mtfile)
+{
+	int r;
+	struct archive *mtree;
+
+	if((mtree = archive_read_new()) == NULL) {
+		RET_ERR(pkg->handle, ALPM_ERR_LIBARCHIVE, NULL);
+	}
+
+	_alpm_archive_read_support_filter_all(mtree);
+	archive_read_support_format_mtree(mtree);
+
+	if((r = _alpm_archive_read_open_file(mtree, mtfile, ALPM_BUFFER_SIZE))) {
+		_alpm_log(pkg->handle, ALPM_LOG_ERROR, _("error while reading file %s: %s\n"),
+					mtfile, archive_error_string(mtree));
+		_alpm_archive_read_free(mtree);
+		RET_ERR(pkg->handle, ALPM_ERR_LIBARCHIVE, NULL);
+	}
+
+	return mtree;
+}
+
+static struct mtree_cache_reader *mtree_cache_reader_new(char *data,
+		size_t len, uint64_t count)
+{
+	struct mtree_cache_reader *reader;
+
+	CALLOC(reader, 1, sizeof(struct mtree_cache_reader), return NULL);
+	if((reader->owner = archive_read_new()) == NULL ||
+			(reader->entry = archive_entry_new()) == NULL) {
+		if(reader->owner) {
+			_alpm_archive_read_free(reader->owner);
+		}
+		free(reader);
+		return NULL;
+	}
+	reader->data = data;
+	reader->len = len;
+	reader->count = count;
+	return reader;
+}
+
+static void mtree_cache_reader_free(struct mtree_cache_reader *reader)
+{
+	archive_entry_free(reader->entry);
+	_alpm_archive_read_free(reader->owner);
+	free(reader->data);
+	free(reader);
+}
+
+/* slurp a cache sidecar; returns NULL if it is missing, malformed or
+ * was written for a different mtree file */
+static struct mtree_cache_reader *mtree_cache_load(const char *cachefile,
+		int64_t mtree_mtime)
+{
+	struct mtree_cache_header header;
+	struct mtree_cache_reader *reader = NULL;
+	struct stat st;
+	char *data = NULL;
+	size_t len;
+	FILE *fp;
+
+	if((fp = fopen(cachefile, "rb")) == NULL) {
+		return NULL;
+	}
+	if(fread(&header, sizeof(header), 1, fp) != 1 ||
+			header.magic != MTREE_CACHE_MAGIC ||
+			header.version != MTREE_CACHE_VERSION ||
+			header.mtree_mtime != mtree_mtime ||
+			fstat(fileno(fp), &st) != 0 ||
+			(size_t)st.st_size < sizeof(header)) {
+		fclose(fp);
+		return NULL;
+	}
+	len = st.st_size - sizeof(header);
+	MALLOC(data, len ? len : 1, fclose(fp); return NULL);
+	if(fread(data, 1, len, fp) != len ||
+			(reader = mtree_cache_reader_new(data, len, header.count)) == NULL) {
+		free(data);
+		reader = NULL;
+	}
+	fclose(fp);
+	return reader;
+}
+
+static int mtree_cache_append(char **buf, size_t *len, size_t *capacity,
+		struct archive_entry *entry)
+{
+	struct mtree_cache_record rec;
+	const char *path = archive_entry_pathname(entry);
+	const char *link = archive_entry_symlink(entry);
+	size_t need;
+
+	rec.pathlen = path ? strlen(path) + 1 : 0;
+	rec.linklen = link ? strlen(link) + 1 : 0;
+	rec.mode = archive_entry_mode(entry);
+	rec.uid = archive_entry_uid(entry);
+	rec.gid = archive_entry_gid(entry);
+	rec.size = archive_entry_size(entry);
+	rec.mtime = archive_entry_mtime(entry);
+
+	need = sizeof(rec) + rec.pathlen + rec.linklen;
+	if(*capacity - *len < need) {
+		size_t newcap = *capacity ? *capacity * 2 : 4096;
+		while(newcap - *len < need) {
+			newcap *= 2;
+		}
+		REALLOC(*buf, newcap, return -1);
+		*capacity = newcap;
+	}
+	memcpy(*buf + *len, &rec, sizeof(rec));
+	*len += sizeof(rec);
+	if(rec.pathlen) {
+		memcpy(*buf + *len, path, rec.pathlen);
+		*len += rec.pathlen;
+	}
+	if(rec.linklen) {
+		memcpy(*buf + *len, link, rec.linklen);
+		*len += rec.linklen;
+	}
+	return 0;
+}
+
+/* best-effort persist; a read-only db or failed write just means the
+ * next run parses the mtree again */
+static void mtree_cache_write(const char *cachefile, int64_t mtree_mtime,
+		uint64_t count, const char *data, size_t len)
+{
+	struct mtree_cache_header header = {
+		.magic = MTREE_CACHE_MAGIC,
+		.version = MTREE_CACHE_VERSION,
+		.mtree_mtime = mtree_mtime,
+		.count = count,
+	};
+	char *tmppath;
+	FILE *fp;
+	size_t cachelen = strlen(cachefile);
+
+	MALLOC(tmppath, cachelen + 5, return);
+	snprintf(tmppath, cachelen + 5, "%s.tmp", cachefile);
+	if((fp = fopen(tmppath, "wb")) == NULL) {
+		free(tmppath);
+		return;
+	}
+	if(fwrite(&header, sizeof(header), 1, fp) == 1 &&
+			(len == 0 || fwrite(data, len, 1, fp) == 1) &&
+			fclose(fp) == 0) {
+		if(rename(tmppath, cachefile) != 0) {
+			unlink(tmppath);
+		}
+	} else {
+		/* fclose above may not have run on the short-write path */
+		fclose(fp);
+		unlink(tmppath);
+	}
+	free(tmppath);
+}
+
+/* parse the whole mtree into records, persisting them for the next run;
+ * returns NULL (with the archive consumed) on parse failure */
+static struct mtree_cache_reader *mtree_cache_build(alpm_pkg_t *pkg,
+		struct archive *mtree, const char *cachefile, int64_t mtree_mtime)
+{
+	struct mtree_cache_reader *reader;
+	struct archive_entry *entry;
+	char *buf = NULL;
+	size_t len = 0, capacity = 0;
+	uint64_t count = 0;
+	int ret;
+
+	while((ret = archive_read_next_header(mtree, &entry)) == ARCHIVE_OK) {
+		if(mtree_cache_append(&buf, &len, &capacity, entry) != 0) {
+			free(buf);
+			return NULL;
+		}
+		count++;
+	}
+	if(ret != ARCHIVE_EOF) {
+		free(buf);
+		return NULL;
+	}
+
+	if((reader = mtree_cache_reader_new(buf, len, count)) == NULL) {
+		free(buf);
+		return NULL;
+	}
+
+	mtree_cache_write(cachefile, mtree_mtime, count, buf, len);
+	_alpm_log(pkg->handle, ALPM_LOG_DEBUG,
+			"cached %" PRIu64 " mtree records for %s\n", count, pkg->name);
+	return reader;
+}
+
 /**
  * Open a package mtree file for reading.
- * @param pkg the local package to read the changelog of
+ * @param pkg the local package to read the mtree of
  * @return a archive structure for the package mtree file
  */
 static struct archive *_cache_mtree_open(alpm_pkg_t *pkg)
 {
-	int r;
-	struct archive *mtree;
+	struct archive *mtree = NULL;
+	struct mtree_cache_reader *reader = NULL;
+	struct stat st;
 
 	alpm_db_t *db = alpm_pkg_get_db(pkg);
 	char *mtfile = _alpm_local_db_pkgpath(db, pkg, "mtree");
+	char *cachefile = _alpm_local_db_pkgpath(db, pkg, "mtree.cache");
 
-	if(access(mtfile, F_OK) != 0) {
+	if(mtfile == NULL || stat(mtfile, &st) != 0) {
 		/* there is no mtree file for this package */
-		goto error;
+		goto cleanup;
 	}
 
-	if((mtree = archive_read_new()) == NULL) {
-		GOTO_ERR(pkg->handle, ALPM_ERR_LIBARCHIVE, error);
+	/* only one cache-backed stream per package at a time; concurrent
+	 * opens parse the mtree directly */
+	if(pkg->mtree_reader == NULL && cachefile != NULL) {
+		reader = mtree_cache_load(cachefile, (int64_t)st.st_mtime);
 	}
 
-	_alpm_archive_read_support_filter_all(mtree);
-	archive_read_support_format_mtree(mtree);
+	if(reader == NULL) {
+		if((mtree = mtree_open_archive(pkg, mtfile)) == NULL) {
+			goto cleanup;
+		}
+		if(pkg->mtree_reader == NULL && cachefile != NULL) {
+			reader = mtree_cache_build(pkg, mtree, cachefile,
+					(int64_t)st.st_mtime);
+			if(reader == NULL) {
+				/* parse problem or allocation failure; the archive has been
+				 * consumed, hand out a fresh one */
+				_alpm_archive_read_free(mtree);
+				mtree = mtree_open_archive(pkg, mtfile);
+				goto cleanup;
+			}
+			_alpm_archive_read_free(mtree);
+			mtree = NULL;
+		}
+	}
 
-	if((r = _alpm_archive_read_open_file(mtree, mtfile, ALPM_BUFFER_SIZE))) {
-		_alpm_log(pkg->handle, ALPM_LOG_ERROR, _("error while reading file %s: %s\n"),
-					mtfile, archive_error_string(mtree));
-		_alpm_archive_read_free(mtree);
-		GOTO_ERR(pkg->handle, ALPM_ERR_LIBARCHIVE, error);
+	if(reader != NULL) {
+		pkg->mtree_reader = reader;
+		mtree = reader->owner;
 	}
 
+cleanup:
 	free(mtfile);
+	free(cachefile);
 	return mtree;
+}
 
-error:
-	free(mtfile);
-	return NULL;
+/* decode the record at the reader's position into its reusable entry */
+static int mtree_cache_next(struct mtree_cache_reader *reader,
+		struct archive_entry **entry)
+{
+	struct mtree_cache_record rec;
+
+	if(reader->served == reader->count) {
+		return 1;
+	}
+	if(reader->len - reader->pos < sizeof(rec)) {
+		return -1;
+	}
+	memcpy(&rec, reader->data + reader->pos, sizeof(rec));
+	reader->pos += sizeof(rec);
+	if(reader->len - reader->pos < (size_t)rec.pathlen + rec.linklen ||
+			(rec.pathlen && reader->data[reader->pos + rec.pathlen - 1]) ||
+			(rec.linklen &&
+			 reader->data[reader->pos + rec.pathlen + rec.linklen - 1])) {
+		return -1;
+	}
+
+	archive_entry_clear(reader->entry);
+	if(rec.pathlen) {
+		archive_entry_set_pathname(reader->entry, reader->data + reader->pos);
+	}
+	if(rec.linklen) {
+		archive_entry_set_symlink(reader->entry,
+				reader->data + reader->pos + rec.pathlen);
+	}
+	reader->pos += (size_t)rec.pathlen + rec.linklen;
+	archive_entry_set_mode(reader->entry, rec.mode);
+	archive_entry_set_uid(reader->entry, rec.uid);
+	archive_entry_set_gid(reader->entry, rec.gid);
+	archive_entry_set_size(reader->entry, rec.size);
+	archive_entry_set_mtime(reader->entry, rec.mtime, 0);
+
+	reader->served++;
+	*entry = reader->entry;
+	return 0;
 }
 
 /**
@@ -284,10 +590,16 @@ error:
  * @param entry an archive_entry to store the entry header information
  * @return 0 on success, 1 if end of archive is reached, -1 otherwise.
  */
-static int _cache_mtree_next(const alpm_pkg_t UNUSED *pkg,
+static int _cache_mtree_next(const alpm_pkg_t *pkg,
 		struct archive *mtree, struct archive_entry **entry)
 {
+	struct mtree_cache_reader *reader = pkg->mtree_reader;
 	int ret;
+
+	if(reader && reader->owner == mtree) {
+		return mtree_cache_next(reader, entry);
+	}
+
 	ret = archive_read_next_header(mtree, entry);
 
 	switch(ret) {
@@ -310,9 +622,17 @@ static int _cache_mtree_next(const alpm_pkg_t UNUSED *pkg,
  * @param mtree the archive structure use for reading from the mtree file
  * @return whether closing the package changelog stream was successful
  */
-static int _cache_mtree_close(const alpm_pkg_t UNUSED *pkg,
+static int _cache_mtree_close(const alpm_pkg_t *pkg,
 		struct archive *mtree)
 {
+	struct mtree_cache_reader *reader = pkg->mtree_reader;
+
+	if(reader && reader->owner == mtree) {
+		/* the reader owns the archive handle; drop the whole thing */
+		((alpm_pkg_t *)pkg)->mtree_reader = NULL;
+		mtree_cache_reader_free(reader);
+		return 0;
+	}
 	return _alpm_archive_read_free(mtree);
 }
 
@@ -321,6 +641,39 @@ static int _cache_force_load(alpm_pkg_t *pkg)
 	return local_db_read(pkg, INFRQ_ALL);
 }
 
+/* Drop the lazily loaded filelist and backup data again so a
+ * long-running handle's memory tracks its actual working set; the next
+ * access simply reloads it from the database. Desc strings are interned
+ * in the database's handle-lifetime pools, so releasing INFRQ_DESC here
+ * would not return any memory and that level is left alone. */
+static int _cache_evict(alpm_pkg_t *pkg)
+{
+	if(pkg->refcount > 0 || pkg->shared_src) {
+		/* shallow copies still borrow this storage, nothing can go */
+		return -1;
+	}
+	if(!(pkg->infolevel & INFRQ_FILES)) {
+		return 0;
+	}
+	if(pkg->files.count && pkg->files.names == NULL) {
+		size_t i;
+		for(i = 0; i < pkg->files.count; i++) {
+			FREE(pkg->files.files[i].name);
+		}
+	}
+	free(pkg->files.files);
+	free(pkg->files.names);
+	free(pkg->files.hashes);
+	memset(&pkg->files, 0, sizeof(alpm_filelist_t));
+	alpm_list_free_inner(pkg->backup, (alpm_list_fn_free)_alpm_backup_free);
+	alpm_list_free(pkg->backup);
+	pkg->backup = NULL;
+	FREE(pkg->backup_index);
+	pkg->backup_index_size = 0;
+	pkg->infolevel &= ~INFRQ_FILES;
+	return 0;
+}
+
 
 /** The local database operations struct. Get package fields through
  * lazy accessor methods that handle any backend loading and caching
@@ -359,6 +712,7 @@ static struct pkg_operations local_pkg_ops = {
 	.mtree_close = _cache_mtree_close,
 
 	.force_load = _cache_force_load,
+	.evict = _cache_evict,
 };
 
 static int checkdbdir(alpm_db_t *db)
@@ -524,6 +878,97 @@ version_error:
 	return -1;
 }
 
+/* A desc read job for the worker pool used by local_db_populate(). Workers
+ * only perform the open/read syscalls; parsing, and with it any logging,
+ * happens afterward on the calling thread. */
+struct desc_prefetch {
+	char *path;
+	char *data;
+	size_t size;
+	int ret;
+};
+
+static void desc_prefetch_worker(void *ctx, size_t index)
+{
+	struct desc_prefetch *job = &((struct desc_prefetch *)ctx)[index];
+	struct stat st;
+	size_t total = 0;
+	int fd;
+
+	job->ret = -1;
+	if(job->path == NULL) {
+		return;
+	}
+	OPEN(fd, job->path, O_RDONLY);
+	if(fd < 0) {
+		return;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size < 0) {
+		close(fd);
+		return;
+	}
+	job->size = st.st_size;
+	if((job->data = malloc(job->size ? job->size : 1)) == NULL) {
+		close(fd);
+		return;
+	}
+	while(total < job->size) {
+		ssize_t nread = read(fd, job->data + total, job->size - total);
+		if(nread == -1 && errno == EINTR) {
+			continue;
+		}
+		if(nread <= 0) {
+			break;
+		}
+		total += nread;
+	}
+	close(fd);
+	if(total != job->size) {
+		free(job->data);
+		job->data = NULL;
+		return;
+	}
+	job->ret = 0;
+}
+
+/* Eagerly load every package's desc data, fanning the file reads out
+ * across the worker pool. Nearly all operations end up pulling in desc
+ * data for much of the local database anyway; doing it here turns a long
+ * serial string of cold-cache opens into a parallel one. Packages whose
+ * read or parse fails are simply left to the lazy loader so that error
+ * handling stays identical to the serial path. */
+static void local_db_desc_prefetch(alpm_db_t *db, size_t nthreads)
+{
+	struct desc_prefetch *jobs;
+	alpm_list_t *i;
+	size_t count = db->pkgcache->entries;
+	size_t n;
+
+	CALLOC(jobs, count, sizeof(struct desc_prefetch), return);
+
+	for(i = db->pkgcache->list, n = 0; i && n < count; i = i->next, n++) {
+		jobs[n].path = _alpm_local_db_pkgpath(db, i->data, "desc");
+	}
+
+	_alpm_parallel_for(nthreads, count, desc_prefetch_worker, jobs);
+
+	for(i = db->pkgcache->list, n = 0; i && n < count; i = i->next, n++) {
+		alpm_pkg_t *pkg = i->data;
+		if(jobs[n].ret == 0 && !(pkg->infolevel & INFRQ_DESC)) {
+			FILE *mfp = fmemopen(jobs[n].data, jobs[n].size, "r");
+			if(mfp) {
+				if(read_desc_from(pkg, mfp) == 0) {
+					pkg->infolevel |= INFRQ_DESC;
+				}
+				fclose(mfp);
+			}
+		}
+		free(jobs[n].data);
+		free(jobs[n].path);
+	}
+	free(jobs);
+}
+
 static int local_db_populate(alpm_db_t *db)
 {
 	size_t est_count;
@@ -555,6 +1000,14 @@ static int local_db_populate(alpm_db_t *db)
 	}
 	db->status |= DB_STATUS_EXISTS;
 	db->status &= ~DB_STATUS_MISSING;
+	_alpm_db_snapshot_stamp(db, &buf);
+
+	/* a valid journal sidesteps the per-package directory reads entirely */
+	if(local_db_journal_load(db, dbpath) == 0) {
+		closedir(dbdir);
+		return 0;
+	}
+
 	if(buf.st_nlink >= 2) {
 		est_count = buf.st_nlink;
 	} else {
@@ -579,6 +1032,22 @@ static int local_db_populate(alpm_db_t *db)
 		RET_ERR(db->handle, ALPM_ERR_MEMORY, -1);
 	}
 
+	/* queue readahead across every entry's desc file before parsing
+	 * starts, so on a cold cache the kernel pulls the tree in from disk
+	 * while the loop below is still splitting names; parse order matches
+	 * the request order, keeping the reads ahead of the reader */
+	while((ent = readdir(dbdir)) != NULL) {
+		char path[PATH_MAX];
+		const char *name = ent->d_name;
+
+		if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+			continue;
+		}
+		snprintf(path, PATH_MAX, "%s%s/desc", dbpath, name);
+		_alpm_readahead_file(path);
+	}
+	rewinddir(dbdir);
+
 	while((ent = readdir(dbdir)) != NULL) {
 		const char *name = ent->d_name;
 
@@ -641,6 +1110,18 @@ static int local_db_populate(alpm_db_t *db)
 	_alpm_log(db->handle, ALPM_LOG_DEBUG, "added %zu packages to package cache for db '%s'\n",
 			count, db->treename);
 
+	{
+		size_t nthreads = _alpm_parallel_nthreads(db->handle, count);
+		if(nthreads > 1) {
+			local_db_desc_prefetch(db, nthreads);
+		}
+	}
+
+	if(db->handle->localdb_journal && local_db_journal_rebuild(db) != 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not rebuild local db journal\n");
+	}
+
 	return 0;
 }
 
@@ -686,13 +1167,160 @@ char *_alpm_local_db_pkgpath(alpm_db_t *db, alpm_pkg_t *info,
 		if(!feof(fp)) goto error; else break; \
 	} \
 	if(_alpm_strip_newline(line, 0) == 0) break; \
-	f = alpm_list_add(f, alpm_dep_from_string(line)); \
+	f = alpm_list_add(f, _alpm_deppool_intern(db->deppool, line)); \
 } while(1) /* note the while(1) and not (0) */
 
+/* Parse a desc-format stream into a package; also used by the journal
+ * backend on in-memory blobs via fmemopen(3). */
+static int read_desc_from(alpm_pkg_t *info, FILE *fp)
+{
+	char line[1024] = {0};
+	alpm_db_t *db = info->origin_data.db;
+
+	/* dependency lists are interned in the db's dep pool below */
+	info->deps_pooled = (db->deppool != NULL);
+
+	while(!feof(fp)) {
+		if(safe_fgets(line, sizeof(line), fp) == NULL && !feof(fp)) {
+			goto error;
+		}
+		size_t linelen = _alpm_strip_newline(line, 0);
+		unsigned int key;
+		if(linelen == 0) {
+			/* length of stripped line was zero */
+			continue;
+		}
+		key = ALPM_FIELD_KEY(line[1], line[2], linelen);
+		if(ALPM_FIELD_MATCH(line, key, "%NAME%")) {
+			READ_NEXT();
+			if(strcmp(line, info->name) != 0) {
+				_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
+							"mismatch on package %s\n"), db->treename, info->name);
+			}
+		} else if(ALPM_FIELD_MATCH(line, key, "%VERSION%")) {
+			READ_NEXT();
+			if(strcmp(line, info->version) != 0) {
+				_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
+							"mismatch on package %s\n"), db->treename, info->name);
+			}
+		} else if(ALPM_FIELD_MATCH(line, key, "%BASE%")) {
+			READ_AND_STORE(info->base);
+		} else if(ALPM_FIELD_MATCH(line, key, "%DESC%")) {
+			READ_AND_STORE(info->desc);
+		} else if(ALPM_FIELD_MATCH(line, key, "%GROUPS%")) {
+			READ_AND_STORE_ALL(info->groups);
+		} else if(ALPM_FIELD_MATCH(line, key, "%URL%")) {
+			READ_AND_STORE(info->url);
+		} else if(ALPM_FIELD_MATCH(line, key, "%LICENSE%")) {
+			READ_AND_STORE_ALL(info->licenses);
+		} else if(ALPM_FIELD_MATCH(line, key, "%ARCH%")) {
+			READ_AND_STORE(info->arch);
+		} else if(ALPM_FIELD_MATCH(line, key, "%BUILDDATE%")) {
+			READ_NEXT();
+			info->builddate = _alpm_parsedate(line);
+		} else if(ALPM_FIELD_MATCH(line, key, "%INSTALLDATE%")) {
+			READ_NEXT();
+			info->installdate = _alpm_parsedate(line);
+		} else if(ALPM_FIELD_MATCH(line, key, "%PACKAGER%")) {
+			READ_AND_STORE(info->packager);
+		} else if(ALPM_FIELD_MATCH(line, key, "%REASON%")) {
+			READ_NEXT();
+			info->reason = (alpm_pkgreason_t)atoi(line);
+		} else if(ALPM_FIELD_MATCH(line, key, "%VALIDATION%")) {
+			alpm_list_t *i, *v = NULL;
+			READ_AND_STORE_ALL(v);
+			for(i = v; i; i = alpm_list_next(i))
+			{
+				if(strcmp(i->data, "none") == 0) {
+					info->validation |= ALPM_PKG_VALIDATION_NONE;
+				} else if(strcmp(i->data, "md5") == 0) {
+					info->validation |= ALPM_PKG_VALIDATION_MD5SUM;
+				} else if(strcmp(i->data, "sha256") == 0) {
+					info->validation |= ALPM_PKG_VALIDATION_SHA256SUM;
+				} else if(strcmp(i->data, "pgp") == 0) {
+					info->validation |= ALPM_PKG_VALIDATION_SIGNATURE;
+				} else {
+					_alpm_log(db->handle, ALPM_LOG_WARNING,
+							_("unknown validation type for package %s: %s\n"),
+							info->name, (const char *)i->data);
+				}
+			}
+			FREELIST(v);
+		} else if(ALPM_FIELD_MATCH(line, key, "%SIZE%")) {
+			READ_NEXT();
+			info->isize = _alpm_strtoofft(line);
+		} else if(ALPM_FIELD_MATCH(line, key, "%REPLACES%")) {
+			READ_AND_SPLITDEP(info->replaces);
+		} else if(ALPM_FIELD_MATCH(line, key, "%DEPENDS%")) {
+			READ_AND_SPLITDEP(info->depends);
+		} else if(ALPM_FIELD_MATCH(line, key, "%OPTDEPENDS%")) {
+			READ_AND_SPLITDEP(info->optdepends);
+		} else if(ALPM_FIELD_MATCH(line, key, "%MAKEDEPENDS%")) {
+			READ_AND_SPLITDEP(info->makedepends);
+		} else if(ALPM_FIELD_MATCH(line, key, "%CHECKDEPENDS%")) {
+			READ_AND_SPLITDEP(info->checkdepends);
+		} else if(ALPM_FIELD_MATCH(line, key, "%CONFLICTS%")) {
+			READ_AND_SPLITDEP(info->conflicts);
+		} else if(ALPM_FIELD_MATCH(line, key, "%PROVIDES%")) {
+			READ_AND_SPLITDEP(info->provides);
+		}
+	}
+	_alpm_pkg_pool_strings(info, db->strpool);
+	return 0;
+
+error:
+	return -1;
+}
+
+/* Parse a files-format stream into a package; also used by the journal
+ * backend on in-memory blobs via fmemopen(3). */
+static int read_files_from(alpm_pkg_t *info, FILE *fp)
+{
+	char line[1024] = {0};
+
+	while(safe_fgets(line, sizeof(line), fp)) {
+		size_t linelen = _alpm_strip_newline(line, 0);
+		unsigned int key = ALPM_FIELD_KEY(line[1], line[2], linelen);
+		if(ALPM_FIELD_MATCH(line, key, "%FILES%")) {
+			size_t files_size = 0, names_size = 0, names_len = 0, len;
+
+			/* all paths land in one contiguous names buffer, so the whole
+			 * filelist costs two allocations and bsearch walks dense memory */
+			while(safe_fgets(line, sizeof(line), fp) &&
+					(len = _alpm_strip_newline(line, 0))) {
+				if(_alpm_filelist_append(&info->files, line, len,
+							&files_size, &names_size, &names_len) != 0) {
+					/* entries still hold offsets, not pointers; drop the
+					 * whole list rather than leave it half-built */
+					FREE(info->files.files);
+					FREE(info->files.names);
+					info->files.count = 0;
+					goto error;
+				}
+			}
+			_alpm_filelist_finish(&info->files, names_len);
+			continue;
+		} else if(ALPM_FIELD_MATCH(line, key, "%BACKUP%")) {
+			while(safe_fgets(line, sizeof(line), fp) && _alpm_strip_newline(line, 0)) {
+				alpm_backup_t *backup;
+				CALLOC(backup, 1, sizeof(alpm_backup_t), goto error);
+				if(_alpm_split_backup(line, &backup)) {
+					FREE(backup);
+					goto error;
+				}
+				info->backup = alpm_list_add(info->backup, backup);
+			}
+		}
+	}
+	return 0;
+
+error:
+	return -1;
+}
+
 static int local_db_read(alpm_pkg_t *info, int inforeq)
 {
 	FILE *fp = NULL;
-	char line[1024] = {0};
 	alpm_db_t *db = info->origin_data.db;
 
 	/* bitmask logic here:
@@ -724,87 +1352,8 @@ static int local_db_read(alpm_pkg_t *info, int inforeq)
 			goto error;
 		}
 		free(path);
-		while(!feof(fp)) {
-			if(safe_fgets(line, sizeof(line), fp) == NULL && !feof(fp)) {
-				goto error;
-			}
-			if(_alpm_strip_newline(line, 0) == 0) {
-				/* length of stripped line was zero */
-				continue;
-			}
-			if(strcmp(line, "%NAME%") == 0) {
-				READ_NEXT();
-				if(strcmp(line, info->name) != 0) {
-					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
-								"mismatch on package %s\n"), db->treename, info->name);
-				}
-			} else if(strcmp(line, "%VERSION%") == 0) {
-				READ_NEXT();
-				if(strcmp(line, info->version) != 0) {
-					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
-								"mismatch on package %s\n"), db->treename, info->name);
-				}
-			} else if(strcmp(line, "%BASE%") == 0) {
-				READ_AND_STORE(info->base);
-			} else if(strcmp(line, "%DESC%") == 0) {
-				READ_AND_STORE(info->desc);
-			} else if(strcmp(line, "%GROUPS%") == 0) {
-				READ_AND_STORE_ALL(info->groups);
-			} else if(strcmp(line, "%URL%") == 0) {
-				READ_AND_STORE(info->url);
-			} else if(strcmp(line, "%LICENSE%") == 0) {
-				READ_AND_STORE_ALL(info->licenses);
-			} else if(strcmp(line, "%ARCH%") == 0) {
-				READ_AND_STORE(info->arch);
-			} else if(strcmp(line, "%BUILDDATE%") == 0) {
-				READ_NEXT();
-				info->builddate = _alpm_parsedate(line);
-			} else if(strcmp(line, "%INSTALLDATE%") == 0) {
-				READ_NEXT();
-				info->installdate = _alpm_parsedate(line);
-			} else if(strcmp(line, "%PACKAGER%") == 0) {
-				READ_AND_STORE(info->packager);
-			} else if(strcmp(line, "%REASON%") == 0) {
-				READ_NEXT();
-				info->reason = (alpm_pkgreason_t)atoi(line);
-			} else if(strcmp(line, "%VALIDATION%") == 0) {
-				alpm_list_t *i, *v = NULL;
-				READ_AND_STORE_ALL(v);
-				for(i = v; i; i = alpm_list_next(i))
-				{
-					if(strcmp(i->data, "none") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_NONE;
-					} else if(strcmp(i->data, "md5") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_MD5SUM;
-					} else if(strcmp(i->data, "sha256") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_SHA256SUM;
-					} else if(strcmp(i->data, "pgp") == 0) {
-						info->validation |= ALPM_PKG_VALIDATION_SIGNATURE;
-					} else {
-						_alpm_log(db->handle, ALPM_LOG_WARNING,
-								_("unknown validation type for package %s: %s\n"),
-								info->name, (const char *)i->data);
-					}
-				}
-				FREELIST(v);
-			} else if(strcmp(line, "%SIZE%") == 0) {
-				READ_NEXT();
-				info->isize = _alpm_strtoofft(line);
-			} else if(strcmp(line, "%REPLACES%") == 0) {
-				READ_AND_SPLITDEP(info->replaces);
-			} else if(strcmp(line, "%DEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->depends);
-			} else if(strcmp(line, "%OPTDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->optdepends);
-			} else if(strcmp(line, "%MAKEDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->makedepends);
-			} else if(strcmp(line, "%CHECKDEPENDS%") == 0) {
-				READ_AND_SPLITDEP(info->checkdepends);
-			} else if(strcmp(line, "%CONFLICTS%") == 0) {
-				READ_AND_SPLITDEP(info->conflicts);
-			} else if(strcmp(line, "%PROVIDES%") == 0) {
-				READ_AND_SPLITDEP(info->provides);
-			}
+		if(read_desc_from(info, fp) != 0) {
+			goto error;
 		}
 		fclose(fp);
 		fp = NULL;
@@ -820,52 +1369,8 @@ static int local_db_read(alpm_pkg_t *info, int inforeq)
 			goto error;
 		}
 		free(path);
-		while(safe_fgets(line, sizeof(line), fp)) {
-			_alpm_strip_newline(line, 0);
-			if(strcmp(line, "%FILES%") == 0) {
-				size_t files_count = 0, files_size = 0, len;
-				alpm_file_t *files = NULL;
-
-				while(safe_fgets(line, sizeof(line), fp) &&
-						(len = _alpm_strip_newline(line, 0))) {
-					if(!_alpm_greedy_grow((void **)&files, &files_size,
-								(files_count ? (files_count + 1) * sizeof(alpm_file_t) : 8 * sizeof(alpm_file_t)))) {
-						goto nomem;
-					}
-					/* since we know the length of the file string already,
-					 * we can do malloc + memcpy rather than strdup */
-					len += 1;
-					MALLOC(files[files_count].name, len, goto nomem);
-					memcpy(files[files_count].name, line, len);
-					files_count++;
-				}
-				/* attempt to hand back any memory we don't need */
-				if(files_count > 0) {
-					REALLOC(files, sizeof(alpm_file_t) * files_count, (void)0);
-				} else {
-					FREE(files);
-				}
-				info->files.count = files_count;
-				info->files.files = files;
-				_alpm_filelist_sort(&info->files);
-				continue;
-nomem:
-				while(files_count > 0) {
-					FREE(files[--files_count].name);
-				}
-				FREE(files);
-				goto error;
-			} else if(strcmp(line, "%BACKUP%") == 0) {
-				while(safe_fgets(line, sizeof(line), fp) && _alpm_strip_newline(line, 0)) {
-					alpm_backup_t *backup;
-					CALLOC(backup, 1, sizeof(alpm_backup_t), goto error);
-					if(_alpm_split_backup(line, &backup)) {
-						FREE(backup);
-						goto error;
-					}
-					info->backup = alpm_list_add(info->backup, backup);
-				}
-			}
+		if(read_files_from(info, fp) != 0) {
+			goto error;
 		}
 		fclose(fp);
 		fp = NULL;
@@ -933,113 +1438,140 @@ static void write_deps(FILE *fp, const char *header, alpm_list_t *deplist)
 	fputc('\n', fp);
 }
 
-int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
+static void write_desc(FILE *fp, alpm_pkg_t *info)
 {
-	FILE *fp = NULL;
-	mode_t oldmask;
 	alpm_list_t *lp;
-	int retval = 0;
-
-	if(db == NULL || info == NULL || !(db->status & DB_STATUS_LOCAL)) {
-		return -1;
+	fprintf(fp, "%%NAME%%\n%s\n\n"
+					"%%VERSION%%\n%s\n\n", info->name, info->version);
+	if(info->base) {
+		fprintf(fp, "%%BASE%%\n"
+						"%s\n\n", info->base);
 	}
-
-	/* make sure we have a sane umask */
-	oldmask = umask(0022);
-
-	/* DESC */
-	if(inforeq & INFRQ_DESC) {
-		char *path;
-		_alpm_log(db->handle, ALPM_LOG_DEBUG,
-				"writing %s-%s DESC information back to db\n",
-				info->name, info->version);
-		path = _alpm_local_db_pkgpath(db, info, "desc");
-		if(!path || (fp = fopen(path, "w")) == NULL) {
-			_alpm_log(db->handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
-					path, strerror(errno));
-			retval = -1;
-			free(path);
-			goto cleanup;
-		}
-		free(path);
-		fprintf(fp, "%%NAME%%\n%s\n\n"
-						"%%VERSION%%\n%s\n\n", info->name, info->version);
-		if(info->base) {
-			fprintf(fp, "%%BASE%%\n"
-							"%s\n\n", info->base);
-		}
-		if(info->desc) {
-			fprintf(fp, "%%DESC%%\n"
-							"%s\n\n", info->desc);
-		}
-		if(info->url) {
-			fprintf(fp, "%%URL%%\n"
-							"%s\n\n", info->url);
-		}
-		if(info->arch) {
-			fprintf(fp, "%%ARCH%%\n"
-							"%s\n\n", info->arch);
-		}
-		if(info->builddate) {
-			fprintf(fp, "%%BUILDDATE%%\n"
-							"%jd\n\n", (intmax_t)info->builddate);
-		}
-		if(info->installdate) {
-			fprintf(fp, "%%INSTALLDATE%%\n"
-							"%jd\n\n", (intmax_t)info->installdate);
-		}
-		if(info->packager) {
-			fprintf(fp, "%%PACKAGER%%\n"
-							"%s\n\n", info->packager);
-		}
-		if(info->isize) {
-			/* only write installed size, csize is irrelevant once installed */
-			fprintf(fp, "%%SIZE%%\n"
-							"%jd\n\n", (intmax_t)info->isize);
-		}
-		if(info->reason) {
-			fprintf(fp, "%%REASON%%\n"
-							"%u\n\n", info->reason);
-		}
-		if(info->groups) {
-			fputs("%GROUPS%\n", fp);
-			for(lp = info->groups; lp; lp = lp->next) {
-				fputs(lp->data, fp);
-				fputc('\n', fp);
-			}
+	if(info->desc) {
+		fprintf(fp, "%%DESC%%\n"
+						"%s\n\n", info->desc);
+	}
+	if(info->url) {
+		fprintf(fp, "%%URL%%\n"
+						"%s\n\n", info->url);
+	}
+	if(info->arch) {
+		fprintf(fp, "%%ARCH%%\n"
+						"%s\n\n", info->arch);
+	}
+	if(info->builddate) {
+		fprintf(fp, "%%BUILDDATE%%\n"
+						"%jd\n\n", (intmax_t)info->builddate);
+	}
+	if(info->installdate) {
+		fprintf(fp, "%%INSTALLDATE%%\n"
+						"%jd\n\n", (intmax_t)info->installdate);
+	}
+	if(info->packager) {
+		fprintf(fp, "%%PACKAGER%%\n"
+						"%s\n\n", info->packager);
+	}
+	if(info->isize) {
+		/* only write installed size, csize is irrelevant once installed */
+		fprintf(fp, "%%SIZE%%\n"
+						"%jd\n\n", (intmax_t)info->isize);
+	}
+	if(info->reason) {
+		fprintf(fp, "%%REASON%%\n"
+						"%u\n\n", info->reason);
+	}
+	if(info->groups) {
+		fputs("%GROUPS%\n", fp);
+		for(lp = info->groups; lp; lp = lp->next) {
+			fputs(lp->data, fp);
 			fputc('\n', fp);
 		}
-		if(info->licenses) {
-			fputs("%LICENSE%\n", fp);
-			for(lp = info->licenses; lp; lp = lp->next) {
-				fputs(lp->data, fp);
-				fputc('\n', fp);
-			}
+		fputc('\n', fp);
+	}
+	if(info->licenses) {
+		fputs("%LICENSE%\n", fp);
+		for(lp = info->licenses; lp; lp = lp->next) {
+			fputs(lp->data, fp);
 			fputc('\n', fp);
 		}
-		if(info->validation) {
-			fputs("%VALIDATION%\n", fp);
-			if(info->validation & ALPM_PKG_VALIDATION_NONE) {
-				fputs("none\n", fp);
-			}
-			if(info->validation & ALPM_PKG_VALIDATION_MD5SUM) {
-				fputs("md5\n", fp);
-			}
-			if(info->validation & ALPM_PKG_VALIDATION_SHA256SUM) {
-				fputs("sha256\n", fp);
-			}
-			if(info->validation & ALPM_PKG_VALIDATION_SIGNATURE) {
-				fputs("pgp\n", fp);
-			}
+		fputc('\n', fp);
+	}
+	if(info->validation) {
+		fputs("%VALIDATION%\n", fp);
+		if(info->validation & ALPM_PKG_VALIDATION_NONE) {
+			fputs("none\n", fp);
+		}
+		if(info->validation & ALPM_PKG_VALIDATION_MD5SUM) {
+			fputs("md5\n", fp);
+		}
+		if(info->validation & ALPM_PKG_VALIDATION_SHA256SUM) {
+			fputs("sha256\n", fp);
+		}
+		if(info->validation & ALPM_PKG_VALIDATION_SIGNATURE) {
+			fputs("pgp\n", fp);
+		}
+		fputc('\n', fp);
+	}
+
+	write_deps(fp, "%REPLACES%", info->replaces);
+	write_deps(fp, "%DEPENDS%", info->depends);
+	write_deps(fp, "%OPTDEPENDS%", info->optdepends);
+	write_deps(fp, "%CONFLICTS%", info->conflicts);
+	write_deps(fp, "%PROVIDES%", info->provides);
+}
+
+static void write_files(FILE *fp, alpm_pkg_t *info)
+{
+	alpm_list_t *lp;
+	if(info->files.count) {
+		size_t i;
+		fputs("%FILES%\n", fp);
+		for(i = 0; i < info->files.count; i++) {
+			const alpm_file_t *file = info->files.files + i;
+			fputs(file->name, fp);
 			fputc('\n', fp);
 		}
+		fputc('\n', fp);
+	}
+	if(info->backup) {
+		fputs("%BACKUP%\n", fp);
+		for(lp = info->backup; lp; lp = lp->next) {
+			const alpm_backup_t *backup = lp->data;
+			fprintf(fp, "%s\t%s\n", backup->name, backup->hash);
+		}
+		fputc('\n', fp);
+	}
+}
+
+int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
+{
+	FILE *fp = NULL;
+	mode_t oldmask;
+	int retval = 0;
 
-		write_deps(fp, "%REPLACES%", info->replaces);
-		write_deps(fp, "%DEPENDS%", info->depends);
-		write_deps(fp, "%OPTDEPENDS%", info->optdepends);
-		write_deps(fp, "%CONFLICTS%", info->conflicts);
-		write_deps(fp, "%PROVIDES%", info->provides);
+	if(db == NULL || info == NULL || !(db->status & DB_STATUS_LOCAL)) {
+		return -1;
+	}
+
+	/* make sure we have a sane umask */
+	oldmask = umask(0022);
 
+	/* DESC */
+	if(inforeq & INFRQ_DESC) {
+		char *path;
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"writing %s-%s DESC information back to db\n",
+				info->name, info->version);
+		path = _alpm_local_db_pkgpath(db, info, "desc");
+		if(!path || (fp = fopen(path, "w")) == NULL) {
+			_alpm_log(db->handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
+					path, strerror(errno));
+			retval = -1;
+			free(path);
+			goto cleanup;
+		}
+		free(path);
+		write_desc(fp, info);
 		fclose(fp);
 		fp = NULL;
 	}
@@ -1059,24 +1591,7 @@ int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
 			goto cleanup;
 		}
 		free(path);
-		if(info->files.count) {
-			size_t i;
-			fputs("%FILES%\n", fp);
-			for(i = 0; i < info->files.count; i++) {
-				const alpm_file_t *file = info->files.files + i;
-				fputs(file->name, fp);
-				fputc('\n', fp);
-			}
-			fputc('\n', fp);
-		}
-		if(info->backup) {
-			fputs("%BACKUP%\n", fp);
-			for(lp = info->backup; lp; lp = lp->next) {
-				const alpm_backup_t *backup = lp->data;
-				fprintf(fp, "%s\t%s\n", backup->name, backup->hash);
-			}
-			fputc('\n', fp);
-		}
+		write_files(fp, info);
 		fclose(fp);
 		fp = NULL;
 	}
@@ -1086,6 +1601,11 @@ int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq)
 
 cleanup:
 	umask(oldmask);
+	if(retval == 0) {
+		local_db_journal_append(db, info, LJOURNAL_UPSERT);
+	} else {
+		local_db_journal_invalidate(db);
+	}
 	return retval;
 }
 
@@ -1131,6 +1651,520 @@ int _alpm_local_db_remove(alpm_db_t *db, alpm_pkg_t *info)
 		ret = -1;
 	}
 	free(pkgpath);
+	if(ret == 0) {
+		local_db_journal_append(db, info, LJOURNAL_REMOVE);
+	} else {
+		local_db_journal_invalidate(db);
+	}
+	return ret;
+}
+
+
+/* Single-file journal replica of the local database.
+ *
+ * The per-package directory tree stays the canonical store; when
+ * enabled via alpm_option_set_localdb_journal(), a sidecar journal
+ * holds an append-only copy of every entry's desc and files data so a
+ * populate costs one open and one sequential read instead of two-plus
+ * opens per installed package. Each database write appends an upsert
+ * or tombstone record and restamps the header with the entry tree's
+ * mtime; if the tree is modified behind libalpm's back the stamp no
+ * longer matches and the journal is ignored and rebuilt from the
+ * directories. Superseded records are compacted away once they
+ * outnumber the live ones.
+ *
+ * This file (and the sync db sidecar index in be_sync.c) is how libalpm
+ * amortizes populate cost across invocations. A resident daemon serving
+ * parsed caches out of shared memory was considered and rejected: the
+ * caches are pointer-rich (alpm_list_t, pkghash, interned strings) and
+ * cannot be mapped at arbitrary addresses without rewriting every
+ * consumer, while a flat on-disk replica gets the same effect through
+ * the page cache with no extra process to manage or invalidate. */
+
+#define LJOURNAL_MAGIC "ALPMLJNL"
+#define LJOURNAL_VERSION 1
+
+struct ljournal_header {
+	char magic[8];
+	uint32_t version;
+	/* written as 1 by the creating host; a mismatch on read means the
+	 * journal came from a machine of different endianness */
+	uint32_t endian;
+	/* mtime of the local db directory the journal was last synced to */
+	int64_t dir_mtime;
+	int64_t dir_mtime_nsec;
+};
+
+/* fixed record prefix, followed by the name, version, desc and files
+ * data with the given lengths and no terminators */
+struct ljournal_record {
+	uint32_t type;
+	uint32_t scriptlet;
+	uint32_t namelen;
+	uint32_t verlen;
+	uint64_t desclen;
+	uint64_t fileslen;
+};
+
+static char *ljournal_path(alpm_db_t *db)
+{
+	char *jpath;
+	size_t len = strlen(db->handle->dbpath) + 15;
+	MALLOC(jpath, len, RET_ERR(db->handle, ALPM_ERR_MEMORY, NULL));
+	snprintf(jpath, len, "%slocal.journal", db->handle->dbpath);
+	return jpath;
+}
+
+static void ljournal_dir_mtime(const struct stat *st, int64_t *mtime,
+		int64_t *mtime_nsec)
+{
+	*mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	*mtime_nsec = st->st_mtim.tv_nsec;
+#else
+	*mtime_nsec = 0;
+#endif
+}
+
+static int ljournal_write_header(FILE *fp, alpm_db_t *db)
+{
+	struct ljournal_header hdr;
+	struct stat dirstat;
+	const char *dbpath = _alpm_db_path(db);
+
+	if(dbpath == NULL || stat(dbpath, &dirstat) != 0) {
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, LJOURNAL_MAGIC, sizeof(hdr.magic));
+	hdr.version = LJOURNAL_VERSION;
+	hdr.endian = 1;
+	ljournal_dir_mtime(&dirstat, &hdr.dir_mtime, &hdr.dir_mtime_nsec);
+
+	if(fseek(fp, 0, SEEK_SET) != 0
+			|| fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+static int ljournal_write_record(FILE *fp, alpm_pkg_t *info, uint32_t type)
+{
+	struct ljournal_record rec;
+	char *descbuf = NULL, *filesbuf = NULL;
+	size_t descsize = 0, filessize = 0;
+	int ret = -1;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = type;
+	rec.namelen = strlen(info->name);
+	rec.verlen = strlen(info->version);
+
+	if(type == LJOURNAL_UPSERT) {
+		FILE *mfp;
+		rec.scriptlet = info->scriptlet != 0;
+		if((mfp = open_memstream(&descbuf, &descsize)) == NULL) {
+			goto cleanup;
+		}
+		write_desc(mfp, info);
+		if(fclose(mfp) != 0) {
+			goto cleanup;
+		}
+		if((mfp = open_memstream(&filesbuf, &filessize)) == NULL) {
+			goto cleanup;
+		}
+		write_files(mfp, info);
+		if(fclose(mfp) != 0) {
+			goto cleanup;
+		}
+		rec.desclen = descsize;
+		rec.fileslen = filessize;
+	}
+
+	if(fwrite(&rec, sizeof(rec), 1, fp) != 1
+			|| fwrite(info->name, rec.namelen, 1, fp) != 1
+			|| fwrite(info->version, rec.verlen, 1, fp) != 1
+			|| (rec.desclen && fwrite(descbuf, descsize, 1, fp) != 1)
+			|| (rec.fileslen && fwrite(filesbuf, filessize, 1, fp) != 1)) {
+		goto cleanup;
+	}
+	ret = 0;
+
+cleanup:
+	free(descbuf);
+	free(filesbuf);
+	return ret;
+}
+
+/* Drop the journal so the next populate rebuilds it from the entry tree. */
+static void local_db_journal_invalidate(alpm_db_t *db)
+{
+	char *jpath = ljournal_path(db);
+	if(jpath) {
+		unlink(jpath);
+		free(jpath);
+	}
+}
+
+/* Append an upsert or tombstone for info and restamp the header; any
+ * failure invalidates the journal rather than the database operation.
+ * While a batch is active the record is collected in memory instead and
+ * written out by _alpm_local_db_journal_batch_end(). */
+static void local_db_journal_append(alpm_db_t *db, alpm_pkg_t *info, int type)
+{
+	char *jpath;
+	FILE *fp;
+	int ok;
+
+	if(!db->handle->localdb_journal) {
+		return;
+	}
+	if(db->journal_batch) {
+		if(type == LJOURNAL_UPSERT && info->origin == ALPM_PKG_FROM_LOCALDB
+				&& local_db_read(info, INFRQ_DESC | INFRQ_FILES | INFRQ_SCRIPTLET) != 0) {
+			db->journal_batch_err = 1;
+			return;
+		}
+		if(ljournal_write_record(db->journal_batch, info, type) != 0) {
+			db->journal_batch_err = 1;
+		}
+		return;
+	}
+	if((jpath = ljournal_path(db)) == NULL) {
+		return;
+	}
+	if((fp = fopen(jpath, "r+")) == NULL) {
+		/* no journal yet; the next populate will build one */
+		free(jpath);
+		return;
+	}
+
+	/* upserts need the full desc and files data in memory */
+	if(type == LJOURNAL_UPSERT && info->origin == ALPM_PKG_FROM_LOCALDB
+			&& local_db_read(info, INFRQ_DESC | INFRQ_FILES | INFRQ_SCRIPTLET) != 0) {
+		ok = 0;
+		fclose(fp);
+		goto done;
+	}
+
+	ok = fseek(fp, 0, SEEK_END) == 0
+			&& ljournal_write_record(fp, info, type) == 0
+			&& ljournal_write_header(fp, db) == 0;
+	if(fclose(fp) != 0) {
+		ok = 0;
+	}
+
+done:
+	if(!ok) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not append to local db journal, invalidating\n");
+		unlink(jpath);
+	}
+	free(jpath);
+}
+
+/* Start collecting journal records in memory. Every database write
+ * between here and _alpm_local_db_journal_batch_end() costs only an
+ * in-memory serialization; the journal file itself is opened, appended
+ * and restamped once for the whole batch instead of once per package.
+ * Failure to set up the batch is harmless, appends simply stay direct. */
+void _alpm_local_db_journal_batch_begin(alpm_db_t *db)
+{
+	if(db == NULL || !db->handle->localdb_journal || db->journal_batch) {
+		return;
+	}
+	db->journal_batch_err = 0;
+	db->journal_batch = open_memstream(&db->journal_batch_buf,
+			&db->journal_batch_size);
+}
+
+/* Flush the collected records in a single append and restamp the
+ * header; any failure drops the journal so the next populate rebuilds
+ * it from the entry tree. */
+int _alpm_local_db_journal_batch_end(alpm_db_t *db)
+{
+	char *jpath;
+	FILE *fp;
+	int ok;
+
+	if(db == NULL || db->journal_batch == NULL) {
+		return 0;
+	}
+	if(fclose(db->journal_batch) != 0) {
+		db->journal_batch_err = 1;
+	}
+	db->journal_batch = NULL;
+
+	if((jpath = ljournal_path(db)) == NULL) {
+		free(db->journal_batch_buf);
+		db->journal_batch_buf = NULL;
+		return -1;
+	}
+
+	if(db->journal_batch_err) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not batch local db journal records, invalidating\n");
+		unlink(jpath);
+		free(jpath);
+		free(db->journal_batch_buf);
+		db->journal_batch_buf = NULL;
+		return -1;
+	}
+
+	if(db->journal_batch_size == 0) {
+		free(jpath);
+		free(db->journal_batch_buf);
+		db->journal_batch_buf = NULL;
+		return 0;
+	}
+
+	if((fp = fopen(jpath, "r+")) == NULL) {
+		/* no journal yet; the next populate will build one */
+		free(jpath);
+		free(db->journal_batch_buf);
+		db->journal_batch_buf = NULL;
+		return 0;
+	}
+
+	ok = fseek(fp, 0, SEEK_END) == 0
+			&& fwrite(db->journal_batch_buf, db->journal_batch_size, 1, fp) == 1
+			&& ljournal_write_header(fp, db) == 0;
+	if(fclose(fp) != 0) {
+		ok = 0;
+	}
+	if(!ok) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not append to local db journal, invalidating\n");
+		unlink(jpath);
+	}
+	free(jpath);
+	free(db->journal_batch_buf);
+	db->journal_batch_buf = NULL;
+	return ok ? 0 : -1;
+}
+
+/* Rewrite the journal from the loaded package cache, one upsert per
+ * package. Used both for the initial build after a directory populate
+ * and for opportunistic compaction. */
+static int local_db_journal_rebuild(alpm_db_t *db)
+{
+	char *jpath = NULL, *tmppath = NULL;
+	FILE *fp = NULL;
+	alpm_list_t *i;
+	size_t len;
+	int ret = -1;
+
+	if((jpath = ljournal_path(db)) == NULL) {
+		return -1;
+	}
+	len = strlen(jpath) + 5;
+	MALLOC(tmppath, len, free(jpath); return -1);
+	snprintf(tmppath, len, "%s.tmp", jpath);
+
+	if((fp = fopen(tmppath, "w")) == NULL) {
+		goto cleanup;
+	}
+	if(ljournal_write_header(fp, db) != 0) {
+		goto cleanup;
+	}
+	for(i = _alpm_db_get_pkgcache(db); i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		if(local_db_read(pkg, INFRQ_DESC | INFRQ_FILES | INFRQ_SCRIPTLET) != 0
+				|| ljournal_write_record(fp, pkg, LJOURNAL_UPSERT) != 0) {
+			goto cleanup;
+		}
+	}
+	if(fclose(fp) != 0) {
+		fp = NULL;
+		goto cleanup;
+	}
+	fp = NULL;
+	if(rename(tmppath, jpath) != 0) {
+		goto cleanup;
+	}
+	_alpm_log(db->handle, ALPM_LOG_DEBUG, "rebuilt local db journal %s\n",
+			jpath);
+	ret = 0;
+
+cleanup:
+	if(fp) {
+		fclose(fp);
+	}
+	if(ret != 0) {
+		unlink(tmppath);
+	}
+	free(tmppath);
+	free(jpath);
+	return ret;
+}
+
+/* Load the package cache from the journal. Returns 0 if the cache was
+ * fully populated, -1 if the journal is missing, stale or malformed and
+ * the caller should fall back to scanning the entry tree. */
+static int local_db_journal_load(alpm_db_t *db, const char *dbpath)
+{
+	char *jpath;
+	int fd = -1, ret = -1;
+	struct stat st, dirstat;
+	struct ljournal_header hdr;
+	int64_t dir_mtime, dir_mtime_nsec;
+	unsigned char *base = MAP_FAILED;
+	size_t mapsize = 0, offset;
+	size_t dead = 0, live;
+	alpm_pkghash_t *cache = NULL;
+
+	if(!db->handle->localdb_journal) {
+		return -1;
+	}
+	if((jpath = ljournal_path(db)) == NULL) {
+		return -1;
+	}
+	OPEN(fd, jpath, O_RDONLY);
+	if(fd < 0) {
+		free(jpath);
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr)) {
+		goto cleanup;
+	}
+	mapsize = st.st_size;
+	base = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(base == MAP_FAILED) {
+		goto cleanup;
+	}
+
+	memcpy(&hdr, base, sizeof(hdr));
+	if(memcmp(hdr.magic, LJOURNAL_MAGIC, sizeof(hdr.magic)) != 0
+			|| hdr.version != LJOURNAL_VERSION || hdr.endian != 1) {
+		goto cleanup;
+	}
+	if(stat(dbpath, &dirstat) != 0) {
+		goto cleanup;
+	}
+	ljournal_dir_mtime(&dirstat, &dir_mtime, &dir_mtime_nsec);
+	if(hdr.dir_mtime != dir_mtime || hdr.dir_mtime_nsec != dir_mtime_nsec) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"local db journal is stale, falling back to directory scan\n");
+		goto cleanup;
+	}
+
+	if((cache = _alpm_pkghash_create(64)) == NULL) {
+		goto cleanup;
+	}
+
+	offset = sizeof(hdr);
+	while(offset < mapsize) {
+		struct ljournal_record rec;
+		const char *name, *version, *descblob, *filesblob;
+		alpm_pkg_t *pkg, *old = NULL;
+
+		if(mapsize - offset < sizeof(rec)) {
+			goto cleanup;
+		}
+		memcpy(&rec, base + offset, sizeof(rec));
+		offset += sizeof(rec);
+		if(rec.namelen == 0 || rec.verlen == 0
+				|| mapsize - offset < rec.namelen + rec.verlen
+				|| rec.desclen > mapsize - offset - rec.namelen - rec.verlen
+				|| rec.fileslen > mapsize - offset - rec.namelen - rec.verlen
+					- rec.desclen) {
+			goto cleanup;
+		}
+		name = (const char *)base + offset;
+		version = name + rec.namelen;
+		descblob = version + rec.verlen;
+		filesblob = descblob + rec.desclen;
+		offset += rec.namelen + rec.verlen + rec.desclen + rec.fileslen;
+
+		if((pkg = _alpm_pkg_new()) == NULL) {
+			goto cleanup;
+		}
+		STRNDUP(pkg->name, name, rec.namelen, _alpm_pkg_free(pkg); goto cleanup);
+		STRNDUP(pkg->version, version, rec.verlen,
+				_alpm_pkg_free(pkg); goto cleanup);
+		pkg->name_hash = _alpm_hash_sdbm(pkg->name);
+
+		/* later records supersede earlier ones */
+		if((old = _alpm_pkghash_find(cache, pkg->name))) {
+			cache = _alpm_pkghash_remove(cache, old, NULL);
+			_alpm_pkg_free(old);
+			dead++;
+		}
+		if(rec.type == LJOURNAL_REMOVE) {
+			_alpm_pkg_free(pkg);
+			dead++;
+			continue;
+		} else if(rec.type != LJOURNAL_UPSERT) {
+			_alpm_pkg_free(pkg);
+			goto cleanup;
+		}
+
+		pkg->origin = ALPM_PKG_FROM_LOCALDB;
+		pkg->origin_data.db = db;
+		pkg->ops = &local_pkg_ops;
+		pkg->handle = db->handle;
+		pkg->scriptlet = rec.scriptlet;
+
+		if(rec.desclen) {
+			FILE *mfp = fmemopen((void *)descblob, rec.desclen, "r");
+			if(mfp == NULL || read_desc_from(pkg, mfp) != 0) {
+				if(mfp) {
+					fclose(mfp);
+				}
+				_alpm_pkg_free(pkg);
+				goto cleanup;
+			}
+			fclose(mfp);
+		}
+		if(rec.fileslen) {
+			FILE *mfp = fmemopen((void *)filesblob, rec.fileslen, "r");
+			if(mfp == NULL || read_files_from(pkg, mfp) != 0) {
+				if(mfp) {
+					fclose(mfp);
+				}
+				_alpm_pkg_free(pkg);
+				goto cleanup;
+			}
+			fclose(mfp);
+		}
+		pkg->infolevel = INFRQ_BASE | INFRQ_DESC | INFRQ_FILES | INFRQ_SCRIPTLET;
+
+		if(_alpm_pkghash_add(&cache, pkg) == NULL) {
+			_alpm_pkg_free(pkg);
+			goto cleanup;
+		}
+	}
+
+	db->pkgcache = cache;
+	live = cache->entries;
+	cache = NULL;
+	if(live > 0) {
+		db->pkgcache->list = alpm_list_msort(db->pkgcache->list, live,
+				_alpm_pkg_cmp);
+	}
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"loaded %zu packages from local db journal for db '%s'\n",
+			live, db->treename);
+	ret = 0;
+
+	/* opportunistic compaction once dead records outnumber live ones */
+	if(dead > live) {
+		local_db_journal_rebuild(db);
+	}
+
+cleanup:
+	if(cache) {
+		alpm_list_free_inner(cache->list, (alpm_list_fn_free)_alpm_pkg_free);
+		_alpm_pkghash_free(cache);
+	}
+	if(base != MAP_FAILED) {
+		munmap(base, mapsize);
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+	free(jpath);
 	return ret;
 }
 
@@ -1158,6 +2192,352 @@ int SYMEXPORT alpm_pkg_set_reason(alpm_pkg_t *pkg, alpm_pkgreason_t reason)
 	return 0;
 }
 
+/* Reverse path -> package owner index.
+ *
+ * Owner queries otherwise have to load and bsearch the filelist of every
+ * installed package. After each committed transaction we write a sidecar
+ * file next to the local database mapping a 64-bit hash of each owned path
+ * to its package, so lookups touch only the (usually one) candidate
+ * package's filelist. The index records the mtime of the local db directory
+ * and is ignored whenever another writer has modified the database behind
+ * our back, in which case callers fall back to the full scan. */
+
+#define OWNERIDX_MAGIC "ALPMOIDX"
+#define OWNERIDX_VERSION 1
+#define OWNERIDX_ENDIAN 0x04030201u
+/* on-disk entry: uint64_t path hash + uint32_t package index */
+#define OWNERIDX_ENTRY_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+struct owneridx_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t pkgcount;
+	uint32_t reserved;
+	uint64_t entrycount;
+	int64_t dir_mtime;
+	int64_t dir_mtime_nsec;
+};
+
+struct owneridx_entry {
+	uint64_t hash;
+	uint32_t pkgindex;
+};
+
+static uint64_t owneridx_hash(const char *path)
+{
+	/* FNV-1a */
+	uint64_t hash = 14695981039346656037ULL;
+	while(*path) {
+		hash ^= (unsigned char)*path++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static char *owneridx_path(alpm_db_t *db)
+{
+	char *idxpath;
+	size_t len = strlen(db->handle->dbpath) + 20;
+	MALLOC(idxpath, len, RET_ERR(db->handle, ALPM_ERR_MEMORY, NULL));
+	snprintf(idxpath, len, "%slocal-owners.cache", db->handle->dbpath);
+	return idxpath;
+}
+
+static int owneridx_entry_cmp(const void *e1, const void *e2)
+{
+	const struct owneridx_entry *entry1 = e1, *entry2 = e2;
+	if(entry1->hash != entry2->hash) {
+		return entry1->hash < entry2->hash ? -1 : 1;
+	}
+	if(entry1->pkgindex != entry2->pkgindex) {
+		return entry1->pkgindex < entry2->pkgindex ? -1 : 1;
+	}
+	return 0;
+}
+
+int _alpm_local_db_owners_rebuild(alpm_db_t *db)
+{
+	char *idxpath = NULL, *tmppath = NULL;
+	FILE *fp = NULL;
+	alpm_list_t *i, *pkgcache;
+	struct owneridx_entry *entries = NULL;
+	struct owneridx_header hdr;
+	struct stat dirstat;
+	uint64_t entrycount = 0, n = 0;
+	uint32_t pkgcount = 0, pkgindex;
+	const char *dbpath;
+	size_t len;
+	int ret = -1;
+
+	pkgcache = alpm_db_get_pkgcache(db);
+	dbpath = _alpm_db_path(db);
+	if(dbpath == NULL || stat(dbpath, &dirstat) != 0) {
+		return -1;
+	}
+
+	for(i = pkgcache; i; i = i->next) {
+		alpm_filelist_t *files = alpm_pkg_get_files(i->data);
+		entrycount += files->count;
+		pkgcount++;
+	}
+
+	idxpath = owneridx_path(db);
+	if(idxpath == NULL) {
+		return -1;
+	}
+	len = strlen(idxpath) + 5;
+	MALLOC(tmppath, len, goto cleanup);
+	snprintf(tmppath, len, "%s.tmp", idxpath);
+
+	if(entrycount > 0) {
+		MALLOC(entries, entrycount * sizeof(struct owneridx_entry), goto cleanup);
+	}
+	for(i = pkgcache, pkgindex = 0; i; i = i->next, pkgindex++) {
+		alpm_filelist_t *files = alpm_pkg_get_files(i->data);
+		size_t f;
+		for(f = 0; f < files->count; f++) {
+			entries[n].hash = owneridx_hash(files->files[f].name);
+			entries[n].pkgindex = pkgindex;
+			n++;
+		}
+	}
+	qsort(entries, entrycount, sizeof(struct owneridx_entry), owneridx_entry_cmp);
+
+	fp = fopen(tmppath, "wb");
+	if(fp == NULL) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not create owner index %s (%s)\n", tmppath, strerror(errno));
+		goto cleanup;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, OWNERIDX_MAGIC, sizeof(hdr.magic));
+	hdr.version = OWNERIDX_VERSION;
+	hdr.endian = OWNERIDX_ENDIAN;
+	hdr.pkgcount = pkgcount;
+	hdr.entrycount = entrycount;
+	hdr.dir_mtime = (int64_t)dirstat.st_mtime;
+	hdr.dir_mtime_nsec = 0;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	hdr.dir_mtime_nsec = (int64_t)dirstat.st_mtim.tv_nsec;
+#endif
+
+	if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+		goto write_error;
+	}
+	/* package name table in pkgcache order */
+	for(i = pkgcache; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		uint32_t namelen = (uint32_t)strlen(pkg->name);
+		if(fwrite(&namelen, sizeof(namelen), 1, fp) != 1
+				|| fwrite(pkg->name, namelen, 1, fp) != 1) {
+			goto write_error;
+		}
+	}
+	for(n = 0; n < entrycount; n++) {
+		if(fwrite(&entries[n].hash, sizeof(uint64_t), 1, fp) != 1
+				|| fwrite(&entries[n].pkgindex, sizeof(uint32_t), 1, fp) != 1) {
+			goto write_error;
+		}
+	}
+	if(fclose(fp) != 0) {
+		fp = NULL;
+		goto write_error;
+	}
+	fp = NULL;
+
+	if(rename(tmppath, idxpath) != 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not rename owner index %s (%s)\n", idxpath, strerror(errno));
+		unlink(tmppath);
+		goto cleanup;
+	}
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"wrote owner index with %" PRIu64 " entries\n", entrycount);
+	ret = 0;
+	goto cleanup;
+
+write_error:
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"could not write owner index %s (%s)\n", tmppath, strerror(errno));
+	if(fp) {
+		fclose(fp);
+	}
+	unlink(tmppath);
+
+cleanup:
+	free(entries);
+	free(tmppath);
+	free(idxpath);
+	return ret;
+}
+
+static void owneridx_entry_at(const unsigned char *entrytable, uint64_t pos,
+		struct owneridx_entry *entry)
+{
+	const unsigned char *record = entrytable + pos * OWNERIDX_ENTRY_SIZE;
+	memcpy(&entry->hash, record, sizeof(uint64_t));
+	memcpy(&entry->pkgindex, record + sizeof(uint64_t), sizeof(uint32_t));
+}
+
+int SYMEXPORT alpm_db_find_file_owners(alpm_db_t *db, const char *path,
+		alpm_list_t **owners)
+{
+	char *idxpath = NULL;
+	int fd = -1, ret = -1;
+	void *map = MAP_FAILED;
+	struct stat idxstat, dirstat;
+	struct owneridx_header hdr;
+	const unsigned char *nametable, *entrytable, *pos;
+	const char **names = NULL;
+	size_t remain;
+	uint64_t low, high, target;
+	uint32_t p;
+	const char *dbpath;
+
+	ASSERT(db != NULL, return -1);
+	ASSERT(path != NULL && owners != NULL,
+			RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
+	ASSERT(db == db->handle->db_local,
+			RET_ERR(db->handle, ALPM_ERR_WRONG_ARGS, -1));
+	*owners = NULL;
+
+	/* make sure the package cache is loaded before consulting the index */
+	if(alpm_db_get_pkgcache(db) == NULL) {
+		return -1;
+	}
+
+	dbpath = _alpm_db_path(db);
+	if(dbpath == NULL || stat(dbpath, &dirstat) != 0) {
+		return -1;
+	}
+
+	idxpath = owneridx_path(db);
+	if(idxpath == NULL) {
+		return -1;
+	}
+	OPEN(fd, idxpath, O_RDONLY);
+	if(fd < 0) {
+		goto cleanup;
+	}
+	if(fstat(fd, &idxstat) != 0 || (size_t)idxstat.st_size < sizeof(hdr)) {
+		goto cleanup;
+	}
+	map = mmap(NULL, (size_t)idxstat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) {
+		goto cleanup;
+	}
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if(memcmp(hdr.magic, OWNERIDX_MAGIC, sizeof(hdr.magic)) != 0
+			|| hdr.version != OWNERIDX_VERSION
+			|| hdr.endian != OWNERIDX_ENDIAN
+			|| hdr.dir_mtime != (int64_t)dirstat.st_mtime) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"owner index is stale or invalid, ignoring\n");
+		goto cleanup;
+	}
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	if(hdr.dir_mtime_nsec != (int64_t)dirstat.st_mtim.tv_nsec) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"owner index is stale or invalid, ignoring\n");
+		goto cleanup;
+	}
+#endif
+
+	/* walk the name table, bounds-checking as we go */
+	nametable = (const unsigned char *)map + sizeof(hdr);
+	remain = (size_t)idxstat.st_size - sizeof(hdr);
+	CALLOC(names, hdr.pkgcount ? hdr.pkgcount : 1, sizeof(char *), goto cleanup);
+	pos = nametable;
+	for(p = 0; p < hdr.pkgcount; p++) {
+		uint32_t namelen;
+		if(remain < sizeof(namelen)) {
+			goto cleanup;
+		}
+		memcpy(&namelen, pos, sizeof(namelen));
+		pos += sizeof(namelen);
+		remain -= sizeof(namelen);
+		if(remain < namelen) {
+			goto cleanup;
+		}
+		names[p] = (const char *)pos;
+		/* lengths are validated lazily when a candidate matches */
+		pos += namelen;
+		remain -= namelen;
+	}
+	entrytable = pos;
+	if(remain < hdr.entrycount * OWNERIDX_ENTRY_SIZE) {
+		goto cleanup;
+	}
+
+	/* binary search for the first entry with our hash */
+	target = owneridx_hash(path);
+	low = 0;
+	high = hdr.entrycount;
+	while(low < high) {
+		uint64_t mid = low + (high - low) / 2;
+		struct owneridx_entry entry;
+		owneridx_entry_at(entrytable, mid, &entry);
+		if(entry.hash < target) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	for(; low < hdr.entrycount; low++) {
+		struct owneridx_entry entry;
+		alpm_pkg_t *pkg;
+		char name[PATH_MAX];
+		uint32_t namelen;
+		const unsigned char *namepos;
+
+		owneridx_entry_at(entrytable, low, &entry);
+		if(entry.hash != target) {
+			break;
+		}
+		if(entry.pkgindex >= hdr.pkgcount) {
+			goto cleanup;
+		}
+		namepos = (const unsigned char *)names[entry.pkgindex];
+		memcpy(&namelen, namepos - sizeof(namelen), sizeof(namelen));
+		if(namelen >= PATH_MAX) {
+			goto cleanup;
+		}
+		memcpy(name, namepos, namelen);
+		name[namelen] = '\0';
+
+		pkg = _alpm_pkghash_find(db->pkgcache, name);
+		if(pkg == NULL) {
+			/* index disagrees with the package cache - treat as stale */
+			goto cleanup;
+		}
+		/* guard against hash collisions with a real membership check; this
+		 * loads at most the candidate package's filelist */
+		if(alpm_filelist_contains(alpm_pkg_get_files(pkg), path)) {
+			*owners = alpm_list_add(*owners, pkg);
+		}
+	}
+	ret = 0;
+
+cleanup:
+	if(ret != 0 && *owners) {
+		alpm_list_free(*owners);
+		*owners = NULL;
+	}
+	free(names);
+	if(map != MAP_FAILED) {
+		munmap(map, (size_t)idxstat.st_size);
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+	free(idxpath);
+	return ret;
+}
+
 struct db_operations local_db_ops = {
 	.validate         = local_db_validate,
 	.populate         = local_db_populate,
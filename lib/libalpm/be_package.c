@@ -40,6 +40,7 @@
 #include "package.h"
 #include "deps.h"
 #include "filelist.h"
+#include "thread.h"
 #include "util.h"
 
 struct package_changelog {
@@ -279,6 +280,7 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		alpm_siglist_t **sigdata, int *validation)
 {
 	int has_sig;
+	int hash_passes = 0;
 	handle->pm_errno = ALPM_ERR_OK;
 
 	if(pkgfile == NULL || strlen(pkgfile) == 0) {
@@ -314,9 +316,19 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 	if(syncpkg && !has_sig) {
 		if(syncpkg->md5sum && !syncpkg->sha256sum) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "md5sum: %s\n", syncpkg->md5sum);
-			_alpm_log(handle, ALPM_LOG_DEBUG, "checking md5sum for %s\n", pkgfile);
-			if(_alpm_test_checksum(pkgfile, syncpkg->md5sum, ALPM_PKG_VALIDATION_MD5SUM) != 0) {
-				RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
+			if(syncpkg->dl_md5sum) {
+				/* digest was computed while the file was downloaded; a
+				 * compare replaces re-reading the whole package */
+				_alpm_log(handle, ALPM_LOG_DEBUG, "using md5sum streamed during download\n");
+				if(strcmp(syncpkg->dl_md5sum, syncpkg->md5sum) != 0) {
+					RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
+				}
+			} else {
+				_alpm_log(handle, ALPM_LOG_DEBUG, "checking md5sum for %s\n", pkgfile);
+				if(_alpm_test_checksum(pkgfile, syncpkg->md5sum, ALPM_PKG_VALIDATION_MD5SUM) != 0) {
+					RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
+				}
+				hash_passes++;
 			}
 			if(validation) {
 				*validation |= ALPM_PKG_VALIDATION_MD5SUM;
@@ -325,9 +337,17 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 
 		if(syncpkg->sha256sum) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "sha256sum: %s\n", syncpkg->sha256sum);
-			_alpm_log(handle, ALPM_LOG_DEBUG, "checking sha256sum for %s\n", pkgfile);
-			if(_alpm_test_checksum(pkgfile, syncpkg->sha256sum, ALPM_PKG_VALIDATION_SHA256SUM) != 0) {
-				RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
+			if(syncpkg->dl_sha256sum) {
+				_alpm_log(handle, ALPM_LOG_DEBUG, "using sha256sum streamed during download\n");
+				if(strcmp(syncpkg->dl_sha256sum, syncpkg->sha256sum) != 0) {
+					RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
+				}
+			} else {
+				_alpm_log(handle, ALPM_LOG_DEBUG, "checking sha256sum for %s\n", pkgfile);
+				if(_alpm_test_checksum(pkgfile, syncpkg->sha256sum, ALPM_PKG_VALIDATION_SHA256SUM) != 0) {
+					RET_ERR(handle, ALPM_ERR_PKG_INVALID_CHECKSUM, -1);
+				}
+				hash_passes++;
 			}
 			if(validation) {
 				*validation |= ALPM_PKG_VALIDATION_SHA256SUM;
@@ -335,6 +355,16 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		}
 	}
 
+	if(hash_passes) {
+		struct stat st;
+		/* this runs on worker threads during validity checking, hence the
+		 * locked helper rather than a direct increment */
+		if(stat(pkgfile, &st) == 0) {
+			_alpm_counter_add(handle, &handle->counters.bytes_hashed,
+					(int64_t)st.st_size * hash_passes);
+		}
+	}
+
 	/* even if we don't have a sig, run the check code if level tells us to */
 	if(level & ALPM_SIG_PACKAGE) {
 		const char *sig = syncpkg ? syncpkg->base64_sig : NULL;
@@ -518,10 +548,14 @@ static int build_filelist_from_mtree(alpm_handle_t *handle, alpm_pkg_t *pkg, str
 	}
 
 	/* throw away any files we loaded directly from the archive */
-	for(i = 0; i < pkg->files.count; i++) {
-		free(pkg->files.files[i].name);
+	if(pkg->files.names == NULL) {
+		for(i = 0; i < pkg->files.count; i++) {
+			free(pkg->files.files[i].name);
+		}
 	}
 	free(pkg->files.files);
+	free(pkg->files.names);
+	free(pkg->files.hashes);
 
 	/* copy over new filelist */
 	memcpy(&pkg->files, &filelist, sizeof(alpm_filelist_t));
@@ -543,30 +577,47 @@ error:
 }
 
 /**
- * Load a package and create the corresponding alpm_pkg_t struct.
+ * Load a package and create the corresponding alpm_pkg_t struct, optionally
+ * computing the md5 and sha256 sums of the package file in the same pass.
+ * Hashing happens on the raw bytes as libarchive reads them, so the digests
+ * come at no extra I/O cost; any part of the file the metadata traversal did
+ * not touch is drained at the end so the sums cover the whole file.
  * @param handle the context handle
  * @param pkgfile path to the package file
  * @param full whether to stop the load after metadata is read or continue
  * through the full archive
+ * @param md5sum output for the md5 hexadecimal digest, or NULL; left NULL
+ * when no crypto backend is available
+ * @param sha256sum output for the sha256 hexadecimal digest; must be
+ * non-NULL exactly when md5sum is
  */
-alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
-		const char *pkgfile, int full)
+alpm_pkg_t *_alpm_pkg_load_digests(alpm_handle_t *handle,
+		const char *pkgfile, int full, char **md5sum, char **sha256sum)
 {
 	int ret, fd;
 	int config = 0;
-	int hit_mtree = 0;
+	int hit_index = 0;
 	struct archive *archive;
 	struct archive_entry *entry;
 	alpm_pkg_t *newpkg;
 	struct stat st;
 	size_t files_size = 0;
+	_alpm_digest_ctx_t *digest = NULL;
 
 	if(pkgfile == NULL || strlen(pkgfile) == 0) {
 		RET_ERR(handle, ALPM_ERR_WRONG_ARGS, NULL);
 	}
 
-	fd = _alpm_open_archive(handle, pkgfile, &st, &archive, ALPM_ERR_PKG_OPEN);
+	if(md5sum) {
+		*md5sum = NULL;
+		*sha256sum = NULL;
+		digest = _alpm_digest_new();
+	}
+
+	fd = _alpm_open_archive_digest(handle, pkgfile, &st, &archive,
+			ALPM_ERR_PKG_OPEN, digest);
 	if(fd < 0) {
+		_alpm_digest_free(digest);
 		if(errno == ENOENT) {
 			handle->pm_errno = ALPM_ERR_PKG_NOT_FOUND;
 		} else if(errno == EACCES) {
@@ -613,15 +664,22 @@ alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 			}
 			config = 1;
 			continue;
-		} else if(full && strcmp(entry_name, ".MTREE") == 0) {
+		} else if(full && strcmp(entry_name, ".FILELIST") == 0) {
+			/* building the file list: cheapest way
+			 * an uncompressed mtree-format index without the per-file
+			 * digests, written by makepkg; it sorts before .MTREE in the
+			 * archive, so the load never touches the checksummed mtree */
+			hit_index = build_filelist_from_mtree(handle, newpkg, archive) == 0;
+			continue;
+		} else if(full && !hit_index && strcmp(entry_name, ".MTREE") == 0) {
 			/* building the file list: cheap way
 			 * get the filelist from the mtree file rather than scanning
 			 * the whole archive  */
-			hit_mtree = build_filelist_from_mtree(handle, newpkg, archive) == 0;
+			hit_index = build_filelist_from_mtree(handle, newpkg, archive) == 0;
 			continue;
 		} else if(handle_simple_path(newpkg, entry_name)) {
 			continue;
-		} else if(full && !hit_mtree) {
+		} else if(full && !hit_index) {
 			/* building the file list: expensive way */
 			if(add_entry_to_files_list(&newpkg->files, &files_size, entry, entry_name) < 0) {
 				goto error;
@@ -635,7 +693,7 @@ alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 		}
 
 		/* if we are not doing a full read, see if we have all we need */
-		if((!full || hit_mtree) && config) {
+		if((!full || hit_index) && config) {
 			break;
 		}
 	}
@@ -651,6 +709,30 @@ alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 		goto pkg_invalid;
 	}
 
+	if(digest) {
+		/* the mtree shortcut stops the traversal early; hash whatever is
+		 * left so the digests cover the complete file */
+		char buf[ALPM_BUFFER_SIZE];
+		ssize_t nread;
+		while((nread = read(fd, buf, sizeof(buf))) > 0
+				|| (nread == -1 && errno == EINTR)) {
+			if(nread > 0) {
+				_alpm_digest_update(digest, buf, nread);
+			}
+		}
+		if(nread == 0) {
+			_alpm_digest_final(digest, md5sum, sha256sum);
+			_alpm_counter_add(handle, &handle->counters.bytes_hashed,
+					st.st_size);
+		} else {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"unable to hash trailing bytes of %s: %s\n",
+					pkgfile, strerror(errno));
+			_alpm_digest_free(digest);
+		}
+		digest = NULL;
+	}
+
 	_alpm_archive_read_free(archive);
 	close(fd);
 
@@ -680,6 +762,7 @@ alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 pkg_invalid:
 	handle->pm_errno = ALPM_ERR_PKG_INVALID;
 error:
+	_alpm_digest_free(digest);
 	_alpm_pkg_free(newpkg);
 	_alpm_archive_read_free(archive);
 	if(fd >= 0) {
@@ -689,6 +772,19 @@ error:
 	return NULL;
 }
 
+/**
+ * Load a package and create the corresponding alpm_pkg_t struct.
+ * @param handle the context handle
+ * @param pkgfile path to the package file
+ * @param full whether to stop the load after metadata is read or continue
+ * through the full archive
+ */
+alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
+		const char *pkgfile, int full)
+{
+	return _alpm_pkg_load_digests(handle, pkgfile, full, NULL, NULL);
+}
+
 /* adopted limit from repo-add */
 #define MAX_SIGFILE_SIZE 16384
 
@@ -718,17 +814,17 @@ static int read_sigfile(const char *sigpath, unsigned char **sig)
 	return st.st_size;
 }
 
-int SYMEXPORT alpm_pkg_load(alpm_handle_t *handle, const char *filename, int full,
-		int level, alpm_pkg_t **pkg)
+/* make sure the keys a package's detached signature was made with are
+ * in the keyring, importing them if the user agrees; split out of
+ * alpm_pkg_load() so batch loading can run it serially up front - key
+ * import may question the user and must stay off worker threads */
+static int load_pkg_keys(alpm_handle_t *handle, const char *filename,
+		int full, int level)
 {
-	int validation = 0;
 	char *sigpath;
 	alpm_pkg_t *pkg_temp;
 	char *packager;
 
-	CHECK_HANDLE(handle, return -1);
-	ASSERT(pkg != NULL, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
-
 	sigpath = _alpm_sigpath(handle, filename);
 	if(sigpath && !_alpm_access(handle, NULL, sigpath, R_OK)) {
 		if(level & ALPM_SIG_PACKAGE) {
@@ -776,6 +872,21 @@ int SYMEXPORT alpm_pkg_load(alpm_handle_t *handle, const char *filename, int ful
 	}
 	free(sigpath);
 
+	return 0;
+}
+
+int SYMEXPORT alpm_pkg_load(alpm_handle_t *handle, const char *filename, int full,
+		int level, alpm_pkg_t **pkg)
+{
+	int validation = 0;
+
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(pkg != NULL, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+
+	if(load_pkg_keys(handle, filename, full, level) != 0) {
+		return -1;
+	}
+
 	if(_alpm_pkg_validate_internal(handle, filename, NULL, level, NULL,
 				&validation) == -1) {
 		/* pm_errno is set by pkg_validate */
@@ -790,3 +901,83 @@ int SYMEXPORT alpm_pkg_load(alpm_handle_t *handle, const char *filename, int ful
 
 	return 0;
 }
+
+struct pkg_load_job {
+	alpm_handle_t *handle;
+	const char *filename;
+	int full;
+	int level;
+	alpm_pkg_t *pkg;
+	int ret;
+	alpm_errno_t err;
+};
+
+static void pkg_load_worker(void *ctx, size_t index)
+{
+	struct pkg_load_job *job = (struct pkg_load_job *)ctx + index;
+	int validation = 0;
+
+	/* the caller defers logging around this phase; validate/load may
+	 * scribble on pm_errno, which the caller rewrites after the join */
+	if(_alpm_pkg_validate_internal(job->handle, job->filename, NULL,
+				job->level, NULL, &validation) == -1 ||
+			(job->pkg = _alpm_pkg_load_internal(job->handle,
+				job->filename, job->full)) == NULL) {
+		job->ret = -1;
+		job->err = job->handle->pm_errno;
+		return;
+	}
+	job->pkg->validation = validation;
+}
+
+int SYMEXPORT alpm_pkg_load_many(alpm_handle_t *handle, size_t count,
+		const char * const *filenames, int full, const int *levels,
+		alpm_pkg_t **pkgs)
+{
+	struct pkg_load_job *jobs;
+	size_t n, nthreads;
+	int ret = 0;
+
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(filenames != NULL && levels != NULL && pkgs != NULL,
+			RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+
+	if(count == 0) {
+		return 0;
+	}
+
+	/* missing keys are imported serially first; the import question must
+	 * come from this thread */
+	for(n = 0; n < count; n++) {
+		pkgs[n] = NULL;
+		if(load_pkg_keys(handle, filenames[n], full, levels[n]) != 0) {
+			return -1;
+		}
+	}
+
+	CALLOC(jobs, count, sizeof(struct pkg_load_job),
+			RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	for(n = 0; n < count; n++) {
+		jobs[n].handle = handle;
+		jobs[n].filename = filenames[n];
+		jobs[n].full = full;
+		jobs[n].level = levels[n];
+	}
+
+	nthreads = _alpm_parallel_nthreads(handle, count);
+	_alpm_log_defer_begin(handle);
+	_alpm_parallel_for(nthreads, count, pkg_load_worker, jobs);
+	_alpm_log_defer_end(handle);
+
+	handle->pm_errno = ALPM_ERR_OK;
+	for(n = 0; n < count; n++) {
+		pkgs[n] = jobs[n].pkg;
+		if(jobs[n].ret == -1 && ret == 0) {
+			handle->pm_errno = jobs[n].err;
+			ret = -1;
+		}
+	}
+
+	free(jobs);
+	return ret;
+}
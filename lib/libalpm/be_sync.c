@@ -19,8 +19,11 @@
  */
 
 #include <errno.h>
+#include <stdint.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <unistd.h>
@@ -136,6 +139,286 @@ valid:
 	return 0;
 }
 
+/* Differential database refresh.
+ *
+ * A mirror may publish a binary delta alongside each database that upgrades
+ * an older revision to the current one, named "<treename><dbext>.delta-<id>"
+ * where <id> is the first 16 hex digits of the SHA-256 of the old revision.
+ * Replaying the delta produces a byte-identical copy of the new database
+ * file, so detached database signatures keep verifying. All integers are
+ * little-endian:
+ *
+ *   char magic[8]      "ALPMDDLT"
+ *   u32  version       currently 1
+ *   u64  old_size      size of the database the delta applies to
+ *   u64  new_size      size of the reconstructed database
+ *   u8   old_sha256[32]
+ *   u8   new_sha256[32]
+ *
+ * followed by an op stream replayed until new_size bytes are produced:
+ *
+ *   u8 0, u64 offset, u64 length    copy bytes from the old database
+ *   u8 1, u64 length, <bytes>       insert literal bytes
+ *
+ * Any parse error or digest mismatch makes the caller fall back to a full
+ * database download, so a bad delta can never leave a corrupt database. */
+
+#define DBDELTA_MAGIC "ALPMDDLT"
+#define DBDELTA_MAGIC_LEN 8
+#define DBDELTA_VERSION 1
+#define DBDELTA_HDR_LEN 92
+#define DBDELTA_ID_LEN 16
+
+static uint32_t dbdelta_read32(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+		((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static uint64_t dbdelta_read64(const unsigned char *buf)
+{
+	return (uint64_t)dbdelta_read32(buf) |
+		((uint64_t)dbdelta_read32(buf + 4) << 32);
+}
+
+static void dbdelta_hexify(const unsigned char *bytes, size_t len, char *out)
+{
+	const char *hex_digits = "0123456789abcdef";
+	size_t i;
+	for(i = 0; i < len; i++) {
+		out[2 * i] = hex_digits[bytes[i] >> 4];
+		out[2 * i + 1] = hex_digits[bytes[i] & 0x0f];
+	}
+	out[2 * len] = '\0';
+}
+
+/** Replay a downloaded delta on top of the current database file.
+ * @param handle the context handle
+ * @param dbpath full path to the current database file
+ * @param deltapath full path to the downloaded delta file
+ * @param old_sha256 hex SHA-256 of the current database file
+ * @return 0 if dbpath now holds the verified new revision, -1 otherwise
+ */
+static int sync_db_delta_apply(alpm_handle_t *handle, const char *dbpath,
+		const char *deltapath, const char *old_sha256)
+{
+	FILE *dfp = NULL, *ofp = NULL, *nfp = NULL;
+	char *olddata = NULL, *newpath = NULL;
+	char *new_md5 = NULL, *new_sha = NULL;
+	_alpm_digest_ctx_t *digest = NULL;
+	unsigned char header[DBDELTA_HDR_LEN], opbuf[16], iobuf[8192];
+	char hexbuf[65];
+	uint64_t old_size, new_size, produced = 0;
+	struct stat st;
+	size_t len;
+	int op, ret = -1;
+
+	if((dfp = fopen(deltapath, "rb")) == NULL) {
+		return -1;
+	}
+	if(fread(header, 1, sizeof(header), dfp) != sizeof(header) ||
+			memcmp(header, DBDELTA_MAGIC, DBDELTA_MAGIC_LEN) != 0 ||
+			dbdelta_read32(header + 8) != DBDELTA_VERSION) {
+		_alpm_log(handle, ALPM_LOG_DEBUG, "invalid delta header in %s\n", deltapath);
+		goto cleanup;
+	}
+	old_size = dbdelta_read64(header + 12);
+	new_size = dbdelta_read64(header + 20);
+	dbdelta_hexify(header + 28, 32, hexbuf);
+	if(strcmp(hexbuf, old_sha256) != 0) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"delta %s does not apply to the local database\n", deltapath);
+		goto cleanup;
+	}
+	if(stat(dbpath, &st) != 0 || (uint64_t)st.st_size != old_size) {
+		goto cleanup;
+	}
+
+	/* without a crypto backend the reconstruction cannot be verified */
+	if((digest = _alpm_digest_new()) == NULL) {
+		goto cleanup;
+	}
+
+	MALLOC(olddata, old_size ? old_size : 1, goto cleanup);
+	if((ofp = fopen(dbpath, "rb")) == NULL ||
+			fread(olddata, 1, old_size, ofp) != old_size) {
+		goto cleanup;
+	}
+	fclose(ofp);
+	ofp = NULL;
+
+	len = strlen(dbpath) + 5;
+	MALLOC(newpath, len, goto cleanup);
+	snprintf(newpath, len, "%s.new", dbpath);
+	if((nfp = fopen(newpath, "wb")) == NULL) {
+		goto cleanup;
+	}
+
+	while(produced < new_size && (op = fgetc(dfp)) != EOF) {
+		if(op == 0) {
+			/* copy from the old database */
+			uint64_t offset, count;
+			if(fread(opbuf, 1, 16, dfp) != 16) {
+				goto cleanup;
+			}
+			offset = dbdelta_read64(opbuf);
+			count = dbdelta_read64(opbuf + 8);
+			if(offset + count < offset || offset + count > old_size ||
+					produced + count > new_size) {
+				goto cleanup;
+			}
+			if(fwrite(olddata + offset, 1, count, nfp) != count) {
+				goto cleanup;
+			}
+			_alpm_digest_update(digest, olddata + offset, count);
+			produced += count;
+		} else if(op == 1) {
+			/* literal insertion */
+			uint64_t count;
+			if(fread(opbuf, 1, 8, dfp) != 8) {
+				goto cleanup;
+			}
+			count = dbdelta_read64(opbuf);
+			if(produced + count > new_size) {
+				goto cleanup;
+			}
+			while(count > 0) {
+				size_t chunk = count > sizeof(iobuf) ? sizeof(iobuf) : (size_t)count;
+				if(fread(iobuf, 1, chunk, dfp) != chunk ||
+						fwrite(iobuf, 1, chunk, nfp) != chunk) {
+					goto cleanup;
+				}
+				_alpm_digest_update(digest, iobuf, chunk);
+				produced += chunk;
+				count -= chunk;
+			}
+		} else {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"unknown op %d in delta %s\n", op, deltapath);
+			goto cleanup;
+		}
+	}
+
+	/* the op stream must account for exactly new_size bytes, no trailers */
+	if(produced != new_size || fgetc(dfp) != EOF) {
+		goto cleanup;
+	}
+	if(fflush(nfp) != 0) {
+		goto cleanup;
+	}
+	fclose(nfp);
+	nfp = NULL;
+
+	if(_alpm_digest_final(digest, &new_md5, &new_sha) != 0) {
+		digest = NULL;
+		goto cleanup;
+	}
+	digest = NULL;
+	dbdelta_hexify(header + 60, 32, hexbuf);
+	if(strcmp(new_sha, hexbuf) != 0) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"delta %s produced a corrupt database\n", deltapath);
+		goto cleanup;
+	}
+
+	/* carry the delta's remote timestamp over so the next refresh can still
+	 * use an if-modified-since request against the full database */
+	if(stat(deltapath, &st) == 0) {
+		struct timeval tv[2] = {
+			{ .tv_sec = st.st_mtime },
+			{ .tv_sec = st.st_mtime },
+		};
+		utimes(newpath, tv);
+	}
+	if(rename(newpath, dbpath) != 0) {
+		goto cleanup;
+	}
+	ret = 0;
+
+cleanup:
+	fclose(dfp);
+	if(ofp) {
+		fclose(ofp);
+	}
+	if(nfp) {
+		fclose(nfp);
+	}
+	if(ret != 0 && newpath) {
+		unlink(newpath);
+	}
+	_alpm_digest_free(digest);
+	free(olddata);
+	free(newpath);
+	free(new_md5);
+	free(new_sha);
+	return ret;
+}
+
+/** Try to refresh a database by downloading and applying a delta.
+ * @param handle the context handle
+ * @param db the sync database to refresh
+ * @param syncpath the sync database directory
+ * @return 0 if the local database was brought up to date, -1 if the caller
+ * should download the full database instead
+ */
+static int sync_db_delta_try(alpm_handle_t *handle, alpm_db_t *db,
+		const char *syncpath)
+{
+	char *dbpath = NULL, *deltapath = NULL, *sha256 = NULL;
+	struct dload_payload payload = {0};
+	alpm_list_t *payload_list = NULL;
+	size_t len;
+	int ret = -1;
+
+	len = strlen(syncpath) + strlen(db->treename) + strlen(handle->dbext) + 1;
+	MALLOC(dbpath, len, return -1);
+	snprintf(dbpath, len, "%s%s%s", syncpath, db->treename, handle->dbext);
+
+	/* a delta only makes sense against an existing database */
+	if(access(dbpath, R_OK) != 0 ||
+			(sha256 = alpm_compute_sha256sum(dbpath)) == NULL) {
+		goto cleanup;
+	}
+
+	len = strlen(db->treename) + strlen(handle->dbext) + 7 + DBDELTA_ID_LEN + 1;
+	MALLOC(payload.filepath, len, goto cleanup);
+	snprintf(payload.filepath, len, "%s%s.delta-%.*s", db->treename,
+			handle->dbext, DBDELTA_ID_LEN, sha256);
+
+	payload.handle = handle;
+	payload.servers = db->servers;
+	/* mirrors without deltas simply 404; that is not an error */
+	payload.errors_ok = 1;
+	payload.unlink_on_fail = 1;
+	/* set hard upper limit of 128 MiB */
+	payload.max_size = 128 * 1024 * 1024;
+
+	len = strlen(syncpath) + strlen(payload.filepath) + 1;
+	MALLOC(deltapath, len, goto cleanup);
+	snprintf(deltapath, len, "%s%s", syncpath, payload.filepath);
+
+	payload_list = alpm_list_add(NULL, &payload);
+	if(_alpm_multi_download(handle, payload_list, syncpath) != 0 ||
+			access(deltapath, R_OK) != 0) {
+		goto cleanup;
+	}
+
+	if(sync_db_delta_apply(handle, dbpath, deltapath, sha256) == 0) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"applied database delta for %s\n", db->treename);
+		ret = 0;
+	}
+	unlink(deltapath);
+
+cleanup:
+	alpm_list_free(payload_list);
+	_alpm_dload_payload_reset(&payload);
+	free(dbpath);
+	free(deltapath);
+	free(sha256);
+	return ret;
+}
+
 int SYMEXPORT alpm_db_update(alpm_handle_t *handle, alpm_list_t *dbs, int force) {
 	char *syncpath;
 	const char *dbext = handle->dbext;
@@ -148,6 +431,7 @@ int SYMEXPORT alpm_db_update(alpm_handle_t *handle, alpm_list_t *dbs, int force)
 	/* Sanity checks */
 	CHECK_HANDLE(handle, return -1);
 	ASSERT(dbs != NULL, return -1);
+	ASSERT(!handle->readonly, RET_ERR(handle, ALPM_ERR_HANDLE_READONLY, -1));
 	handle->pm_errno = ALPM_ERR_OK;
 
 	syncpath = get_sync_dir(handle);
@@ -161,6 +445,9 @@ int SYMEXPORT alpm_db_update(alpm_handle_t *handle, alpm_list_t *dbs, int force)
 		GOTO_ERR(handle, ALPM_ERR_HANDLE_LOCK, cleanup);
 	}
 
+	event.type = ALPM_EVENT_DB_RETRIEVE_START;
+	EVENT(handle, &event);
+
 	for(i = dbs; i; i = i->next) {
 		alpm_db_t *db = i->data;
 		int dbforce = force;
@@ -180,22 +467,28 @@ int SYMEXPORT alpm_db_update(alpm_handle_t *handle, alpm_list_t *dbs, int force)
 			dbforce = 1;
 		}
 
-		CALLOC(payload, 1, sizeof(*payload), GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
-
-		/* set hard upper limit of 128 MiB */
-		payload->max_size = 128 * 1024 * 1024;
-		payload->servers = db->servers;
-
-		/* print server + filename into a buffer */
-		len = strlen(db->treename) + strlen(dbext) + 1;
-		MALLOC(payload->filepath, len,
-			FREE(payload); GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
-		snprintf(payload->filepath, len, "%s%s", db->treename, dbext);
-		payload->handle = handle;
-		payload->force = dbforce;
-		payload->unlink_on_fail = 1;
-
-		payloads = alpm_list_add(payloads, payload);
+		if(!dbforce && handle->db_deltas &&
+				sync_db_delta_try(handle, db, syncpath) == 0) {
+			/* the local database already matches the server; only the
+			 * (re-dated) signature still needs to be fetched below */
+		} else {
+			CALLOC(payload, 1, sizeof(*payload), GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+
+			/* set hard upper limit of 128 MiB */
+			payload->max_size = 128 * 1024 * 1024;
+			payload->servers = db->servers;
+
+			/* print server + filename into a buffer */
+			len = strlen(db->treename) + strlen(dbext) + 1;
+			MALLOC(payload->filepath, len,
+				FREE(payload); GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+			snprintf(payload->filepath, len, "%s%s", db->treename, dbext);
+			payload->handle = handle;
+			payload->force = dbforce;
+			payload->unlink_on_fail = 1;
+
+			payloads = alpm_list_add(payloads, payload);
+		}
 
 		siglevel = alpm_db_get_siglevel(db);
 		if(siglevel & ALPM_SIG_DATABASE) {
@@ -219,10 +512,56 @@ int SYMEXPORT alpm_db_update(alpm_handle_t *handle, alpm_list_t *dbs, int force)
 
 			payloads = alpm_list_add(payloads, sig_payload);
 		}
+
+		/* if a files database has been fetched before, refresh it in the
+		 * same concurrent batch instead of leaving it for a separate -Fy
+		 * pass; failures here are not fatal since the regular database is
+		 * what this refresh was asked for */
+		if(strcmp(dbext, ".files") != 0) {
+			char *filespath;
+			len = strlen(syncpath) + strlen(db->treename) + 7;
+			MALLOC(filespath, len, GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+			snprintf(filespath, len, "%s%s.files", syncpath, db->treename);
+
+			if(access(filespath, R_OK) == 0) {
+				CALLOC(payload, 1, sizeof(*payload),
+					free(filespath); GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+				payload->max_size = 128 * 1024 * 1024;
+				payload->servers = db->servers;
+				len = strlen(db->treename) + 7;
+				MALLOC(payload->filepath, len,
+					FREE(payload); free(filespath);
+					GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+				snprintf(payload->filepath, len, "%s.files", db->treename);
+				payload->handle = handle;
+				payload->force = dbforce;
+				payload->errors_ok = 1;
+				payload->unlink_on_fail = 1;
+				payloads = alpm_list_add(payloads, payload);
+
+				if(siglevel & ALPM_SIG_DATABASE) {
+					struct dload_payload *sig_payload;
+					CALLOC(sig_payload, 1, sizeof(*sig_payload),
+						free(filespath); GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+					sig_payload->signature = 1;
+					len = strlen(db->treename) + 11;
+					MALLOC(sig_payload->filepath, len,
+						FREE(sig_payload); free(filespath);
+						GOTO_ERR(handle, ALPM_ERR_MEMORY, cleanup));
+					snprintf(sig_payload->filepath, len, "%s.files.sig",
+							db->treename);
+					sig_payload->handle = handle;
+					sig_payload->force = dbforce;
+					sig_payload->errors_ok = 1;
+					sig_payload->max_size = 16 * 1024;
+					sig_payload->servers = db->servers;
+					payloads = alpm_list_add(payloads, sig_payload);
+				}
+			}
+			free(filespath);
+		}
 	}
 
-	event.type = ALPM_EVENT_DB_RETRIEVE_START;
-	EVENT(handle, &event);
 	ret = _alpm_multi_download(handle, payloads, syncpath);
 	if(ret < 0) {
 		event.type = ALPM_EVENT_DB_RETRIEVE_FAILED;
@@ -276,9 +615,11 @@ cleanup:
 	return ret;
 }
 
-/* Forward decl so I don't reorganize the whole file right now */
+/* Forward decls so I don't reorganize the whole file right now */
 static int sync_db_read(alpm_db_t *db, struct archive *archive,
 		struct archive_entry *entry, alpm_pkg_t **likely_pkg);
+static alpm_filelist_t *_sync_get_files(alpm_pkg_t *pkg);
+static int _sync_force_load(alpm_pkg_t *pkg);
 
 static int _sync_get_validation(alpm_pkg_t *pkg)
 {
@@ -343,8 +684,12 @@ static alpm_pkg_t *load_pkg_for_entry(alpm_db_t *db, const char *entryname,
 
 		pkg->origin = ALPM_PKG_FROM_SYNCDB;
 		pkg->origin_data.db = db;
+		/* dependency lists are interned in the db's dep pool on parse */
+		pkg->deps_pooled = (db->deppool != NULL);
 		pkg->ops = &default_pkg_ops;
 		pkg->ops->get_validation = _sync_get_validation;
+		pkg->ops->get_files = _sync_get_files;
+		pkg->ops->force_load = _sync_force_load;
 		pkg->handle = db->handle;
 
 		/* add to the collection */
@@ -398,6 +743,663 @@ static size_t estimate_package_count(struct stat *st, struct archive *archive)
 	return (size_t)((st->st_size / per_package) + 1);
 }
 
+/* Sidecar binary index for sync databases.
+ *
+ * Decompressing and parsing the database archive dominates cold-start time,
+ * so after a successful populate the parsed metadata is serialized to
+ * "<treename><dbext>.cache" next to the database. Subsequent populates mmap
+ * the sidecar and rebuild the package cache without touching libarchive. The
+ * sidecar records the size and mtime of the database it was generated from
+ * and is discarded on any mismatch or truncation, falling back to a regular
+ * archive parse. Strings are copied out of the mapping so package ownership
+ * and free paths are unchanged.
+ *
+ * Filelists (the bulk of a .files database) are not deserialized during
+ * populate: each package record carries a length-prefixed filelist blob,
+ * and only its byte span is remembered so a single-package file query can
+ * pread() exactly that span out of the sidecar on demand. */
+
+#define SYNCIDX_MAGIC "ALPMSIDX"
+#define SYNCIDX_VERSION 2
+#define SYNCIDX_ENDIAN 0x04030201u
+
+struct syncidx_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t pkgcount;
+	uint32_t reserved;
+	int64_t db_size;
+	int64_t db_mtime;
+};
+
+struct syncidx_cursor {
+	const unsigned char *pos;
+	size_t remain;
+	/* start of the mapping, for offset bookkeeping; NULL when parsing a
+	 * standalone filelist blob */
+	const unsigned char *base;
+};
+
+static char *syncidx_path(alpm_db_t *db, const char *dbpath)
+{
+	char *idxpath;
+	size_t len = strlen(dbpath) + 7;
+	MALLOC(idxpath, len, RET_ERR(db->handle, ALPM_ERR_MEMORY, NULL));
+	snprintf(idxpath, len, "%s.cache", dbpath);
+	return idxpath;
+}
+
+static int syncidx_read(struct syncidx_cursor *cursor, void *dest, size_t len)
+{
+	if(len > cursor->remain) {
+		return -1;
+	}
+	memcpy(dest, cursor->pos, len);
+	cursor->pos += len;
+	cursor->remain -= len;
+	return 0;
+}
+
+static int syncidx_read_u32(struct syncidx_cursor *cursor, uint32_t *val)
+{
+	return syncidx_read(cursor, val, sizeof(*val));
+}
+
+static int syncidx_read_i64(struct syncidx_cursor *cursor, int64_t *val)
+{
+	return syncidx_read(cursor, val, sizeof(*val));
+}
+
+/* a length of UINT32_MAX denotes a NULL string */
+static int syncidx_read_str(struct syncidx_cursor *cursor, char **dest)
+{
+	uint32_t len;
+	*dest = NULL;
+	if(syncidx_read_u32(cursor, &len) != 0) {
+		return -1;
+	}
+	if(len == UINT32_MAX) {
+		return 0;
+	}
+	if(len > cursor->remain) {
+		return -1;
+	}
+	STRNDUP(*dest, (const char *)cursor->pos, len, return -1);
+	cursor->pos += len;
+	cursor->remain -= len;
+	return 0;
+}
+
+static int syncidx_read_strlist(struct syncidx_cursor *cursor, alpm_list_t **dest)
+{
+	uint32_t count;
+	if(syncidx_read_u32(cursor, &count) != 0) {
+		return -1;
+	}
+	while(count--) {
+		char *str;
+		if(syncidx_read_str(cursor, &str) != 0 || str == NULL) {
+			free(str);
+			return -1;
+		}
+		*dest = alpm_list_add(*dest, str);
+	}
+	return 0;
+}
+
+static int syncidx_read_deplist(struct syncidx_cursor *cursor,
+		_alpm_deppool_t *pool, alpm_list_t **dest)
+{
+	uint32_t count;
+	if(syncidx_read_u32(cursor, &count) != 0) {
+		return -1;
+	}
+	while(count--) {
+		char *depstring;
+		alpm_depend_t *dep;
+		if(syncidx_read_str(cursor, &depstring) != 0 || depstring == NULL) {
+			free(depstring);
+			return -1;
+		}
+		dep = _alpm_deppool_intern(pool, depstring);
+		free(depstring);
+		if(dep == NULL) {
+			return -1;
+		}
+		*dest = alpm_list_add(*dest, dep);
+	}
+	return 0;
+}
+
+/* Parse a filelist blob (count followed by that many strings) into pkg. */
+static int syncidx_parse_files(struct syncidx_cursor *cursor, alpm_pkg_t *pkg)
+{
+	uint32_t files_count;
+
+	if(syncidx_read_u32(cursor, &files_count) != 0) {
+		return -1;
+	}
+	if(files_count > 0) {
+		size_t f;
+		alpm_file_t *files;
+		CALLOC(files, files_count, sizeof(alpm_file_t), return -1);
+		pkg->files.files = files;
+		for(f = 0; f < files_count; f++) {
+			if(syncidx_read_str(cursor, &files[f].name) != 0
+					|| files[f].name == NULL) {
+				return -1;
+			}
+			pkg->files.count++;
+		}
+	}
+	return 0;
+}
+
+static int syncidx_read_pkg(struct syncidx_cursor *cursor,
+		_alpm_deppool_t *pool, alpm_pkg_t *pkg)
+{
+	uint32_t files_len;
+	int64_t val;
+
+	if(syncidx_read_str(cursor, &pkg->name) != 0
+			|| syncidx_read_str(cursor, &pkg->version) != 0
+			|| syncidx_read_str(cursor, &pkg->filename) != 0
+			|| syncidx_read_str(cursor, &pkg->base) != 0
+			|| syncidx_read_str(cursor, &pkg->desc) != 0
+			|| syncidx_read_str(cursor, &pkg->url) != 0
+			|| syncidx_read_str(cursor, &pkg->packager) != 0
+			|| syncidx_read_str(cursor, &pkg->md5sum) != 0
+			|| syncidx_read_str(cursor, &pkg->sha256sum) != 0
+			|| syncidx_read_str(cursor, &pkg->base64_sig) != 0
+			|| syncidx_read_str(cursor, &pkg->arch) != 0) {
+		return -1;
+	}
+	if(pkg->name == NULL || pkg->version == NULL) {
+		return -1;
+	}
+
+	if(syncidx_read_i64(cursor, &val) != 0) {
+		return -1;
+	}
+	pkg->builddate = (alpm_time_t)val;
+	if(syncidx_read_i64(cursor, &val) != 0) {
+		return -1;
+	}
+	pkg->size = (off_t)val;
+	if(syncidx_read_i64(cursor, &val) != 0) {
+		return -1;
+	}
+	pkg->isize = (off_t)val;
+
+	pkg->deps_pooled = (pool != NULL);
+	if(syncidx_read_strlist(cursor, &pkg->licenses) != 0
+			|| syncidx_read_strlist(cursor, &pkg->groups) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->replaces) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->depends) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->optdepends) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->checkdepends) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->makedepends) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->conflicts) != 0
+			|| syncidx_read_deplist(cursor, pool, &pkg->provides) != 0) {
+		return -1;
+	}
+
+	/* don't deserialize the filelist blob here; remember its span so a
+	 * single-package file query can read just that slice back later */
+	if(syncidx_read_u32(cursor, &files_len) != 0
+			|| files_len > cursor->remain) {
+		return -1;
+	}
+	pkg->syncidx_files_off = (int64_t)(cursor->pos - cursor->base);
+	pkg->syncidx_files_len = files_len;
+	cursor->pos += files_len;
+	cursor->remain -= files_len;
+
+	return 0;
+}
+
+static int syncidx_write(FILE *fp, const void *src, size_t len)
+{
+	return fwrite(src, len, 1, fp) == 1 ? 0 : -1;
+}
+
+static int syncidx_write_u32(FILE *fp, uint32_t val)
+{
+	return syncidx_write(fp, &val, sizeof(val));
+}
+
+static int syncidx_write_i64(FILE *fp, int64_t val)
+{
+	return syncidx_write(fp, &val, sizeof(val));
+}
+
+static int syncidx_write_str(FILE *fp, const char *str)
+{
+	uint32_t len;
+	if(str == NULL) {
+		return syncidx_write_u32(fp, UINT32_MAX);
+	}
+	len = (uint32_t)strlen(str);
+	if(syncidx_write_u32(fp, len) != 0) {
+		return -1;
+	}
+	return len ? syncidx_write(fp, str, len) : 0;
+}
+
+static int syncidx_write_strlist(FILE *fp, alpm_list_t *list)
+{
+	alpm_list_t *i;
+	if(syncidx_write_u32(fp, (uint32_t)alpm_list_count(list)) != 0) {
+		return -1;
+	}
+	for(i = list; i; i = i->next) {
+		if(syncidx_write_str(fp, i->data) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int syncidx_write_deplist(FILE *fp, alpm_list_t *list)
+{
+	alpm_list_t *i;
+	if(syncidx_write_u32(fp, (uint32_t)alpm_list_count(list)) != 0) {
+		return -1;
+	}
+	for(i = list; i; i = i->next) {
+		char *depstring = alpm_dep_compute_string(i->data);
+		int ret;
+		if(depstring == NULL) {
+			return -1;
+		}
+		ret = syncidx_write_str(fp, depstring);
+		free(depstring);
+		if(ret != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int syncidx_write_pkg(FILE *fp, alpm_pkg_t *pkg)
+{
+	size_t f, files_len;
+
+	if(syncidx_write_str(fp, pkg->name) != 0
+			|| syncidx_write_str(fp, pkg->version) != 0
+			|| syncidx_write_str(fp, pkg->filename) != 0
+			|| syncidx_write_str(fp, pkg->base) != 0
+			|| syncidx_write_str(fp, pkg->desc) != 0
+			|| syncidx_write_str(fp, pkg->url) != 0
+			|| syncidx_write_str(fp, pkg->packager) != 0
+			|| syncidx_write_str(fp, pkg->md5sum) != 0
+			|| syncidx_write_str(fp, pkg->sha256sum) != 0
+			|| syncidx_write_str(fp, pkg->base64_sig) != 0
+			|| syncidx_write_str(fp, pkg->arch) != 0) {
+		return -1;
+	}
+
+	if(syncidx_write_i64(fp, (int64_t)pkg->builddate) != 0
+			|| syncidx_write_i64(fp, (int64_t)pkg->size) != 0
+			|| syncidx_write_i64(fp, (int64_t)pkg->isize) != 0) {
+		return -1;
+	}
+
+	if(syncidx_write_strlist(fp, pkg->licenses) != 0
+			|| syncidx_write_strlist(fp, pkg->groups) != 0
+			|| syncidx_write_deplist(fp, pkg->replaces) != 0
+			|| syncidx_write_deplist(fp, pkg->depends) != 0
+			|| syncidx_write_deplist(fp, pkg->optdepends) != 0
+			|| syncidx_write_deplist(fp, pkg->checkdepends) != 0
+			|| syncidx_write_deplist(fp, pkg->makedepends) != 0
+			|| syncidx_write_deplist(fp, pkg->conflicts) != 0
+			|| syncidx_write_deplist(fp, pkg->provides) != 0) {
+		return -1;
+	}
+
+	/* the filelist blob is length-prefixed so readers can skip it and
+	 * fetch it on demand later */
+	files_len = sizeof(uint32_t);
+	for(f = 0; f < pkg->files.count; f++) {
+		files_len += sizeof(uint32_t) + strlen(pkg->files.files[f].name);
+	}
+	if(syncidx_write_u32(fp, (uint32_t)files_len) != 0
+			|| syncidx_write_u32(fp, (uint32_t)pkg->files.count) != 0) {
+		return -1;
+	}
+	for(f = 0; f < pkg->files.count; f++) {
+		if(syncidx_write_str(fp, pkg->files.files[f].name) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Serialize the populated package cache; failure only costs us the fast path
+ * on the next invocation, so errors are logged and swallowed. */
+static void syncidx_save(alpm_db_t *db, const char *dbpath,
+		const struct stat *dbstat)
+{
+	char *idxpath, *tmppath = NULL;
+	FILE *fp = NULL;
+	alpm_list_t *i;
+	struct syncidx_header hdr;
+	size_t len;
+
+	idxpath = syncidx_path(db, dbpath);
+	if(idxpath == NULL) {
+		return;
+	}
+	len = strlen(idxpath) + 5;
+	MALLOC(tmppath, len, goto cleanup);
+	snprintf(tmppath, len, "%s.tmp", idxpath);
+
+	fp = fopen(tmppath, "wb");
+	if(fp == NULL) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not create sync db index %s (%s)\n", tmppath, strerror(errno));
+		goto cleanup;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SYNCIDX_MAGIC, sizeof(hdr.magic));
+	hdr.version = SYNCIDX_VERSION;
+	hdr.endian = SYNCIDX_ENDIAN;
+	hdr.pkgcount = (uint32_t)alpm_list_count(db->pkgcache->list);
+	hdr.db_size = (int64_t)dbstat->st_size;
+	hdr.db_mtime = (int64_t)dbstat->st_mtime;
+
+	if(syncidx_write(fp, &hdr, sizeof(hdr)) != 0) {
+		goto write_error;
+	}
+	for(i = db->pkgcache->list; i; i = i->next) {
+		if(syncidx_write_pkg(fp, i->data) != 0) {
+			goto write_error;
+		}
+	}
+	if(fclose(fp) != 0) {
+		fp = NULL;
+		goto write_error;
+	}
+	fp = NULL;
+
+	if(rename(tmppath, idxpath) != 0) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"could not rename sync db index %s (%s)\n", idxpath, strerror(errno));
+		unlink(tmppath);
+	} else {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"wrote sync db index for db '%s'\n", db->treename);
+	}
+	goto cleanup;
+
+write_error:
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"could not write sync db index %s (%s)\n", tmppath, strerror(errno));
+	if(fp) {
+		fclose(fp);
+	}
+	unlink(tmppath);
+
+cleanup:
+	free(tmppath);
+	free(idxpath);
+}
+
+/* Last-resort filelist load straight from the database archive, used when
+ * the sidecar index disappeared or changed under us mid-run. */
+static int sync_db_files_fallback(alpm_pkg_t *pkg)
+{
+	alpm_db_t *db = pkg->origin_data.db;
+	alpm_handle_t *handle = db->handle;
+	const char *dbpath;
+	int fd, ret = -1;
+	struct stat buf;
+	struct archive *archive;
+	struct archive_entry *entry;
+	char *wanted = NULL;
+	size_t len;
+
+	dbpath = _alpm_db_path(db);
+	if(dbpath == NULL) {
+		return -1;
+	}
+	fd = _alpm_open_archive(handle, dbpath, &buf, &archive, ALPM_ERR_DB_OPEN);
+	if(fd < 0) {
+		return -1;
+	}
+
+	len = strlen(pkg->name) + strlen(pkg->version) + 8;
+	MALLOC(wanted, len, goto cleanup);
+	snprintf(wanted, len, "%s-%s/files", pkg->name, pkg->version);
+
+	while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+		const char *entryname = archive_entry_pathname(entry);
+		struct archive_read_buffer abuf = {0};
+
+		if(entryname == NULL || strcmp(entryname, wanted) != 0) {
+			continue;
+		}
+
+		abuf.max_line_size = 512 * 1024;
+		while(_alpm_archive_fgets(archive, &abuf) == ARCHIVE_OK) {
+			char *line = abuf.line;
+			size_t linelen = _alpm_strip_newline(line, abuf.real_line_size);
+			size_t files_size = 0, names_size = 0, names_len = 0;
+
+			if(linelen == 0 || strcmp(line, "%FILES%") != 0) {
+				continue;
+			}
+			while(_alpm_archive_fgets(archive, &abuf) == ARCHIVE_OK) {
+				line = abuf.line;
+				linelen = _alpm_strip_newline(line, abuf.real_line_size);
+				if(linelen == 0) {
+					break;
+				}
+				if(_alpm_filelist_append(&pkg->files, line, linelen,
+							&files_size, &names_size, &names_len) != 0) {
+					FREE(pkg->files.files);
+					FREE(pkg->files.names);
+					pkg->files.count = 0;
+					goto cleanup;
+				}
+			}
+			_alpm_filelist_finish(&pkg->files, names_len);
+			ret = 0;
+			break;
+		}
+		break;
+	}
+
+cleanup:
+	free(wanted);
+	_alpm_archive_read_free(archive);
+	close(fd);
+	return ret;
+}
+
+/* Materialize a lazily-indexed filelist by reading its span back out of
+ * the sidecar index. Any failure falls back to scanning the database
+ * archive; either way the load is attempted only once. */
+static int syncidx_load_files(alpm_pkg_t *pkg)
+{
+	alpm_db_t *db = pkg->origin_data.db;
+	const char *dbpath = _alpm_db_path(db);
+	char *idxpath = NULL;
+	unsigned char *blob = NULL;
+	int fd = -1, ok = 0;
+	struct syncidx_header hdr;
+	struct syncidx_cursor cursor;
+	int64_t off = pkg->syncidx_files_off;
+	uint32_t len = pkg->syncidx_files_len;
+
+	pkg->syncidx_files_off = 0;
+
+	if(dbpath == NULL || (idxpath = syncidx_path(db, dbpath)) == NULL) {
+		goto cleanup;
+	}
+	OPEN(fd, idxpath, O_RDONLY);
+	if(fd < 0) {
+		goto cleanup;
+	}
+	/* make sure this is still the sidecar the package cache came from */
+	if(pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)
+			|| memcmp(hdr.magic, SYNCIDX_MAGIC, sizeof(hdr.magic)) != 0
+			|| hdr.version != SYNCIDX_VERSION
+			|| hdr.endian != SYNCIDX_ENDIAN
+			|| !db->snap_valid
+			|| hdr.db_size != db->snap_size
+			|| hdr.db_mtime != db->snap_mtime) {
+		goto cleanup;
+	}
+	MALLOC(blob, len, goto cleanup);
+	if(pread(fd, blob, len, (off_t)off) != (ssize_t)len) {
+		goto cleanup;
+	}
+
+	cursor.pos = blob;
+	cursor.remain = len;
+	cursor.base = NULL;
+	if(syncidx_parse_files(&cursor, pkg) != 0) {
+		size_t f;
+		for(f = 0; f < pkg->files.count; f++) {
+			free(pkg->files.files[f].name);
+		}
+		FREE(pkg->files.files);
+		pkg->files.count = 0;
+		goto cleanup;
+	}
+	ok = 1;
+
+cleanup:
+	free(blob);
+	free(idxpath);
+	if(fd >= 0) {
+		close(fd);
+	}
+	if(!ok) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"sync db index unusable for '%s', scanning archive for filelist\n",
+				pkg->name);
+		return sync_db_files_fallback(pkg);
+	}
+	return 0;
+}
+
+static alpm_filelist_t *_sync_get_files(alpm_pkg_t *pkg)
+{
+	if(pkg->origin == ALPM_PKG_FROM_SYNCDB && pkg->syncidx_files_off > 0) {
+		syncidx_load_files(pkg);
+	}
+	return &(pkg->files);
+}
+
+static int _sync_force_load(alpm_pkg_t *pkg)
+{
+	if(pkg->origin == ALPM_PKG_FROM_SYNCDB && pkg->syncidx_files_off > 0) {
+		return syncidx_load_files(pkg);
+	}
+	return 0;
+}
+
+/* Attempt to populate the package cache from the mmap'd sidecar index.
+ * Returns 0 on success; on any failure the partial cache is torn down and
+ * -1 returned so the caller falls back to the archive parse. */
+static int syncidx_load(alpm_db_t *db, const char *dbpath,
+		const struct stat *dbstat)
+{
+	char *idxpath;
+	int fd = -1, ret = -1;
+	uint32_t p;
+	void *map = MAP_FAILED;
+	struct stat idxstat;
+	struct syncidx_header hdr;
+	struct syncidx_cursor cursor;
+
+	idxpath = syncidx_path(db, dbpath);
+	if(idxpath == NULL) {
+		return -1;
+	}
+
+	OPEN(fd, idxpath, O_RDONLY);
+	if(fd < 0) {
+		goto cleanup;
+	}
+	if(fstat(fd, &idxstat) != 0 || (size_t)idxstat.st_size < sizeof(hdr)) {
+		goto cleanup;
+	}
+	map = mmap(NULL, (size_t)idxstat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) {
+		goto cleanup;
+	}
+
+	cursor.pos = map;
+	cursor.remain = (size_t)idxstat.st_size;
+	cursor.base = map;
+	if(syncidx_read(&cursor, &hdr, sizeof(hdr)) != 0
+			|| memcmp(hdr.magic, SYNCIDX_MAGIC, sizeof(hdr.magic)) != 0
+			|| hdr.version != SYNCIDX_VERSION
+			|| hdr.endian != SYNCIDX_ENDIAN
+			|| hdr.db_size != (int64_t)dbstat->st_size
+			|| hdr.db_mtime != (int64_t)dbstat->st_mtime) {
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"sync db index for db '%s' is stale or invalid, ignoring\n",
+				db->treename);
+		goto cleanup;
+	}
+
+	db->pkgcache = _alpm_pkghash_create(hdr.pkgcount + 1);
+	if(db->pkgcache == NULL) {
+		goto cleanup;
+	}
+
+	for(p = 0; p < hdr.pkgcount; p++) {
+		alpm_pkg_t *pkg = _alpm_pkg_new();
+		if(pkg == NULL) {
+			goto load_error;
+		}
+		if(syncidx_read_pkg(&cursor, db->deppool, pkg) != 0) {
+			_alpm_log(db->handle, ALPM_LOG_DEBUG,
+					"sync db index for db '%s' is corrupt, ignoring\n", db->treename);
+			_alpm_pkg_free(pkg);
+			goto load_error;
+		}
+		pkg->name_hash = _alpm_hash_sdbm(pkg->name);
+		pkg->origin = ALPM_PKG_FROM_SYNCDB;
+		pkg->origin_data.db = db;
+		pkg->ops = &default_pkg_ops;
+		pkg->ops->get_validation = _sync_get_validation;
+		pkg->ops->get_files = _sync_get_files;
+		pkg->ops->force_load = _sync_force_load;
+		pkg->handle = db->handle;
+		if(_alpm_pkghash_add(&db->pkgcache, pkg) == NULL) {
+			_alpm_pkg_free(pkg);
+			goto load_error;
+		}
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"loaded %u packages from sync db index for db '%s'\n",
+			hdr.pkgcount, db->treename);
+	ret = 0;
+	goto cleanup;
+
+load_error:
+	_alpm_db_free_pkgcache(db);
+
+cleanup:
+	if(map != MAP_FAILED) {
+		munmap(map, (size_t)idxstat.st_size);
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+	free(idxpath);
+	return ret;
+}
+
 static int sync_db_populate(alpm_db_t *db)
 {
 	const char *dbpath;
@@ -422,6 +1424,24 @@ static int sync_db_populate(alpm_db_t *db)
 		return -1;
 	}
 
+	/* a current sidecar index lets us skip the archive parse entirely */
+	if(stat(dbpath, &buf) == 0 && syncidx_load(db, dbpath, &buf) == 0) {
+		alpm_list_t *p;
+		_alpm_db_snapshot_stamp(db, &buf);
+		count = alpm_list_count(db->pkgcache->list);
+		if(count > 0) {
+			db->pkgcache->list = alpm_list_msort(db->pkgcache->list,
+					count, _alpm_pkg_cmp);
+		}
+		for(p = db->pkgcache->list; p; p = p->next) {
+			_alpm_pkg_pool_strings(p->data, db->strpool);
+		}
+		_alpm_log(db->handle, ALPM_LOG_DEBUG,
+				"added %zu packages to package cache for db '%s'\n",
+				count, db->treename);
+		return 0;
+	}
+
 	fd = _alpm_open_archive(db->handle, dbpath, &buf,
 			&archive, ALPM_ERR_DB_OPEN);
 	if(fd < 0) {
@@ -429,6 +1449,7 @@ static int sync_db_populate(alpm_db_t *db)
 		db->status |= DB_STATUS_INVALID;
 		return -1;
 	}
+	_alpm_db_snapshot_stamp(db, &buf);
 	est_count = estimate_package_count(&buf, archive);
 
 	/* currently only .files dbs contain file lists - make flexible when required*/
@@ -465,13 +1486,21 @@ static int sync_db_populate(alpm_db_t *db)
 
 	count = alpm_list_count(db->pkgcache->list);
 	if(count > 0) {
+		alpm_list_t *p;
 		db->pkgcache->list = alpm_list_msort(db->pkgcache->list,
 				count, _alpm_pkg_cmp);
+		for(p = db->pkgcache->list; p; p = p->next) {
+			_alpm_pkg_pool_strings(p->data, db->strpool);
+		}
 	}
 	_alpm_log(db->handle, ALPM_LOG_DEBUG,
 			"added %zu packages to package cache for db '%s'\n",
 			count, db->treename);
 
+	if(ret == 0) {
+		syncidx_save(db, dbpath, &buf);
+	}
+
 cleanup:
 	_alpm_archive_read_free(archive);
 	if(fd >= 0) {
@@ -529,7 +1558,7 @@ static int _alpm_validate_filename(alpm_db_t *db, const char *pkgname,
 #define READ_AND_SPLITDEP(f) do { \
 	if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) goto error; \
 	if(_alpm_strip_newline(buf.line, buf.real_line_size) == 0) break; \
-	f = alpm_list_add(f, alpm_dep_from_string(line)); \
+	f = alpm_list_add(f, _alpm_deppool_intern(db->deppool, buf.line)); \
 } while(1) /* note the while(1) and not (0) */
 
 static int sync_db_read(alpm_db_t *db, struct archive *archive,
@@ -574,101 +1603,98 @@ static int sync_db_read(alpm_db_t *db, struct archive *archive,
 		int ret;
 		while((ret = _alpm_archive_fgets(archive, &buf)) == ARCHIVE_OK) {
 			char *line = buf.line;
-			if(_alpm_strip_newline(line, buf.real_line_size) == 0) {
+			size_t linelen = _alpm_strip_newline(line, buf.real_line_size);
+			unsigned int key;
+			if(linelen == 0) {
 				/* length of stripped line was zero */
 				continue;
 			}
+			key = ALPM_FIELD_KEY(line[1], line[2], linelen);
 
-			if(strcmp(line, "%NAME%") == 0) {
+			if(ALPM_FIELD_MATCH(line, key, "%NAME%")) {
 				READ_NEXT();
 				if(strcmp(line, pkg->name) != 0) {
 					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: name "
 								"mismatch on package %s\n"), db->treename, pkg->name);
 				}
-			} else if(strcmp(line, "%VERSION%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%VERSION%")) {
 				READ_NEXT();
 				if(strcmp(line, pkg->version) != 0) {
 					_alpm_log(db->handle, ALPM_LOG_ERROR, _("%s database is inconsistent: version "
 								"mismatch on package %s\n"), db->treename, pkg->name);
 				}
-			} else if(strcmp(line, "%FILENAME%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%FILENAME%")) {
 				READ_AND_STORE(pkg->filename);
 				if(_alpm_validate_filename(db, pkg->name, pkg->filename) < 0) {
 					return -1;
 				}
-			} else if(strcmp(line, "%BASE%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%BASE%")) {
 				READ_AND_STORE(pkg->base);
-			} else if(strcmp(line, "%DESC%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%DESC%")) {
 				READ_AND_STORE(pkg->desc);
-			} else if(strcmp(line, "%GROUPS%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%GROUPS%")) {
 				READ_AND_STORE_ALL(pkg->groups);
-			} else if(strcmp(line, "%URL%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%URL%")) {
 				READ_AND_STORE(pkg->url);
-			} else if(strcmp(line, "%LICENSE%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%LICENSE%")) {
 				READ_AND_STORE_ALL(pkg->licenses);
-			} else if(strcmp(line, "%ARCH%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%ARCH%")) {
 				READ_AND_STORE(pkg->arch);
-			} else if(strcmp(line, "%BUILDDATE%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%BUILDDATE%")) {
 				READ_NEXT();
 				pkg->builddate = _alpm_parsedate(line);
-			} else if(strcmp(line, "%PACKAGER%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%PACKAGER%")) {
 				READ_AND_STORE(pkg->packager);
-			} else if(strcmp(line, "%CSIZE%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%CSIZE%")) {
 				READ_NEXT();
 				pkg->size = _alpm_strtoofft(line);
-			} else if(strcmp(line, "%ISIZE%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%ISIZE%")) {
 				READ_NEXT();
 				pkg->isize = _alpm_strtoofft(line);
-			} else if(strcmp(line, "%MD5SUM%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%MD5SUM%")) {
 				READ_AND_STORE(pkg->md5sum);
-			} else if(strcmp(line, "%SHA256SUM%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%SHA256SUM%")) {
 				READ_AND_STORE(pkg->sha256sum);
-			} else if(strcmp(line, "%PGPSIG%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%PGPSIG%")) {
 				READ_AND_STORE(pkg->base64_sig);
-			} else if(strcmp(line, "%REPLACES%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%REPLACES%")) {
 				READ_AND_SPLITDEP(pkg->replaces);
-			} else if(strcmp(line, "%DEPENDS%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%DEPENDS%")) {
 				READ_AND_SPLITDEP(pkg->depends);
-			} else if(strcmp(line, "%OPTDEPENDS%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%OPTDEPENDS%")) {
 				READ_AND_SPLITDEP(pkg->optdepends);
-			} else if(strcmp(line, "%MAKEDEPENDS%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%MAKEDEPENDS%")) {
 				READ_AND_SPLITDEP(pkg->makedepends);
-			} else if(strcmp(line, "%CHECKDEPENDS%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%CHECKDEPENDS%")) {
 				READ_AND_SPLITDEP(pkg->checkdepends);
-			} else if(strcmp(line, "%CONFLICTS%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%CONFLICTS%")) {
 				READ_AND_SPLITDEP(pkg->conflicts);
-			} else if(strcmp(line, "%PROVIDES%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%PROVIDES%")) {
 				READ_AND_SPLITDEP(pkg->provides);
-			} else if(strcmp(line, "%FILES%") == 0) {
+			} else if(ALPM_FIELD_MATCH(line, key, "%FILES%")) {
 				/* TODO: this could lazy load if there is future demand */
-				size_t files_count = 0, files_size = 0;
-				alpm_file_t *files = NULL;
+				size_t files_size = 0, names_size = 0, names_len = 0, len;
 
 				while(1) {
 					if(_alpm_archive_fgets(archive, &buf) != ARCHIVE_OK) {
 						goto error;
 					}
 					line = buf.line;
-					if(_alpm_strip_newline(line, buf.real_line_size) == 0) {
+					len = _alpm_strip_newline(line, buf.real_line_size);
+					if(len == 0) {
 						break;
 					}
 
-					if(!_alpm_greedy_grow((void **)&files, &files_size,
-								(files_count ? (files_count + 1) * sizeof(alpm_file_t) : 8 * sizeof(alpm_file_t)))) {
+					/* paths share one contiguous names buffer */
+					if(_alpm_filelist_append(&pkg->files, line, len,
+								&files_size, &names_size, &names_len) != 0) {
+						FREE(pkg->files.files);
+						FREE(pkg->files.names);
+						pkg->files.count = 0;
 						goto error;
 					}
-					STRDUP(files[files_count].name, line, goto error);
-					files_count++;
-				}
-				/* attempt to hand back any memory we don't need */
-				if(files_count > 0) {
-					REALLOC(files, sizeof(alpm_file_t) * files_count, (void)0);
-				} else {
-					FREE(files);
 				}
-				pkg->files.count = files_count;
-				pkg->files.files = files;
-				_alpm_filelist_sort(&pkg->files);
+				_alpm_filelist_finish(&pkg->files, names_len);
 			}
 		}
 		if(ret != ARCHIVE_EOF) {
@@ -716,6 +1742,13 @@ alpm_db_t *_alpm_db_register_sync(alpm_handle_t *handle, const char *treename,
 
 	sync_db_validate(db);
 
+	/* queue asynchronous readahead on the db file; registration happens
+	 * well before first access, so a cold-cache read overlaps whatever
+	 * setup the frontend still has left */
+	if(db->status & DB_STATUS_EXISTS) {
+		_alpm_readahead_file(_alpm_db_path(db));
+	}
+
 	handle->dbs_sync = alpm_list_add(handle->dbs_sync, db);
 	return db;
 }
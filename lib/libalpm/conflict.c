@@ -39,6 +39,7 @@
 #include "log.h"
 #include "deps.h"
 #include "filelist.h"
+#include "thread.h"
 
 /**
  * @brief Creates a new conflict.
@@ -146,6 +147,77 @@ static int add_conflict(alpm_handle_t *handle, alpm_list_t **baddeps,
 	return 0;
 }
 
+/* Name index for the conflict phase: every package is registered under
+ * its own name and each of its provide names, so a declared conflict
+ * probes its possible matches by name instead of scanning the whole
+ * package list. A _alpm_depcmp() only ever matches a package whose name
+ * or provide name equals the depend's name, which makes the probe
+ * exact; version constraints are still checked by depcmp on the few
+ * candidates the index returns. Open addressing with linear probing;
+ * duplicate keys each occupy their own slot. */
+struct conflict_index_entry {
+	unsigned long hash;
+	const char *name;
+	alpm_pkg_t *pkg;
+};
+
+struct conflict_index {
+	struct conflict_index_entry *buckets;
+	size_t capacity; /* power of two */
+};
+
+static void conflict_index_insert(struct conflict_index *idx,
+		unsigned long hash, const char *name, alpm_pkg_t *pkg)
+{
+	size_t slot = hash & (idx->capacity - 1);
+	while(idx->buckets[slot].name != NULL) {
+		slot = (slot + 1) & (idx->capacity - 1);
+	}
+	idx->buckets[slot].hash = hash;
+	idx->buckets[slot].name = name;
+	idx->buckets[slot].pkg = pkg;
+}
+
+static void conflict_index_free(struct conflict_index *idx)
+{
+	if(idx) {
+		free(idx->buckets);
+		free(idx);
+	}
+}
+
+static struct conflict_index *conflict_index_build(alpm_list_t *pkgs)
+{
+	struct conflict_index *idx;
+	alpm_list_t *i, *j;
+	size_t count = 0;
+
+	for(i = pkgs; i; i = i->next) {
+		count += 1 + alpm_list_count(alpm_pkg_get_provides(i->data));
+	}
+	if(count == 0) {
+		return NULL;
+	}
+
+	CALLOC(idx, 1, sizeof(struct conflict_index), return NULL);
+	idx->capacity = 16;
+	while(idx->capacity < count * 2) {
+		idx->capacity *= 2;
+	}
+	CALLOC(idx->buckets, idx->capacity, sizeof(struct conflict_index_entry),
+			free(idx); return NULL);
+
+	for(i = pkgs; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		conflict_index_insert(idx, pkg->name_hash, pkg->name, pkg);
+		for(j = alpm_pkg_get_provides(pkg); j; j = j->next) {
+			alpm_depend_t *provide = j->data;
+			conflict_index_insert(idx, provide->name_hash, provide->name, pkg);
+		}
+	}
+	return idx;
+}
+
 /**
  * @brief Check if packages from list1 conflict with packages from list2.
  *
@@ -164,11 +236,15 @@ static void check_conflict(alpm_handle_t *handle,
 		alpm_list_t *list1, alpm_list_t *list2,
 		alpm_list_t **baddeps, int order)
 {
+	struct conflict_index *idx;
 	alpm_list_t *i;
 
 	if(!baddeps) {
 		return;
 	}
+
+	idx = conflict_index_build(list2);
+
 	for(i = list1; i; i = i->next) {
 		alpm_pkg_t *pkg1 = i->data;
 		alpm_list_t *j;
@@ -177,6 +253,33 @@ static void check_conflict(alpm_handle_t *handle,
 			alpm_depend_t *conflict = j->data;
 			alpm_list_t *k;
 
+			if(idx) {
+				size_t slot = conflict->name_hash & (idx->capacity - 1);
+				for(; idx->buckets[slot].name != NULL;
+						slot = (slot + 1) & (idx->capacity - 1)) {
+					alpm_pkg_t *pkg2 = idx->buckets[slot].pkg;
+
+					if(idx->buckets[slot].hash != conflict->name_hash
+							|| strcmp(idx->buckets[slot].name, conflict->name) != 0) {
+						continue;
+					}
+					if(pkg1->name_hash == pkg2->name_hash
+							&& strcmp(pkg1->name, pkg2->name) == 0) {
+						/* skip the package we're currently processing */
+						continue;
+					}
+					if(_alpm_depcmp(pkg2, conflict)) {
+						if(order >= 0) {
+							add_conflict(handle, baddeps, pkg1, pkg2, conflict);
+						} else {
+							add_conflict(handle, baddeps, pkg2, pkg1, conflict);
+						}
+					}
+				}
+				continue;
+			}
+
+			/* allocation failure: scan the list directly */
 			for(k = list2; k; k = k->next) {
 				alpm_pkg_t *pkg2 = k->data;
 
@@ -196,6 +299,8 @@ static void check_conflict(alpm_handle_t *handle,
 			}
 		}
 	}
+
+	conflict_index_free(idx);
 }
 
 /**
@@ -325,27 +430,61 @@ static int dir_belongsto_pkgs(alpm_handle_t *handle, const char *dirpath,
 		const char *name = ent->d_name;
 		int owned = 0, is_dir = 0;
 		alpm_list_t *i;
-		struct stat sbuf;
 
 		if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
 			continue;
 		}
 
-		snprintf(full_path, PATH_MAX, "%s%s%s", handle->root, dirpath, name);
-
-		if(lstat(full_path, &sbuf) != 0) {
-			_alpm_log(handle, ALPM_LOG_DEBUG, "could not stat %s\n", full_path);
-			closedir(dir);
-			return 0;
-		}
-		is_dir = S_ISDIR(sbuf.st_mode);
-
-		snprintf(path, PATH_MAX, "%s%s%s", dirpath, name, is_dir ? "/" : "");
+		/* ownership is answered from the filelists; the filesystem is
+		 * only consulted when readdir cannot tell the entry type and the
+		 * filelists know the path in both its file and directory form.
+		 * In particular an entry the filelists do not know at all is
+		 * unowned without a single stat - the expensive case on remote
+		 * filesystems. */
+#ifdef DT_DIR
+		if(ent->d_type != DT_UNKNOWN) {
+			is_dir = (ent->d_type == DT_DIR);
+
+			snprintf(path, PATH_MAX, "%s%s%s", dirpath, name, is_dir ? "/" : "");
+			for(i = pkgs; i && !owned; i = i->next) {
+				if(alpm_filelist_contains(alpm_pkg_get_files(i->data), path)) {
+					owned = 1;
+				}
+			}
+		} else
+#endif
+		{
+			int owned_as_dir = 0;
+
+			snprintf(path, PATH_MAX, "%s%s", dirpath, name);
+			for(i = pkgs; i && !owned; i = i->next) {
+				if(alpm_filelist_contains(alpm_pkg_get_files(i->data), path)) {
+					owned = 1;
+				}
+			}
+			snprintf(path, PATH_MAX, "%s%s/", dirpath, name);
+			for(i = pkgs; i && !owned_as_dir; i = i->next) {
+				if(alpm_filelist_contains(alpm_pkg_get_files(i->data), path)) {
+					owned_as_dir = 1;
+				}
+			}
 
-		for(i = pkgs; i && !owned; i = i->next) {
-			if(alpm_filelist_contains(alpm_pkg_get_files(i->data), path)) {
-				owned = 1;
+			if(owned && owned_as_dir) {
+				/* both forms are packaged; ask the filesystem which one
+				 * this actually is */
+				struct stat sbuf;
+				snprintf(full_path, PATH_MAX, "%s%s%s", handle->root, dirpath, name);
+				if(lstat(full_path, &sbuf) != 0) {
+					_alpm_log(handle, ALPM_LOG_DEBUG, "could not stat %s\n", full_path);
+					closedir(dir);
+					return 0;
+				}
+				is_dir = S_ISDIR(sbuf.st_mode);
+			} else if(owned_as_dir) {
+				is_dir = 1;
 			}
+			owned |= owned_as_dir;
+			snprintf(path, PATH_MAX, "%s%s%s", dirpath, name, is_dir ? "/" : "");
 		}
 
 		if(owned && is_dir) {
@@ -363,7 +502,7 @@ static int dir_belongsto_pkgs(alpm_handle_t *handle, const char *dirpath,
 	return 1;
 }
 
-static alpm_list_t *alpm_db_find_file_owners(alpm_db_t* db, const char *path)
+static alpm_list_t *db_find_file_owners(alpm_db_t *db, const char *path)
 {
 	alpm_list_t *i, *owners = NULL;
 	for(i = alpm_db_get_pkgcache(db); i; i = i->next) {
@@ -391,6 +530,137 @@ static int _alpm_can_overwrite_file(alpm_handle_t *handle, const char *path, con
 		|| _alpm_fnmatch_patterns(handle->overwrite_files, rootedpath) == 0;
 }
 
+/* A single file from a transaction target, used for the merged
+ * target-vs-target conflict scan. */
+struct target_file {
+	const char *name;
+	alpm_pkg_t *pkg;
+	/* position of pkg in the upgrade list, to keep conflict pairs in
+	 * transaction order */
+	size_t order;
+};
+
+static int target_file_cmp(const void *a, const void *b)
+{
+	const struct target_file *tf1 = a, *tf2 = b;
+	int cmp = _alpm_filelist_pathcmp(tf1->name, tf2->name);
+	if(cmp != 0) {
+		return cmp;
+	}
+	if(tf1->order != tf2->order) {
+		return tf1->order < tf2->order ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Check every target against every target by merging the pre-sorted
+ * filelists into one path-ordered array and scanning it for runs of
+ * equal paths; pairwise work only happens on actual collisions instead
+ * of once per package pair. Returns -1 on memory exhaustion. */
+static int find_target_conflicts(alpm_handle_t *handle, alpm_list_t *upgrade,
+		alpm_list_t **conflicts)
+{
+	alpm_list_t *i;
+	struct target_file *all;
+	size_t total = 0, n = 0, run, next;
+	size_t order;
+	char path[PATH_MAX];
+
+	for(i = upgrade; i; i = i->next) {
+		total += alpm_pkg_get_files(i->data)->count;
+	}
+	if(total == 0) {
+		return 0;
+	}
+	CALLOC(all, total, sizeof(struct target_file), return -1);
+
+	for(i = upgrade, order = 0; i; i = i->next, order++) {
+		alpm_pkg_t *pkg = i->data;
+		alpm_filelist_t *files = alpm_pkg_get_files(pkg);
+		size_t f;
+		for(f = 0; f < files->count; f++) {
+			all[n].name = files->files[f].name;
+			all[n].pkg = pkg;
+			all[n].order = order;
+			n++;
+		}
+	}
+	qsort(all, total, sizeof(struct target_file), target_file_cmp);
+
+	for(run = 0; run < total; run = next) {
+		size_t a, b;
+		next = run + 1;
+		while(next < total
+				&& _alpm_filelist_pathcmp(all[run].name, all[next].name) == 0) {
+			next++;
+		}
+		if(next - run < 2) {
+			continue;
+		}
+		for(a = run; a < next; a++) {
+			for(b = a + 1; b < next; b++) {
+				const char *filename = all[a].name;
+				alpm_pkg_t *p1 = all[a].pkg, *p2 = all[b].pkg;
+
+				if(p1 == p2) {
+					continue;
+				}
+				/* two directory entries are not a conflict */
+				if(filename[strlen(filename) - 1] == '/'
+						&& all[b].name[strlen(all[b].name) - 1] == '/') {
+					continue;
+				}
+				snprintf(path, PATH_MAX, "%s%s", handle->root, filename);
+
+				/* can skip file-file conflicts when forced *
+				 * checking presence in p2's files detects dir-file or file-dir
+				 * conflicts as the path from p1 is used */
+				if(_alpm_can_overwrite_file(handle, filename, path)
+						&& alpm_filelist_contains(alpm_pkg_get_files(p2), filename)) {
+					_alpm_log(handle, ALPM_LOG_DEBUG,
+						"%s exists in both '%s' and '%s'\n", filename,
+						p1->name, p2->name);
+					_alpm_log(handle, ALPM_LOG_DEBUG,
+						"file-file conflict being forced\n");
+					continue;
+				}
+
+				*conflicts = add_fileconflict(handle, *conflicts, path, p1, p2);
+				if(handle->pm_errno == ALPM_ERR_MEMORY) {
+					free(all);
+					return -1;
+				}
+			}
+		}
+	}
+
+	free(all);
+	return 0;
+}
+
+/* Worker gathering lstat() results for the filesystem conflict check;
+ * all conflict resolution stays on the calling thread. */
+struct conflict_stat {
+	struct stat lsbuf;
+	int exists;
+};
+
+struct conflict_stat_ctx {
+	const char *root;
+	_alpm_vector_t *files;
+	struct conflict_stat *stats;
+};
+
+static void conflict_stat_worker(void *ctx, size_t index)
+{
+	struct conflict_stat_ctx *c = ctx;
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s%s", c->root,
+			(const char *)c->files->data[index]);
+	c->stats[index].exists = llstat(path, &c->stats[index].lsbuf) == 0;
+}
+
 /**
  * @brief Find file conflicts that may occur during the transaction.
  *
@@ -422,61 +692,26 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 	 * be possible with real transactions. Right now we only do half as much
 	 * here as we do when we actually extract files in add.c with our 12
 	 * different cases. */
+
+	/* CHECK 1: check every target against every target */
+	_alpm_log(handle, ALPM_LOG_DEBUG, "searching for inter-target file conflicts\n");
+	if(find_target_conflicts(handle, upgrade, &conflicts) != 0) {
+		alpm_list_free_inner(conflicts, (alpm_list_fn_free) alpm_conflict_free);
+		alpm_list_free(conflicts);
+		return NULL;
+	}
+
 	for(current = 0, i = upgrade; i; i = i->next, current++) {
 		alpm_pkg_t *p1 = i->data;
-		alpm_list_t *j;
-		alpm_list_t *newfiles = NULL;
+		size_t fidx, nthreads;
+		_alpm_vector_t newfiles = VECTOR_INIT;
+		struct conflict_stat *stats;
 		alpm_pkg_t *dbpkg;
 
 		int percent = (current * 100) / numtargs;
 		PROGRESS(handle, ALPM_PROGRESS_CONFLICTS_START, "", percent,
 		         numtargs, current);
 
-		/* CHECK 1: check every target against every target */
-		_alpm_log(handle, ALPM_LOG_DEBUG, "searching for file conflicts: %s\n",
-				p1->name);
-		for(j = i->next; j; j = j->next) {
-			alpm_list_t *common_files;
-			alpm_pkg_t *p2 = j->data;
-
-			alpm_filelist_t *p1_files = alpm_pkg_get_files(p1);
-			alpm_filelist_t *p2_files = alpm_pkg_get_files(p2);
-
-			common_files = _alpm_filelist_intersection(p1_files, p2_files);
-
-			if(common_files) {
-				alpm_list_t *k;
-				char path[PATH_MAX];
-				for(k = common_files; k; k = k->next) {
-					char *filename = k->data;
-					snprintf(path, PATH_MAX, "%s%s", handle->root, filename);
-
-					/* can skip file-file conflicts when forced *
-					 * checking presence in p2_files detects dir-file or file-dir
-					 * conflicts as the path from p1 is returned */
-					if(_alpm_can_overwrite_file(handle, filename, path)
-							&& alpm_filelist_contains(p2_files, filename)) {
-						_alpm_log(handle, ALPM_LOG_DEBUG,
-							"%s exists in both '%s' and '%s'\n", filename,
-							p1->name, p2->name);
-						_alpm_log(handle, ALPM_LOG_DEBUG,
-							"file-file conflict being forced\n");
-						continue;
-					}
-
-					conflicts = add_fileconflict(handle, conflicts, path, p1, p2);
-					if(handle->pm_errno == ALPM_ERR_MEMORY) {
-						alpm_list_free_inner(conflicts,
-								(alpm_list_fn_free) alpm_conflict_free);
-						alpm_list_free(conflicts);
-						alpm_list_free(common_files);
-						return NULL;
-					}
-				}
-				alpm_list_free(common_files);
-			}
-		}
-
 		/* CHECK 2: check every target against the filesystem */
 		_alpm_log(handle, ALPM_LOG_DEBUG, "searching for filesystem conflicts: %s\n",
 				p1->name);
@@ -484,24 +719,49 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 
 		/* Do two different checks here. If the package is currently installed,
 		 * then only check files that are new in the new package. If the package
-		 * is not currently installed, then simply stat the whole filelist. Note
-		 * that the former list needs to be freed while the latter list should NOT
-		 * be freed. */
+		 * is not currently installed, then simply stat the whole filelist. Either
+		 * way the vector only borrows the filelist strings. */
 		if(dbpkg) {
 			/* older ver of package currently installed */
-			newfiles = _alpm_filelist_difference(alpm_pkg_get_files(p1),
-					alpm_pkg_get_files(dbpkg));
+			if(_alpm_filelist_difference(alpm_pkg_get_files(p1),
+						alpm_pkg_get_files(dbpkg), &newfiles) != 0) {
+				_alpm_vector_release(&newfiles, NULL);
+				alpm_list_free_inner(conflicts,
+						(alpm_list_fn_free) alpm_conflict_free);
+				alpm_list_free(conflicts);
+				RET_ERR(handle, ALPM_ERR_MEMORY, NULL);
+			}
 		} else {
 			/* no version of package currently installed */
 			alpm_filelist_t *fl = alpm_pkg_get_files(p1);
 			size_t filenum;
 			for(filenum = 0; filenum < fl->count; filenum++) {
-				newfiles = alpm_list_add(newfiles, fl->files[filenum].name);
+				if(_alpm_vector_add(&newfiles, fl->files[filenum].name) != 0) {
+					_alpm_vector_release(&newfiles, NULL);
+					alpm_list_free_inner(conflicts,
+							(alpm_list_fn_free) alpm_conflict_free);
+					alpm_list_free(conflicts);
+					RET_ERR(handle, ALPM_ERR_MEMORY, NULL);
+				}
+			}
+		}
+
+		/* fan the lstat() calls out across the worker pool; resolution
+		 * below stays serial and in order */
+		nthreads = _alpm_parallel_nthreads(handle, newfiles.count);
+		stats = NULL;
+		if(nthreads > 1 && newfiles.count) {
+			CALLOC(stats, newfiles.count, sizeof(struct conflict_stat),
+					stats = NULL);
+			if(stats) {
+				struct conflict_stat_ctx ctx = { handle->root, &newfiles, stats };
+				_alpm_parallel_for(nthreads, newfiles.count,
+						conflict_stat_worker, &ctx);
 			}
 		}
 
-		for(j = newfiles; j; j = j->next) {
-			const char *filestr = j->data;
+		for(fidx = 0; fidx < newfiles.count; fidx++) {
+			const char *filestr = newfiles.data[fidx];
 			const char *relative_path;
 			alpm_list_t *k;
 			/* have we acted on this conflict? */
@@ -515,7 +775,12 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 			relative_path = path + rootlen;
 
 			/* stat the file - if it exists, do some checks */
-			if(llstat(path, &lsbuf) != 0) {
+			if(stats) {
+				if(!stats[fidx].exists) {
+					continue;
+				}
+				lsbuf = stats[fidx].lsbuf;
+			} else if(llstat(path, &lsbuf) != 0) {
 				continue;
 			}
 
@@ -541,12 +806,10 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 
 					/* go ahead and skip any files inside filestr as they will
 					 * necessarily be resolved by replacing the file with a dir
-					 * NOTE: afterward, j will point to the last file inside filestr */
-					for( ; j->next; j = j->next) {
-						const char *filestr2 = j->next->data;
-						if(strncmp(filestr, filestr2, fslen) != 0) {
-							break;
-						}
+					 * NOTE: afterward, fidx will point to the last file inside filestr */
+					while(fidx + 1 < newfiles.count && strncmp(filestr,
+								newfiles.data[fidx + 1], fslen) == 0) {
+						fidx++;
 					}
 				}
 			}
@@ -562,13 +825,11 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 					if(pfile_isdir) {
 						/* go ahead and skip any files inside filestr as they will
 						 * necessarily be resolved by replacing the file with a dir
-						 * NOTE: afterward, j will point to the last file inside filestr */
+						 * NOTE: afterward, fidx will point to the last file inside filestr */
 						size_t fslen = strlen(filestr);
-						for( ; j->next; j = j->next) {
-							const char *filestr2 = j->next->data;
-							if(strncmp(filestr, filestr2, fslen) != 0) {
-								break;
-							}
+						while(fidx + 1 < newfiles.count && strncmp(filestr,
+									newfiles.data[fidx + 1], fslen) == 0) {
+							fidx++;
 						}
 					}
 				}
@@ -592,7 +853,8 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 					 * package from removing the file when it was already installed
 					 * by its new owner (whether the file is in backup array or not */
 					handle->trans->skip_remove =
-						alpm_list_add(handle->trans->skip_remove, strdup(relative_path));
+						alpm_list_add(handle->trans->skip_remove,
+								_alpm_arena_strdup(handle->trans->arena, relative_path));
 					_alpm_log(handle, ALPM_LOG_DEBUG,
 							"file changed packages, adding to remove skiplist\n");
 					resolved_conflict = 1;
@@ -601,12 +863,10 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 						/* replacing a file with a directory:
 						 * go ahead and skip any files inside filestr as they will
 						 * necessarily be resolved by replacing the file with a dir
-						 * NOTE: afterward, j will point to the last file inside filestr */
-						for( ; j->next; j = j->next) {
-							const char *filestr2 = j->next->data;
-							if(strncmp(filestr, filestr2, fslen) != 0) {
-								break;
-							}
+						 * NOTE: afterward, fidx will point to the last file inside filestr */
+						while(fidx + 1 < newfiles.count && strncmp(filestr,
+									newfiles.data[fidx + 1], fslen) == 0) {
+							fidx++;
 						}
 					}
 				}
@@ -618,7 +878,7 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 				char *dir = malloc(strlen(relative_path) + 2);
 				sprintf(dir, "%s/", relative_path);
 
-				owners = alpm_db_find_file_owners(handle->db_local, dir);
+				owners = db_find_file_owners(handle->db_local, dir);
 				if(owners) {
 					alpm_list_t *pkgs = NULL, *diff;
 
@@ -674,15 +934,24 @@ alpm_list_t *_alpm_db_find_fileconflicts(alpm_handle_t *handle,
 					alpm_list_free_inner(conflicts,
 							(alpm_list_fn_free) alpm_conflict_free);
 					alpm_list_free(conflicts);
-					alpm_list_free(newfiles);
+					_alpm_vector_release(&newfiles, NULL);
+					free(stats);
 					return NULL;
 				}
 			}
 		}
-		alpm_list_free(newfiles);
+		_alpm_vector_release(&newfiles, NULL);
+		free(stats);
 	}
 	PROGRESS(handle, ALPM_PROGRESS_CONFLICTS_START, "", 100,
 			numtargs, current);
 
+	/* the owner searches above fault in the filelist of nearly every
+	 * installed package; drop them again so steady-state memory tracks
+	 * the actual working set (anything still needed reloads lazily) */
+	for(i = _alpm_db_get_pkgcache(handle->db_local); i; i = i->next) {
+		alpm_pkg_evict(i->data);
+	}
+
 	return conflicts;
 }
@@ -30,12 +30,14 @@
 /* libalpm */
 #include "db.h"
 #include "alpm_list.h"
+#include "deps.h"
 #include "log.h"
 #include "util.h"
 #include "handle.h"
 #include "alpm.h"
 #include "package.h"
 #include "group.h"
+#include "thread.h"
 
 alpm_db_t SYMEXPORT *alpm_register_syncdb(alpm_handle_t *handle,
 		const char *treename, int siglevel)
@@ -229,6 +231,102 @@ int SYMEXPORT alpm_db_get_valid(alpm_db_t *db)
 	return db->ops->validate(db);
 }
 
+/* Record what the on-disk database looked like when its package cache
+ * was read; the populate paths call this with the stat they already have
+ * in hand. */
+void _alpm_db_snapshot_stamp(alpm_db_t *db, const struct stat *st)
+{
+	db->snap_mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	db->snap_mtime_nsec = st->st_mtim.tv_nsec;
+#else
+	db->snap_mtime_nsec = 0;
+#endif
+	db->snap_ino = st->st_ino;
+	db->snap_size = st->st_size;
+	db->snap_valid = 1;
+}
+
+int SYMEXPORT alpm_db_snapshot_check(alpm_db_t *db)
+{
+	const char *dbpath;
+	struct stat st;
+	int64_t mtime_nsec = 0;
+
+	ASSERT(db != NULL, return -1);
+	db->handle->pm_errno = ALPM_ERR_OK;
+	ASSERT(db->snap_valid, RET_ERR(db->handle, ALPM_ERR_DB_NULL, -1));
+
+	dbpath = _alpm_db_path(db);
+	if(dbpath == NULL) {
+		/* pm_errno set in _alpm_db_path() */
+		return -1;
+	}
+
+	if(stat(dbpath, &st) != 0) {
+		RET_ERR(db->handle, ALPM_ERR_DB_INVALID, -1);
+	}
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+	if(db->snap_mtime != st.st_mtime
+			|| db->snap_mtime_nsec != mtime_nsec
+			|| db->snap_ino != (int64_t)st.st_ino
+			|| db->snap_size != (int64_t)st.st_size) {
+		RET_ERR(db->handle, ALPM_ERR_DB_INVALID, -1);
+	}
+	return 0;
+}
+
+int SYMEXPORT alpm_db_refresh(alpm_db_t *db)
+{
+	ASSERT(db != NULL, return -1);
+	db->handle->pm_errno = ALPM_ERR_OK;
+	ASSERT(db->handle->trans == NULL,
+			RET_ERR(db->handle, ALPM_ERR_TRANS_NOT_NULL, -1));
+
+	if(!(db->status & DB_STATUS_PKGCACHE)) {
+		/* nothing parsed yet; the next access reads from disk anyway */
+		return 0;
+	}
+	if(db->snap_valid && alpm_db_snapshot_check(db) == 0) {
+		/* generation unchanged, keep the parsed cache */
+		return 0;
+	}
+	db->handle->pm_errno = ALPM_ERR_OK;
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"database '%s' changed on disk, dropping caches\n", db->treename);
+	_alpm_db_free_pkgcache(db);
+	/* run validation again too; the database file may have been
+	 * replaced, appeared or vanished since it was last checked */
+	db->status &= ~(DB_STATUS_VALID | DB_STATUS_INVALID
+			| DB_STATUS_EXISTS | DB_STATUS_MISSING);
+	db->snap_valid = 0;
+	return 1;
+}
+
+int SYMEXPORT alpm_dbs_refresh(alpm_handle_t *handle)
+{
+	alpm_list_t *i;
+	int changed, ret;
+
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(handle->trans == NULL,
+			RET_ERR(handle, ALPM_ERR_TRANS_NOT_NULL, -1));
+
+	if((changed = alpm_db_refresh(handle->db_local)) < 0) {
+		return -1;
+	}
+	for(i = handle->dbs_sync; i; i = i->next) {
+		if((ret = alpm_db_refresh(i->data)) < 0) {
+			return -1;
+		}
+		changed += ret;
+	}
+	return changed;
+}
+
 alpm_pkg_t SYMEXPORT *alpm_db_get_pkg(alpm_db_t *db, const char *name)
 {
 	alpm_pkg_t *pkg;
@@ -251,6 +349,81 @@ alpm_list_t SYMEXPORT *alpm_db_get_pkgcache(alpm_db_t *db)
 	return _alpm_db_get_pkgcache(db);
 }
 
+struct populate_task {
+	alpm_db_t *db;
+	int ret;
+	alpm_errno_t err;
+};
+
+static void populate_worker(void *ctx, size_t index)
+{
+	struct populate_task *task = (struct populate_task *)ctx + index;
+	/* the caller defers logging around this phase; populate may scribble
+	 * on pm_errno, which the caller rewrites after the join */
+	task->ret = task->db->ops->populate(task->db);
+	if(task->ret == -1) {
+		task->err = task->db->handle->pm_errno;
+	}
+}
+
+int SYMEXPORT alpm_dbs_populate_async(alpm_handle_t *handle)
+{
+	alpm_list_t *i;
+	struct populate_task *tasks;
+	size_t count = 0, n, nthreads;
+	int ret = 0;
+
+	CHECK_HANDLE(handle, return -1);
+
+	for(i = handle->dbs_sync; i; i = i->next) {
+		alpm_db_t *db = i->data;
+		if((db->status & DB_STATUS_VALID) && !(db->status & DB_STATUS_PKGCACHE)) {
+			count++;
+		}
+	}
+	if(count == 0) {
+		return 0;
+	}
+
+	CALLOC(tasks, count, sizeof(struct populate_task),
+			RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	n = 0;
+	for(i = handle->dbs_sync; i; i = i->next) {
+		alpm_db_t *db = i->data;
+		if((db->status & DB_STATUS_VALID) && !(db->status & DB_STATUS_PKGCACHE)) {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"loading package cache for repository '%s'\n", db->treename);
+			tasks[n++].db = db;
+		}
+	}
+
+	nthreads = _alpm_parallel_nthreads(handle, count);
+	TRACE_BEGIN(handle, ALPM_TRACE_DB_POPULATE, "sync");
+	_alpm_log_defer_begin(handle);
+	_alpm_parallel_for(nthreads, count, populate_worker, tasks);
+	_alpm_log_defer_end(handle);
+	TRACE_END(handle, ALPM_TRACE_DB_POPULATE, "sync");
+
+	handle->pm_errno = ALPM_ERR_OK;
+	for(n = 0; n < count; n++) {
+		alpm_db_t *db = tasks[n].db;
+		if(tasks[n].ret == 0) {
+			db->status |= DB_STATUS_PKGCACHE;
+		} else {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"failed to load package cache for repository '%s'\n",
+					db->treename);
+			if(ret == 0) {
+				handle->pm_errno = tasks[n].err;
+				ret = -1;
+			}
+		}
+	}
+
+	free(tasks);
+	return ret;
+}
+
 alpm_group_t SYMEXPORT *alpm_db_get_group(alpm_db_t *db, const char *name)
 {
 	ASSERT(db != NULL, return NULL);
@@ -306,6 +479,9 @@ alpm_db_t *_alpm_db_new(const char *treename, int is_local)
 		db->status &= ~DB_STATUS_LOCAL;
 	}
 	db->usage = ALPM_DB_USAGE_ALL;
+	/* interning failures just leave strings unpooled, so a NULL pool is fine */
+	db->strpool = _alpm_strpool_new();
+	db->deppool = _alpm_deppool_new();
 
 	return db;
 }
@@ -319,6 +495,12 @@ void _alpm_db_free(alpm_db_t *db)
 	FREELIST(db->servers);
 	FREE(db->_path);
 	FREE(db->treename);
+	_alpm_strpool_free(db->strpool);
+	_alpm_deppool_free(db->deppool);
+	if(db->journal_batch) {
+		fclose(db->journal_batch);
+		free(db->journal_batch_buf);
+	}
 	FREE(db);
 
 	return;
@@ -364,21 +546,196 @@ int _alpm_db_cmp(const void *d1, const void *d2)
 	return strcmp(db1->treename, db2->treename);
 }
 
+/* Contiguous name+desc column scanned by searches. Every name and
+ * description lives NUL-terminated in one dense text buffer, so the hot
+ * part of a search walks a few megabytes of sequential memory instead
+ * of chasing per-package pointers; for the local db it also means
+ * INFRQ_DESC is faulted in exactly once, at build time. Entries follow
+ * package cache order. The strings are copies, but the column still
+ * goes stale and must be rebuilt whenever the package cache changes. */
+struct searchcol_entry {
+	alpm_pkg_t *pkg;
+	size_t name_off;
+	size_t desc_off; /* (size_t)-1 when the package has no description */
+};
+
+struct __alpm_searchcol_t {
+	char *text;
+	struct searchcol_entry *entries;
+	size_t count;
+};
+
+void _alpm_db_free_searchcol(alpm_db_t *db)
+{
+	if(db == NULL || db->searchcol == NULL) {
+		return;
+	}
+	free(db->searchcol->text);
+	free(db->searchcol->entries);
+	FREE(db->searchcol);
+}
+
+/* Build (or return) the db's search column. Returns NULL on allocation
+ * failure, in which case the caller falls back to the per-package scan. */
+static struct __alpm_searchcol_t *searchcol_get(alpm_db_t *db)
+{
+	alpm_list_t *i, *pkgs;
+	struct __alpm_searchcol_t *col;
+	size_t textlen = 0, count = 0, off = 0, n = 0;
+
+	if(db->searchcol) {
+		return db->searchcol;
+	}
+
+	pkgs = _alpm_db_get_pkgcache(db);
+	for(i = pkgs; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		const char *desc = alpm_pkg_get_desc(pkg);
+		textlen += strlen(pkg->name) + 1;
+		if(desc) {
+			textlen += strlen(desc) + 1;
+		}
+		/* provides and groups are still read from the package during
+		 * matching; fault them in here so worker threads never load */
+		alpm_pkg_get_provides(pkg);
+		alpm_pkg_get_groups(pkg);
+		count++;
+	}
+
+	CALLOC(col, 1, sizeof(*col), return NULL);
+	MALLOC(col->text, textlen ? textlen : 1, free(col); return NULL);
+	CALLOC(col->entries, count ? count : 1, sizeof(struct searchcol_entry),
+			free(col->text); free(col); return NULL);
+	col->count = count;
+
+	for(i = pkgs; i; i = i->next, n++) {
+		alpm_pkg_t *pkg = i->data;
+		const char *desc = alpm_pkg_get_desc(pkg);
+		size_t len = strlen(pkg->name) + 1;
+
+		col->entries[n].pkg = pkg;
+		col->entries[n].name_off = off;
+		memcpy(col->text + off, pkg->name, len);
+		off += len;
+		if(desc) {
+			len = strlen(desc) + 1;
+			col->entries[n].desc_off = off;
+			memcpy(col->text + off, desc, len);
+			off += len;
+		} else {
+			col->entries[n].desc_off = (size_t)-1;
+		}
+	}
+
+	db->searchcol = col;
+	return col;
+}
+
+/* match one package against a search pattern; returns the string the
+ * pattern matched on, or NULL. All metadata must already be loaded when
+ * this runs on a worker thread. */
+static const char *search_pkg_match(alpm_pkg_t *pkg, const char *name,
+		const char *desc, const regex_t *reg, const char *targ)
+{
+	const alpm_list_t *k;
+
+	/* check name as regex AND as plain text */
+	if(name && (regexec(reg, name, 0, 0, 0) == 0 || strstr(name, targ))) {
+		return name;
+	}
+	/* check desc */
+	if(desc && regexec(reg, desc, 0, 0, 0) == 0) {
+		return desc;
+	}
+	/* TODO: should we be doing this, and should we print something
+	 * differently when we do match it since it isn't currently printed? */
+	/* check provides */
+	for(k = alpm_pkg_get_provides(pkg); k; k = k->next) {
+		alpm_depend_t *provide = k->data;
+		if(regexec(reg, provide->name, 0, 0, 0) == 0) {
+			return provide->name;
+		}
+	}
+	/* check groups */
+	for(k = alpm_pkg_get_groups(pkg); k; k = k->next) {
+		if(regexec(reg, k->data, 0, 0, 0) == 0) {
+			return k->data;
+		}
+	}
+	return NULL;
+}
+
+struct search_ctx {
+	const char *text;
+	const struct searchcol_entry **entries;
+	const char **matched;
+	const regex_t *reg;
+	const char *targ;
+};
+
+/* worker for the sharded search scan; regexec(3) on a shared compiled
+ * pattern is thread-safe */
+static void search_worker(void *ctx, size_t index)
+{
+	struct search_ctx *sctx = ctx;
+	const struct searchcol_entry *e = sctx->entries[index];
+
+	sctx->matched[index] = search_pkg_match(e->pkg,
+			sctx->text + e->name_off,
+			e->desc_off == (size_t)-1 ? NULL : sctx->text + e->desc_off,
+			sctx->reg, sctx->targ);
+}
+
 int _alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
 		alpm_list_t **ret)
 {
-	const alpm_list_t *i, *j, *k;
+	const alpm_list_t *i, *j;
+	alpm_list_t *list;
+	struct __alpm_searchcol_t *col;
+	regex_t *regs;
+	size_t nneedles, n;
 
 	if(!(db->usage & ALPM_DB_USAGE_SEARCH)) {
 		return 0;
 	}
 
+	/* compile every pattern up front so bad input fails before any
+	 * matching happens and each pattern is compiled exactly once */
+	nneedles = alpm_list_count(needles);
+	if(nneedles == 0) {
+		return 0;
+	}
+	CALLOC(regs, nneedles, sizeof(regex_t),
+			RET_ERR(db->handle, ALPM_ERR_MEMORY, -1));
+	for(i = needles, n = 0; i; i = i->next, n++) {
+		if(i->data == NULL) {
+			continue;
+		}
+		if(regcomp(&regs[n], i->data,
+					REG_EXTENDED | REG_NOSUB | REG_ICASE | REG_NEWLINE) != 0) {
+			for(i = needles, nneedles = n, n = 0; n < nneedles;
+					i = i->next, n++) {
+				if(i->data) {
+					regfree(&regs[n]);
+				}
+			}
+			free(regs);
+			RET_ERR(db->handle, ALPM_ERR_INVALID_REGEX, -1);
+		}
+	}
+
+	/* one column serves every needle; a failed build just means the
+	 * per-package fallback scan below */
+	col = searchcol_get(db);
+
 	/* copy the pkgcache- we will free the list var after each needle */
-	alpm_list_t *list = alpm_list_copy(_alpm_db_get_pkgcache(db));
+	list = alpm_list_copy(_alpm_db_get_pkgcache(db));
 
-	for(i = needles; i; i = i->next) {
+	for(i = needles, n = 0; i; i = i->next, n++) {
 		char *targ;
-		regex_t reg;
+		size_t count, nthreads, idx, ci;
+		const struct searchcol_entry **entries = NULL;
+		const char **matched = NULL;
 
 		if(i->data == NULL) {
 			continue;
@@ -387,54 +744,65 @@ int _alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
 		targ = i->data;
 		_alpm_log(db->handle, ALPM_LOG_DEBUG, "searching for target '%s'\n", targ);
 
-		if(regcomp(&reg, targ, REG_EXTENDED | REG_NOSUB | REG_ICASE | REG_NEWLINE) != 0) {
-			db->handle->pm_errno = ALPM_ERR_INVALID_REGEX;
-			alpm_list_free(list);
-			alpm_list_free(*ret);
-			return -1;
+		count = alpm_list_count(list);
+		if(col) {
+			CALLOC(entries, count ? count : 1, sizeof(*entries), goto serial);
+			/* the filtered list is always an ordered subsequence of the
+			 * column, so one forward sweep lines the two up */
+			for(j = list, idx = 0, ci = 0; j; j = j->next, idx++) {
+				while(col->entries[ci].pkg != j->data) {
+					ci++;
+				}
+				entries[idx] = &col->entries[ci++];
+			}
 		}
 
-		for(j = list; j; j = j->next) {
-			alpm_pkg_t *pkg = j->data;
-			const char *matched = NULL;
-			const char *name = pkg->name;
-			const char *desc = alpm_pkg_get_desc(pkg);
-
-			/* check name as regex AND as plain text */
-			if(name && (regexec(&reg, name, 0, 0, 0) == 0 || strstr(name, targ))) {
-				matched = name;
-			}
-			/* check desc */
-			else if(desc && regexec(&reg, desc, 0, 0, 0) == 0) {
-				matched = desc;
-			}
-			/* TODO: should we be doing this, and should we print something
-			 * differently when we do match it since it isn't currently printed? */
-			if(!matched) {
-				/* check provides */
-				for(k = alpm_pkg_get_provides(pkg); k; k = k->next) {
-					alpm_depend_t *provide = k->data;
-					if(regexec(&reg, provide->name, 0, 0, 0) == 0) {
-						matched = provide->name;
-						break;
-					}
+		nthreads = entries ? _alpm_parallel_nthreads(db->handle, count) : 1;
+		if(entries && nthreads > 1) {
+			CALLOC(matched, count, sizeof(const char *),
+					free(entries); entries = NULL; goto serial);
+
+			struct search_ctx sctx = { col->text, entries, matched,
+				&regs[n], targ };
+			_alpm_parallel_for(nthreads, count, search_worker, &sctx);
+
+			for(idx = 0; idx < count; idx++) {
+				if(matched[idx]) {
+					_alpm_log(db->handle, ALPM_LOG_DEBUG,
+							"search target '%s' matched '%s' on package '%s'\n",
+							targ, matched[idx], entries[idx]->pkg->name);
+					*ret = alpm_list_add(*ret, entries[idx]->pkg);
 				}
 			}
-			if(!matched) {
-				/* check groups */
-				for(k = alpm_pkg_get_groups(pkg); k; k = k->next) {
-					if(regexec(&reg, k->data, 0, 0, 0) == 0) {
-						matched = k->data;
-						break;
-					}
+			free(entries);
+			free(matched);
+		} else if(entries) {
+			for(idx = 0; idx < count; idx++) {
+				const struct searchcol_entry *e = entries[idx];
+				const char *m = search_pkg_match(e->pkg,
+						col->text + e->name_off,
+						e->desc_off == (size_t)-1 ? NULL : col->text + e->desc_off,
+						&regs[n], targ);
+				if(m != NULL) {
+					_alpm_log(db->handle, ALPM_LOG_DEBUG,
+							"search target '%s' matched '%s' on package '%s'\n",
+							targ, m, e->pkg->name);
+					*ret = alpm_list_add(*ret, e->pkg);
 				}
 			}
-
-			if(matched != NULL) {
-				_alpm_log(db->handle, ALPM_LOG_DEBUG,
-						"search target '%s' matched '%s' on package '%s'\n",
-						targ, matched, name);
-				*ret = alpm_list_add(*ret, pkg);
+			free(entries);
+		} else {
+serial:
+			for(j = list; j; j = j->next) {
+				alpm_pkg_t *pkg = j->data;
+				const char *m = search_pkg_match(pkg, pkg->name,
+						alpm_pkg_get_desc(pkg), &regs[n], targ);
+				if(m != NULL) {
+					_alpm_log(db->handle, ALPM_LOG_DEBUG,
+							"search target '%s' matched '%s' on package '%s'\n",
+							targ, m, pkg->name);
+					*ret = alpm_list_add(*ret, pkg);
+				}
 			}
 		}
 
@@ -442,9 +810,15 @@ int _alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
 		 * next needle. This allows for AND-based package searching. */
 		alpm_list_free(list);
 		list = *ret;
-		regfree(&reg);
 	}
 
+	for(i = needles, n = 0; i; i = i->next, n++) {
+		if(i->data) {
+			regfree(&regs[n]);
+		}
+	}
+	free(regs);
+
 	return 0;
 }
 
@@ -495,6 +869,12 @@ void _alpm_db_free_pkgcache(alpm_db_t *db)
 	_alpm_log(db->handle, ALPM_LOG_DEBUG,
 			"freeing package cache for repository '%s'\n", db->treename);
 
+	/* the name indexes borrow names from the cached packages and the
+	 * search column carries stale entry pointers */
+	_alpm_db_free_providersidx(db);
+	_alpm_db_free_revdepidx(db);
+	_alpm_db_free_searchcol(db);
+
 	if(db->pkgcache) {
 		alpm_list_free_inner(db->pkgcache->list,
 				(alpm_list_fn_free)_alpm_pkg_free);
@@ -516,7 +896,11 @@ alpm_pkghash_t *_alpm_db_get_pkgcache_hash(alpm_db_t *db)
 	}
 
 	if(!(db->status & DB_STATUS_PKGCACHE)) {
-		if(load_pkgcache(db)) {
+		int err;
+		TRACE_BEGIN(db->handle, ALPM_TRACE_DB_POPULATE, db->treename);
+		err = load_pkgcache(db);
+		TRACE_END(db->handle, ALPM_TRACE_DB_POPULATE, db->treename);
+		if(err) {
 			/* handle->error set in local/sync-db-populate */
 			return NULL;
 		}
@@ -536,6 +920,72 @@ alpm_list_t *_alpm_db_get_pkgcache(alpm_db_t *db)
 	return hash->list;
 }
 
+/* Keep a materialized group cache in sync with a package insert; called
+ * with the package already in the pkgcache. Falls back to dropping the
+ * cache on allocation failure so a later lookup rebuilds it. */
+static void grpcache_add_pkg(alpm_db_t *db, alpm_pkg_t *pkg)
+{
+	alpm_list_t *i;
+
+	if(!(db->status & DB_STATUS_GRPCACHE)) {
+		return;
+	}
+
+	for(i = alpm_pkg_get_groups(pkg); i; i = i->next) {
+		const char *grpname = i->data;
+		alpm_list_t *j;
+		alpm_group_t *grp = NULL;
+
+		for(j = db->grpcache; j; j = j->next) {
+			alpm_group_t *g = j->data;
+			if(strcmp(g->name, grpname) == 0) {
+				grp = g;
+				break;
+			}
+		}
+		if(!grp) {
+			grp = _alpm_group_new(grpname);
+			if(!grp) {
+				free_groupcache(db);
+				return;
+			}
+			db->grpcache = alpm_list_add(db->grpcache, grp);
+		}
+		grp->packages = alpm_list_add(grp->packages, pkg);
+	}
+}
+
+/* Remove a package's cache entry from every group it appears in; groups
+ * left empty are dropped. The package's own group list may not be loaded
+ * anymore, so scan all groups for the pointer instead. */
+static int ptr_cmp(const void *p1, const void *p2)
+{
+	return (p1 != p2);
+}
+
+static void grpcache_remove_pkg(alpm_db_t *db, alpm_pkg_t *pkg)
+{
+	alpm_list_t *i;
+
+	if(!(db->status & DB_STATUS_GRPCACHE)) {
+		return;
+	}
+
+	for(i = db->grpcache; i; ) {
+		alpm_group_t *grp = i->data;
+		alpm_list_t *item = i;
+		i = i->next;
+
+		grp->packages = alpm_list_remove(grp->packages, pkg,
+				ptr_cmp, NULL);
+		if(grp->packages == NULL) {
+			db->grpcache = alpm_list_remove_item(db->grpcache, item);
+			free(item);
+			_alpm_group_free(grp);
+		}
+	}
+}
+
 /* "duplicate" pkg then add it to pkgcache */
 int _alpm_db_add_pkgincache(alpm_db_t *db, alpm_pkg_t *pkg)
 {
@@ -565,7 +1015,10 @@ int _alpm_db_add_pkgincache(alpm_db_t *db, alpm_pkg_t *pkg)
 		RET_ERR(db->handle, ALPM_ERR_MEMORY, -1);
 	}
 
-	free_groupcache(db);
+	grpcache_add_pkg(db, newpkg);
+	_alpm_db_free_providersidx(db);
+	_alpm_db_free_revdepidx(db);
+	_alpm_db_free_searchcol(db);
 
 	return 0;
 }
@@ -589,15 +1042,254 @@ int _alpm_db_remove_pkgfromcache(alpm_db_t *db, alpm_pkg_t *pkg)
 		return -1;
 	}
 
+	grpcache_remove_pkg(db, data);
 	_alpm_pkg_free(data);
 
-	free_groupcache(db);
+	_alpm_db_free_providersidx(db);
+	_alpm_db_free_revdepidx(db);
+	_alpm_db_free_searchcol(db);
+
+	return 0;
+}
+
+struct nameidx_bucket {
+	const char *name;
+	unsigned long hash;
+	alpm_list_t *pkgs;
+};
+
+/* open-addressing name -> package list table, shared by the providers
+ * and reverse-dependency indexes */
+struct __alpm_nameidx_t {
+	struct nameidx_bucket *buckets;
+	unsigned int nbuckets; /* always a power of two */
+};
+
+static void nameidx_free(struct __alpm_nameidx_t *idx)
+{
+	unsigned int i;
+
+	if(idx == NULL) {
+		return;
+	}
+	for(i = 0; i < idx->nbuckets; i++) {
+		alpm_list_free(idx->buckets[i].pkgs);
+	}
+	free(idx->buckets);
+	free(idx);
+}
+
+static struct __alpm_nameidx_t *nameidx_new(size_t entries)
+{
+	struct __alpm_nameidx_t *idx;
+	unsigned int nbuckets = 64;
+
+	while(nbuckets < entries * 2) {
+		nbuckets *= 2;
+	}
+
+	CALLOC(idx, 1, sizeof(*idx), return NULL);
+	CALLOC(idx->buckets, nbuckets, sizeof(struct nameidx_bucket),
+			free(idx); return NULL);
+	idx->nbuckets = nbuckets;
+	return idx;
+}
+
+static int nameidx_insert(struct __alpm_nameidx_t *idx,
+		const char *name, unsigned long hash, alpm_pkg_t *pkg)
+{
+	unsigned int pos = hash & (idx->nbuckets - 1);
+	alpm_list_t *pkgs;
 
+	while(idx->buckets[pos].name) {
+		if(idx->buckets[pos].hash == hash &&
+				strcmp(idx->buckets[pos].name, name) == 0) {
+			break;
+		}
+		pos = (pos + 1) & (idx->nbuckets - 1);
+	}
+
+	pkgs = alpm_list_add(idx->buckets[pos].pkgs, pkg);
+	if(pkgs == NULL) {
+		return -1;
+	}
+	idx->buckets[pos].name = name;
+	idx->buckets[pos].hash = hash;
+	idx->buckets[pos].pkgs = pkgs;
+	return 0;
+}
+
+static alpm_list_t *nameidx_lookup(struct __alpm_nameidx_t *idx,
+		const char *name, unsigned long hash)
+{
+	unsigned int pos = hash & (idx->nbuckets - 1);
+
+	while(idx->buckets[pos].name) {
+		if(idx->buckets[pos].hash == hash &&
+				strcmp(idx->buckets[pos].name, name) == 0) {
+			return idx->buckets[pos].pkgs;
+		}
+		pos = (pos + 1) & (idx->nbuckets - 1);
+	}
+	return NULL;
+}
+
+void _alpm_db_free_providersidx(alpm_db_t *db)
+{
+	if(db == NULL) {
+		return;
+	}
+	nameidx_free(db->providersidx);
+	db->providersidx = NULL;
+}
+
+void _alpm_db_free_revdepidx(alpm_db_t *db)
+{
+	if(db == NULL) {
+		return;
+	}
+	nameidx_free(db->revdepidx[0]);
+	nameidx_free(db->revdepidx[1]);
+	db->revdepidx[0] = NULL;
+	db->revdepidx[1] = NULL;
+}
+
+/* Build the name -> providers index from the package cache. Each package
+ * is indexed under its own name and every name it provides, so dependency
+ * lookups only inspect packages that can actually satisfy the name.
+ * Version constraints are still checked by the caller. The indexed names
+ * are borrowed from the packages, which is why the index must be freed
+ * whenever the package cache changes. */
+static int providersidx_build(alpm_db_t *db)
+{
+	alpm_list_t *i, *j;
+	struct __alpm_nameidx_t *idx;
+	size_t entries = 0;
+
+	for(i = db->pkgcache->list; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		entries += 1 + alpm_list_count(alpm_pkg_get_provides(pkg));
+	}
+
+	idx = nameidx_new(entries);
+	if(idx == NULL) {
+		return -1;
+	}
+	db->providersidx = idx;
+
+	for(i = db->pkgcache->list; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		if(nameidx_insert(idx, pkg->name, pkg->name_hash, pkg) != 0) {
+			goto error;
+		}
+		for(j = alpm_pkg_get_provides(pkg); j; j = j->next) {
+			alpm_depend_t *provide = j->data;
+			if(nameidx_insert(idx, provide->name, provide->name_hash,
+						pkg) != 0) {
+				goto error;
+			}
+		}
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"built providers index for repository '%s' (%zu entries)\n",
+			db->treename, entries);
+	return 0;
+
+error:
+	_alpm_db_free_providersidx(db);
+	return -1;
+}
+
+/* Look up all packages providing a name. On success *providers is set to
+ * the (possibly empty) list of candidates, owned by the index. Returns -1
+ * if the index is unavailable; the caller should then fall back to a full
+ * cache scan. */
+int _alpm_db_get_providers(alpm_db_t *db, const char *name,
+		alpm_list_t **providers)
+{
+	*providers = NULL;
+	if(_alpm_db_get_pkgcache_hash(db) == NULL) {
+		return -1;
+	}
+	if(db->providersidx == NULL && providersidx_build(db) != 0) {
+		return -1;
+	}
+
+	*providers = nameidx_lookup(db->providersidx, name, _alpm_hash_sdbm(name));
+	return 0;
+}
+
+/* Build the dependency name -> depending packages index from the package
+ * cache. Each package is indexed under the names it depends on, so
+ * "who requires X" queries only inspect packages that actually name X
+ * (or one of its provisions) in a dependency. Version constraints are
+ * still checked by the caller via _alpm_depcmp(). */
+static int revdepidx_build(alpm_db_t *db, int optional)
+{
+	alpm_list_t *i, *j;
+	struct __alpm_nameidx_t *idx;
+	size_t entries = 0;
+
+	for(i = db->pkgcache->list; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		entries += alpm_list_count(optional ?
+				alpm_pkg_get_optdepends(pkg) : alpm_pkg_get_depends(pkg));
+	}
+
+	idx = nameidx_new(entries);
+	if(idx == NULL) {
+		return -1;
+	}
+	db->revdepidx[optional] = idx;
+
+	for(i = db->pkgcache->list; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		j = optional ? alpm_pkg_get_optdepends(pkg)
+				: alpm_pkg_get_depends(pkg);
+		for(; j; j = j->next) {
+			alpm_depend_t *dep = j->data;
+			if(nameidx_insert(idx, dep->name, dep->name_hash, pkg) != 0) {
+				nameidx_free(idx);
+				db->revdepidx[optional] = NULL;
+				return -1;
+			}
+		}
+	}
+
+	_alpm_log(db->handle, ALPM_LOG_DEBUG,
+			"built reverse %sdependency index for repository '%s' (%zu entries)\n",
+			optional ? "optional " : "", db->treename, entries);
+	return 0;
+}
+
+/* Look up all packages whose (opt)depends name 'name'. On success *rdeps
+ * is set to the (possibly empty) list of candidates, owned by the index.
+ * Returns -1 if the index is unavailable; the caller should then fall
+ * back to a full cache scan. */
+int _alpm_db_get_revdeps(alpm_db_t *db, const char *name, int optional,
+		alpm_list_t **rdeps)
+{
+	optional = optional ? 1 : 0;
+
+	*rdeps = NULL;
+	if(_alpm_db_get_pkgcache_hash(db) == NULL) {
+		return -1;
+	}
+	if(db->revdepidx[optional] == NULL &&
+			revdepidx_build(db, optional) != 0) {
+		return -1;
+	}
+
+	*rdeps = nameidx_lookup(db->revdepidx[optional], name,
+			_alpm_hash_sdbm(name));
 	return 0;
 }
 
 alpm_pkg_t *_alpm_db_get_pkgfromcache(alpm_db_t *db, const char *target)
 {
+	alpm_pkg_t *pkg;
+
 	if(db == NULL) {
 		return NULL;
 	}
@@ -607,7 +1299,18 @@ alpm_pkg_t *_alpm_db_get_pkgfromcache(alpm_db_t *db, const char *target)
 		return NULL;
 	}
 
-	return _alpm_pkghash_find(pkgcache, target);
+	pkg = _alpm_pkghash_find(pkgcache, target);
+
+	/* callers include worker threads (e.g. the sysupgrade scan), so the
+	 * counters take the lock; one critical section covers both */
+	pthread_mutex_lock(&db->handle->counters_lock);
+	db->handle->counters.cache_lookups++;
+	if(pkg) {
+		db->handle->counters.cache_hits++;
+	}
+	pthread_mutex_unlock(&db->handle->counters_lock);
+
+	return pkg;
 }
 
 /* Returns a new group cache from db.
@@ -615,6 +1318,10 @@ alpm_pkg_t *_alpm_db_get_pkgfromcache(alpm_db_t *db, const char *target)
 static int load_grpcache(alpm_db_t *db)
 {
 	alpm_list_t *lp;
+	/* group names are resolved through a temporary hash table so the build
+	 * stays linear in the number of package/group memberships */
+	size_t nbuckets = 256, ngroups = 0;
+	alpm_group_t **buckets;
 
 	if(db == NULL) {
 		return -1;
@@ -623,41 +1330,64 @@ static int load_grpcache(alpm_db_t *db)
 	_alpm_log(db->handle, ALPM_LOG_DEBUG, "loading group cache for repository '%s'\n",
 			db->treename);
 
+	CALLOC(buckets, nbuckets, sizeof(alpm_group_t *), return -1);
+
 	for(lp = _alpm_db_get_pkgcache(db); lp; lp = lp->next) {
 		const alpm_list_t *i;
 		alpm_pkg_t *pkg = lp->data;
 
 		for(i = alpm_pkg_get_groups(pkg); i; i = i->next) {
 			const char *grpname = i->data;
-			alpm_list_t *j;
-			alpm_group_t *grp = NULL;
-			int found = 0;
-
-			/* first look through the group cache for a group with this name */
-			for(j = db->grpcache; j; j = j->next) {
-				grp = j->data;
-
-				if(strcmp(grp->name, grpname) == 0
-						&& !alpm_list_find_ptr(grp->packages, pkg)) {
-					grp->packages = alpm_list_add(grp->packages, pkg);
-					found = 1;
+			alpm_group_t *grp;
+			size_t position = _alpm_hash_sdbm(grpname) % nbuckets;
+
+			while((grp = buckets[position]) != NULL) {
+				if(strcmp(grp->name, grpname) == 0) {
 					break;
 				}
+				position = (position + 1) % nbuckets;
 			}
-			if(found) {
+			if(grp) {
+				grp->packages = alpm_list_add(grp->packages, pkg);
 				continue;
 			}
+
 			/* we didn't find the group, so create a new one with this name */
 			grp = _alpm_group_new(grpname);
 			if(!grp) {
+				free(buckets);
 				free_groupcache(db);
 				return -1;
 			}
 			grp->packages = alpm_list_add(grp->packages, pkg);
 			db->grpcache = alpm_list_add(db->grpcache, grp);
+			buckets[position] = grp;
+			ngroups++;
+
+			if(ngroups * 2 >= nbuckets) {
+				/* rehash at 50% load to keep probe chains short */
+				alpm_group_t **newbuckets;
+				alpm_list_t *j;
+				size_t newsize = nbuckets * 2;
+
+				CALLOC(newbuckets, newsize, sizeof(alpm_group_t *),
+						free(buckets); free_groupcache(db); return -1);
+				for(j = db->grpcache; j; j = j->next) {
+					alpm_group_t *g = j->data;
+					size_t pos = _alpm_hash_sdbm(g->name) % newsize;
+					while(newbuckets[pos] != NULL) {
+						pos = (pos + 1) % newsize;
+					}
+					newbuckets[pos] = g;
+				}
+				free(buckets);
+				buckets = newbuckets;
+				nbuckets = newsize;
+			}
 		}
 	}
 
+	free(buckets);
 	db->status |= DB_STATUS_GRPCACHE;
 	return 0;
 }
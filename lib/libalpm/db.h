@@ -22,12 +22,17 @@
 #ifndef ALPM_DB_H
 #define ALPM_DB_H
 
+#include <stdio.h>
+
 /* libarchive */
+#include <sys/stat.h> /* struct stat */
+
 #include <archive.h>
 #include <archive_entry.h>
 
 #include "alpm.h"
 #include "pkghash.h"
+#include "strpool.h"
 #include "signing.h"
 
 /* Database entries */
@@ -68,10 +73,40 @@ struct __alpm_db_t {
 	/* do not access directly, use _alpm_db_path(db) for lazy access */
 	char *_path;
 	alpm_pkghash_t *pkgcache;
+	/* interning pool backing pooled package metadata strings */
+	_alpm_strpool_t *strpool;
+	/* interning pool sharing parsed dependency objects across packages
+	 * whose deps_pooled flag is set (deps.c) */
+	struct __alpm_deppool_t *deppool;
+	/* open memstream collecting local db journal records while a batch
+	 * is active; flushed to the journal in a single append with one
+	 * header restamp by _alpm_local_db_journal_batch_end() (be_local.c) */
+	FILE *journal_batch;
+	char *journal_batch_buf;
+	size_t journal_batch_size;
+	int journal_batch_err;
+	/* lazily built name -> providing packages index; freed whenever the
+	 * package cache changes */
+	struct __alpm_nameidx_t *providersidx;
+	/* lazily built dependency name -> depending packages indexes
+	 * ([0] depends, [1] optdepends); freed with the providers index */
+	struct __alpm_nameidx_t *revdepidx[2];
+	/* lazily built contiguous name+desc text column scanned by
+	 * _alpm_db_search(); freed whenever the package cache changes */
+	struct __alpm_searchcol_t *searchcol;
 	alpm_list_t *grpcache;
 	alpm_list_t *servers;
 	struct db_operations *ops;
 
+	/* identity of the on-disk database when the package cache was
+	 * populated; alpm_db_snapshot_check() compares against a fresh stat
+	 * so lockless readers can detect a concurrent writer */
+	int64_t snap_mtime;
+	int64_t snap_mtime_nsec;
+	int64_t snap_ino;
+	int64_t snap_size;
+	int snap_valid;
+
 	/* bitfields for validity, local, loaded caches, etc. */
 	/* From _alpm_dbstatus_t */
 	int status;
@@ -85,6 +120,7 @@ struct __alpm_db_t {
 /* db.c, database general calls */
 alpm_db_t *_alpm_db_new(const char *treename, int is_local);
 void _alpm_db_free(alpm_db_t *db);
+void _alpm_db_snapshot_stamp(alpm_db_t *db, const struct stat *st);
 const char *_alpm_db_path(alpm_db_t *db);
 int _alpm_db_cmp(const void *d1, const void *d2);
 int _alpm_db_search(alpm_db_t *db, const alpm_list_t *needles,
@@ -99,6 +135,9 @@ int _alpm_local_db_prepare(alpm_db_t *db, alpm_pkg_t *info);
 int _alpm_local_db_write(alpm_db_t *db, alpm_pkg_t *info, int inforeq);
 int _alpm_local_db_remove(alpm_db_t *db, alpm_pkg_t *info);
 char *_alpm_local_db_pkgpath(alpm_db_t *db, alpm_pkg_t *info, const char *filename);
+void _alpm_local_db_journal_batch_begin(alpm_db_t *db);
+int _alpm_local_db_journal_batch_end(alpm_db_t *db);
+int _alpm_local_db_owners_rebuild(alpm_db_t *db);
 
 /* cache bullshit */
 /* packages */
@@ -108,6 +147,13 @@ int _alpm_db_remove_pkgfromcache(alpm_db_t *db, alpm_pkg_t *pkg);
 alpm_pkghash_t *_alpm_db_get_pkgcache_hash(alpm_db_t *db);
 alpm_list_t *_alpm_db_get_pkgcache(alpm_db_t *db);
 alpm_pkg_t *_alpm_db_get_pkgfromcache(alpm_db_t *db, const char *target);
+int _alpm_db_get_providers(alpm_db_t *db, const char *name,
+		alpm_list_t **providers);
+void _alpm_db_free_providersidx(alpm_db_t *db);
+int _alpm_db_get_revdeps(alpm_db_t *db, const char *name, int optional,
+		alpm_list_t **rdeps);
+void _alpm_db_free_revdepidx(alpm_db_t *db);
+void _alpm_db_free_searchcol(alpm_db_t *db);
 /* groups */
 alpm_list_t *_alpm_db_get_groupcache(alpm_db_t *db);
 alpm_group_t *_alpm_db_get_groupfromcache(alpm_db_t *db, const char *target);
@@ -23,6 +23,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 /* libalpm */
 #include "deps.h"
@@ -96,16 +100,79 @@ static alpm_pkg_t *find_dep_satisfier(alpm_list_t *pkgs, alpm_depend_t *dep)
 	return NULL;
 }
 
+/* per-package record used while building the dependency graph */
+struct dep_candidate {
+	alpm_pkg_t *pkg;
+	alpm_graph_t *vertex; /* NULL until the package joins the graph */
+	alpm_graph_t *edge_from; /* last vertex an edge was added from */
+};
+
+struct depidx_bucket {
+	const char *name;
+	unsigned long hash;
+	alpm_list_t *entries; /* struct dep_candidate * */
+};
+
+static int depidx_insert(struct depidx_bucket *buckets, size_t nbuckets,
+		const char *name, unsigned long hash, struct dep_candidate *cand)
+{
+	size_t pos = hash & (nbuckets - 1);
+	alpm_list_t *entries;
+
+	while(buckets[pos].name) {
+		if(buckets[pos].hash == hash &&
+				strcmp(buckets[pos].name, name) == 0) {
+			break;
+		}
+		pos = (pos + 1) & (nbuckets - 1);
+	}
+	entries = alpm_list_add(buckets[pos].entries, cand);
+	if(entries == NULL) {
+		return -1;
+	}
+	buckets[pos].name = name;
+	buckets[pos].hash = hash;
+	buckets[pos].entries = entries;
+	return 0;
+}
+
+static alpm_list_t *depidx_get(struct depidx_bucket *buckets, size_t nbuckets,
+		const char *name, unsigned long hash)
+{
+	size_t pos = hash & (nbuckets - 1);
+
+	while(buckets[pos].name) {
+		if(buckets[pos].hash == hash &&
+				strcmp(buckets[pos].name, name) == 0) {
+			return buckets[pos].entries;
+		}
+		pos = (pos + 1) & (nbuckets - 1);
+	}
+	return NULL;
+}
+
 /* Convert a list of alpm_pkg_t * to a graph structure,
  * with a edge for each dependency.
  * Returns a list of vertices (one vertex = one package)
  * (used by alpm_sortbydeps)
+ *
+ * Edges are found through a temporary name -> candidates hash over the
+ * targets and the local packages, so construction is linear in packages
+ * plus dependency entries rather than quadratic in targets. Graph nodes
+ * come out of *arenaref, which the caller must free along with the
+ * returned list. Returns NULL on allocation failure.
  */
 static alpm_list_t *dep_graph_init(alpm_handle_t *handle,
-		alpm_list_t *targets, alpm_list_t *ignore)
+		alpm_list_t *targets, alpm_list_t *ignore,
+		alpm_graph_arena_t **arenaref)
 {
-	alpm_list_t *i, *j;
+	alpm_list_t *i, *j, *k;
 	alpm_list_t *vertices = NULL;
+	alpm_graph_arena_t *arena;
+	struct dep_candidate *cands = NULL;
+	struct depidx_bucket *buckets = NULL;
+	size_t ntargets = alpm_list_count(targets);
+	size_t ncands, nnames = 0, nbuckets = 64, r;
 	alpm_list_t *localpkgs = alpm_list_diff(
 			alpm_db_get_pkgcache(handle->db_local), targets, _alpm_pkg_cmp);
 
@@ -115,47 +182,112 @@ static alpm_list_t *dep_graph_init(alpm_handle_t *handle,
 		alpm_list_free(oldlocal);
 	}
 
-	/* We create the vertices */
+	*arenaref = arena = _alpm_graph_arena_new(ntargets);
+	if(arena == NULL) {
+		goto error;
+	}
+
+	ncands = ntargets + alpm_list_count(localpkgs);
+	CALLOC(cands, ncands, sizeof(struct dep_candidate), goto error);
+
+	/* We create the vertices; targets join the graph right away, local
+	 * packages only when an edge first reaches them */
+	r = 0;
 	for(i = targets; i; i = i->next) {
-		alpm_graph_t *vertex = _alpm_graph_new();
+		alpm_graph_t *vertex = _alpm_graph_arena_alloc(arena);
+		if(vertex == NULL) {
+			goto error;
+		}
 		vertex->data = (void *)i->data;
 		vertices = alpm_list_add(vertices, vertex);
+		cands[r].pkg = i->data;
+		cands[r].vertex = vertex;
+		r++;
+	}
+	for(i = localpkgs; i; i = i->next) {
+		cands[r].pkg = i->data;
+		r++;
 	}
 
-	/* We compute the edges */
+	/* index every candidate under its name and everything it provides */
+	for(r = 0; r < ncands; r++) {
+		nnames += 1 + alpm_list_count(alpm_pkg_get_provides(cands[r].pkg));
+	}
+	while(nbuckets < nnames * 2) {
+		nbuckets *= 2;
+	}
+	CALLOC(buckets, nbuckets, sizeof(struct depidx_bucket), goto error);
+	for(r = 0; r < ncands; r++) {
+		alpm_pkg_t *pkg = cands[r].pkg;
+		if(depidx_insert(buckets, nbuckets, pkg->name, pkg->name_hash,
+					&cands[r]) != 0) {
+			goto error;
+		}
+		for(j = alpm_pkg_get_provides(pkg); j; j = j->next) {
+			alpm_depend_t *provide = j->data;
+			if(depidx_insert(buckets, nbuckets, provide->name,
+						provide->name_hash, &cands[r]) != 0) {
+				goto error;
+			}
+		}
+	}
+
+	/* We compute the edges. The vertex list keeps growing while we walk
+	 * it, which lazily pulls local packages into the graph so they don't
+	 * get resolved unnecessarily */
 	for(i = vertices; i; i = i->next) {
 		alpm_graph_t *vertex_i = i->data;
 		alpm_pkg_t *p_i = vertex_i->data;
 		/* TODO this should be somehow combined with alpm_checkdeps */
-		for(j = vertices; j; j = j->next) {
-			alpm_graph_t *vertex_j = j->data;
-			alpm_pkg_t *p_j = vertex_j->data;
-			if(_alpm_pkg_depends_on(p_i, p_j)) {
-				vertex_i->children =
-					alpm_list_add(vertex_i->children, vertex_j);
-			}
-		}
-
-		/* lazily add local packages to the dep graph so they don't
-		 * get resolved unnecessarily */
-		j = localpkgs;
-		while(j) {
-			alpm_list_t *next = j->next;
-			if(_alpm_pkg_depends_on(p_i, j->data)) {
-				alpm_graph_t *vertex_j = _alpm_graph_new();
-				vertex_j->data = (void *)j->data;
-				vertices = alpm_list_add(vertices, vertex_j);
-				vertex_i->children = alpm_list_add(vertex_i->children, vertex_j);
-				localpkgs = alpm_list_remove_item(localpkgs, j);
-				free(j);
+		for(j = alpm_pkg_get_depends(p_i); j; j = j->next) {
+			alpm_depend_t *dep = j->data;
+			for(k = depidx_get(buckets, nbuckets, dep->name, dep->name_hash);
+					k; k = k->next) {
+				struct dep_candidate *cand = k->data;
+				if(cand->edge_from == vertex_i) {
+					/* an earlier dependency already drew this edge */
+					continue;
+				}
+				if(!_alpm_depcmp(cand->pkg, dep)) {
+					continue;
+				}
+				if(cand->vertex == NULL) {
+					cand->vertex = _alpm_graph_arena_alloc(arena);
+					if(cand->vertex == NULL) {
+						goto error;
+					}
+					cand->vertex->data = (void *)cand->pkg;
+					vertices = alpm_list_add(vertices, cand->vertex);
+				}
+				if(_alpm_graph_arena_add_child(arena, vertex_i,
+							cand->vertex) != 0) {
+					goto error;
+				}
+				cand->edge_from = vertex_i;
 			}
-			j = next;
 		}
-
 		vertex_i->iterator = vertex_i->children;
 	}
+
+	for(r = 0; r < nbuckets; r++) {
+		alpm_list_free(buckets[r].entries);
+	}
+	free(buckets);
+	free(cands);
 	alpm_list_free(localpkgs);
 	return vertices;
+
+error:
+	if(buckets) {
+		for(r = 0; r < nbuckets; r++) {
+			alpm_list_free(buckets[r].entries);
+		}
+		free(buckets);
+	}
+	free(cands);
+	alpm_list_free(vertices);
+	alpm_list_free(localpkgs);
+	return NULL;
 }
 
 static void _alpm_warn_dep_cycle(alpm_handle_t *handle, alpm_list_t *targets,
@@ -217,6 +349,7 @@ alpm_list_t *_alpm_sortbydeps(alpm_handle_t *handle,
 	alpm_list_t *vertices = NULL;
 	alpm_list_t *i;
 	alpm_graph_t *vertex;
+	alpm_graph_arena_t *arena = NULL;
 
 	if(targets == NULL) {
 		return NULL;
@@ -224,7 +357,12 @@ alpm_list_t *_alpm_sortbydeps(alpm_handle_t *handle,
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "started sorting dependencies\n");
 
-	vertices = dep_graph_init(handle, targets, ignore);
+	vertices = dep_graph_init(handle, targets, ignore, &arena);
+	if(vertices == NULL) {
+		/* allocation failure; fall back to the unsorted target order */
+		_alpm_graph_arena_free(arena);
+		return alpm_list_copy(targets);
+	}
 
 	i = vertices;
 	vertex = vertices->data;
@@ -272,8 +410,8 @@ alpm_list_t *_alpm_sortbydeps(alpm_handle_t *handle,
 		newtargs = tmptargs;
 	}
 
-	alpm_list_free_inner(vertices, _alpm_graph_free);
 	alpm_list_free(vertices);
+	_alpm_graph_arena_free(arena);
 
 	return newtargs;
 }
@@ -297,6 +435,119 @@ alpm_pkg_t SYMEXPORT *alpm_find_satisfier(alpm_list_t *pkgs, const char *depstri
 	return pkg;
 }
 
+/* Index over one package universe answering "which package satisfies
+ * this dependency?" probes. Every satisfier shares its name with the
+ * dependency, either literally or through a Provides entry, so packages
+ * are bucketed under their name and every provision name; a probe scans
+ * one bucket with _alpm_depcmp() instead of the whole list. Bucket
+ * order follows list order, so the package reported for a dependency is
+ * the same one a linear scan would have found. */
+struct satidx_bucket {
+	unsigned long hash;
+	const char *name;
+	alpm_list_t *pkgs;
+};
+
+struct satidx {
+	struct satidx_bucket *buckets;
+	size_t nbuckets; /* always a power of two */
+};
+
+static void satidx_free(struct satidx *idx)
+{
+	size_t n;
+	if(idx == NULL) {
+		return;
+	}
+	for(n = 0; n < idx->nbuckets; n++) {
+		alpm_list_free(idx->buckets[n].pkgs);
+	}
+	free(idx->buckets);
+	free(idx);
+}
+
+static int satidx_insert(struct satidx *idx, const char *name,
+		unsigned long hash, alpm_pkg_t *pkg)
+{
+	size_t pos = hash & (idx->nbuckets - 1);
+	while(idx->buckets[pos].name) {
+		if(idx->buckets[pos].hash == hash
+				&& strcmp(idx->buckets[pos].name, name) == 0) {
+			break;
+		}
+		pos = (pos + 1) & (idx->nbuckets - 1);
+	}
+	idx->buckets[pos].hash = hash;
+	idx->buckets[pos].name = name;
+	return alpm_list_append(&idx->buckets[pos].pkgs, pkg) ? 0 : -1;
+}
+
+static struct satidx *satidx_build(alpm_list_t *pkgs)
+{
+	struct satidx *idx;
+	alpm_list_t *i, *j;
+	size_t entries = 0;
+
+	for(i = pkgs; i; i = i->next) {
+		entries += 1 + alpm_list_count(alpm_pkg_get_provides(i->data));
+	}
+	if(entries == 0) {
+		return NULL;
+	}
+
+	CALLOC(idx, 1, sizeof(*idx), return NULL);
+	idx->nbuckets = 64;
+	while(idx->nbuckets < entries * 2) {
+		idx->nbuckets *= 2;
+	}
+	CALLOC(idx->buckets, idx->nbuckets, sizeof(*idx->buckets),
+			free(idx); return NULL);
+
+	for(i = pkgs; i; i = i->next) {
+		alpm_pkg_t *pkg = i->data;
+		if(satidx_insert(idx, pkg->name, pkg->name_hash, pkg) != 0) {
+			satidx_free(idx);
+			return NULL;
+		}
+		for(j = alpm_pkg_get_provides(pkg); j; j = j->next) {
+			alpm_depend_t *prov = j->data;
+			if(satidx_insert(idx, prov->name, prov->name_hash, pkg) != 0) {
+				satidx_free(idx);
+				return NULL;
+			}
+		}
+	}
+	return idx;
+}
+
+/* Falls back to a linear scan of pkgs when the index could not be
+ * built, so callers need not care about allocation failure. */
+static alpm_pkg_t *satidx_find(struct satidx *idx, alpm_list_t *pkgs,
+		alpm_depend_t *dep)
+{
+	size_t pos;
+	alpm_list_t *c;
+
+	if(idx == NULL) {
+		return find_dep_satisfier(pkgs, dep);
+	}
+
+	pos = dep->name_hash & (idx->nbuckets - 1);
+	while(idx->buckets[pos].name) {
+		if(idx->buckets[pos].hash == dep->name_hash
+				&& strcmp(idx->buckets[pos].name, dep->name) == 0) {
+			for(c = idx->buckets[pos].pkgs; c; c = c->next) {
+				if(_alpm_depcmp(c->data, dep)) {
+					return c->data;
+				}
+			}
+			return NULL;
+		}
+		pos = (pos + 1) & (idx->nbuckets - 1);
+	}
+	return NULL;
+}
+
 alpm_list_t SYMEXPORT *alpm_checkdeps(alpm_handle_t *handle,
 		alpm_list_t *pkglist, alpm_list_t *rem, alpm_list_t *upgrade,
 		int reversedeps)
@@ -304,6 +555,7 @@ alpm_list_t SYMEXPORT *alpm_checkdeps(alpm_handle_t *handle,
 	alpm_list_t *i, *j;
 	alpm_list_t *dblist = NULL, *modified = NULL;
 	alpm_list_t *baddeps = NULL;
+	struct satidx *dbidx, *upgradeidx, *modifiedidx;
 	int nodepversion;
 
 	CHECK_HANDLE(handle, return NULL);
@@ -317,6 +569,13 @@ alpm_list_t SYMEXPORT *alpm_checkdeps(alpm_handle_t *handle,
 		}
 	}
 
+	/* every dependency of every remaining package gets probed against
+	 * these sets; index them once so each probe is a bucket scan rather
+	 * than a walk over the installed package universe */
+	dbidx = satidx_build(dblist);
+	upgradeidx = satidx_build(upgrade);
+	modifiedidx = satidx_build(modified);
+
 	nodepversion = no_dep_version(handle);
 
 	/* look for unsatisfied dependencies of the upgrade list */
@@ -334,8 +593,8 @@ alpm_list_t SYMEXPORT *alpm_checkdeps(alpm_handle_t *handle,
 			/* 1. we check the upgrade list */
 			/* 2. we check database for untouched satisfying packages */
 			/* 3. we check the dependency ignore list */
-			if(!find_dep_satisfier(upgrade, depend) &&
-					!find_dep_satisfier(dblist, depend) &&
+			if(!satidx_find(upgradeidx, upgrade, depend) &&
+					!satidx_find(dbidx, dblist, depend) &&
 					!_alpm_depcmp_provides(depend, handle->assumeinstalled)) {
 				/* Unsatisfied dependency in the upgrade list */
 				alpm_depmissing_t *miss;
@@ -361,14 +620,14 @@ alpm_list_t SYMEXPORT *alpm_checkdeps(alpm_handle_t *handle,
 				if(nodepversion) {
 					depend->mod = ALPM_DEP_MOD_ANY;
 				}
-				alpm_pkg_t *causingpkg = find_dep_satisfier(modified, depend);
+				alpm_pkg_t *causingpkg = satidx_find(modifiedidx, modified, depend);
 				/* we won't break this depend, if it is already broken, we ignore it */
 				/* 1. check upgrade list for satisfiers */
 				/* 2. check dblist for satisfiers */
 				/* 3. we check the dependency ignore list */
 				if(causingpkg &&
-						!find_dep_satisfier(upgrade, depend) &&
-						!find_dep_satisfier(dblist, depend) &&
+						!satidx_find(upgradeidx, upgrade, depend) &&
+						!satidx_find(dbidx, dblist, depend) &&
 						!_alpm_depcmp_provides(depend, handle->assumeinstalled)) {
 					alpm_depmissing_t *miss;
 					char *missdepstring = alpm_dep_compute_string(depend);
@@ -383,6 +642,9 @@ alpm_list_t SYMEXPORT *alpm_checkdeps(alpm_handle_t *handle,
 		}
 	}
 
+	satidx_free(dbidx);
+	satidx_free(upgradeidx);
+	satidx_free(modifiedidx);
 	alpm_list_free(modified);
 	alpm_list_free(dblist);
 
@@ -522,6 +784,108 @@ error:
 	return NULL;
 }
 
+struct deppool_entry {
+	unsigned long hash; /* of the raw depstring */
+	char *depstring;
+	alpm_depend_t *dep;
+};
+
+struct __alpm_deppool_t {
+	struct deppool_entry *entries;
+	unsigned int nentries; /* always a power of two */
+	unsigned int count;
+};
+
+_alpm_deppool_t *_alpm_deppool_new(void)
+{
+	_alpm_deppool_t *pool;
+	CALLOC(pool, 1, sizeof(*pool), return NULL);
+	pool->nentries = 256;
+	CALLOC(pool->entries, pool->nentries, sizeof(*pool->entries),
+			free(pool); return NULL);
+	return pool;
+}
+
+/* Look up (or parse and insert) the dependency for a raw depstring.
+ * With a NULL pool this degrades to a plain alpm_dep_from_string() so
+ * callers need not handle pool allocation failure; should an insertion
+ * fail the parsed object is still returned, merely unshared (and leaked
+ * at teardown, which only happens under memory exhaustion). */
+alpm_depend_t *_alpm_deppool_intern(_alpm_deppool_t *pool, const char *depstring)
+{
+	unsigned long hash;
+	unsigned int pos, mask;
+	alpm_depend_t *dep;
+
+	if(pool == NULL || depstring == NULL) {
+		return alpm_dep_from_string(depstring);
+	}
+
+	hash = _alpm_hash_sdbm(depstring);
+	mask = pool->nentries - 1;
+	pos = hash & mask;
+	while(pool->entries[pos].dep) {
+		if(pool->entries[pos].hash == hash
+				&& strcmp(pool->entries[pos].depstring, depstring) == 0) {
+			return pool->entries[pos].dep;
+		}
+		pos = (pos + 1) & mask;
+	}
+
+	if((dep = alpm_dep_from_string(depstring)) == NULL) {
+		return NULL;
+	}
+
+	/* grow at 50% load so probe sequences stay short */
+	if(pool->count + 1 > pool->nentries / 2) {
+		struct deppool_entry *entries;
+		unsigned int i, nentries = pool->nentries * 2;
+		CALLOC(entries, nentries, sizeof(*entries), return dep);
+		for(i = 0; i < pool->nentries; i++) {
+			unsigned int newpos;
+			if(pool->entries[i].dep == NULL) {
+				continue;
+			}
+			newpos = pool->entries[i].hash & (nentries - 1);
+			while(entries[newpos].dep) {
+				newpos = (newpos + 1) & (nentries - 1);
+			}
+			entries[newpos] = pool->entries[i];
+		}
+		free(pool->entries);
+		pool->entries = entries;
+		pool->nentries = nentries;
+		mask = nentries - 1;
+		pos = hash & mask;
+		while(pool->entries[pos].dep) {
+			pos = (pos + 1) & mask;
+		}
+	}
+
+	STRDUP(pool->entries[pos].depstring, depstring, return dep);
+	pool->entries[pos].hash = hash;
+	pool->entries[pos].dep = dep;
+	pool->count++;
+
+	return dep;
+}
+
+void _alpm_deppool_free(_alpm_deppool_t *pool)
+{
+	unsigned int i;
+	if(pool == NULL) {
+		return;
+	}
+	for(i = 0; i < pool->nentries; i++) {
+		if(pool->entries[i].dep) {
+			free(pool->entries[i].depstring);
+			alpm_dep_free(pool->entries[i].dep);
+		}
+	}
+	free(pool->entries);
+	free(pool);
+}
+
 alpm_depend_t *_alpm_dep_dup(const alpm_depend_t *dep)
 {
 	alpm_depend_t *newdep;
@@ -608,7 +972,7 @@ int _alpm_recursedeps(alpm_db_t *db, alpm_list_t **targs, int include_explicit)
 		alpm_pkg_t *pkg = i->data, *copy = NULL;
 		_alpm_log(db->handle, ALPM_LOG_DEBUG,
 				"adding '%s' to the targets\n", pkg->name);
-		if(_alpm_pkg_dup(pkg, &copy)) {
+		if(_alpm_pkg_dup_shared(pkg, &copy)) {
 			/* we return memory on "non-fatal" error in _alpm_pkg_dup */
 			_alpm_pkg_free(copy);
 			alpm_list_free(rem);
@@ -621,6 +985,356 @@ int _alpm_recursedeps(alpm_db_t *db, alpm_list_t **targs, int include_explicit)
 	return 0;
 }
 
+/* Persistent resolver cache
+ *
+ * Provider searches walk every candidate in every sync db; hosts that run
+ * many small transactions in a row resolve the same depstrings to the same
+ * packages over and over. Decisions made by resolvedep() are persisted to
+ * <dbpath>resolver.cache, keyed by depstring and fingerprinted with the
+ * sync db mtimes and sizes, so repeat resolutions against unchanged repos
+ * skip the provider scan. A cache hit is only ever a hint: the named
+ * package must still exist, satisfy the dependency and pass the usual
+ * exclusion and ignore checks, otherwise the full search runs as before.
+ */
+
+#define DEPCACHE_VERSION 1
+#define DEPCACHE_FILENAME "resolver.cache"
+#define DEPCACHE_MIN_BUCKETS 64
+
+struct depcache_entry {
+	char *depstring;
+	char *dbname;
+	char *pkgname;
+	char *pkgver;
+};
+
+struct _alpm_depcache {
+	struct depcache_entry **slots;
+	size_t nslots; /* always a power of two */
+	size_t count;
+	unsigned long fingerprint;
+	int dirty;
+};
+
+static void depcache_path(alpm_handle_t *handle, char *path, size_t size)
+{
+	snprintf(path, size, "%s" DEPCACHE_FILENAME, handle->dbpath);
+}
+
+/* hash the identity of every registered sync db together; a changed mtime
+ * or size on any of them invalidates the whole cache */
+static unsigned long depcache_fingerprint(alpm_handle_t *handle)
+{
+	alpm_list_t *i;
+	unsigned long fp = 0;
+
+	for(i = handle->dbs_sync; i; i = i->next) {
+		alpm_db_t *db = i->data;
+		const char *dbpath = _alpm_db_path(db);
+		struct stat st;
+		char buf[PATH_MAX];
+
+		if(dbpath == NULL || stat(dbpath, &st) != 0) {
+			st.st_mtime = 0;
+			st.st_size = 0;
+		}
+		snprintf(buf, sizeof(buf), "%s:%lld:%lld;", db->treename,
+				(long long)st.st_mtime, (long long)st.st_size);
+		fp ^= _alpm_hash_sdbm(buf) + 0x9e3779b9 + (fp << 6) + (fp >> 2);
+	}
+
+	return fp;
+}
+
+static struct depcache_entry **depcache_slot(struct _alpm_depcache *cache,
+		const char *depstring)
+{
+	size_t i = _alpm_hash_sdbm(depstring) & (cache->nslots - 1);
+
+	while(cache->slots[i] != NULL
+			&& strcmp(cache->slots[i]->depstring, depstring) != 0) {
+		i = (i + 1) & (cache->nslots - 1);
+	}
+	return &cache->slots[i];
+}
+
+static void depcache_entry_free(struct depcache_entry *entry)
+{
+	if(entry) {
+		free(entry->depstring);
+		free(entry->dbname);
+		free(entry->pkgname);
+		free(entry->pkgver);
+		free(entry);
+	}
+}
+
+static int depcache_grow(struct _alpm_depcache *cache)
+{
+	struct depcache_entry **old_slots = cache->slots;
+	size_t old_nslots = cache->nslots, i;
+
+	cache->nslots = old_nslots ? old_nslots * 2 : DEPCACHE_MIN_BUCKETS;
+	CALLOC(cache->slots, cache->nslots, sizeof(struct depcache_entry *),
+			cache->slots = old_slots; cache->nslots = old_nslots; return -1);
+
+	for(i = 0; i < old_nslots; i++) {
+		if(old_slots[i]) {
+			*depcache_slot(cache, old_slots[i]->depstring) = old_slots[i];
+		}
+	}
+	free(old_slots);
+	return 0;
+}
+
+/* Unlink and free the entry in 'slot'. The table uses linear probing, so
+ * the rest of the cluster is re-seated to keep entries that probed past
+ * the freed slot reachable. */
+static void depcache_remove(struct _alpm_depcache *cache,
+		struct depcache_entry **slot)
+{
+	size_t i = slot - cache->slots;
+
+	depcache_entry_free(*slot);
+	*slot = NULL;
+	cache->count--;
+
+	for(i = (i + 1) & (cache->nslots - 1); cache->slots[i] != NULL;
+			i = (i + 1) & (cache->nslots - 1)) {
+		struct depcache_entry *entry = cache->slots[i];
+		cache->slots[i] = NULL;
+		*depcache_slot(cache, entry->depstring) = entry;
+	}
+}
+
+static int depcache_insert(struct _alpm_depcache *cache, const char *depstring,
+		const char *dbname, const char *pkgname, const char *pkgver)
+{
+	struct depcache_entry **slot, *entry;
+
+	/* keep the table at most half full */
+	if((cache->count + 1) * 2 > cache->nslots && depcache_grow(cache) != 0) {
+		return -1;
+	}
+
+	slot = depcache_slot(cache, depstring);
+	if(*slot != NULL) {
+		entry = *slot;
+		if(strcmp(entry->dbname, dbname) == 0
+				&& strcmp(entry->pkgname, pkgname) == 0
+				&& strcmp(entry->pkgver, pkgver) == 0) {
+			return 0;
+		}
+		free(entry->dbname);
+		free(entry->pkgname);
+		free(entry->pkgver);
+		entry->dbname = entry->pkgname = entry->pkgver = NULL;
+	} else {
+		CALLOC(entry, 1, sizeof(struct depcache_entry), return -1);
+		STRDUP(entry->depstring, depstring, free(entry); return -1);
+		*slot = entry;
+		cache->count++;
+	}
+
+	/* a partially-filled entry must not stay in the table: lookups
+	 * strcmp the NULL fields and the save loop prints them, so drop the
+	 * whole entry and degrade to a cache miss instead */
+	STRDUP(entry->dbname, dbname, depcache_remove(cache, slot); return -1);
+	STRDUP(entry->pkgname, pkgname, depcache_remove(cache, slot); return -1);
+	STRDUP(entry->pkgver, pkgver, depcache_remove(cache, slot); return -1);
+	cache->dirty = 1;
+	return 0;
+}
+
+/* Load <dbpath>resolver.cache, or set up an empty cache if it is missing,
+ * unreadable, from another cache version or from a different db state. */
+static void depcache_load(alpm_handle_t *handle)
+{
+	char path[PATH_MAX];
+	char line[PATH_MAX];
+	FILE *fp;
+	int version = 0;
+	unsigned long fp_stored = 0;
+	struct _alpm_depcache *cache;
+
+	handle->depcache_loaded = 1;
+	CALLOC(cache, 1, sizeof(struct _alpm_depcache), return);
+	cache->fingerprint = depcache_fingerprint(handle);
+	handle->depcache = cache;
+
+	depcache_path(handle, path, sizeof(path));
+	if((fp = fopen(path, "r")) == NULL) {
+		return;
+	}
+
+	if(fgets(line, sizeof(line), fp) == NULL
+			|| sscanf(line, "%d %lx", &version, &fp_stored) != 2
+			|| version != DEPCACHE_VERSION
+			|| fp_stored != cache->fingerprint) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"resolver cache is stale or unreadable, starting fresh\n");
+		fclose(fp);
+		return;
+	}
+
+	while(fgets(line, sizeof(line), fp)) {
+		char *depstring = line, *dbname, *pkgname, *pkgver;
+
+		_alpm_strip_newline(line, 0);
+		if((dbname = strchr(depstring, '\t')) == NULL) {
+			continue;
+		}
+		*dbname++ = '\0';
+		if((pkgname = strchr(dbname, '\t')) == NULL) {
+			continue;
+		}
+		*pkgname++ = '\0';
+		if((pkgver = strchr(pkgname, '\t')) == NULL) {
+			continue;
+		}
+		*pkgver++ = '\0';
+		depcache_insert(cache, depstring, dbname, pkgname, pkgver);
+	}
+	/* what we read back is not new information */
+	cache->dirty = 0;
+	fclose(fp);
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"loaded %zu cached resolver decisions\n", cache->count);
+}
+
+void _alpm_depcache_save(alpm_handle_t *handle)
+{
+	char path[PATH_MAX], tmppath[PATH_MAX];
+	FILE *fp;
+	size_t i;
+	struct _alpm_depcache *cache = handle->depcache;
+
+	if(cache == NULL || !cache->dirty) {
+		return;
+	}
+
+	depcache_path(handle, path, sizeof(path));
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if((fp = fopen(tmppath, "w")) == NULL) {
+		/* read-only db directory or missing privileges; not an error */
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"could not write resolver cache %s (%s)\n", path, strerror(errno));
+		return;
+	}
+
+	fprintf(fp, "%d %lx\n", DEPCACHE_VERSION, cache->fingerprint);
+	for(i = 0; i < cache->nslots; i++) {
+		struct depcache_entry *entry = cache->slots[i];
+		if(entry) {
+			fprintf(fp, "%s\t%s\t%s\t%s\n", entry->depstring,
+					entry->dbname, entry->pkgname, entry->pkgver);
+		}
+	}
+
+	if(fclose(fp) != 0 || rename(tmppath, path) != 0) {
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"could not write resolver cache %s (%s)\n", path, strerror(errno));
+		unlink(tmppath);
+		return;
+	}
+	cache->dirty = 0;
+}
+
+void _alpm_depcache_free(alpm_handle_t *handle)
+{
+	struct _alpm_depcache *cache = handle->depcache;
+	size_t i;
+
+	if(cache == NULL) {
+		return;
+	}
+	for(i = 0; i < cache->nslots; i++) {
+		depcache_entry_free(cache->slots[i]);
+	}
+	free(cache->slots);
+	free(cache);
+	handle->depcache = NULL;
+	handle->depcache_loaded = 0;
+}
+
+/* Look up a persisted decision for dep and revalidate it against the
+ * current state; returns NULL whenever the full search has to run. */
+static alpm_pkg_t *depcache_lookup(alpm_handle_t *handle, alpm_depend_t *dep,
+		alpm_list_t *dbs, alpm_list_t *excluding)
+{
+	char *depstring;
+	struct depcache_entry *entry;
+	alpm_list_t *i;
+	alpm_db_t *db = NULL;
+	alpm_pkg_t *pkg;
+
+	if(!handle->depcache_loaded) {
+		depcache_load(handle);
+	}
+	if(handle->depcache == NULL || handle->depcache->count == 0) {
+		return NULL;
+	}
+
+	depstring = alpm_dep_compute_string(dep);
+	if(depstring == NULL) {
+		return NULL;
+	}
+	entry = *depcache_slot(handle->depcache, depstring);
+	free(depstring);
+	if(entry == NULL) {
+		return NULL;
+	}
+
+	for(i = dbs; i; i = i->next) {
+		alpm_db_t *candidate = i->data;
+		if((candidate->usage & (ALPM_DB_USAGE_INSTALL|ALPM_DB_USAGE_UPGRADE))
+				&& strcmp(candidate->treename, entry->dbname) == 0) {
+			db = candidate;
+			break;
+		}
+	}
+	if(db == NULL) {
+		return NULL;
+	}
+
+	pkg = _alpm_db_get_pkgfromcache(db, entry->pkgname);
+	if(pkg == NULL
+			|| strcmp(pkg->version, entry->pkgver) != 0
+			|| !_alpm_depcmp(pkg, dep)
+			|| alpm_pkg_find(excluding, pkg->name)
+			|| alpm_pkg_should_ignore(handle, pkg)) {
+		return NULL;
+	}
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"cached resolver decision: %s satisfies %s\n", pkg->name, dep->name);
+	return pkg;
+}
+
+/* remember that pkg satisfied dep so later transactions can skip the
+ * provider search */
+static void depcache_store(alpm_handle_t *handle, alpm_depend_t *dep,
+		alpm_pkg_t *pkg)
+{
+	char *depstring;
+
+	if(!handle->depcache_loaded) {
+		depcache_load(handle);
+	}
+	if(handle->depcache == NULL || pkg->origin != ALPM_PKG_FROM_SYNCDB) {
+		return;
+	}
+
+	depstring = alpm_dep_compute_string(dep);
+	if(depstring == NULL) {
+		return;
+	}
+	depcache_insert(handle->depcache, depstring,
+			pkg->origin_data.db->treename, pkg->name, pkg->version);
+	free(depstring);
+}
+
 /**
  * helper function for resolvedeps: search for dep satisfier in dbs
  *
@@ -674,13 +1388,28 @@ static alpm_pkg_t *resolvedep(alpm_handle_t *handle, alpm_depend_t *dep,
 			return pkg;
 		}
 	}
-	/* 2. satisfiers (skip literals here) */
+	/* 2. a decision persisted by an earlier run, revalidated against the
+	 * current db contents and exclusion list */
+	if(dbs == handle->dbs_sync) {
+		alpm_pkg_t *pkg = depcache_lookup(handle, dep, dbs, excluding);
+		if(pkg) {
+			return pkg;
+		}
+	}
+	/* 3. satisfiers (skip literals here) */
 	for(i = dbs; i; i = i->next) {
 		alpm_db_t *db = i->data;
+		alpm_list_t *candidates;
 		if(!(db->usage & (ALPM_DB_USAGE_INSTALL|ALPM_DB_USAGE_UPGRADE))) {
 			continue;
 		}
-		for(j = _alpm_db_get_pkgcache(db); j; j = j->next) {
+		/* the providers index narrows the scan to packages that can
+		 * actually satisfy the name; fall back to the full cache if it
+		 * could not be built */
+		if(_alpm_db_get_providers(db, dep->name, &candidates) != 0) {
+			candidates = _alpm_db_get_pkgcache(db);
+		}
+		for(j = candidates; j; j = j->next) {
 			alpm_pkg_t *pkg = j->data;
 			if((pkg->name_hash != dep->name_hash || strcmp(pkg->name, dep->name) != 0)
 					&& _alpm_depcmp_provides(dep, alpm_pkg_get_provides(pkg))
@@ -708,6 +1437,9 @@ static alpm_pkg_t *resolvedep(alpm_handle_t *handle, alpm_depend_t *dep,
 				/* provide is already installed so return early instead of prompting later */
 				if(_alpm_db_get_pkgfromcache(handle->db_local, pkg->name)) {
 					alpm_list_free(providers);
+					if(dbs == handle->dbs_sync) {
+						depcache_store(handle, dep, pkg);
+					}
 					return pkg;
 				}
 
@@ -734,6 +1466,9 @@ static alpm_pkg_t *resolvedep(alpm_handle_t *handle, alpm_depend_t *dep,
 			alpm_list_t *nth = alpm_list_nth(providers, question.use_index);
 			alpm_pkg_t *pkg = nth->data;
 			alpm_list_free(providers);
+			if(dbs == handle->dbs_sync) {
+				depcache_store(handle, dep, pkg);
+			}
 			return pkg;
 		}
 		alpm_list_free(providers);
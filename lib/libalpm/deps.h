@@ -28,6 +28,17 @@
 #include "alpm.h"
 
 alpm_depend_t *_alpm_dep_dup(const alpm_depend_t *dep);
+
+/* Interning pool for parsed dependency objects. Databases repeat the
+ * same few thousand depstrings across most of their packages, so each
+ * unique string is parsed once and the resulting alpm_depend_t shared.
+ * Interned objects are owned by the pool and stay valid until
+ * _alpm_deppool_free(); they must never be passed to alpm_dep_free(). */
+typedef struct __alpm_deppool_t _alpm_deppool_t;
+
+_alpm_deppool_t *_alpm_deppool_new(void);
+alpm_depend_t *_alpm_deppool_intern(_alpm_deppool_t *pool, const char *depstring);
+void _alpm_deppool_free(_alpm_deppool_t *pool);
 alpm_list_t *_alpm_sortbydeps(alpm_handle_t *handle,
 		alpm_list_t *targets, alpm_list_t *ignore, int reverse);
 int _alpm_recursedeps(alpm_db_t *db, alpm_list_t **targs, int include_explicit);
@@ -38,4 +49,8 @@ int _alpm_depcmp_literal(alpm_pkg_t *pkg, alpm_depend_t *dep);
 int _alpm_depcmp_provides(alpm_depend_t *dep, alpm_list_t *provisions);
 int _alpm_depcmp(alpm_pkg_t *pkg, alpm_depend_t *dep);
 
+/* persistent resolver cache; see the description in deps.c */
+void _alpm_depcache_save(alpm_handle_t *handle);
+void _alpm_depcache_free(alpm_handle_t *handle);
+
 #endif /* ALPM_DEPS_H */
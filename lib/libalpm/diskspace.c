@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 
 #if defined(HAVE_MNTENT_H)
 #include <mntent.h>
@@ -49,6 +50,7 @@
 #include "log.h"
 #include "trans.h"
 #include "handle.h"
+#include "thread.h"
 
 static int mount_point_cmp(const void *p1, const void *p2)
 {
@@ -216,16 +218,82 @@ static alpm_mountpoint_t *match_mount_point(const alpm_list_t *mount_points,
 	return NULL;
 }
 
+/* Files are processed in sorted order, so consecutive paths usually live in
+ * the same directory and therefore on the same mount point; remembering the
+ * last directory prefix avoids rescanning the mount point list per file. */
+struct mount_point_cache {
+	char dir[PATH_MAX];
+	size_t dirlen;
+	alpm_mountpoint_t *mp;
+};
+
+static alpm_mountpoint_t *match_mount_point_cached(
+		const alpm_list_t *mount_points, const char *real_path,
+		struct mount_point_cache *cache)
+{
+	const char *slash = strrchr(real_path, '/');
+	size_t dirlen = slash ? (size_t)(slash - real_path) + 1 : 0;
+
+	if(dirlen > 0 && dirlen < PATH_MAX && dirlen == cache->dirlen &&
+			strncmp(cache->dir, real_path, dirlen) == 0) {
+		return cache->mp;
+	}
+
+	cache->mp = match_mount_point(mount_points, real_path);
+	if(dirlen > 0 && dirlen < PATH_MAX) {
+		memcpy(cache->dir, real_path, dirlen);
+		cache->dirlen = dirlen;
+	} else {
+		cache->dirlen = 0;
+	}
+	return cache->mp;
+}
+
+struct diskspace_stat {
+	struct stat st;
+	int exists;
+};
+
+struct diskspace_stat_ctx {
+	const char *root;
+	alpm_filelist_t *filelist;
+	struct diskspace_stat *stats;
+};
+
+static void diskspace_stat_worker(void *ctx, size_t index)
+{
+	struct diskspace_stat_ctx *c = ctx;
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s%s", c->root, c->filelist->files[index].name);
+	c->stats[index].exists = llstat(path, &c->stats[index].st) == 0;
+}
+
 static int calculate_removed_size(alpm_handle_t *handle,
 		const alpm_list_t *mount_points, alpm_pkg_t *pkg)
 {
-	size_t i;
+	size_t i, nthreads;
 	alpm_filelist_t *filelist = alpm_pkg_get_files(pkg);
+	struct diskspace_stat *stats = NULL;
+	struct mount_point_cache cache = {{0}, 0, NULL};
 
 	if(!filelist->count) {
 		return 0;
 	}
 
+	/* fan the lstat() calls out across the worker pool; mount point
+	 * matching and accumulation below stay serial and in order */
+	nthreads = _alpm_parallel_nthreads(handle, filelist->count);
+	if(nthreads > 1) {
+		CALLOC(stats, filelist->count, sizeof(struct diskspace_stat),
+				stats = NULL);
+		if(stats) {
+			struct diskspace_stat_ctx ctx = { handle->root, filelist, stats };
+			_alpm_parallel_for(nthreads, filelist->count,
+					diskspace_stat_worker, &ctx);
+		}
+	}
+
 	for(i = 0; i < filelist->count; i++) {
 		const alpm_file_t *file = filelist->files + i;
 		alpm_mountpoint_t *mp;
@@ -236,13 +304,16 @@ static int calculate_removed_size(alpm_handle_t *handle,
 
 		snprintf(path, PATH_MAX, "%s%s", handle->root, filename);
 
-		if(llstat(path, &st) == -1) {
+		if(stats ? !stats[i].exists : llstat(path, &st) == -1) {
 			if(alpm_option_match_noextract(handle, filename)) {
 				_alpm_log(handle, ALPM_LOG_WARNING,
 						_("could not get file information for %s\n"), filename);
 			}
 			continue;
 		}
+		if(stats) {
+			st = stats[i].st;
+		}
 
 		/* skip directories and symlinks to be consistent with libarchive that
 		 * reports them to be zero size */
@@ -250,7 +321,7 @@ static int calculate_removed_size(alpm_handle_t *handle,
 			continue;
 		}
 
-		mp = match_mount_point(mount_points, path);
+		mp = match_mount_point_cached(mount_points, path, &cache);
 		if(mp == NULL) {
 			_alpm_log(handle, ALPM_LOG_WARNING,
 					_("could not determine mount point for file %s\n"), filename);
@@ -275,6 +346,7 @@ static int calculate_removed_size(alpm_handle_t *handle,
 		mp->used |= USED_REMOVE;
 	}
 
+	free(stats);
 	return 0;
 }
 
@@ -283,6 +355,7 @@ static int calculate_installed_size(alpm_handle_t *handle,
 {
 	size_t i;
 	alpm_filelist_t *filelist = alpm_pkg_get_files(pkg);
+	struct mount_point_cache cache = {{0}, 0, NULL};
 
 	if(!filelist->count) {
 		return 0;
@@ -309,7 +382,7 @@ static int calculate_installed_size(alpm_handle_t *handle,
 
 		snprintf(path, PATH_MAX, "%s%s", handle->root, filename);
 
-		mp = match_mount_point(mount_points, path);
+		mp = match_mount_point_cached(mount_points, path, &cache);
 		if(mp == NULL) {
 			_alpm_log(handle, ALPM_LOG_WARNING,
 					_("could not determine mount point for file %s\n"), filename);
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h> /* fallocate */
 #include <sys/socket.h> /* setsockopt, SO_KEEPALIVE */
 #include <sys/time.h>
 #include <sys/types.h>
@@ -35,6 +36,9 @@
 #ifdef HAVE_NETINET_TCP_H
 #include <netinet/tcp.h> /* TCP_KEEPINTVL, TCP_KEEPIDLE */
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #ifdef HAVE_LIBCURL
 #include <curl/curl.h>
@@ -47,6 +51,7 @@
 #include "log.h"
 #include "util.h"
 #include "handle.h"
+#include "db.h"
 
 #ifdef HAVE_LIBCURL
 static const char *get_filename(const char *url)
@@ -83,6 +88,30 @@ static void inthandler(int UNUSED signum)
 	dload_interrupted = ABORT_SIGINT;
 }
 
+/* Report aggregate progress of a segmented payload. All segments run on
+ * the same thread inside the curl multi loop, so the per-segment counters
+ * can be summed without synchronization. */
+static void segment_report_progress(struct dload_payload *parent)
+{
+	alpm_list_t *i;
+	off_t dlnow = parent->seg_dlnow;
+	alpm_download_event_progress_t cb_data = {0};
+
+	for(i = parent->segments; i; i = i->next) {
+		struct dload_payload *seg = i->data;
+		dlnow += seg->seg_dlnow;
+	}
+
+	if(parent->handle->dlcb == NULL || dlnow == parent->prevprogress) {
+		return;
+	}
+
+	cb_data.total = parent->content_size;
+	cb_data.downloaded = dlnow;
+	parent->handle->dlcb(parent->remote_name, ALPM_DOWNLOAD_PROGRESS, &cb_data);
+	parent->prevprogress = dlnow;
+}
+
 static int dload_progress_cb(void *file, curl_off_t dltotal, curl_off_t dlnow,
 		curl_off_t UNUSED ultotal, curl_off_t UNUSED ulnow)
 {
@@ -118,6 +147,13 @@ static int dload_progress_cb(void *file, curl_off_t dltotal, curl_off_t dlnow,
 		return 1;
 	}
 
+	/* ranged sub-transfers roll their progress up into the parent payload */
+	if(payload->parent || payload->segments) {
+		payload->seg_dlnow = dlnow;
+		segment_report_progress(payload->parent ? payload->parent : payload);
+		return 0;
+	}
+
 	/* none of what follows matters if the front end has no callback */
 	if(payload->handle->dlcb == NULL) {
 		return 0;
@@ -139,6 +175,9 @@ static int dload_progress_cb(void *file, curl_off_t dltotal, curl_off_t dlnow,
 	return 0;
 }
 
+/* RFC1123 states applications should support this length */
+#define HOSTNAME_SIZE 256
+
 static int curl_gethost(const char *url, char *buffer, size_t buf_len)
 {
 	size_t hostlen;
@@ -179,6 +218,105 @@ static int curl_gethost(const char *url, char *buffer, size_t buf_len)
 	return 0;
 }
 
+/* Observed per-mirror behavior, kept on the handle across download batches
+ * so later payloads start on mirrors that performed well earlier. Download
+ * loops run on a single thread, so no locking is needed. */
+struct server_stats {
+	char hostname[HOSTNAME_SIZE];
+	double speed_ema;   /* bytes per second */
+	double latency_ema; /* seconds to first byte */
+	int samples;
+	int failures;       /* consecutive failures */
+};
+
+/* weight of the newest sample in the moving averages */
+#define SERVER_STATS_ALPHA 0.3
+/* payloads below this many bytes are latency- rather than bandwidth-bound */
+#define SERVER_STATS_SMALL_PAYLOAD (256 * 1024)
+
+static struct server_stats *server_stats_find(alpm_handle_t *handle,
+		const char *hostname)
+{
+	alpm_list_t *i;
+	for(i = handle->server_stats; i; i = i->next) {
+		struct server_stats *stats = i->data;
+		if(strcmp(stats->hostname, hostname) == 0) {
+			return stats;
+		}
+	}
+	return NULL;
+}
+
+static void server_stats_record(alpm_handle_t *handle, CURL *curl,
+		const char *hostname, int success)
+{
+	struct server_stats *stats = server_stats_find(handle, hostname);
+	double speed = 0.0, latency = 0.0;
+
+	if(stats == NULL) {
+		CALLOC(stats, 1, sizeof(struct server_stats), return);
+		/* bounded by curl_gethost() above */
+		strcpy(stats->hostname, hostname);
+		handle->server_stats = alpm_list_add(handle->server_stats, stats);
+	}
+
+	if(!success) {
+		stats->failures++;
+		return;
+	}
+	stats->failures = 0;
+	curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD, &speed);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &latency);
+	if(stats->samples == 0) {
+		stats->speed_ema = speed;
+		stats->latency_ema = latency;
+	} else {
+		stats->speed_ema += SERVER_STATS_ALPHA * (speed - stats->speed_ema);
+		stats->latency_ema += SERVER_STATS_ALPHA * (latency - stats->latency_ema);
+	}
+	stats->samples++;
+}
+
+/* Choose the starting mirror for a payload. Mirrors that were never tried
+ * get probed right away; otherwise the best-scoring one wins, with repeat
+ * failures pushing a mirror towards the bottom. Small payloads rank by
+ * time-to-first-byte instead of throughput. */
+static alpm_list_t *server_stats_pick(alpm_handle_t *handle,
+		alpm_list_t *servers, off_t size)
+{
+	alpm_list_t *i, *best = servers;
+	double best_score = -1.0;
+	int latency_bound = size > 0 && size < SERVER_STATS_SMALL_PAYLOAD;
+
+	for(i = servers; i; i = i->next) {
+		char hostname[HOSTNAME_SIZE];
+		struct server_stats *stats;
+		double score;
+
+		if(curl_gethost(i->data, hostname, sizeof(hostname)) != 0) {
+			continue;
+		}
+		stats = server_stats_find(handle, hostname);
+		if(stats == NULL) {
+			return i;
+		}
+		if(stats->samples == 0) {
+			/* only failures so far; consider it, but score it last */
+			score = 0.0;
+		} else if(latency_bound) {
+			score = 1.0 / (stats->latency_ema + 0.001);
+		} else {
+			score = stats->speed_ema;
+		}
+		score /= 1.0 + (double)stats->failures * stats->failures;
+		if(score > best_score) {
+			best_score = score;
+			best = i;
+		}
+	}
+	return best;
+}
+
 static int utimes_long(const char *path, long seconds)
 {
 	if(seconds != -1) {
@@ -267,6 +405,14 @@ static void curl_set_handle_opts(struct dload_payload *payload,
 	curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 60L);
 	curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
 	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)payload);
+	if(handle->curlsh) {
+		curl_easy_setopt(curl, CURLOPT_SHARE, handle->curlsh);
+	}
+	/* negotiate HTTP/2 where available and prefer multiplexing onto an
+	 * existing connection over opening another one; servers that can't
+	 * negotiate it fall back to HTTP/1.1 */
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "%s: url is %s\n",
 		payload->remote_name, payload->fileurl);
@@ -319,6 +465,15 @@ static void unmask_signal(int signum, struct sigaction *sa)
 	sigaction(signum, sa, NULL);
 }
 
+/* write callback that tees downloaded data into the streaming digester */
+static size_t dload_writedigest_cb(void *ptr, size_t size, size_t nmemb,
+		void *user)
+{
+	struct dload_payload *payload = user;
+	_alpm_digest_update(payload->digest, ptr, size * nmemb);
+	return fwrite(ptr, size, nmemb, payload->localf);
+}
+
 static FILE *create_tempfile(struct dload_payload *payload, const char *localpath)
 {
 	int fd;
@@ -350,8 +505,27 @@ static FILE *create_tempfile(struct dload_payload *payload, const char *localpat
 	return fp;
 }
 
-/* RFC1123 states applications should support this length */
-#define HOSTNAME_SIZE 256
+/* Reserve the expected on-disk size of a download up front so that
+ * growing the file write-by-write does not fragment it on extent- and
+ * CoW-based filesystems. FALLOC_FL_KEEP_SIZE leaves the reported file
+ * size untouched, so resume and segmentation logic keyed off st_size
+ * keep working; failure (filesystem without extent support) is simply
+ * ignored. */
+static void prealloc_download_file(struct dload_payload *payload, FILE *localf)
+{
+#ifdef HAVE_FALLOCATE
+	if(payload->handle->preallocate && payload->content_size > 0 &&
+			fallocate(fileno(localf), FALLOC_FL_KEEP_SIZE, 0,
+				payload->content_size) == 0) {
+		_alpm_log(payload->handle, ALPM_LOG_DEBUG,
+				"%s: preallocated %jd bytes\n", payload->remote_name,
+				(intmax_t)payload->content_size);
+	}
+#else
+	(void)payload;
+	(void)localf;
+#endif
+}
 
 static int curl_download_internal(struct dload_payload *payload,
 		const char *localpath, char **final_file, const char **final_url)
@@ -429,6 +603,8 @@ static int curl_download_internal(struct dload_payload *payload,
 			"opened tempfile for download: %s (%s)\n", payload->tempfile_name,
 			payload->tempfile_openmode);
 
+	prealloc_download_file(payload, localf);
+
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, localf);
 
 	/* Ignore any SIGPIPE signals. With libcurl, these shouldn't be happening,
@@ -613,8 +789,11 @@ static int curl_multi_retry_next_server(CURLM *curlm, CURL *curl, struct dload_p
 	size_t len;
 	alpm_handle_t *handle = payload->handle;
 
-	payload->servers = payload->servers->next;
-	if(!payload->servers) {
+	/* walk the rotation circularly; the scheduler may not have started at
+	 * the head of the list */
+	payload->servers = payload->servers->next ?
+			payload->servers->next : payload->servers_head;
+	if(payload->servers == payload->servers_start) {
 		_alpm_log(payload->handle, ALPM_LOG_DEBUG,
 				"%s: no more servers to retry\n", payload->remote_name);
 		return -1;
@@ -636,6 +815,11 @@ static int curl_multi_retry_next_server(CURLM *curlm, CURL *curl, struct dload_p
 		fseek(payload->localf, 0, SEEK_SET);
 	}
 
+	/* data already written makes a streamed digest stale; validation will
+	 * fall back to reading the finished file */
+	_alpm_digest_free(payload->digest);
+	payload->digest = NULL;
+
 	/* Set curl with the new URL */
 	curl_easy_setopt(curl, CURLOPT_URL, payload->fileurl);
 
@@ -645,6 +829,108 @@ static int curl_multi_retry_next_server(CURLM *curlm, CURL *curl, struct dload_p
 	return 0;
 }
 
+/* Handle completion of one byte-range segment of a segmented payload.
+ * Intermediate segments return 0; the last segment to finish settles the
+ * whole payload. Segmented downloads are not retried against other
+ * servers, and a failed one leaves holes in the .part file, so the
+ * tempfile is always unlinked on failure. */
+static int curl_multi_check_finished_segment(CURLM *curlm, CURLMsg *msg)
+{
+	struct dload_payload *payload = NULL, *parent;
+	alpm_handle_t *handle;
+	CURL *curl = msg->easy_handle;
+	CURLcode curlerr;
+	long remote_time = -1;
+	char hostname[HOSTNAME_SIZE];
+	alpm_list_t *i;
+	int ret = 0;
+
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, &payload);
+	parent = payload->parent ? payload->parent : payload;
+	handle = parent->handle;
+
+	curl_gethost(parent->fileurl, hostname, sizeof(hostname));
+	curlerr = msg->data.result;
+	server_stats_record(handle, curl, hostname,
+			curlerr == CURLE_OK && payload->respcode == 206);
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"%s: segment at %jd returned result %d, response code %ld\n",
+			parent->remote_name, (intmax_t)payload->seg_start, curlerr,
+			payload->respcode);
+
+	/* a 200 response means the server ignored our Range header and sent the
+	 * whole file from the start; that cannot be stitched into the segment
+	 * layout, so treat anything but 206 as a failure */
+	if(curlerr == CURLE_OK && payload->respcode != 206) {
+		snprintf(payload->error_buffer, sizeof(payload->error_buffer),
+				"server does not support ranged requests (code %ld)",
+				payload->respcode);
+		curlerr = CURLE_RANGE_ERROR;
+	}
+	if(curlerr != CURLE_OK) {
+		parent->segment_errors++;
+		if(parent->segment_errors == 1 && !parent->errors_ok) {
+			handle->pm_errno = ALPM_ERR_RETRIEVE;
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("failed retrieving file '%s' from %s : %s\n"),
+					parent->remote_name, hostname, payload->error_buffer);
+		}
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_FILETIME, &remote_time);
+
+	if(payload->localf != NULL) {
+		fclose(payload->localf);
+		payload->localf = NULL;
+	}
+	curl_multi_remove_handle(curlm, curl);
+	curl_easy_cleanup(curl);
+	payload->curl = NULL;
+
+	if(--parent->segments_active > 0) {
+		return 0;
+	}
+
+	/* last segment done, settle the whole payload */
+	if(parent->segment_errors == 0 && !dload_interrupted) {
+		utimes_long(parent->tempfile_name, remote_time);
+		if(rename(parent->tempfile_name, parent->destfile_name)) {
+			_alpm_log(handle, ALPM_LOG_ERROR, _("could not rename %s to %s (%s)\n"),
+					parent->tempfile_name, parent->destfile_name, strerror(errno));
+			ret = -1;
+		}
+	} else {
+		unlink(parent->tempfile_name);
+		ret = -1;
+	}
+
+	if(!parent->signature) {
+		alpm_download_event_completed_t cb_data = {0};
+		cb_data.total = parent->content_size;
+		cb_data.result = ret;
+		handle->dlcb(parent->remote_name, ALPM_DOWNLOAD_COMPLETED, &cb_data);
+	}
+
+	for(i = parent->segments; i; i = i->next) {
+		struct dload_payload *seg = i->data;
+		_alpm_dload_payload_reset(seg);
+		free(seg);
+	}
+	alpm_list_free(parent->segments);
+	parent->segments = NULL;
+
+	FREE(parent->fileurl);
+
+	if(ret == -1 && parent->errors_ok) {
+		ret = -2;
+	}
+	if(parent->on_complete) {
+		parent->on_complete(parent->on_complete_ctx, parent,
+				ret == 0 ? 0 : -1);
+	}
+	return ret;
+}
+
 /* Returns 2 if download retry happened
  * Returns 1 if the file is up-to-date
  * Returns 0 if current payload is completed successfully
@@ -670,8 +956,14 @@ static int curl_multi_check_finished_download(CURLM *curlm, CURLMsg *msg,
 	ASSERT(curlerr == CURLE_OK, RET_ERR(handle, ALPM_ERR_LIBCURL, -1));
 	handle = payload->handle;
 
+	if(payload->parent || payload->segments) {
+		return curl_multi_check_finished_segment(curlm, msg);
+	}
+
 	curl_gethost(payload->fileurl, hostname, sizeof(hostname));
 	curlerr = msg->data.result;
+	server_stats_record(handle, curl, hostname,
+			curlerr == CURLE_OK && payload->respcode < 400);
 	_alpm_log(handle, ALPM_LOG_DEBUG, "%s: curl returned result %d from transfer\n",
 			payload->remote_name, curlerr);
 
@@ -808,6 +1100,16 @@ cleanup:
 		utimes_long(payload->tempfile_name, remote_time);
 	}
 
+	if(payload->digest != NULL) {
+		if(ret == 0) {
+			_alpm_digest_final(payload->digest, &payload->dl_md5sum,
+					&payload->dl_sha256sum);
+		} else {
+			_alpm_digest_free(payload->digest);
+		}
+		payload->digest = NULL;
+	}
+
 	if(ret == 0) {
 		if(payload->destfile_name) {
 			if(rename(payload->tempfile_name, payload->destfile_name)) {
@@ -839,9 +1141,114 @@ cleanup:
 	if(ret == -1 && payload->errors_ok) {
 		ret = -2;
 	}
+	if(payload->on_complete) {
+		payload->on_complete(payload->on_complete_ctx, payload,
+				ret == 0 ? 0 : -1);
+	}
 	return ret;
 }
 
+/* number of byte-range sub-transfers a large payload is split into */
+#define SEGMENT_COUNT 4
+/* payloads smaller than this ride a single connection */
+#define SEGMENT_MIN_SIZE (32 * 1024 * 1024)
+
+/* Split a payload into SEGMENT_COUNT byte-range sub-transfers that write
+ * into the shared .part file at their own offsets. The payload's own curl
+ * handle fetches the first range; the rest get child payloads. Returns 0
+ * with all handles added to the multi stack, or -1 if the payload is not
+ * eligible (unknown size, resumed .part, non-http) or setup failed, in
+ * which case the caller falls back to the single-connection path. */
+static int curl_multi_segment_payload(alpm_handle_t *handle, CURLM *curlm,
+		struct dload_payload *payload)
+{
+	off_t seg_size;
+	alpm_list_t *s;
+	char range[64];
+	int i;
+
+	/* segmentation needs the exact remote size and a fresh tempfile; a
+	 * resumed .part or a size-capped payload keeps the single connection.
+	 * Only http(s) gives us a response code to verify range support. */
+	if(payload->content_size < SEGMENT_MIN_SIZE ||
+			payload->initial_size > 0 || payload->signature ||
+			strncmp(payload->fileurl, "http", 4) != 0) {
+		return -1;
+	}
+
+	seg_size = (payload->content_size + SEGMENT_COUNT - 1) / SEGMENT_COUNT;
+
+	for(i = 1; i < SEGMENT_COUNT; i++) {
+		struct dload_payload *seg;
+		CURL *segcurl;
+
+		CALLOC(seg, 1, sizeof(*seg), goto fail);
+		payload->segments = alpm_list_add(payload->segments, seg);
+		seg->handle = handle;
+		seg->parent = payload;
+		seg->seg_start = (off_t)i * seg_size;
+		seg->seg_size = payload->content_size - seg->seg_start;
+		if(seg->seg_size > seg_size) {
+			seg->seg_size = seg_size;
+		}
+		seg->max_size = seg->seg_size;
+		seg->errors_ok = payload->errors_ok;
+		STRDUP(seg->remote_name, payload->remote_name, goto fail);
+		STRDUP(seg->fileurl, payload->fileurl, goto fail);
+		STRDUP(seg->tempfile_name, payload->tempfile_name, goto fail);
+
+		if((seg->localf = fopen(seg->tempfile_name, "r+b")) == NULL ||
+				fseeko(seg->localf, seg->seg_start, SEEK_SET) != 0) {
+			goto fail;
+		}
+
+		if((segcurl = curl_easy_init()) == NULL) {
+			goto fail;
+		}
+		seg->curl = segcurl;
+		curl_set_handle_opts(seg, segcurl, seg->error_buffer);
+		snprintf(range, sizeof(range), "%jd-%jd", (intmax_t)seg->seg_start,
+				(intmax_t)(seg->seg_start + seg->seg_size - 1));
+		curl_easy_setopt(segcurl, CURLOPT_RANGE, range);
+		curl_easy_setopt(segcurl, CURLOPT_WRITEDATA, seg->localf);
+	}
+
+	/* the payload's own handle fetches the first range */
+	snprintf(range, sizeof(range), "0-%jd", (intmax_t)(seg_size - 1));
+	curl_easy_setopt(payload->curl, CURLOPT_RANGE, range);
+	payload->seg_start = 0;
+	payload->seg_size = seg_size;
+	payload->segments_active = SEGMENT_COUNT;
+	payload->segment_errors = 0;
+
+	for(s = payload->segments; s; s = s->next) {
+		struct dload_payload *seg = s->data;
+		curl_multi_add_handle(curlm, seg->curl);
+	}
+	curl_multi_add_handle(curlm, payload->curl);
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"%s: downloading in %d segments of up to %jd bytes\n",
+			payload->remote_name, SEGMENT_COUNT, (intmax_t)seg_size);
+	return 0;
+
+fail:
+	for(s = payload->segments; s; s = s->next) {
+		struct dload_payload *seg = s->data;
+		if(seg->localf != NULL) {
+			fclose(seg->localf);
+		}
+		if(seg->curl != NULL) {
+			curl_easy_cleanup(seg->curl);
+		}
+		_alpm_dload_payload_reset(seg);
+		free(seg);
+	}
+	alpm_list_free(payload->segments);
+	payload->segments = NULL;
+	return -1;
+}
+
 /* Returns 0 in case if a new download transaction has been successfully started
  * Returns -1 if am error happened while starting a new download
  */
@@ -855,6 +1262,12 @@ static int curl_multi_add_payload(alpm_handle_t *handle, CURLM *curlm,
 	int ret = -1;
 
 	ASSERT(payload->servers, RET_ERR(handle, ALPM_ERR_SERVER_NONE, -1));
+	/* start on the mirror with the best track record for this payload
+	 * size; retries wrap around the rest of the rotation */
+	payload->servers_head = payload->servers;
+	payload->servers = server_stats_pick(handle, payload->servers,
+			payload->content_size ? payload->content_size : payload->max_size);
+	payload->servers_start = payload->servers;
 	server = payload->servers->data;
 
 	curl = curl_easy_init();
@@ -915,8 +1328,25 @@ static int curl_multi_add_payload(alpm_handle_t *handle, CURLM *curlm,
 			payload->tempfile_name,
 			payload->tempfile_openmode);
 
+	prealloc_download_file(payload, payload->localf);
+
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, payload->localf);
-	curl_multi_add_handle(curlm, curl);
+
+	/* large payloads of known size are split across several connections;
+	 * anything else, or a failed split, takes the usual single transfer */
+	if(curl_multi_segment_payload(handle, curlm, payload) != 0) {
+		/* hash the stream as it is written so checksum validation can skip
+		 * re-reading the file; segments arrive out of order and resumed
+		 * downloads miss their head, those keep the on-disk pass */
+		if(!payload->signature && payload->initial_size == 0) {
+			payload->digest = _alpm_digest_new();
+		}
+		if(payload->digest) {
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dload_writedigest_cb);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)payload);
+		}
+		curl_multi_add_handle(curlm, curl);
+	}
 	return 0;
 
 cleanup:
@@ -928,6 +1358,143 @@ cleanup:
 	return ret;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/* Socket-action event loop. The perform/wait iteration rescans every
+ * in-flight transfer per wakeup; with the socket callbacks below curl
+ * tells us which descriptors to watch and we hand back only the ones
+ * epoll reports ready, so the loop costs what the activity costs no
+ * matter how many payloads are in flight. */
+struct curl_socket_loop {
+	int epfd;
+	long timeout_ms; /* curl's pending timer, -1 for none */
+	CURLM *curlm;
+};
+
+static int curl_socket_cb(CURL *easy, curl_socket_t s, int what,
+		void *userp, void *socketp)
+{
+	struct curl_socket_loop *loop = userp;
+	struct epoll_event ev;
+	(void)easy;
+
+	if(what == CURL_POLL_REMOVE) {
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, s, NULL);
+		curl_multi_assign(loop->curlm, s, NULL);
+		return 0;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	if(what & CURL_POLL_IN) {
+		ev.events |= EPOLLIN;
+	}
+	if(what & CURL_POLL_OUT) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.fd = s;
+
+	if(socketp == NULL) {
+		if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, s, &ev) != 0 && errno == EEXIST) {
+			epoll_ctl(loop->epfd, EPOLL_CTL_MOD, s, &ev);
+		}
+		/* non-NULL marker so re-registrations take the MOD path */
+		curl_multi_assign(loop->curlm, s, loop);
+	} else {
+		epoll_ctl(loop->epfd, EPOLL_CTL_MOD, s, &ev);
+	}
+	return 0;
+}
+
+static int curl_timer_cb(CURLM *curlm, long timeout_ms, void *userp)
+{
+	struct curl_socket_loop *loop = userp;
+	(void)curlm;
+	loop->timeout_ms = timeout_ms;
+	return 0;
+}
+
+/* wait for socket activity or the pending curl timer and dispatch it */
+static void curl_socket_loop_wait(struct curl_socket_loop *loop,
+		int *still_running)
+{
+	struct epoll_event events[32];
+	int nfds, n;
+	int timeout = 1000;
+
+	if(loop->timeout_ms >= 0 && loop->timeout_ms < timeout) {
+		timeout = (int)loop->timeout_ms;
+	}
+
+	nfds = epoll_wait(loop->epfd, events, 32, timeout);
+	if(nfds <= 0) {
+		/* timer expiry or EINTR; let curl run its timeouts */
+		curl_multi_socket_action(loop->curlm, CURL_SOCKET_TIMEOUT, 0,
+				still_running);
+		return;
+	}
+	for(n = 0; n < nfds; n++) {
+		int what = 0;
+		if(events[n].events & EPOLLIN) {
+			what |= CURL_CSELECT_IN;
+		}
+		if(events[n].events & EPOLLOUT) {
+			what |= CURL_CSELECT_OUT;
+		}
+		if(events[n].events & (EPOLLERR | EPOLLHUP)) {
+			what |= CURL_CSELECT_ERR;
+		}
+		curl_multi_socket_action(loop->curlm, events[n].data.fd, what,
+				still_running);
+	}
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* sort payloads largest first, so the batch tail is small files and fast
+ * mirrors spend their time on the big payloads */
+static int payload_size_cmp(const void *a, const void *b)
+{
+	const struct dload_payload *pa = a, *pb = b;
+	off_t sa = pa->content_size ? pa->content_size : pa->max_size;
+	off_t sb = pb->content_size ? pb->content_size : pb->max_size;
+	return (sa < sb) - (sa > sb);
+}
+
+/* drain completion messages, adjusting the in-flight target and error
+ * state exactly as transfers report in */
+static void curl_multi_process_messages(alpm_handle_t *handle, CURLM *curlm,
+		const char *localpath, alpm_list_t **payloads, int *still_running,
+		int *target, int parallel_downloads, int *err)
+{
+	CURLMsg *msg;
+	int msgs_left = -1;
+
+	while((msg = curl_multi_info_read(curlm, &msgs_left))) {
+		if(msg->msg == CURLMSG_DONE) {
+			int ret = curl_multi_check_finished_download(curlm, msg, localpath);
+			if(ret == -1) {
+				/* if current payload failed to download then stop adding new payloads but wait for the
+				 * current ones
+				 */
+				*payloads = NULL;
+				*err = -1;
+			} else if(ret == 2) {
+				/* in case of a retry increase the counter of active requests
+				 * to avoid exiting the loop early
+				 */
+				(*still_running)++;
+				/* a mirror had to be swapped out; ease off concurrency */
+				if(*target > 1) {
+					(*target)--;
+				}
+			} else if(ret == 0 && *target < parallel_downloads) {
+				/* clean completion; work back up to the configured cap */
+				(*target)++;
+			}
+		} else {
+			_alpm_log(handle, ALPM_LOG_ERROR, _("curl transfer error: %d\n"), msg->msg);
+		}
+	}
+}
+
 static int curl_multi_download_internal(alpm_handle_t *handle,
 		alpm_list_t *payloads /* struct dload_payload */,
 		const char *localpath)
@@ -935,14 +1502,34 @@ static int curl_multi_download_internal(alpm_handle_t *handle,
 	int still_running = 0;
 	int err = 0;
 	int parallel_downloads = handle->parallel_downloads;
+	/* in-flight cap, eased off when mirrors start failing and restored as
+	 * transfers complete cleanly; the configured value stays the ceiling */
+	int target = parallel_downloads;
+	alpm_list_t *sorted = alpm_list_copy(payloads);
 
 	CURLM *curlm = handle->curlm;
-	CURLMsg *msg;
+#ifdef HAVE_SYS_EPOLL_H
+	struct curl_socket_loop loop = { -1, 0, curlm };
+
+	loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(loop.epfd >= 0) {
+		curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION, curl_socket_cb);
+		curl_multi_setopt(curlm, CURLMOPT_SOCKETDATA, &loop);
+		curl_multi_setopt(curlm, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
+		curl_multi_setopt(curlm, CURLMOPT_TIMERDATA, &loop);
+	}
+#endif
 
-	while(still_running || payloads) {
-		int msgs_left = -1;
+	if(sorted) {
+		size_t n = alpm_list_count(sorted);
+		if(n > 1) {
+			sorted = alpm_list_msort(sorted, n, payload_size_cmp);
+		}
+		payloads = sorted;
+	}
 
-		for(; still_running < parallel_downloads && payloads; still_running++) {
+	while(still_running || payloads) {
+		for(; still_running < target && payloads; still_running++) {
 			struct dload_payload *payload = payloads->data;
 
 			if(curl_multi_add_payload(handle, curlm, payload, localpath) == 0) {
@@ -961,6 +1548,30 @@ static int curl_multi_download_internal(alpm_handle_t *handle,
 			}
 		}
 
+#ifdef HAVE_SYS_EPOLL_H
+		if(loop.epfd >= 0) {
+			/* kick expired timers (and start anything just added) */
+			CURLMcode mc = curl_multi_socket_action(curlm, CURL_SOCKET_TIMEOUT,
+					0, &still_running);
+			if(mc != CURLM_OK) {
+				_alpm_log(handle, ALPM_LOG_ERROR,
+						_("curl returned error %d from transfer\n"), mc);
+				payloads = NULL;
+				err = -1;
+			}
+			curl_multi_process_messages(handle, curlm, localpath, &payloads,
+					&still_running, &target, parallel_downloads, &err);
+			if(still_running) {
+				curl_socket_loop_wait(&loop, &still_running);
+				/* completions dispatched during the wait must be reaped
+				 * before the loop condition is rechecked */
+				curl_multi_process_messages(handle, curlm, localpath, &payloads,
+						&still_running, &target, parallel_downloads, &err);
+			}
+			continue;
+		}
+#endif
+
 		CURLMcode mc = curl_multi_perform(curlm, &still_running);
 
 		if(mc != CURLM_OK) {
@@ -969,30 +1580,24 @@ static int curl_multi_download_internal(alpm_handle_t *handle,
 			err = -1;
 		}
 
-		while((msg = curl_multi_info_read(curlm, &msgs_left))) {
-			if(msg->msg == CURLMSG_DONE) {
-				int ret = curl_multi_check_finished_download(curlm, msg, localpath);
-				if(ret == -1) {
-					/* if current payload failed to download then stop adding new payloads but wait for the
-					 * current ones
-					 */
-					payloads = NULL;
-					err = -1;
-				} else if(ret == 2) {
-					/* in case of a retry increase the counter of active requests
-					 * to avoid exiting the loop early
-					 */
-					still_running++;
-				}
-			} else {
-				_alpm_log(handle, ALPM_LOG_ERROR, _("curl transfer error: %d\n"), msg->msg);
-			}
-		}
+		curl_multi_process_messages(handle, curlm, localpath, &payloads,
+				&still_running, &target, parallel_downloads, &err);
 		if(still_running) {
 			curl_multi_wait(curlm, NULL, 0, 1000, NULL);
 		}
 	}
 
+#ifdef HAVE_SYS_EPOLL_H
+	if(loop.epfd >= 0) {
+		curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION, NULL);
+		curl_multi_setopt(curlm, CURLMOPT_SOCKETDATA, NULL);
+		curl_multi_setopt(curlm, CURLMOPT_TIMERFUNCTION, NULL);
+		curl_multi_setopt(curlm, CURLMOPT_TIMERDATA, NULL);
+		close(loop.epfd);
+	}
+#endif
+
+	alpm_list_free(sorted);
 	_alpm_log(handle, ALPM_LOG_DEBUG, "curl_multi_download_internal return code is %d\n", err);
 	return err;
 }
@@ -1029,7 +1634,7 @@ int _alpm_download(struct dload_payload *payload, const char *localpath,
 	}
 }
 
-int _alpm_multi_download(alpm_handle_t *handle,
+static int multi_download_dispatch(alpm_handle_t *handle,
 		alpm_list_t *payloads /* struct dload_payload */,
 		const char *localpath)
 {
@@ -1071,6 +1676,19 @@ int _alpm_multi_download(alpm_handle_t *handle,
 	}
 }
 
+int _alpm_multi_download(alpm_handle_t *handle,
+		alpm_list_t *payloads /* struct dload_payload */,
+		const char *localpath)
+{
+	int ret;
+	TRACE_BEGIN(handle, ALPM_TRACE_DOWNLOAD, NULL);
+	ret = multi_download_dispatch(handle, payloads, localpath);
+	TRACE_END(handle, ALPM_TRACE_DOWNLOAD, NULL);
+	/* new files landed in the cachedir; rebuild the index on next lookup */
+	_alpm_filecache_invalidate(handle);
+	return ret;
+}
+
 static char *filecache_find_url(alpm_handle_t *handle, const char *url)
 {
 	const char *filebase = strrchr(url, '/');
@@ -1158,6 +1776,7 @@ char SYMEXPORT *alpm_fetch_pkgurl(alpm_handle_t *handle, const char *url)
 
 	/* we should be able to find the file the second time around */
 	if(filepath == NULL) {
+		_alpm_filecache_invalidate(handle);
 		filepath = _alpm_filecache_find(handle, final_file);
 	}
 	free(final_file);
@@ -1165,6 +1784,202 @@ char SYMEXPORT *alpm_fetch_pkgurl(alpm_handle_t *handle, const char *url)
 	return filepath;
 }
 
+#ifdef HAVE_LIBCURL
+
+/* number of leading bytes fetched from each mirror by a benchmark probe */
+#define MIRROR_PROBE_SIZE (256 * 1024)
+
+struct mirror_probe {
+	const char *server;
+	CURL *curl;
+	char error_buffer[CURL_ERROR_SIZE];
+	size_t bytes;
+	double speed;
+	double latency;
+	int ok;
+};
+
+static size_t mirror_probe_write_cb(void *ptr, size_t size, size_t nmemb,
+		void *user)
+{
+	struct mirror_probe *probe = user;
+	(void)ptr;
+	probe->bytes += size * nmemb;
+	if(probe->bytes >= MIRROR_PROBE_SIZE) {
+		/* got what we came for; a short return aborts the transfer in case
+		 * the server ignored our Range header */
+		return 0;
+	}
+	return size * nmemb;
+}
+
+/* successful probes first, fastest first; failed probes keep server order */
+static int mirror_bench_cmp(const void *a, const void *b)
+{
+	const alpm_mirror_bench_t *ba = a, *bb = b;
+	if(ba->ok != bb->ok) {
+		return bb->ok - ba->ok;
+	}
+	return (ba->speed < bb->speed) - (ba->speed > bb->speed);
+}
+
+#endif /* HAVE_LIBCURL */
+
+int SYMEXPORT alpm_mirrors_benchmark(alpm_handle_t *handle, alpm_db_t *db,
+		alpm_list_t **results)
+{
+#ifdef HAVE_LIBCURL
+	struct mirror_probe *probes;
+	alpm_list_t *i;
+	char *filepath;
+	char range[32];
+	size_t len, count, n, nok = 0;
+	int still_running = 0;
+	CURLM *curlm;
+	CURLMsg *msg;
+	int ret = 0;
+
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(db != NULL && results != NULL,
+			RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	*results = NULL;
+	count = alpm_list_count(db->servers);
+	ASSERT(count != 0, RET_ERR(handle, ALPM_ERR_SERVER_NONE, -1));
+	curlm = handle->curlm;
+
+	/* probe the leading bytes of the database file itself; every mirror
+	 * carries it and it is large enough to see the pipe open up */
+	len = strlen(db->treename) + strlen(handle->dbext) + 1;
+	MALLOC(filepath, len, RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	snprintf(filepath, len, "%s%s", db->treename, handle->dbext);
+	snprintf(range, sizeof(range), "0-%d", MIRROR_PROBE_SIZE - 1);
+
+	CALLOC(probes, count, sizeof(struct mirror_probe),
+			free(filepath); RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+
+	for(i = db->servers, n = 0; i; i = i->next, n++) {
+		struct mirror_probe *probe = &probes[n];
+		char *url;
+		size_t urllen = strlen(i->data) + strlen(filepath) + 2;
+
+		probe->server = i->data;
+		MALLOC(url, urllen, continue);
+		snprintf(url, urllen, "%s/%s", i->data, filepath);
+
+		if((probe->curl = curl_easy_init()) == NULL) {
+			free(url);
+			continue;
+		}
+		curl_easy_setopt(probe->curl, CURLOPT_URL, url);
+		curl_easy_setopt(probe->curl, CURLOPT_RANGE, range);
+		curl_easy_setopt(probe->curl, CURLOPT_WRITEFUNCTION, mirror_probe_write_cb);
+		curl_easy_setopt(probe->curl, CURLOPT_WRITEDATA, (void *)probe);
+		curl_easy_setopt(probe->curl, CURLOPT_PRIVATE, (void *)probe);
+		curl_easy_setopt(probe->curl, CURLOPT_ERRORBUFFER, probe->error_buffer);
+		curl_easy_setopt(probe->curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(probe->curl, CURLOPT_MAXREDIRS, 3L);
+		curl_easy_setopt(probe->curl, CURLOPT_CONNECTTIMEOUT, 10L);
+		curl_easy_setopt(probe->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+		curl_easy_setopt(probe->curl, CURLOPT_LOW_SPEED_TIME, 10L);
+		curl_easy_setopt(probe->curl, CURLOPT_NOPROGRESS, 1L);
+		if(handle->curlsh) {
+			/* warm the shared DNS/TLS caches for the downloads to follow */
+			curl_easy_setopt(probe->curl, CURLOPT_SHARE, handle->curlsh);
+		}
+		curl_multi_add_handle(curlm, probe->curl);
+		free(url);
+	}
+
+	do {
+		int msgs_left = -1;
+		CURLMcode mc = curl_multi_perform(curlm, &still_running);
+		if(mc != CURLM_OK) {
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("curl returned error %d from transfer\n"), mc);
+			ret = -1;
+			break;
+		}
+		while((msg = curl_multi_info_read(curlm, &msgs_left))) {
+			struct mirror_probe *probe = NULL;
+			char hostname[HOSTNAME_SIZE];
+			long respcode = 0;
+
+			if(msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &probe);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &respcode);
+			/* a write-callback abort just means the mirror sent the whole
+			 * file; the bytes we did take still carry the measurement */
+			probe->ok = (msg->data.result == CURLE_OK ||
+						msg->data.result == CURLE_WRITE_ERROR)
+					&& respcode < 400 && probe->bytes > 0;
+			if(probe->ok) {
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_SPEED_DOWNLOAD,
+						&probe->speed);
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_STARTTRANSFER_TIME,
+						&probe->latency);
+			}
+			/* seed the download scheduler with the measurement */
+			if(curl_gethost(probe->server, hostname, sizeof(hostname)) == 0) {
+				server_stats_record(handle, msg->easy_handle, hostname, probe->ok);
+			}
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"mirror probe %s: %s, %.0f bytes/s, %.3fs to first byte\n",
+					probe->server, probe->ok ? "ok" : "failed",
+					probe->speed, probe->latency);
+			curl_multi_remove_handle(curlm, msg->easy_handle);
+			curl_easy_cleanup(msg->easy_handle);
+			probe->curl = NULL;
+		}
+		if(still_running) {
+			curl_multi_wait(curlm, NULL, 0, 1000, NULL);
+		}
+	} while(still_running);
+
+	for(n = 0; n < count; n++) {
+		alpm_mirror_bench_t *bench;
+		if(probes[n].curl) {
+			/* aborted by an earlier multi error */
+			curl_multi_remove_handle(curlm, probes[n].curl);
+			curl_easy_cleanup(probes[n].curl);
+			probes[n].curl = NULL;
+		}
+		CALLOC(bench, 1, sizeof(alpm_mirror_bench_t), continue);
+		STRDUP(bench->server, probes[n].server, free(bench); continue);
+		bench->speed = probes[n].speed;
+		bench->latency = probes[n].latency;
+		bench->ok = probes[n].ok;
+		nok += probes[n].ok;
+		*results = alpm_list_add(*results, bench);
+	}
+	if(*results) {
+		*results = alpm_list_msort(*results, alpm_list_count(*results),
+				mirror_bench_cmp);
+	}
+
+	free(probes);
+	free(filepath);
+	if(ret == 0 && nok == 0) {
+		RET_ERR(handle, ALPM_ERR_RETRIEVE, -1);
+	}
+	return ret;
+#else
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(db != NULL && results != NULL,
+			RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	*results = NULL;
+	RET_ERR(handle, ALPM_ERR_EXTERNAL_DOWNLOAD, -1);
+#endif
+}
+
+void SYMEXPORT alpm_mirror_bench_free(alpm_mirror_bench_t *bench)
+{
+	ASSERT(bench != NULL, return);
+	FREE(bench->server);
+	FREE(bench);
+}
+
 void _alpm_dload_payload_reset(struct dload_payload *payload)
 {
 	ASSERT(payload, return);
@@ -1175,6 +1990,11 @@ void _alpm_dload_payload_reset(struct dload_payload *payload)
 	FREE(payload->content_disp_name);
 	FREE(payload->fileurl);
 	FREE(payload->filepath);
+	FREE(payload->dl_md5sum);
+	FREE(payload->dl_sha256sum);
+#ifdef HAVE_LIBCURL
+	_alpm_digest_free(payload->digest);
+#endif
 	*payload = (struct dload_payload){0};
 }
 
@@ -22,6 +22,7 @@
 
 #include "alpm_list.h"
 #include "alpm.h"
+#include "util.h"
 
 struct dload_payload {
 	alpm_handle_t *handle;
@@ -32,10 +33,13 @@ struct dload_payload {
 	char *content_disp_name;
 	char *fileurl;
 	char *filepath; /* download URL path */
+	char *dl_md5sum; /* digests streamed during the download, */
+	char *dl_sha256sum; /* set once the transfer completed successfully */
 	alpm_list_t *servers;
 	long respcode;
 	off_t initial_size;
 	off_t max_size;
+	off_t content_size; /* exact remote file size, 0 if unknown */
 	off_t prevprogress;
 	int force;
 	int allow_resume;
@@ -43,10 +47,29 @@ struct dload_payload {
 	int unlink_on_fail;
 	int trust_remote_name;
 	int signature; /* specifies if the payload is a signature file */
+	/* invoked from the download loop as soon as this payload settles
+	 * (result 0 on success, -1 on failure), so callers can overlap
+	 * post-processing of finished files with the remaining transfers;
+	 * runs on the downloading thread, after the destfile rename */
+	void (*on_complete)(void *ctx, struct dload_payload *payload, int result);
+	void *on_complete_ctx;
 #ifdef HAVE_LIBCURL
 	CURL *curl;
+	/* mirror rotation bookkeeping: the full server list and the node the
+	 * scheduler tried first, so retries can wrap around the whole list */
+	alpm_list_t *servers_head;
+	alpm_list_t *servers_start;
 	char error_buffer[CURL_ERROR_SIZE];
 	FILE *localf; /* temp download file */
+	_alpm_digest_ctx_t *digest; /* hashes the stream as it is written */
+	/* byte-range segmentation for large payloads */
+	struct dload_payload *parent; /* set on range sub-transfers */
+	alpm_list_t *segments; /* child payloads, set on the parent */
+	off_t seg_start; /* first byte of this segment */
+	off_t seg_size; /* number of bytes this segment fetches */
+	off_t seg_dlnow; /* segment bytes downloaded so far */
+	int segments_active;
+	int segment_errors;
 #endif
 };
 
@@ -157,6 +157,9 @@ const char SYMEXPORT *alpm_strerror(alpm_errno_t err)
 		/* Missing compile-time features */
 		case ALPM_ERR_MISSING_CAPABILITY_SIGNATURES:
 				return _("compiled without signature support");
+		/* Read-only mode */
+		case ALPM_ERR_HANDLE_READONLY:
+			return _("handle is in read-only mode");
 		/* Unknown error! */
 		default:
 			return _("unexpected error");
@@ -18,6 +18,7 @@
  */
 
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -25,14 +26,13 @@
 #include "filelist.h"
 #include "util.h"
 
-/* Returns the difference of the provided two lists of files.
+/* Fills 'ret' with the difference of the provided two lists of files.
  * Pre-condition: both lists are sorted!
- * When done, free the list but NOT the contained data.
+ * When done, release the vector but do NOT free the contained data.
  */
-alpm_list_t *_alpm_filelist_difference(alpm_filelist_t *filesA,
-		alpm_filelist_t *filesB)
+int _alpm_filelist_difference(alpm_filelist_t *filesA,
+		alpm_filelist_t *filesB, _alpm_vector_t *ret)
 {
-	alpm_list_t *ret = NULL;
 	size_t ctrA = 0, ctrB = 0;
 
 	while(ctrA < filesA->count && ctrB < filesB->count) {
@@ -42,7 +42,9 @@ alpm_list_t *_alpm_filelist_difference(alpm_filelist_t *filesA,
 		int cmp = strcmp(strA, strB);
 		if(cmp < 0) {
 			/* item only in filesA, qualifies as a difference */
-			ret = alpm_list_add(ret, strA);
+			if(_alpm_vector_add(ret, strA) != 0) {
+				return -1;
+			}
 			ctrA++;
 		} else if(cmp > 0) {
 			ctrB++;
@@ -54,14 +56,16 @@ alpm_list_t *_alpm_filelist_difference(alpm_filelist_t *filesA,
 
 	/* ensure we have completely emptied pA */
 	while(ctrA < filesA->count) {
-		ret = alpm_list_add(ret, filesA->files[ctrA].name);
+		if(_alpm_vector_add(ret, filesA->files[ctrA].name) != 0) {
+			return -1;
+		}
 		ctrA++;
 	}
 
-	return ret;
+	return 0;
 }
 
-static int _alpm_filelist_pathcmp(const char *p1, const char *p2)
+int _alpm_filelist_pathcmp(const char *p1, const char *p2)
 {
 	while(*p1 && *p1 == *p2) {
 		p1++;
@@ -78,14 +82,13 @@ static int _alpm_filelist_pathcmp(const char *p1, const char *p2)
 	return *p1 - *p2;
 }
 
-/* Returns the intersection of the provided two lists of files.
+/* Fills 'ret' with the intersection of the provided two lists of files.
  * Pre-condition: both lists are sorted!
- * When done, free the list but NOT the contained data.
+ * When done, release the vector but do NOT free the contained data.
  */
-alpm_list_t *_alpm_filelist_intersection(alpm_filelist_t *filesA,
-		alpm_filelist_t *filesB)
+int _alpm_filelist_intersection(alpm_filelist_t *filesA,
+		alpm_filelist_t *filesB, _alpm_vector_t *ret)
 {
-	alpm_list_t *ret = NULL;
 	size_t ctrA = 0, ctrB = 0;
 	alpm_file_t *arrA = filesA->files, *arrB = filesB->files;
 
@@ -99,14 +102,16 @@ alpm_list_t *_alpm_filelist_intersection(alpm_filelist_t *filesA,
 		} else {
 			/* when not directories, item in both qualifies as an intersect */
 			if(strA[strlen(strA) - 1] != '/' || strB[strlen(strB) - 1] != '/') {
-				ret = alpm_list_add(ret, arrA[ctrA].name);
+				if(_alpm_vector_add(ret, arrA[ctrA].name) != 0) {
+					return -1;
+				}
 			}
 			ctrA++;
 			ctrB++;
 		}
 	}
 
-	return ret;
+	return 0;
 }
 
 /* Helper function for comparing files list entries
@@ -118,19 +123,66 @@ static int _alpm_files_cmp(const void *f1, const void *f2)
 	return strcmp(file1->name, file2->name);
 }
 
+/* lazily built hash index over file names; buckets hold index + 1 into
+ * the files array, 0 marks an empty bucket */
+struct filelist_hash {
+	size_t nbuckets; /* always a power of two */
+	size_t buckets[];
+};
+
+static int filelist_hash_build(alpm_filelist_t *filelist)
+{
+	struct filelist_hash *hash;
+	size_t nbuckets = 16, i;
+
+	while(nbuckets < filelist->count * 2) {
+		nbuckets *= 2;
+	}
+	hash = calloc(1, sizeof(struct filelist_hash) + nbuckets * sizeof(size_t));
+	if(hash == NULL) {
+		return -1;
+	}
+	hash->nbuckets = nbuckets;
+	for(i = 0; i < filelist->count; i++) {
+		size_t b = _alpm_hash_sdbm(filelist->files[i].name) & (nbuckets - 1);
+		while(hash->buckets[b] != 0) {
+			b = (b + 1) & (nbuckets - 1);
+		}
+		hash->buckets[b] = i + 1;
+	}
+	filelist->hashes = hash;
+	return 0;
+}
+
 alpm_file_t SYMEXPORT *alpm_filelist_contains(alpm_filelist_t *filelist,
 		const char *path)
 {
-	alpm_file_t key;
+	struct filelist_hash *hash;
+	size_t b;
 
-	if(!filelist) {
+	if(!filelist || filelist->count == 0) {
 		return NULL;
 	}
 
-	key.name = (char *)path;
+	/* the index is built on the first query; worker threads must not be
+	 * handed a filelist that has never been queried */
+	if(filelist->hashes == NULL && filelist_hash_build(filelist) != 0) {
+		/* out of memory; fall back to binary search */
+		alpm_file_t key;
+		key.name = (char *)path;
+		return bsearch(&key, filelist->files, filelist->count,
+				sizeof(alpm_file_t), _alpm_files_cmp);
+	}
 
-	return bsearch(&key, filelist->files, filelist->count,
-			sizeof(alpm_file_t), _alpm_files_cmp);
+	hash = filelist->hashes;
+	for(b = _alpm_hash_sdbm(path) & (hash->nbuckets - 1);
+			hash->buckets[b] != 0; b = (b + 1) & (hash->nbuckets - 1)) {
+		alpm_file_t *file = filelist->files + (hash->buckets[b] - 1);
+		if(strcmp(file->name, path) == 0) {
+			return file;
+		}
+	}
+	return NULL;
 }
 
 void _alpm_filelist_sort(alpm_filelist_t *filelist)
@@ -145,3 +197,54 @@ void _alpm_filelist_sort(alpm_filelist_t *filelist)
 		}
 	}
 }
+
+int _alpm_filelist_append(alpm_filelist_t *filelist, const char *path,
+		size_t len, size_t *files_size, size_t *names_size, size_t *names_len)
+{
+	alpm_file_t *file;
+
+	if(!_alpm_greedy_grow((void **)&filelist->files, files_size,
+				(filelist->count ? (filelist->count + 1) * sizeof(alpm_file_t)
+				 : 8 * sizeof(alpm_file_t)))) {
+		return -1;
+	}
+	if(!_alpm_greedy_grow((void **)&filelist->names, names_size,
+				*names_len + len + 1)) {
+		return -1;
+	}
+
+	memcpy(filelist->names + *names_len, path, len);
+	filelist->names[*names_len + len] = '\0';
+
+	file = filelist->files + filelist->count;
+	/* offset into the names buffer; resolved in _alpm_filelist_finish()
+	 * once the buffer has stopped moving under reallocation */
+	file->name = (char *)(uintptr_t)*names_len;
+	file->size = 0;
+	file->mode = 0;
+
+	*names_len += len + 1;
+	filelist->count++;
+	return 0;
+}
+
+void _alpm_filelist_finish(alpm_filelist_t *filelist, size_t names_len)
+{
+	size_t i;
+
+	if(filelist->count == 0) {
+		FREE(filelist->files);
+		FREE(filelist->names);
+		return;
+	}
+
+	/* attempt to hand back any memory we don't need */
+	REALLOC(filelist->files, filelist->count * sizeof(alpm_file_t), (void)0);
+	REALLOC(filelist->names, names_len, (void)0);
+
+	for(i = 0; i < filelist->count; i++) {
+		filelist->files[i].name =
+			filelist->names + (uintptr_t)filelist->files[i].name;
+	}
+	_alpm_filelist_sort(filelist);
+}
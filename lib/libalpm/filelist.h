@@ -20,13 +20,29 @@
 #define ALPM_FILELIST_H
 
 #include "alpm.h"
+#include "vector.h"
 
-alpm_list_t *_alpm_filelist_difference(alpm_filelist_t *filesA,
-		alpm_filelist_t *filesB);
+/* Compare two file paths, ignoring a trailing slash on either side so
+ * that directory entries compare equal to their file counterparts. */
+int _alpm_filelist_pathcmp(const char *p1, const char *p2);
 
-alpm_list_t *_alpm_filelist_intersection(alpm_filelist_t *filesA,
-		alpm_filelist_t *filesB);
+int _alpm_filelist_difference(alpm_filelist_t *filesA,
+		alpm_filelist_t *filesB, _alpm_vector_t *ret);
+
+int _alpm_filelist_intersection(alpm_filelist_t *filesA,
+		alpm_filelist_t *filesB, _alpm_vector_t *ret);
 
 void _alpm_filelist_sort(alpm_filelist_t *filelist);
 
+/* Incremental construction of a filelist backed by a single contiguous
+ * name buffer. While building, each entry's name field holds its offset
+ * into the buffer; _alpm_filelist_finish() resolves the offsets to
+ * pointers, trims the allocations and sorts the list. An unfinished list
+ * is still safe to hand to _alpm_pkg_free(), which only frees the two
+ * allocations when the names buffer is set. */
+int _alpm_filelist_append(alpm_filelist_t *filelist, const char *path,
+		size_t len, size_t *files_size, size_t *names_size, size_t *names_len);
+
+void _alpm_filelist_finish(alpm_filelist_t *filelist, size_t names_len);
+
 #endif /* ALPM_FILELIST_H */
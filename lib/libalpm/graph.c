@@ -36,3 +36,117 @@ void _alpm_graph_free(void *data)
 	alpm_list_free(graph->children);
 	free(graph);
 }
+
+#define GRAPH_ARENA_MIN_NODES 64
+
+struct graph_arena_block {
+	struct graph_arena_block *next;
+	size_t used;
+	size_t cap;
+	alpm_graph_t nodes[];
+};
+
+struct graph_edge_block {
+	struct graph_edge_block *next;
+	size_t used;
+	size_t cap;
+	alpm_list_t cells[];
+};
+
+struct __alpm_graph_arena_t {
+	struct graph_arena_block *blocks;
+	struct graph_edge_block *edges;
+};
+
+static struct graph_arena_block *arena_block_new(size_t cap)
+{
+	struct graph_arena_block *block;
+	CALLOC(block, 1, sizeof(*block) + cap * sizeof(alpm_graph_t),
+			return NULL);
+	block->cap = cap;
+	return block;
+}
+
+alpm_graph_arena_t *_alpm_graph_arena_new(size_t hint)
+{
+	alpm_graph_arena_t *arena;
+	CALLOC(arena, 1, sizeof(*arena), return NULL);
+	if(hint < GRAPH_ARENA_MIN_NODES) {
+		hint = GRAPH_ARENA_MIN_NODES;
+	}
+	arena->blocks = arena_block_new(hint);
+	if(arena->blocks == NULL) {
+		free(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+alpm_graph_t *_alpm_graph_arena_alloc(alpm_graph_arena_t *arena)
+{
+	struct graph_arena_block *block = arena->blocks;
+	if(block->used == block->cap) {
+		struct graph_arena_block *newblock = arena_block_new(block->cap * 2);
+		if(newblock == NULL) {
+			return NULL;
+		}
+		newblock->next = block;
+		arena->blocks = newblock;
+		block = newblock;
+	}
+	/* blocks are calloc'd, so the node comes back zeroed */
+	return &block->nodes[block->used++];
+}
+
+/* Append 'child' to parent->children using a list cell drawn from the
+ * arena's edge pool, keeping the alpm_list invariants (head->prev is the
+ * tail) so the list remains usable with the alpm_list functions. */
+int _alpm_graph_arena_add_child(alpm_graph_arena_t *arena,
+		alpm_graph_t *parent, alpm_graph_t *child)
+{
+	struct graph_edge_block *block = arena->edges;
+	alpm_list_t *cell;
+
+	if(block == NULL || block->used == block->cap) {
+		struct graph_edge_block *newblock;
+		size_t cap = block ? block->cap * 2 : GRAPH_ARENA_MIN_NODES;
+		MALLOC(newblock, sizeof(*newblock) + cap * sizeof(alpm_list_t),
+				return -1);
+		newblock->next = block;
+		newblock->used = 0;
+		newblock->cap = cap;
+		arena->edges = newblock;
+		block = newblock;
+	}
+
+	cell = &block->cells[block->used++];
+	cell->data = child;
+	cell->next = NULL;
+	if(parent->children == NULL) {
+		cell->prev = cell;
+		parent->children = cell;
+	} else {
+		cell->prev = parent->children->prev;
+		parent->children->prev->next = cell;
+		parent->children->prev = cell;
+	}
+	return 0;
+}
+
+void _alpm_graph_arena_free(alpm_graph_arena_t *arena)
+{
+	struct graph_arena_block *block, *next;
+	struct graph_edge_block *eblock, *enext;
+	if(arena == NULL) {
+		return;
+	}
+	for(block = arena->blocks; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	for(eblock = arena->edges; eblock; eblock = enext) {
+		enext = eblock->next;
+		free(eblock);
+	}
+	free(arena);
+}
@@ -38,7 +38,18 @@ typedef struct __alpm_graph_t {
 	enum __alpm_graph_vertex_state state;
 } alpm_graph_t;
 
+/* Arena holding graph nodes and edge list cells in large blocks, so
+ * building a graph is not one malloc per vertex and edge. Freeing the
+ * arena releases every node and edge allocated from it in O(blocks). */
+typedef struct __alpm_graph_arena_t alpm_graph_arena_t;
+
 alpm_graph_t *_alpm_graph_new(void);
 void _alpm_graph_free(void *data);
 
+alpm_graph_arena_t *_alpm_graph_arena_new(size_t hint);
+alpm_graph_t *_alpm_graph_arena_alloc(alpm_graph_arena_t *arena);
+int _alpm_graph_arena_add_child(alpm_graph_arena_t *arena,
+		alpm_graph_t *parent, alpm_graph_t *child);
+void _alpm_graph_arena_free(alpm_graph_arena_t *arena);
+
 #endif /* ALPM_GRAPH_H */
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <sched.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <syslog.h>
 #include <sys/stat.h>
@@ -37,6 +39,9 @@
 #include "trans.h"
 #include "alpm.h"
 #include "deps.h"
+#include "hook.h"
+#include "patternset.h"
+#include "signing.h"
 
 alpm_handle_t *_alpm_handle_new(void)
 {
@@ -44,6 +49,14 @@ alpm_handle_t *_alpm_handle_new(void)
 
 	CALLOC(handle, 1, sizeof(alpm_handle_t), return NULL);
 	handle->lockfd = -1;
+	handle->worker_threads = 1;
+	pthread_mutex_init(&handle->log_defer_lock, NULL);
+	pthread_mutex_init(&handle->logbuf_lock, NULL);
+	pthread_mutex_init(&handle->counters_lock, NULL);
+	pthread_cond_init(&handle->logbuf_cond, NULL);
+#ifdef HAVE_LIBGPGME
+	pthread_mutex_init(&handle->gpgme_ctx_lock, NULL);
+#endif
 
 	return handle;
 }
@@ -55,6 +68,7 @@ void _alpm_handle_free(alpm_handle_t *handle)
 	}
 
 	/* close logfile */
+	_alpm_logaction_shutdown(handle);
 	if(handle->logstream) {
 		fclose(handle->logstream);
 		handle->logstream = NULL;
@@ -66,15 +80,26 @@ void _alpm_handle_free(alpm_handle_t *handle)
 
 #ifdef HAVE_LIBGPGME
 	FREELIST(handle->known_keys);
+	_alpm_gpgme_release_ctxs(handle);
+	pthread_mutex_destroy(&handle->gpgme_ctx_lock);
+#endif
+#ifdef HAVE_LIBCURL
+	FREELIST(handle->server_stats);
 #endif
 
+	/* persist resolver decisions for the next invocation */
+	_alpm_depcache_save(handle);
+	_alpm_depcache_free(handle);
+
 	/* free memory */
 	_alpm_trans_free(handle->trans);
 	FREE(handle->root);
 	FREE(handle->dbpath);
 	FREE(handle->dbext);
+	_alpm_filecache_invalidate(handle);
 	FREELIST(handle->cachedirs);
 	FREELIST(handle->hookdirs);
+	_alpm_hook_cache_free(handle);
 	FREE(handle->logfile);
 	FREE(handle->lockfile);
 	FREE(handle->arch);
@@ -83,11 +108,18 @@ void _alpm_handle_free(alpm_handle_t *handle)
 	FREELIST(handle->noextract);
 	FREELIST(handle->ignorepkg);
 	FREELIST(handle->ignoregroup);
+	_alpm_patternset_free(handle->ignorepkg_set);
+	_alpm_patternset_free(handle->ignoregroup_set);
 	FREELIST(handle->overwrite_files);
 
 	alpm_list_free_inner(handle->assumeinstalled, (alpm_list_fn_free)alpm_dep_free);
 	alpm_list_free(handle->assumeinstalled);
 
+	pthread_mutex_destroy(&handle->log_defer_lock);
+	pthread_mutex_destroy(&handle->logbuf_lock);
+	pthread_mutex_destroy(&handle->counters_lock);
+	pthread_cond_destroy(&handle->logbuf_cond);
+
 	FREE(handle);
 }
 
@@ -198,6 +230,12 @@ alpm_cb_progress SYMEXPORT alpm_option_get_progresscb(alpm_handle_t *handle)
 	return handle->progresscb;
 }
 
+alpm_cb_trace SYMEXPORT alpm_option_get_tracecb(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return NULL);
+	return handle->tracecb;
+}
+
 const char SYMEXPORT *alpm_option_get_root(alpm_handle_t *handle)
 {
 	CHECK_HANDLE(handle, return NULL);
@@ -294,6 +332,24 @@ int SYMEXPORT alpm_option_get_checkspace(alpm_handle_t *handle)
 	return handle->checkspace;
 }
 
+int SYMEXPORT alpm_option_get_readonly(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->readonly;
+}
+
+int SYMEXPORT alpm_option_get_durability(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->durability;
+}
+
+int SYMEXPORT alpm_option_get_preallocate(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->preallocate;
+}
+
 const char SYMEXPORT *alpm_option_get_dbext(alpm_handle_t *handle)
 {
 	CHECK_HANDLE(handle, return NULL);
@@ -349,6 +405,13 @@ int SYMEXPORT alpm_option_set_progresscb(alpm_handle_t *handle, alpm_cb_progress
 	return 0;
 }
 
+int SYMEXPORT alpm_option_set_tracecb(alpm_handle_t *handle, alpm_cb_trace cb)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->tracecb = cb;
+	return 0;
+}
+
 static char *canonicalize_path(const char *path)
 {
 	char *new_path;
@@ -462,6 +525,7 @@ int SYMEXPORT alpm_option_add_cachedir(alpm_handle_t *handle, const char *cached
 		RET_ERR(handle, ALPM_ERR_MEMORY, -1);
 	}
 	handle->cachedirs = alpm_list_add(handle->cachedirs, newcachedir);
+	_alpm_filecache_invalidate(handle);
 	_alpm_log(handle, ALPM_LOG_DEBUG, "option 'cachedir' = %s\n", newcachedir);
 	return 0;
 }
@@ -494,6 +558,7 @@ int SYMEXPORT alpm_option_remove_cachedir(alpm_handle_t *handle, const char *cac
 		RET_ERR(handle, ALPM_ERR_MEMORY, -1);
 	}
 	handle->cachedirs = alpm_list_remove_str(handle->cachedirs, newcachedir, &vdata);
+	_alpm_filecache_invalidate(handle);
 	FREE(newcachedir);
 	if(vdata != NULL) {
 		FREE(vdata);
@@ -515,10 +580,12 @@ int SYMEXPORT alpm_option_set_logfile(alpm_handle_t *handle, const char *logfile
 	STRDUP(handle->logfile, logfile, RET_ERR(handle, ALPM_ERR_MEMORY, -1));
 
 	/* free the old logfile path string, and close the stream so logaction
-	 * will reopen a new stream on the new logfile */
+	 * will reopen a new stream on the new logfile; stop the async writer
+	 * first so no queued lines still reference the old stream */
 	if(oldlogfile) {
 		FREE(oldlogfile);
 	}
+	_alpm_logaction_shutdown(handle);
 	if(handle->logstream) {
 		fclose(handle->logstream);
 		handle->logstream = NULL;
@@ -616,31 +683,43 @@ int SYMEXPORT alpm_option_match_noextract(alpm_handle_t *handle, const char *pat
 
 int SYMEXPORT alpm_option_add_ignorepkg(alpm_handle_t *handle, const char *pkg)
 {
+	_alpm_patternset_free(handle->ignorepkg_set);
+	handle->ignorepkg_set = NULL;
 	return _alpm_option_strlist_add(handle, &(handle->ignorepkg), pkg);
 }
 
 int SYMEXPORT alpm_option_set_ignorepkgs(alpm_handle_t *handle, alpm_list_t *ignorepkgs)
 {
+	_alpm_patternset_free(handle->ignorepkg_set);
+	handle->ignorepkg_set = NULL;
 	return _alpm_option_strlist_set(handle, &(handle->ignorepkg), ignorepkgs);
 }
 
 int SYMEXPORT alpm_option_remove_ignorepkg(alpm_handle_t *handle, const char *pkg)
 {
+	_alpm_patternset_free(handle->ignorepkg_set);
+	handle->ignorepkg_set = NULL;
 	return _alpm_option_strlist_rem(handle, &(handle->ignorepkg), pkg);
 }
 
 int SYMEXPORT alpm_option_add_ignoregroup(alpm_handle_t *handle, const char *grp)
 {
+	_alpm_patternset_free(handle->ignoregroup_set);
+	handle->ignoregroup_set = NULL;
 	return _alpm_option_strlist_add(handle, &(handle->ignoregroup), grp);
 }
 
 int SYMEXPORT alpm_option_set_ignoregroups(alpm_handle_t *handle, alpm_list_t *ignoregrps)
 {
+	_alpm_patternset_free(handle->ignoregroup_set);
+	handle->ignoregroup_set = NULL;
 	return _alpm_option_strlist_set(handle, &(handle->ignoregroup), ignoregrps);
 }
 
 int SYMEXPORT alpm_option_remove_ignoregroup(alpm_handle_t *handle, const char *grp)
 {
+	_alpm_patternset_free(handle->ignoregroup_set);
+	handle->ignoregroup_set = NULL;
 	return _alpm_option_strlist_rem(handle, &(handle->ignoregroup), grp);
 }
 
@@ -754,6 +833,27 @@ int SYMEXPORT alpm_option_set_checkspace(alpm_handle_t *handle, int checkspace)
 	return 0;
 }
 
+int SYMEXPORT alpm_option_set_readonly(alpm_handle_t *handle, int readonly)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->readonly = readonly;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_durability(alpm_handle_t *handle, int durability)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->durability = durability;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_preallocate(alpm_handle_t *handle, int preallocate)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->preallocate = preallocate;
+	return 0;
+}
+
 int SYMEXPORT alpm_option_set_dbext(alpm_handle_t *handle, const char *dbext)
 {
 	CHECK_HANDLE(handle, return -1);
@@ -866,3 +966,105 @@ int SYMEXPORT alpm_option_set_parallel_downloads(alpm_handle_t *handle,
 #endif
 	return 0;
 }
+
+static unsigned int detect_worker_threads(void)
+{
+	long ncpus = 0;
+#ifdef CPU_COUNT
+	cpu_set_t set;
+	/* the affinity mask reflects taskset and cgroup cpuset restrictions,
+	 * which the raw online cpu count does not */
+	if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+		ncpus = CPU_COUNT(&set);
+	}
+#endif
+	if(ncpus <= 0) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(ncpus <= 0) {
+		ncpus = 1;
+	}
+	return (unsigned int)ncpus;
+}
+
+int SYMEXPORT alpm_option_set_worker_threads(alpm_handle_t *handle,
+		unsigned int num_threads)
+{
+	CHECK_HANDLE(handle, return -1);
+	if(num_threads == 0) {
+		num_threads = detect_worker_threads();
+	}
+	handle->worker_threads = num_threads;
+	return 0;
+}
+
+unsigned int SYMEXPORT alpm_option_get_worker_threads(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return 0);
+	return handle->worker_threads;
+}
+
+void _alpm_counter_add(alpm_handle_t *handle, int64_t *counter, int64_t amount)
+{
+	pthread_mutex_lock(&handle->counters_lock);
+	*counter += amount;
+	pthread_mutex_unlock(&handle->counters_lock);
+}
+
+int SYMEXPORT alpm_get_counters(alpm_handle_t *handle, alpm_counters_t *counters)
+{
+	CHECK_HANDLE(handle, return -1);
+	ASSERT(counters != NULL, RET_ERR(handle, ALPM_ERR_WRONG_ARGS, -1));
+	pthread_mutex_lock(&handle->counters_lock);
+	*counters = handle->counters;
+	pthread_mutex_unlock(&handle->counters_lock);
+	return 0;
+}
+
+int SYMEXPORT alpm_reset_counters(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	pthread_mutex_lock(&handle->counters_lock);
+	memset(&handle->counters, 0, sizeof(handle->counters));
+	pthread_mutex_unlock(&handle->counters_lock);
+	return 0;
+}
+
+int SYMEXPORT alpm_option_set_localdb_journal(alpm_handle_t *handle, int enable)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->localdb_journal = enable;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_get_localdb_journal(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->localdb_journal;
+}
+
+int SYMEXPORT alpm_option_set_verify_extraction(alpm_handle_t *handle, int enable)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->verify_extraction = enable;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_get_verify_extraction(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->verify_extraction;
+}
+
+int SYMEXPORT alpm_option_set_db_deltas(alpm_handle_t *handle, int enable)
+{
+	CHECK_HANDLE(handle, return -1);
+	handle->db_deltas = enable;
+	return 0;
+}
+
+int SYMEXPORT alpm_option_get_db_deltas(alpm_handle_t *handle)
+{
+	CHECK_HANDLE(handle, return -1);
+	return handle->db_deltas;
+}
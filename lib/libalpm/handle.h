@@ -21,6 +21,7 @@
 #define ALPM_HANDLE_H
 
 #include <stdio.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <regex.h>
 
@@ -49,23 +50,59 @@ do { \
 		(h)->progresscb(e, p, per, n, r); \
 	} \
 } while(0)
+/* span tracing; the callback test keeps disabled tracing down to a
+ * single branch on the hot paths (_alpm_trace lives in log.c) */
+#define TRACE_BEGIN(h, phase, detail) \
+do { \
+	if((h)->tracecb) { \
+		_alpm_trace(h, phase, 1, detail); \
+	} \
+} while(0)
+#define TRACE_END(h, phase, detail) \
+do { \
+	if((h)->tracecb) { \
+		_alpm_trace(h, phase, 0, detail); \
+	} \
+} while(0)
 
 struct __alpm_handle_t {
 	/* internal usage */
 	alpm_db_t *db_local;    /* local db pointer */
 	alpm_list_t *dbs_sync;  /* List of (alpm_db_t *) */
 	FILE *logstream;        /* log file stream pointer */
+
+	/* asynchronous pacman.log writer (log.c): alpm_logaction() queues
+	 * formatted lines under logbuf_lock and a background thread writes
+	 * them out, so file logging stays off the install hot path; flushed
+	 * and fsynced at transaction boundaries */
+	alpm_list_t *logbuf;     /* queued formatted lines (char *) */
+	size_t logbuf_len;
+	int logbuf_busy;         /* flusher is writing a batch */
+	int logbuf_shutdown;
+	int logbuf_thread_running;
+	pthread_t logbuf_thread;
+	pthread_mutex_t logbuf_lock;
+	pthread_cond_t logbuf_cond;
 	alpm_trans_t *trans;
 
 #ifdef HAVE_LIBCURL
 	/* libcurl handle */
 	CURLM *curlm;
+	/* share object pooling DNS entries, TLS sessions and connections
+	 * across every transfer for the life of the handle (dload.c) */
+	CURLSH *curlsh;
 	unsigned short disable_dl_timeout;
 	unsigned int parallel_downloads; /* number of download streams */
+	alpm_list_t *server_stats; /* per-mirror throughput/latency records (dload.c) */
 #endif
 
 #ifdef HAVE_LIBGPGME
 	alpm_list_t *known_keys;  /* keys verified to be in our keychain */
+	/* pooled gpgme verification contexts (gpgme_ctx_t), reused across
+	 * signature checks instead of created per call; shared by worker
+	 * threads under gpgme_ctx_lock (signing.c) */
+	alpm_list_t *gpgme_ctxs;
+	pthread_mutex_t gpgme_ctx_lock;
 #endif
 
 	/* callback functions */
@@ -76,6 +113,7 @@ struct __alpm_handle_t {
 	alpm_cb_event eventcb;
 	alpm_cb_question questioncb;
 	alpm_cb_progress progresscb;
+	alpm_cb_trace tracecb;      /* Phase tracing callback function */
 
 	/* filesystem paths */
 	char *root;              /* Root path, default '/' */
@@ -85,6 +123,10 @@ struct __alpm_handle_t {
 	char *gpgdir;            /* Directory where GnuPG files are stored */
 	alpm_list_t *cachedirs;  /* Paths to pacman cache directories */
 	alpm_list_t *hookdirs;   /* Paths to hook directories */
+	/* parsed hooks cached between transaction phases, with the hookdir
+	 * identity they were built from (hook.c) */
+	alpm_list_t *hook_cache;
+	struct _alpm_hook_stamp *hook_cache_stamp;
 	alpm_list_t *overwrite_files; /* Paths that may be overwritten */
 
 	/* package lists */
@@ -92,12 +134,26 @@ struct __alpm_handle_t {
 	alpm_list_t *noextract;   /* List of files NOT to extract */
 	alpm_list_t *ignorepkg;   /* List of packages to ignore */
 	alpm_list_t *ignoregroup; /* List of groups to ignore */
+	/* lazily compiled matchers for the two lists above, dropped whenever
+	 * the corresponding list changes (patternset.c) */
+	struct __alpm_patternset_t *ignorepkg_set;
+	struct __alpm_patternset_t *ignoregroup_set;
 	alpm_list_t *assumeinstalled;   /* List of virtual packages used to satisfy dependencies */
 
 	/* options */
+	unsigned int worker_threads; /* Thread count for parallel library phases */
 	char *arch;              /* Architecture of packages we should allow */
 	int usesyslog;           /* Use syslog instead of logfile? */ /* TODO move to frontend */
 	int checkspace;          /* Check disk space before installing */
+	int readonly;            /* Never take the db lock; refuse transactions */
+	int durability;          /* Sync extracted files to disk before writing
+	                                       their local db entry */
+	int preallocate;         /* fallocate() download/extraction targets when
+	                                       the final size is known */
+	int localdb_journal;     /* Maintain a single-file journal of the local db */
+	int verify_extraction;   /* Check extracted file digests against the
+	                                       package mtree while installing */
+	int db_deltas;           /* Try differential sync database downloads */
 	char *dbext;             /* Sync DB extension */
 	int siglevel;            /* Default signature verification level */
 	int localfilesiglevel;   /* Signature verification level for local file
@@ -105,6 +161,29 @@ struct __alpm_handle_t {
 	int remotefilesiglevel;  /* Signature verification level for remote file
 	                                       upgrade operations */
 
+	/* lazily built snapshot of the cachedirs' contents, used to answer
+	 * filecache lookups without per-directory stat calls (util.c) */
+	alpm_list_t *filecache_index; /* List of (struct filecache_index_dir *) */
+	int filecache_index_valid;
+
+	/* persistent satisfier decisions keyed by depstring, reloaded from
+	 * dbpath and validated against the sync db mtimes (deps.c) */
+	struct _alpm_depcache *depcache;
+	int depcache_loaded;
+
+	/* deferred logging; while log_defer is set, _alpm_log() queues
+	 * messages under log_defer_lock instead of calling into the frontend,
+	 * so worker threads never invoke the log callback (log.c) */
+	int log_defer;
+	pthread_mutex_t log_defer_lock;
+	alpm_list_t *log_defer_queue; /* List of (struct log_defer_msg *) */
+
+	/* performance counters reported by alpm_get_counters(); a few of the
+	 * accounting sites run on worker threads, so updates go through
+	 * _alpm_counter_add() under counters_lock (the repo has no atomics) */
+	alpm_counters_t counters;
+	pthread_mutex_t counters_lock;
+
 	/* error code */
 	alpm_errno_t pm_errno;
 
@@ -115,6 +194,8 @@ struct __alpm_handle_t {
 alpm_handle_t *_alpm_handle_new(void);
 void _alpm_handle_free(alpm_handle_t *handle);
 
+void _alpm_counter_add(alpm_handle_t *handle, int64_t *counter, int64_t amount);
+
 int _alpm_handle_lock(alpm_handle_t *handle);
 int _alpm_handle_unlock(alpm_handle_t *handle);
 
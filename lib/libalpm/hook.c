@@ -26,8 +26,10 @@
 #include "hook.h"
 #include "ini.h"
 #include "log.h"
+#include "thread.h"
 #include "trans.h"
 #include "util.h"
+#include "vector.h"
 
 enum _alpm_hook_op_t {
 	ALPM_HOOK_OP_INSTALL = (1 << 0),
@@ -62,6 +64,60 @@ struct _alpm_hook_cb_ctx {
 	struct _alpm_hook_t *hook;
 };
 
+/* identity of the hook directories a parsed hook set was built from;
+ * directory changes (hooks installed/removed/renamed) touch the directory
+ * inode, which is what invalidates the cache */
+struct _alpm_hook_stamp {
+	size_t count;
+	struct {
+		int64_t dev, ino, mtime, mtime_nsec;
+		int missing;
+	} *dirs;
+};
+
+static void hook_stamp_free(struct _alpm_hook_stamp *stamp)
+{
+	if(stamp) {
+		free(stamp->dirs);
+		free(stamp);
+	}
+}
+
+static struct _alpm_hook_stamp *hook_stamp_dirs(alpm_handle_t *handle)
+{
+	struct _alpm_hook_stamp *stamp;
+	alpm_list_t *i;
+	size_t n = 0;
+
+	CALLOC(stamp, 1, sizeof(*stamp), return NULL);
+	stamp->count = alpm_list_count(handle->hookdirs);
+	if(stamp->count == 0) {
+		return stamp;
+	}
+	CALLOC(stamp->dirs, stamp->count, sizeof(*stamp->dirs),
+			free(stamp); return NULL);
+	for(i = handle->hookdirs; i; i = i->next, n++) {
+		struct stat buf;
+		if(stat(i->data, &buf) != 0) {
+			stamp->dirs[n].missing = 1;
+		} else {
+			stamp->dirs[n].dev = (int64_t)buf.st_dev;
+			stamp->dirs[n].ino = (int64_t)buf.st_ino;
+			stamp->dirs[n].mtime = (int64_t)buf.st_mtime;
+			stamp->dirs[n].mtime_nsec = (int64_t)buf.st_mtim.tv_nsec;
+		}
+	}
+	return stamp;
+}
+
+static int hook_stamp_eq(const struct _alpm_hook_stamp *s1,
+		const struct _alpm_hook_stamp *s2)
+{
+	/* both arrays are zero-initialized, so padding compares equal */
+	return s1->count == s2->count && (s1->count == 0
+			|| memcmp(s1->dirs, s2->dirs, s1->count * sizeof(*s1->dirs)) == 0);
+}
+
 static void _alpm_trigger_free(struct _alpm_trigger_t *trigger)
 {
 	if(trigger) {
@@ -84,6 +140,15 @@ static void _alpm_hook_free(struct _alpm_hook_t *hook)
 	}
 }
 
+void _alpm_hook_cache_free(alpm_handle_t *handle)
+{
+	alpm_list_free_inner(handle->hook_cache, (alpm_list_fn_free) _alpm_hook_free);
+	alpm_list_free(handle->hook_cache);
+	handle->hook_cache = NULL;
+	hook_stamp_free(handle->hook_cache_stamp);
+	handle->hook_cache_stamp = NULL;
+}
+
 static int _alpm_trigger_validate(alpm_handle_t *handle,
 		struct _alpm_trigger_t *trigger, const char *file)
 {
@@ -255,14 +320,27 @@ static int _alpm_hook_parse_cb(const char *file, int line,
 	return 0;
 }
 
-static int _alpm_hook_trigger_match_file(alpm_handle_t *handle,
-		struct _alpm_hook_t *hook, struct _alpm_trigger_t *t)
+/* One-shot index of the transaction's file paths, shared by every file
+ * trigger in a hook run so trigger evaluation scales with the number of
+ * hooks rather than hooks x files. Path strings are borrowed from the
+ * transaction packages and stay valid for the whole run. */
+struct hook_path_index {
+	_alpm_vector_t install; /* files installed by trans->add, sorted */
+	_alpm_vector_t remove;  /* files removed by upgrade/removal, sorted */
+	int built;
+	int failed;
+};
+
+static int hook_path_cmp(const void *p1, const void *p2)
 {
-	alpm_list_t *i, *j, *install = NULL, *upgrade = NULL, *remove = NULL;
-	size_t isize = 0, rsize = 0;
-	int ret = 0;
+	return strcmp(*(char *const *)p1, *(char *const *)p2);
+}
+
+static int hook_path_index_build(alpm_handle_t *handle,
+		struct hook_path_index *idx)
+{
+	alpm_list_t *i;
 
-	/* check if file will be installed */
 	for(i = handle->trans->add; i; i = i->next) {
 		alpm_pkg_t *pkg = i->data;
 		alpm_filelist_t filelist = pkg->files;
@@ -271,42 +349,139 @@ static int _alpm_hook_trigger_match_file(alpm_handle_t *handle,
 			if(alpm_option_match_noextract(handle, filelist.files[f].name) == 0) {
 				continue;
 			}
-			if(_alpm_fnmatch_patterns(t->targets, filelist.files[f].name) == 0) {
-				install = alpm_list_add(install, filelist.files[f].name);
-				isize++;
+			if(_alpm_vector_add(&idx->install, filelist.files[f].name) != 0) {
+				return -1;
 			}
 		}
-	}
-
-	/* check if file will be removed due to package upgrade */
-	for(i = handle->trans->add; i; i = i->next) {
-		alpm_pkg_t *spkg = i->data;
-		alpm_pkg_t *pkg = spkg->oldpkg;
-		if(pkg) {
-			alpm_filelist_t filelist = pkg->files;
-			size_t f;
+		if(pkg->oldpkg) {
+			filelist = pkg->oldpkg->files;
 			for(f = 0; f < filelist.count; f++) {
-				if(_alpm_fnmatch_patterns(t->targets, filelist.files[f].name) == 0) {
-					remove = alpm_list_add(remove, filelist.files[f].name);
-					rsize++;
+				if(_alpm_vector_add(&idx->remove, filelist.files[f].name) != 0) {
+					return -1;
 				}
 			}
 		}
 	}
 
-	/* check if file will be removed due to package removal */
 	for(i = handle->trans->remove; i; i = i->next) {
 		alpm_pkg_t *pkg = i->data;
 		alpm_filelist_t filelist = pkg->files;
 		size_t f;
 		for(f = 0; f < filelist.count; f++) {
-			if(_alpm_fnmatch_patterns(t->targets, filelist.files[f].name) == 0) {
-				remove = alpm_list_add(remove, filelist.files[f].name);
-				rsize++;
+			if(_alpm_vector_add(&idx->remove, filelist.files[f].name) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	_alpm_vector_sort(&idx->install, hook_path_cmp);
+	_alpm_vector_sort(&idx->remove, hook_path_cmp);
+	return 0;
+}
+
+/* first index in the sorted path array with the given prefix */
+static size_t hook_path_lower_bound(void **data, size_t count,
+		const char *prefix, size_t plen)
+{
+	size_t lo = 0, hi = count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(strncmp(data[mid], prefix, plen) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Collect the paths matched by a trigger's patterns. Every non-inverted
+ * pattern has a literal prefix (possibly empty) that bounds the range of
+ * sorted paths it can match; only paths in those ranges can be matched by
+ * the pattern list at all, since inverted patterns never produce a match
+ * on their own. Candidates still go through _alpm_fnmatch_patterns() so
+ * inverted patterns keep their usual meaning. */
+static void hook_match_paths(struct _alpm_trigger_t *t, _alpm_vector_t *paths,
+		alpm_list_t **matches, size_t *nmatches)
+{
+	alpm_list_t *p;
+	char *evaluated;
+
+	if(paths->count == 0) {
+		return;
+	}
+
+	/* remember which paths have been run through the pattern list so
+	 * overlapping pattern ranges evaluate (and match) each path once;
+	 * without the marker buffer, fall back to a full scan */
+	evaluated = calloc(paths->count, 1);
+
+	for(p = evaluated ? t->targets : NULL; p; p = p->next) {
+		const char *pattern = p->data;
+		size_t plen, f;
+
+		if(pattern[0] == '!') {
+			continue;
+		}
+		if(pattern[0] == '\\') {
+			pattern++;
+		}
+		plen = strcspn(pattern, "*?[\\");
+
+		for(f = hook_path_lower_bound(paths->data, paths->count, pattern, plen);
+				f < paths->count &&
+				strncmp(paths->data[f], pattern, plen) == 0; f++) {
+			if(evaluated[f]) {
+				continue;
+			}
+			evaluated[f] = 1;
+			if(_alpm_fnmatch_patterns(t->targets, paths->data[f]) == 0) {
+				*matches = alpm_list_add(*matches, paths->data[f]);
+				(*nmatches)++;
 			}
 		}
 	}
 
+	if(evaluated == NULL) {
+		size_t f;
+		for(f = 0; f < paths->count; f++) {
+			if(_alpm_fnmatch_patterns(t->targets, paths->data[f]) == 0) {
+				*matches = alpm_list_add(*matches, paths->data[f]);
+				(*nmatches)++;
+			}
+		}
+	}
+
+	free(evaluated);
+}
+
+static int _alpm_hook_trigger_match_file(alpm_handle_t *handle,
+		struct _alpm_hook_t *hook, struct _alpm_trigger_t *t,
+		struct hook_path_index *idx)
+{
+	alpm_list_t *i, *j, *install = NULL, *upgrade = NULL, *remove = NULL;
+	size_t isize = 0, rsize = 0;
+	int ret = 0;
+
+	if(idx->failed) {
+		RET_ERR(handle, ALPM_ERR_MEMORY, 0);
+	}
+	if(!idx->built) {
+		if(hook_path_index_build(handle, idx) != 0) {
+			/* a partial index would silently drop matches */
+			_alpm_vector_release(&idx->install, NULL);
+			_alpm_vector_release(&idx->remove, NULL);
+			idx->failed = 1;
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("could not index transaction files\n"));
+			RET_ERR(handle, ALPM_ERR_MEMORY, 0);
+		}
+		idx->built = 1;
+	}
+
+	hook_match_paths(t, &idx->install, &install, &isize);
+	hook_match_paths(t, &idx->remove, &remove, &rsize);
+
 	i = install = alpm_list_msort(install, isize, (alpm_list_fn_cmp)strcmp);
 	j = remove = alpm_list_msort(remove, rsize, (alpm_list_fn_cmp)strcmp);
 	while(i) {
@@ -417,19 +592,21 @@ static int _alpm_hook_trigger_match_pkg(alpm_handle_t *handle,
 }
 
 static int _alpm_hook_trigger_match(alpm_handle_t *handle,
-		struct _alpm_hook_t *hook, struct _alpm_trigger_t *t)
+		struct _alpm_hook_t *hook, struct _alpm_trigger_t *t,
+		struct hook_path_index *idx)
 {
 	return t->type == ALPM_HOOK_TYPE_PACKAGE
 		? _alpm_hook_trigger_match_pkg(handle, hook, t)
-		: _alpm_hook_trigger_match_file(handle, hook, t);
+		: _alpm_hook_trigger_match_file(handle, hook, t, idx);
 }
 
-static int _alpm_hook_triggered(alpm_handle_t *handle, struct _alpm_hook_t *hook)
+static int _alpm_hook_triggered(alpm_handle_t *handle, struct _alpm_hook_t *hook,
+		struct hook_path_index *idx)
 {
 	alpm_list_t *i;
 	int ret = 0;
 	for(i = hook->triggers; i; i = i->next) {
-		if(_alpm_hook_trigger_match(handle, hook, i->data)) {
+		if(_alpm_hook_trigger_match(handle, hook, i->data, idx)) {
 			if(!hook->needs_targets) {
 				return 1;
 			} else {
@@ -504,7 +681,8 @@ static alpm_list_t *_alpm_strlist_dedup(alpm_list_t *list)
 	return list;
 }
 
-static int _alpm_hook_run_hook(alpm_handle_t *handle, struct _alpm_hook_t *hook)
+static int _alpm_hook_check_depends(alpm_handle_t *handle,
+		struct _alpm_hook_t *hook)
 {
 	alpm_list_t *i, *pkgs = _alpm_db_get_pkgcache(handle->db_local);
 
@@ -516,6 +694,15 @@ static int _alpm_hook_run_hook(alpm_handle_t *handle, struct _alpm_hook_t *hook)
 		}
 	}
 
+	return 0;
+}
+
+static int _alpm_hook_run_hook(alpm_handle_t *handle, struct _alpm_hook_t *hook)
+{
+	if(_alpm_hook_check_depends(handle, hook) != 0) {
+		return -1;
+	}
+
 	if(hook->needs_targets) {
 		alpm_list_t *ctx;
 		hook->matches = alpm_list_msort(hook->matches,
@@ -529,13 +716,178 @@ static int _alpm_hook_run_hook(alpm_handle_t *handle, struct _alpm_hook_t *hook)
 	}
 }
 
+/* Two hooks may only run concurrently when we know their effects cannot
+ * interact: both must carry a target list and the sorted lists must be
+ * disjoint. Hooks run without targets have an unknown footprint and are
+ * treated as overlapping everything. */
+static int hook_targets_overlap(struct _alpm_hook_t *h1, struct _alpm_hook_t *h2)
+{
+	alpm_list_t *i = h1->matches, *j = h2->matches;
+
+	if(i == NULL || j == NULL) {
+		return 1;
+	}
+
+	while(i && j) {
+		int cmp = strcmp(i->data, j->data);
+		if(cmp < 0) {
+			i = i->next;
+		} else if(cmp > 0) {
+			j = j->next;
+		} else {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Run post-transaction hooks, grouping hooks with provably disjoint
+ * target sets into a single _alpm_run_chroot_batch() invocation. Batches
+ * are built greedily in sorted order and never extend past the first hook
+ * that overlaps an earlier member, so hooks that could interact still run
+ * in their configured order. Events and log output stay on this thread. */
+static int _alpm_hook_run_parallel(alpm_handle_t *handle,
+		alpm_list_t *hooks_triggered, size_t triggered)
+{
+	alpm_event_hook_run_t hook_event;
+	alpm_list_t *i;
+	struct hook_job {
+		struct _alpm_hook_t *hook;
+		alpm_list_t *ctx;
+		int failed;
+	} *batch;
+	struct _alpm_chroot_job *jobs;
+	size_t position = 1, max_batch = _alpm_parallel_nthreads(handle, triggered);
+	int ret = 0;
+
+	/* sort and dedup every target list up front; feeding targets and the
+	 * pairwise overlap tests both rely on sorted lists */
+	for(i = hooks_triggered; i; i = i->next) {
+		struct _alpm_hook_t *hook = i->data;
+		if(hook->needs_targets) {
+			hook->matches = alpm_list_msort(hook->matches,
+					alpm_list_count(hook->matches), (alpm_list_fn_cmp)strcmp);
+			hook->matches = _alpm_strlist_dedup(hook->matches);
+		}
+	}
+
+	MALLOC(batch, max_batch * sizeof(*batch),
+			RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	CALLOC(jobs, max_batch, sizeof(*jobs),
+			free(batch); RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+
+	hook_event.total = triggered;
+
+	i = hooks_triggered;
+	while(i) {
+		size_t k, n, batch_len = 1, njobs = 0;
+
+		batch[0].hook = i->data;
+		for(i = i->next; i && batch_len < max_batch; i = i->next) {
+			struct _alpm_hook_t *cand = i->data;
+			int overlap = 0;
+			for(k = 0; k < batch_len && !overlap; k++) {
+				overlap = hook_targets_overlap(batch[k].hook, cand);
+			}
+			if(overlap) {
+				break;
+			}
+			batch[batch_len++].hook = cand;
+		}
+
+		if(batch_len > 1) {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"running batch of %zu hooks with disjoint targets\n", batch_len);
+		}
+
+		for(k = 0; k < batch_len; k++) {
+			struct _alpm_hook_t *hook = batch[k].hook;
+
+			alpm_logaction(handle, ALPM_CALLER_PREFIX, "running '%s'...\n", hook->name);
+
+			hook_event.type = ALPM_EVENT_HOOK_RUN_START;
+			hook_event.name = hook->name;
+			hook_event.desc = hook->desc;
+			hook_event.position = position + k;
+			EVENT(handle, &hook_event);
+
+			batch[k].failed = 0;
+			batch[k].ctx = hook->matches;
+			if(_alpm_hook_check_depends(handle, hook) != 0) {
+				batch[k].failed = 1;
+				continue;
+			}
+
+			jobs[njobs].cmd = hook->cmd[0];
+			jobs[njobs].argv = hook->cmd;
+			if(hook->needs_targets) {
+				jobs[njobs].stdin_cb = (_alpm_cb_io) _alpm_hook_feed_targets;
+				jobs[njobs].stdin_ctx = &batch[k].ctx;
+			} else {
+				jobs[njobs].stdin_cb = NULL;
+				jobs[njobs].stdin_ctx = NULL;
+			}
+			jobs[njobs].retval = 0;
+			njobs++;
+		}
+
+		if(njobs > 0) {
+			_alpm_run_chroot_batch(handle, njobs, jobs);
+		}
+
+		for(n = 0, k = 0; k < batch_len; k++) {
+			if(!batch[k].failed) {
+				batch[k].failed = jobs[n++].retval;
+			}
+		}
+
+		for(k = 0; k < batch_len; k++) {
+			struct _alpm_hook_t *hook = batch[k].hook;
+
+			hook_event.type = ALPM_EVENT_HOOK_RUN_DONE;
+			hook_event.name = hook->name;
+			hook_event.desc = hook->desc;
+			hook_event.position = position + k;
+			EVENT(handle, &hook_event);
+
+			if(batch[k].failed && hook->abort_on_fail) {
+				ret = -1;
+			}
+		}
+
+		position += batch_len;
+	}
+
+	free(batch);
+	free(jobs);
+
+	return ret;
+}
+
 int _alpm_hook_run(alpm_handle_t *handle, alpm_hook_when_t when)
 {
 	alpm_event_hook_t event = { .when = when };
 	alpm_event_hook_run_t hook_event;
 	alpm_list_t *i, *hooks = NULL, *hooks_triggered = NULL;
 	size_t suflen = strlen(ALPM_HOOK_SUFFIX), triggered = 0;
-	int ret = 0;
+	struct hook_path_index idx = { VECTOR_INIT, VECTOR_INIT, 0, 0 };
+	struct _alpm_hook_stamp *stamp;
+	int ret = 0, cacheable = 0;
+
+	stamp = hook_stamp_dirs(handle);
+	if(stamp && handle->hook_cache_stamp
+			&& hook_stamp_eq(stamp, handle->hook_cache_stamp)) {
+		/* the hook directories are unchanged since the last run; reuse the
+		 * parsed (and already sorted) definitions instead of rescanning */
+		_alpm_log(handle, ALPM_LOG_DEBUG, "reusing cached hook definitions\n");
+		hooks = handle->hook_cache;
+		handle->hook_cache = NULL;
+		hook_stamp_free(handle->hook_cache_stamp);
+		handle->hook_cache_stamp = NULL;
+		goto match;
+	}
+	_alpm_hook_cache_free(handle);
 
 	for(i = alpm_list_last(handle->hookdirs); i; i = alpm_list_previous(i)) {
 		char path[PATH_MAX];
@@ -633,9 +985,12 @@ int _alpm_hook_run(alpm_handle_t *handle, alpm_hook_when_t when)
 	hooks = alpm_list_msort(hooks, alpm_list_count(hooks),
 			(alpm_list_fn_cmp)_alpm_hook_cmp);
 
+match:
+	cacheable = (ret == 0);
+
 	for(i = hooks; i; i = i->next) {
 		struct _alpm_hook_t *hook = i->data;
-		if(hook && hook->when == when && _alpm_hook_triggered(handle, hook)) {
+		if(hook && hook->when == when && _alpm_hook_triggered(handle, hook, &idx)) {
 			hooks_triggered = alpm_list_add(hooks_triggered, hook);
 			triggered++;
 		}
@@ -645,27 +1000,34 @@ int _alpm_hook_run(alpm_handle_t *handle, alpm_hook_when_t when)
 		event.type = ALPM_EVENT_HOOK_START;
 		EVENT(handle, (void *)&event);
 
-		hook_event.position = 1;
-		hook_event.total = triggered;
+		if(when == ALPM_HOOK_POST_TRANSACTION
+				&& _alpm_parallel_nthreads(handle, triggered) > 1) {
+			if(_alpm_hook_run_parallel(handle, hooks_triggered, triggered) != 0) {
+				ret = -1;
+			}
+		} else {
+			hook_event.position = 1;
+			hook_event.total = triggered;
 
-		for(i = hooks_triggered; i; i = i->next, hook_event.position++) {
-			struct _alpm_hook_t *hook = i->data;
-			alpm_logaction(handle, ALPM_CALLER_PREFIX, "running '%s'...\n", hook->name);
+			for(i = hooks_triggered; i; i = i->next, hook_event.position++) {
+				struct _alpm_hook_t *hook = i->data;
+				alpm_logaction(handle, ALPM_CALLER_PREFIX, "running '%s'...\n", hook->name);
 
-			hook_event.type = ALPM_EVENT_HOOK_RUN_START;
-			hook_event.name = hook->name;
-			hook_event.desc = hook->desc;
-			EVENT(handle, &hook_event);
+				hook_event.type = ALPM_EVENT_HOOK_RUN_START;
+				hook_event.name = hook->name;
+				hook_event.desc = hook->desc;
+				EVENT(handle, &hook_event);
 
-			if(_alpm_hook_run_hook(handle, hook) != 0 && hook->abort_on_fail) {
-				ret = -1;
-			}
+				if(_alpm_hook_run_hook(handle, hook) != 0 && hook->abort_on_fail) {
+					ret = -1;
+				}
 
-			hook_event.type = ALPM_EVENT_HOOK_RUN_DONE;
-			EVENT(handle, &hook_event);
+				hook_event.type = ALPM_EVENT_HOOK_RUN_DONE;
+				EVENT(handle, &hook_event);
 
-			if(ret != 0 && when == ALPM_HOOK_PRE_TRANSACTION) {
-				break;
+				if(ret != 0 && when == ALPM_HOOK_PRE_TRANSACTION) {
+					break;
+				}
 			}
 		}
 
@@ -676,8 +1038,26 @@ int _alpm_hook_run(alpm_handle_t *handle, alpm_hook_when_t when)
 	}
 
 cleanup:
-	alpm_list_free_inner(hooks, (alpm_list_fn_free) _alpm_hook_free);
-	alpm_list_free(hooks);
+	_alpm_vector_release(&idx.install, NULL);
+	_alpm_vector_release(&idx.remove, NULL);
+	/* matches borrow their strings from per-transaction data and are
+	 * rebuilt by trigger matching on every run; clear them whether the
+	 * hook definitions are cached or freed */
+	for(i = hooks; i; i = i->next) {
+		struct _alpm_hook_t *hook = i->data;
+		if(hook) {
+			alpm_list_free(hook->matches);
+			hook->matches = NULL;
+		}
+	}
+	if(cacheable && stamp != NULL) {
+		handle->hook_cache = hooks;
+		handle->hook_cache_stamp = stamp;
+	} else {
+		hook_stamp_free(stamp);
+		alpm_list_free_inner(hooks, (alpm_list_fn_free) _alpm_hook_free);
+		alpm_list_free(hooks);
+	}
 
 	return ret;
 }
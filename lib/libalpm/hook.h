@@ -25,5 +25,6 @@
 #define ALPM_HOOK_SUFFIX ".hook"
 
 int _alpm_hook_run(alpm_handle_t *handle, alpm_hook_when_t when);
+void _alpm_hook_cache_free(alpm_handle_t *handle);
 
 #endif /* ALPM_HOOK_H */
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 
 /* libalpm */
 #include "log.h"
@@ -30,16 +31,95 @@
 #include "util.h"
 #include "alpm.h"
 
-static int _alpm_log_leader(FILE *f, const char *prefix)
+/* Asynchronous pacman.log writer.
+ *
+ * Opening, appending and flushing the log file used to happen inline in
+ * alpm_logaction(), which sits in the middle of the extraction hot path;
+ * on hosts where the log lives on slow or forwarded storage every entry
+ * was a blocking stall. Lines are now formatted (with their timestamp)
+ * at call time, queued, and written by a background flusher thread.
+ * Ordering is preserved by the single queue; the queue is bounded so a
+ * stalled disk applies backpressure instead of growing without limit,
+ * and _alpm_logaction_flush() drains the queue and fsyncs at transaction
+ * boundaries so the log is durable before the db lock is released.
+ * Syslog delivery stays synchronous. */
+
+#define LOGBUF_MAX_LINES 256
+
+static void *logbuf_flusher(void *arg)
 {
-	time_t t = time(NULL);
-	struct tm *tm = localtime(&t);
-	int length = 32;
-	char timestamp[length];
+	alpm_handle_t *handle = arg;
 
-	/* Use ISO-8601 date format */
-	strftime(timestamp,length,"%FT%T%z", tm);
-	return fprintf(f, "[%s] [%s] ", timestamp, prefix);
+	pthread_mutex_lock(&handle->logbuf_lock);
+	while(1) {
+		alpm_list_t *batch, *i;
+
+		while(handle->logbuf == NULL && !handle->logbuf_shutdown) {
+			pthread_cond_wait(&handle->logbuf_cond, &handle->logbuf_lock);
+		}
+		if(handle->logbuf == NULL) {
+			break;
+		}
+
+		batch = handle->logbuf;
+		handle->logbuf = NULL;
+		handle->logbuf_len = 0;
+		handle->logbuf_busy = 1;
+		/* writers may be waiting on the queue bound */
+		pthread_cond_broadcast(&handle->logbuf_cond);
+		pthread_mutex_unlock(&handle->logbuf_lock);
+
+		for(i = batch; i; i = i->next) {
+			fputs(i->data, handle->logstream);
+			free(i->data);
+		}
+		alpm_list_free(batch);
+		fflush(handle->logstream);
+
+		pthread_mutex_lock(&handle->logbuf_lock);
+		handle->logbuf_busy = 0;
+		/* _alpm_logaction_flush() waits for the batch in flight */
+		pthread_cond_broadcast(&handle->logbuf_cond);
+	}
+	pthread_mutex_unlock(&handle->logbuf_lock);
+	return NULL;
+}
+
+/* Wait until every queued line has hit the log file, then sync it to
+ * disk. Called at transaction boundaries and before the stream is
+ * closed or swapped. */
+void _alpm_logaction_flush(alpm_handle_t *handle)
+{
+	if(handle->logbuf_thread_running) {
+		pthread_mutex_lock(&handle->logbuf_lock);
+		while(handle->logbuf != NULL || handle->logbuf_busy) {
+			pthread_cond_wait(&handle->logbuf_cond, &handle->logbuf_lock);
+		}
+		pthread_mutex_unlock(&handle->logbuf_lock);
+	}
+	if(handle->logstream) {
+		fflush(handle->logstream);
+		fsync(fileno(handle->logstream));
+	}
+}
+
+/* Flush outstanding lines and join the flusher thread; the handle is
+ * going away or the stream is being replaced. */
+void _alpm_logaction_shutdown(alpm_handle_t *handle)
+{
+	if(handle->logbuf_thread_running) {
+		pthread_mutex_lock(&handle->logbuf_lock);
+		handle->logbuf_shutdown = 1;
+		pthread_cond_broadcast(&handle->logbuf_cond);
+		pthread_mutex_unlock(&handle->logbuf_lock);
+		pthread_join(handle->logbuf_thread, NULL);
+		handle->logbuf_thread_running = 0;
+		handle->logbuf_shutdown = 0;
+	}
+	if(handle->logstream) {
+		fflush(handle->logstream);
+		fsync(fileno(handle->logstream));
+	}
 }
 
 int SYMEXPORT alpm_logaction(alpm_handle_t *handle, const char *prefix,
@@ -47,6 +127,10 @@ int SYMEXPORT alpm_logaction(alpm_handle_t *handle, const char *prefix,
 {
 	int ret = 0;
 	va_list args;
+	char *msg = NULL, *line = NULL;
+	time_t t;
+	struct tm *tm;
+	char timestamp[32];
 
 	ASSERT(handle != NULL, return -1);
 
@@ -78,26 +162,79 @@ int SYMEXPORT alpm_logaction(alpm_handle_t *handle, const char *prefix,
 
 	if(handle->usesyslog) {
 		/* we can't use a va_list more than once, so we need to copy it
-		 * so we can use the original when calling vfprintf below. */
+		 * so we can use the original when formatting the line below. */
 		va_list args_syslog;
 		va_copy(args_syslog, args);
 		vsyslog(LOG_WARNING, fmt, args_syslog);
 		va_end(args_syslog);
 	}
 
-	if(handle->logstream) {
-		if(_alpm_log_leader(handle->logstream, prefix) < 0
-				|| vfprintf(handle->logstream, fmt, args) < 0) {
+	if(handle->logstream == NULL) {
+		va_end(args);
+		return ret;
+	}
+
+	/* the timestamp belongs to now, not to whenever the flusher gets
+	 * around to writing the line */
+	t = time(NULL);
+	tm = localtime(&t);
+	/* Use ISO-8601 date format */
+	strftime(timestamp, sizeof(timestamp), "%FT%T%z", tm);
+
+	if(vasprintf(&msg, fmt, args) < 0
+			|| asprintf(&line, "[%s] [%s] %s", timestamp, prefix, msg) < 0) {
+		free(msg);
+		va_end(args);
+		RET_ERR(handle, ALPM_ERR_MEMORY, -1);
+	}
+	free(msg);
+	va_end(args);
+
+	pthread_mutex_lock(&handle->logbuf_lock);
+	if(!handle->logbuf_thread_running) {
+		if(pthread_create(&handle->logbuf_thread, NULL,
+					logbuf_flusher, handle) == 0) {
+			handle->logbuf_thread_running = 1;
+		}
+	}
+	if(!handle->logbuf_thread_running) {
+		/* no flusher available; write synchronously as before */
+		pthread_mutex_unlock(&handle->logbuf_lock);
+		if(fputs(line, handle->logstream) < 0) {
 			ret = -1;
 			handle->pm_errno = ALPM_ERR_SYSTEM;
 		}
 		fflush(handle->logstream);
+		free(line);
+		return ret;
+	}
+	while(handle->logbuf_len >= LOGBUF_MAX_LINES) {
+		pthread_cond_wait(&handle->logbuf_cond, &handle->logbuf_lock);
 	}
+	handle->logbuf = alpm_list_add(handle->logbuf, line);
+	handle->logbuf_len++;
+	pthread_cond_broadcast(&handle->logbuf_cond);
+	pthread_mutex_unlock(&handle->logbuf_lock);
 
-	va_end(args);
 	return ret;
 }
 
+struct log_defer_msg {
+	alpm_loglevel_t flag;
+	char *msg;
+};
+
+/* varargs shim so a pre-formatted message can be pushed through the
+ * va_list-based log callback */
+static void log_cb_direct(alpm_handle_t *handle, alpm_loglevel_t flag,
+		const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	handle->logcb(flag, fmt, args);
+	va_end(args);
+}
+
 void _alpm_log(alpm_handle_t *handle, alpm_loglevel_t flag, const char *fmt, ...)
 {
 	va_list args;
@@ -106,7 +243,71 @@ void _alpm_log(alpm_handle_t *handle, alpm_loglevel_t flag, const char *fmt, ...
 		return;
 	}
 
+	if(handle->log_defer) {
+		/* format now, deliver from the thread that ends the deferral */
+		struct log_defer_msg *msg;
+		char *buf = NULL;
+		va_start(args, fmt);
+		if(vasprintf(&buf, fmt, args) < 0) {
+			buf = NULL;
+		}
+		va_end(args);
+		if(buf == NULL || (msg = malloc(sizeof(struct log_defer_msg))) == NULL) {
+			free(buf);
+			return;
+		}
+		msg->flag = flag;
+		msg->msg = buf;
+		pthread_mutex_lock(&handle->log_defer_lock);
+		handle->log_defer_queue = alpm_list_add(handle->log_defer_queue, msg);
+		pthread_mutex_unlock(&handle->log_defer_lock);
+		return;
+	}
+
 	va_start(args, fmt);
 	handle->logcb(flag, fmt, args);
 	va_end(args);
 }
+
+void _alpm_log_defer_begin(alpm_handle_t *handle)
+{
+	handle->log_defer++;
+}
+
+void _alpm_log_defer_end(alpm_handle_t *handle)
+{
+	alpm_list_t *queue, *i;
+
+	if(--handle->log_defer > 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&handle->log_defer_lock);
+	queue = handle->log_defer_queue;
+	handle->log_defer_queue = NULL;
+	pthread_mutex_unlock(&handle->log_defer_lock);
+
+	for(i = queue; i; i = i->next) {
+		struct log_defer_msg *msg = i->data;
+		if(handle->logcb) {
+			log_cb_direct(handle, msg->flag, "%s", msg->msg);
+		}
+		free(msg->msg);
+		free(msg);
+	}
+	alpm_list_free(queue);
+}
+
+void _alpm_trace(alpm_handle_t *handle, alpm_trace_phase_t phase,
+		int begin, const char *detail)
+{
+	struct timespec ts;
+
+	if(handle == NULL || handle->tracecb == NULL) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	handle->tracecb(phase, begin, detail,
+			(int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
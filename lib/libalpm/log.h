@@ -27,4 +27,21 @@
 void _alpm_log(alpm_handle_t *handle, alpm_loglevel_t flag,
 		const char *fmt, ...) __attribute__((format(printf,3,4)));
 
+/* Drain the asynchronous pacman.log queue and fsync the stream; called
+ * at transaction boundaries. Shutdown additionally joins the flusher
+ * thread, for handle teardown or logfile replacement. */
+void _alpm_logaction_flush(alpm_handle_t *handle);
+void _alpm_logaction_shutdown(alpm_handle_t *handle);
+
+/* Bracket a parallel phase: between begin and end, _alpm_log() queues
+ * messages instead of invoking the callback; end flushes the queue from
+ * the calling thread. Calls may nest. */
+void _alpm_log_defer_begin(alpm_handle_t *handle);
+void _alpm_log_defer_end(alpm_handle_t *handle);
+
+/* use via the TRACE_BEGIN/TRACE_END macros in handle.h, which check that
+ * a tracing callback is registered before paying for the call */
+void _alpm_trace(alpm_handle_t *handle, alpm_trace_phase_t phase,
+		int begin, const char *detail);
+
 #endif /* ALPM_LOG_H */
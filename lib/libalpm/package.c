@@ -33,6 +33,7 @@
 #include "db.h"
 #include "handle.h"
 #include "deps.h"
+#include "patternset.h"
 
 int SYMEXPORT alpm_pkg_free(alpm_pkg_t *pkg)
 {
@@ -46,6 +47,13 @@ int SYMEXPORT alpm_pkg_free(alpm_pkg_t *pkg)
 	return 0;
 }
 
+int SYMEXPORT alpm_pkg_evict(alpm_pkg_t *pkg)
+{
+	ASSERT(pkg != NULL, return -1);
+	pkg->handle->pm_errno = ALPM_ERR_OK;
+	return pkg->ops->evict(pkg);
+}
+
 int SYMEXPORT alpm_pkg_checkmd5sum(alpm_pkg_t *pkg)
 {
 	char *fpath;
@@ -135,6 +143,8 @@ static int _pkg_mtree_close(const alpm_pkg_t UNUSED *pkg,
 
 static int _pkg_force_load(alpm_pkg_t UNUSED *pkg) { return 0; }
 
+static int _pkg_evict(alpm_pkg_t UNUSED *pkg) { return 0; }
+
 /** The standard package operations struct. Get fields directly from the
  * struct itself with no abstraction layer or any type of lazy loading.
  */
@@ -172,6 +182,7 @@ struct pkg_operations default_pkg_ops = {
 	.mtree_close     = _pkg_mtree_close,
 
 	.force_load      = _pkg_force_load,
+	.evict           = _pkg_evict,
 };
 
 /* Public functions for getting package information. These functions
@@ -441,30 +452,57 @@ int SYMEXPORT alpm_pkg_has_scriptlet(alpm_pkg_t *pkg)
 	return pkg->ops->has_scriptlet(pkg);
 }
 
+static void check_requiredby(alpm_pkg_t *pkg, alpm_pkg_t *cachepkg,
+		alpm_list_t **reqs, int optional)
+{
+	alpm_list_t *j;
+
+	if(optional == 0) {
+		j = alpm_pkg_get_depends(cachepkg);
+	} else {
+		j = alpm_pkg_get_optdepends(cachepkg);
+	}
+
+	for(; j; j = j->next) {
+		if(_alpm_depcmp(pkg, j->data)) {
+			const char *cachepkgname = cachepkg->name;
+			if(alpm_list_find_str(*reqs, cachepkgname) == NULL) {
+				*reqs = alpm_list_add(*reqs, strdup(cachepkgname));
+			}
+		}
+	}
+}
+
 static void find_requiredby(alpm_pkg_t *pkg, alpm_db_t *db, alpm_list_t **reqs,
 		int optional)
 {
 	const alpm_list_t *i;
+	alpm_list_t *candidates, *j;
 	pkg->handle->pm_errno = ALPM_ERR_OK;
 
-	for(i = _alpm_db_get_pkgcache(db); i; i = i->next) {
-		alpm_pkg_t *cachepkg = i->data;
-		alpm_list_t *j;
-
-		if(optional == 0) {
-			j = alpm_pkg_get_depends(cachepkg);
-		} else {
-			j = alpm_pkg_get_optdepends(cachepkg);
+	/* the reverse-dependency index narrows the scan to packages that
+	 * name this package (or one of its provisions) in a dependency;
+	 * check_requiredby() still verifies any version constraints */
+	if(_alpm_db_get_revdeps(db, pkg->name, optional, &candidates) == 0) {
+		for(i = candidates; i; i = i->next) {
+			check_requiredby(pkg, i->data, reqs, optional);
 		}
-
-		for(; j; j = j->next) {
-			if(_alpm_depcmp(pkg, j->data)) {
-				const char *cachepkgname = cachepkg->name;
-				if(alpm_list_find_str(*reqs, cachepkgname) == NULL) {
-					*reqs = alpm_list_add(*reqs, strdup(cachepkgname));
-				}
+		for(j = alpm_pkg_get_provides(pkg); j; j = j->next) {
+			alpm_depend_t *provide = j->data;
+			if(_alpm_db_get_revdeps(db, provide->name, optional,
+						&candidates) != 0) {
+				continue;
+			}
+			for(i = candidates; i; i = i->next) {
+				check_requiredby(pkg, i->data, reqs, optional);
 			}
 		}
+		return;
+	}
+
+	/* index unavailable, scan the whole package cache */
+	for(i = _alpm_db_get_pkgcache(db); i; i = i->next) {
+		check_requiredby(pkg, i->data, reqs, optional);
 	}
 }
 
@@ -627,48 +665,210 @@ cleanup:
 	RET_ERR(pkg->handle, ALPM_ERR_MEMORY, -1);
 }
 
+/**
+ * Duplicate a package handle without copying its metadata.
+ *
+ * Database-backed packages are immutable once fully loaded, so transaction
+ * setup does not need the second copy of every string, dependency and file
+ * list that _alpm_pkg_dup() makes. The returned package borrows the
+ * original's storage and holds a reference that keeps that storage alive
+ * until the copy is freed, even if the database entry is discarded first;
+ * only the transaction-specific fields (oldpkg, removes, download digests,
+ * backup index) belong to the copy. Packages loaded from files fall back
+ * to a full duplication. The reference count is unsynchronized, so copies
+ * must be taken and released on the caller's thread.
+ * @param pkg the package to duplicate
+ * @param new_ptr location to store duplicated package pointer
+ * @return 0 on success, -1 on fatal error, 1 on non-fatal error
+ */
+int _alpm_pkg_dup_shared(alpm_pkg_t *pkg, alpm_pkg_t **new_ptr)
+{
+	alpm_pkg_t *newpkg;
+	int ret = 0;
+
+	if(!pkg || !pkg->handle) {
+		return -1;
+	}
+
+	if(!new_ptr) {
+		RET_ERR(pkg->handle, ALPM_ERR_WRONG_ARGS, -1);
+	}
+
+	if(pkg->origin == ALPM_PKG_FROM_FILE) {
+		return _alpm_pkg_dup(pkg, new_ptr);
+	}
+
+	if(pkg->ops->force_load(pkg)) {
+		_alpm_log(pkg->handle, ALPM_LOG_WARNING,
+				_("could not fully load metadata for package %s-%s\n"),
+				pkg->name, pkg->version);
+		ret = 1;
+		pkg->handle->pm_errno = ALPM_ERR_PKG_INVALID;
+	}
+
+	MALLOC(newpkg, sizeof(alpm_pkg_t),
+			RET_ERR(pkg->handle, ALPM_ERR_MEMORY, -1));
+	*newpkg = *pkg;
+
+	/* these belong to each owner individually */
+	newpkg->refcount = 0;
+	newpkg->shared_src = pkg;
+	newpkg->oldpkg = NULL;
+	newpkg->removes = NULL;
+	newpkg->dl_md5sum = NULL;
+	newpkg->dl_sha256sum = NULL;
+	newpkg->backup_index = NULL;
+	newpkg->backup_index_size = 0;
+	newpkg->mtree_reader = NULL;
+
+	pkg->refcount++;
+
+	*new_ptr = newpkg;
+	return ret;
+}
+
 static void free_deplist(alpm_list_t *deps)
 {
 	alpm_list_free_inner(deps, (alpm_list_fn_free)alpm_dep_free);
 	alpm_list_free(deps);
 }
 
+/* Swap one malloc'd string field for the pool's interned copy */
+static void pool_string(char **str, _alpm_strpool_t *pool)
+{
+	const char *interned;
+	if(*str == NULL || (interned = _alpm_strpool_intern(pool, *str)) == NULL) {
+		return;
+	}
+	if(interned != *str) {
+		free(*str);
+		*str = (char *)interned;
+	}
+}
+
+static void pool_strlist(alpm_list_t *list, _alpm_strpool_t *pool)
+{
+	for(; list; list = list->next) {
+		const char *interned = _alpm_strpool_intern(pool, list->data);
+		if(interned && interned != list->data) {
+			free(list->data);
+			list->data = (void *)interned;
+		}
+	}
+}
+
+/* Move a package's flat metadata strings and license/group data into the
+ * owning database's interning pool. Heavily repeated values end up stored
+ * once per database and the rest land in shared slabs instead of separate
+ * heap chunks. Safe to call more than once; should interning fail the
+ * affected string simply stays on the heap (and is leaked at free, which
+ * only happens under memory exhaustion). */
+void _alpm_pkg_pool_strings(alpm_pkg_t *pkg, _alpm_strpool_t *pool)
+{
+	if(pkg == NULL || pool == NULL) {
+		return;
+	}
+
+	pkg->strings_pooled = 1;
+	pool_string(&pkg->filename, pool);
+	pool_string(&pkg->base, pool);
+	pool_string(&pkg->name, pool);
+	pool_string(&pkg->version, pool);
+	pool_string(&pkg->desc, pool);
+	pool_string(&pkg->url, pool);
+	pool_string(&pkg->packager, pool);
+	pool_string(&pkg->md5sum, pool);
+	pool_string(&pkg->sha256sum, pool);
+	pool_string(&pkg->base64_sig, pool);
+	pool_string(&pkg->arch, pool);
+	pool_strlist(pkg->licenses, pool);
+	pool_strlist(pkg->groups, pool);
+}
+
 void _alpm_pkg_free(alpm_pkg_t *pkg)
 {
 	if(pkg == NULL) {
 		return;
 	}
 
-	FREE(pkg->filename);
-	FREE(pkg->base);
-	FREE(pkg->name);
-	FREE(pkg->version);
-	FREE(pkg->desc);
-	FREE(pkg->url);
-	FREE(pkg->packager);
-	FREE(pkg->md5sum);
-	FREE(pkg->sha256sum);
-	FREE(pkg->base64_sig);
-	FREE(pkg->arch);
-
-	FREELIST(pkg->licenses);
-	free_deplist(pkg->replaces);
-	FREELIST(pkg->groups);
+	if(pkg->refcount > 0) {
+		/* shallow copies still borrow this package's storage; the last
+		 * release performs the real teardown */
+		pkg->refcount--;
+		return;
+	}
+
+	if(pkg->shared_src) {
+		/* shallow copy: only the transaction-specific fields are ours,
+		 * everything else belongs to shared_src */
+		FREE(pkg->dl_md5sum);
+		FREE(pkg->dl_sha256sum);
+		free(pkg->backup_index);
+		alpm_list_free(pkg->removes);
+		_alpm_pkg_free(pkg->oldpkg);
+		_alpm_pkg_free(pkg->shared_src);
+		FREE(pkg);
+		return;
+	}
+
+	if(pkg->strings_pooled) {
+		/* flat strings and license/group data live in the database's
+		 * string pool; only the list cells are ours */
+		alpm_list_free(pkg->licenses);
+		alpm_list_free(pkg->groups);
+	} else {
+		FREE(pkg->filename);
+		FREE(pkg->base);
+		FREE(pkg->name);
+		FREE(pkg->version);
+		FREE(pkg->desc);
+		FREE(pkg->url);
+		FREE(pkg->packager);
+		FREE(pkg->md5sum);
+		FREE(pkg->sha256sum);
+		FREE(pkg->base64_sig);
+		FREE(pkg->arch);
+		FREELIST(pkg->licenses);
+		FREELIST(pkg->groups);
+	}
+	/* download-time digests are never pooled */
+	FREE(pkg->dl_md5sum);
+	FREE(pkg->dl_sha256sum);
 	if(pkg->files.count) {
-		size_t i;
-		for(i = 0; i < pkg->files.count; i++) {
-			FREE(pkg->files.files[i].name);
+		/* a set names buffer backs every entry, so the individual name
+		 * pointers (or build-time offsets) must not be freed */
+		if(pkg->files.names == NULL) {
+			size_t i;
+			for(i = 0; i < pkg->files.count; i++) {
+				FREE(pkg->files.files[i].name);
+			}
 		}
 		free(pkg->files.files);
+		free(pkg->files.names);
+		free(pkg->files.hashes);
 	}
 	alpm_list_free_inner(pkg->backup, (alpm_list_fn_free)_alpm_backup_free);
 	alpm_list_free(pkg->backup);
-	free_deplist(pkg->depends);
-	free_deplist(pkg->optdepends);
-	free_deplist(pkg->checkdepends);
-	free_deplist(pkg->makedepends);
-	free_deplist(pkg->conflicts);
-	free_deplist(pkg->provides);
+	free(pkg->backup_index);
+	if(pkg->deps_pooled) {
+		/* dependency objects belong to the database's dep pool; only
+		 * the list cells are ours */
+		alpm_list_free(pkg->replaces);
+		alpm_list_free(pkg->depends);
+		alpm_list_free(pkg->optdepends);
+		alpm_list_free(pkg->checkdepends);
+		alpm_list_free(pkg->makedepends);
+		alpm_list_free(pkg->conflicts);
+		alpm_list_free(pkg->provides);
+	} else {
+		free_deplist(pkg->replaces);
+		free_deplist(pkg->depends);
+		free_deplist(pkg->optdepends);
+		free_deplist(pkg->checkdepends);
+		free_deplist(pkg->makedepends);
+		free_deplist(pkg->conflicts);
+		free_deplist(pkg->provides);
+	}
 	alpm_list_free(pkg->removes);
 	_alpm_pkg_free(pkg->oldpkg);
 
@@ -751,15 +951,35 @@ int SYMEXPORT alpm_pkg_should_ignore(alpm_handle_t *handle, alpm_pkg_t *pkg)
 	alpm_list_t *groups = NULL;
 
 	/* first see if the package is ignored */
-	if(alpm_list_find(handle->ignorepkg, pkg->name, _alpm_fnmatch)) {
-		return 1;
+	if(handle->ignorepkg) {
+		/* compile the patterns on first use; a sysupgrade consults them
+		 * once per installed package, so fnmatch-per-pattern adds up */
+		if(handle->ignorepkg_set == NULL) {
+			handle->ignorepkg_set = _alpm_patternset_build(handle->ignorepkg);
+		}
+		if(handle->ignorepkg_set) {
+			if(_alpm_patternset_match(handle->ignorepkg_set, pkg->name)) {
+				return 1;
+			}
+		} else if(alpm_list_find(handle->ignorepkg, pkg->name, _alpm_fnmatch)) {
+			return 1;
+		}
 	}
 
 	/* next see if the package is in a group that is ignored */
-	for(groups = alpm_pkg_get_groups(pkg); groups; groups = groups->next) {
-		char *grp = groups->data;
-		if(alpm_list_find(handle->ignoregroup, grp, _alpm_fnmatch)) {
-			return 1;
+	if(handle->ignoregroup) {
+		if(handle->ignoregroup_set == NULL) {
+			handle->ignoregroup_set = _alpm_patternset_build(handle->ignoregroup);
+		}
+		for(groups = alpm_pkg_get_groups(pkg); groups; groups = groups->next) {
+			char *grp = groups->data;
+			if(handle->ignoregroup_set) {
+				if(_alpm_patternset_match(handle->ignoregroup_set, grp)) {
+					return 1;
+				}
+			} else if(alpm_list_find(handle->ignoregroup, grp, _alpm_fnmatch)) {
+				return 1;
+			}
 		}
 	}
 
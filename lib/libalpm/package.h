@@ -31,6 +31,7 @@
 #include <archive_entry.h>
 
 #include "alpm.h"
+#include "strpool.h"
 #include "backup.h"
 #include "db.h"
 #include "signing.h"
@@ -76,6 +77,7 @@ struct pkg_operations {
 	int (*mtree_close) (const alpm_pkg_t *, struct archive *);
 
 	int (*force_load) (alpm_pkg_t *);
+	int (*evict) (alpm_pkg_t *);
 };
 
 /** The standard package operations struct. get fields directly from the
@@ -98,6 +100,10 @@ struct __alpm_pkg_t {
 	char *sha256sum;
 	char *base64_sig;
 	char *arch;
+	/* digests streamed while the package file was downloaded; when set,
+	 * validation compares against these instead of re-reading the file */
+	char *dl_md5sum;
+	char *dl_sha256sum;
 
 	alpm_time_t builddate;
 	alpm_time_t installdate;
@@ -112,6 +118,9 @@ struct __alpm_pkg_t {
 	alpm_list_t *replaces;
 	alpm_list_t *groups;
 	alpm_list_t *backup;
+	/* lazily built hash set over 'backup', see _alpm_needbackup() */
+	alpm_backup_t **backup_index;
+	size_t backup_index_size;
 	alpm_list_t *depends;
 	alpm_list_t *optdepends;
 	alpm_list_t *checkdepends;
@@ -135,6 +144,27 @@ struct __alpm_pkg_t {
 	alpm_pkgfrom_t origin;
 	alpm_pkgreason_t reason;
 	int scriptlet;
+	/* flat metadata strings and license/group data are owned by the
+	 * database's string pool, not the package */
+	int strings_pooled;
+	/* dependency objects are owned by the database's dep pool, shared
+	 * with other packages; only the list cells belong to the package */
+	int deps_pooled;
+
+	/* storage sharing, see _alpm_pkg_dup_shared(): number of shallow
+	 * copies still borrowing this package's storage, and the package
+	 * this copy borrows from (NULL for a full owner) */
+	int refcount;
+	alpm_pkg_t *shared_src;
+
+	/* active binary mtree cache reader, keyed off the archive handle
+	 * returned by mtree_open (be_local.c) */
+	void *mtree_reader;
+
+	/* byte span of this package's filelist inside the sync db sidecar
+	 * index; offset 0 once loaded or when unused (be_sync.c) */
+	int64_t syncidx_files_off;
+	uint32_t syncidx_files_len;
 
 	/* Bitfield from alpm_dbinfrq_t */
 	int infolevel;
@@ -146,7 +176,9 @@ alpm_file_t *_alpm_file_copy(alpm_file_t *dest, const alpm_file_t *src);
 
 alpm_pkg_t *_alpm_pkg_new(void);
 int _alpm_pkg_dup(alpm_pkg_t *pkg, alpm_pkg_t **new_ptr);
+int _alpm_pkg_dup_shared(alpm_pkg_t *pkg, alpm_pkg_t **new_ptr);
 void _alpm_pkg_free(alpm_pkg_t *pkg);
+void _alpm_pkg_pool_strings(alpm_pkg_t *pkg, _alpm_strpool_t *pool);
 void _alpm_pkg_free_trans(alpm_pkg_t *pkg);
 
 int _alpm_pkg_validate_internal(alpm_handle_t *handle,
@@ -154,6 +186,8 @@ int _alpm_pkg_validate_internal(alpm_handle_t *handle,
 		alpm_siglist_t **sigdata, int *validation);
 alpm_pkg_t *_alpm_pkg_load_internal(alpm_handle_t *handle,
 		const char *pkgfile, int full);
+alpm_pkg_t *_alpm_pkg_load_digests(alpm_handle_t *handle,
+		const char *pkgfile, int full, char **md5sum, char **sha256sum);
 
 int _alpm_pkg_cmp(const void *p1, const void *p2);
 int _alpm_pkg_compare_versions(alpm_pkg_t *local_pkg, alpm_pkg_t *pkg);
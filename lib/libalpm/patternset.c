@@ -0,0 +1,129 @@
+/*
+ *  patternset.c
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* libalpm */
+#include "patternset.h"
+#include "util.h"
+
+struct patternset_bucket {
+	unsigned long hash;
+	char *literal; /* NULL marks an empty bucket */
+};
+
+struct __alpm_patternset_t {
+	/* literal patterns, open addressing, power-of-two sized */
+	struct patternset_bucket *buckets;
+	size_t nbuckets;
+	size_t nliterals;
+	/* patterns containing glob metacharacters, checked with fnmatch */
+	alpm_list_t *globs; /* list of (char *) */
+};
+
+_alpm_patternset_t *_alpm_patternset_build(alpm_list_t *patterns)
+{
+	_alpm_patternset_t *set;
+	alpm_list_t *i;
+	size_t count = alpm_list_count(patterns);
+
+	if(count == 0) {
+		return NULL;
+	}
+
+	CALLOC(set, 1, sizeof(_alpm_patternset_t), return NULL);
+	/* size for at most 50% load */
+	set->nbuckets = 8;
+	while(set->nbuckets < count * 2) {
+		set->nbuckets *= 2;
+	}
+	CALLOC(set->buckets, set->nbuckets, sizeof(struct patternset_bucket),
+			free(set); return NULL);
+
+	for(i = patterns; i; i = i->next) {
+		const char *pattern = i->data;
+		char *copy;
+
+		STRDUP(copy, pattern, _alpm_patternset_free(set); return NULL);
+
+		if(strpbrk(pattern, "*?[\\") != NULL) {
+			if(alpm_list_append(&set->globs, copy) == NULL) {
+				free(copy);
+				_alpm_patternset_free(set);
+				return NULL;
+			}
+		} else {
+			unsigned long hash = _alpm_hash_sdbm(pattern);
+			size_t pos = hash & (set->nbuckets - 1);
+			while(set->buckets[pos].literal != NULL) {
+				if(set->buckets[pos].hash == hash
+						&& strcmp(set->buckets[pos].literal, pattern) == 0) {
+					break;
+				}
+				pos = (pos + 1) & (set->nbuckets - 1);
+			}
+			if(set->buckets[pos].literal != NULL) {
+				/* duplicate pattern */
+				free(copy);
+				continue;
+			}
+			set->buckets[pos].hash = hash;
+			set->buckets[pos].literal = copy;
+			set->nliterals++;
+		}
+	}
+
+	return set;
+}
+
+int _alpm_patternset_match(_alpm_patternset_t *set, const char *string)
+{
+	if(set == NULL || string == NULL) {
+		return 0;
+	}
+
+	if(set->nliterals) {
+		unsigned long hash = _alpm_hash_sdbm(string);
+		size_t pos = hash & (set->nbuckets - 1);
+		while(set->buckets[pos].literal != NULL) {
+			if(set->buckets[pos].hash == hash
+					&& strcmp(set->buckets[pos].literal, string) == 0) {
+				return 1;
+			}
+			pos = (pos + 1) & (set->nbuckets - 1);
+		}
+	}
+
+	return _alpm_fnmatch_patterns(set->globs, string) == 0;
+}
+
+void _alpm_patternset_free(_alpm_patternset_t *set)
+{
+	size_t n;
+	if(set == NULL) {
+		return;
+	}
+	for(n = 0; n < set->nbuckets; n++) {
+		free(set->buckets[n].literal);
+	}
+	free(set->buckets);
+	FREELIST(set->globs);
+	free(set);
+}
@@ -0,0 +1,37 @@
+/*
+ *  patternset.h
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_PATTERNSET_H
+#define ALPM_PATTERNSET_H
+
+#include "alpm_list.h"
+
+/* A compiled set of shell patterns. Patterns without glob metacharacters
+ * (the overwhelming majority of IgnorePkg/IgnoreGroup entries) go into a
+ * hash set and match with one probe; only the remaining true globs are
+ * run through fnmatch(). The set copies the pattern strings, so the list
+ * it was built from may change afterwards - callers cache a set and
+ * rebuild it when their pattern list does. */
+typedef struct __alpm_patternset_t _alpm_patternset_t;
+
+/* returns NULL on allocation failure or an empty pattern list */
+_alpm_patternset_t *_alpm_patternset_build(alpm_list_t *patterns);
+int _alpm_patternset_match(_alpm_patternset_t *set, const char *string);
+void _alpm_patternset_free(_alpm_patternset_t *set);
+
+#endif /* ALPM_PATTERNSET_H */
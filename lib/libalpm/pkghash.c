@@ -56,6 +56,8 @@ static const unsigned int stride = 1;
 static const double max_hash_load = 0.68;
 /* Initial load percentage given a certain size */
 static const double initial_hash_load = 0.58;
+/* How many entries do we drain from the old table per insert? */
+static const unsigned int migrate_step = 16;
 
 /* Allocate a hash table with space for at least "size" elements */
 alpm_pkghash_t *_alpm_pkghash_create(unsigned int size)
@@ -81,37 +83,74 @@ alpm_pkghash_t *_alpm_pkghash_create(unsigned int size)
 		return NULL;
 	}
 
-	CALLOC(hash->hash_table, hash->buckets, sizeof(alpm_list_t *), \
+	CALLOC(hash->hash_table, hash->buckets, sizeof(alpm_pkghash_bucket_t), \
 				free(hash); return NULL);
 
 	return hash;
 }
 
 static unsigned int get_hash_position(unsigned long name_hash,
-		alpm_pkghash_t *hash)
+		alpm_pkghash_bucket_t *table, unsigned int buckets)
 {
 	unsigned int position;
 
-	position = name_hash % hash->buckets;
+	position = name_hash % buckets;
 
 	/* collision resolution using open addressing with linear probing */
-	while(hash->hash_table[position] != NULL) {
+	while(table[position].cell != NULL) {
 		position += stride;
-		while(position >= hash->buckets) {
-			position -= hash->buckets;
+		while(position >= buckets) {
+			position -= buckets;
 		}
 	}
 
 	return position;
 }
 
-/* Expand the hash table size to the next increment and rebin the entries */
-static alpm_pkghash_t *rehash(alpm_pkghash_t *oldhash)
+/* Move a batch of entries from the old bucket array into the current one.
+ * Whole probe clusters (runs of occupied buckets up to the next empty one)
+ * are moved at a time so the chains remaining in the old table are never
+ * broken mid-run and lookups there stay valid. */
+static void migrate_some(alpm_pkghash_t *hash)
 {
-	alpm_pkghash_t *newhash;
-	unsigned int newsize, i;
+	unsigned int moved = 0;
+
+	while(hash->old_table && moved < migrate_step) {
+		if(hash->old_entries == 0 || hash->migrate_pos >= hash->old_buckets) {
+			free(hash->old_table);
+			hash->old_table = NULL;
+			hash->old_buckets = 0;
+			hash->old_entries = 0;
+			hash->migrate_pos = 0;
+			return;
+		}
+		if(hash->old_table[hash->migrate_pos].cell == NULL) {
+			hash->migrate_pos++;
+			continue;
+		}
+		while(hash->migrate_pos < hash->old_buckets
+				&& hash->old_table[hash->migrate_pos].cell != NULL) {
+			alpm_pkghash_bucket_t *bucket = &hash->old_table[hash->migrate_pos];
+			unsigned int position = get_hash_position(bucket->name_hash,
+					hash->hash_table, hash->buckets);
+
+			hash->hash_table[position] = *bucket;
+			bucket->cell = NULL;
+			hash->old_entries--;
+			hash->migrate_pos++;
+			moved++;
+		}
+	}
+}
+
+/* Start an incremental resize: allocate the next table size and leave the
+ * existing entries behind in old_table to be drained by later inserts. */
+static int rehash(alpm_pkghash_t *hash)
+{
+	alpm_pkghash_bucket_t *newtable;
+	unsigned int newsize, newbuckets = 0, i, loopsize;
 
-	/* Hash tables will need resized in two cases:
+	/* A table resize is needed in two cases:
 	 *  - adding packages to the local database
 	 *  - poor estimation of the number of packages in sync database
 	 *
@@ -120,39 +159,45 @@ static alpm_pkghash_t *rehash(alpm_pkghash_t *oldhash)
 	 * larger database sizes, this increase is reduced to avoid excess
 	 * memory allocation as both scenarios requiring a rehash should not
 	 * require a table size increase that large. */
-	if(oldhash->buckets < 500) {
-		newsize = oldhash->buckets * 2;
-	} else if(oldhash->buckets < 2000) {
-		newsize = oldhash->buckets * 3 / 2;
-	} else if(oldhash->buckets < 5000) {
-		newsize = oldhash->buckets * 4 / 3;
+	if(hash->buckets < 500) {
+		newsize = hash->buckets * 2;
+	} else if(hash->buckets < 2000) {
+		newsize = hash->buckets * 3 / 2;
+	} else if(hash->buckets < 5000) {
+		newsize = hash->buckets * 4 / 3;
 	} else {
-		newsize = oldhash->buckets + 1;
+		newsize = hash->buckets + 1;
 	}
 
-	newhash = _alpm_pkghash_create(newsize);
-	if(newhash == NULL) {
-		return NULL;
+	/* only one resize can be in flight; drain any unfinished one first */
+	while(hash->old_table) {
+		migrate_some(hash);
 	}
 
-	newhash->list = oldhash->list;
-	oldhash->list = NULL;
-
-	for(i = 0; i < oldhash->buckets; i++) {
-		if(oldhash->hash_table[i] != NULL) {
-			alpm_pkg_t *package = oldhash->hash_table[i]->data;
-			unsigned int position = get_hash_position(package->name_hash, newhash);
-
-			newhash->hash_table[position] = oldhash->hash_table[i];
-			oldhash->hash_table[i] = NULL;
+	loopsize = ARRAYSIZE(prime_list);
+	for(i = 0; i < loopsize; i++) {
+		if(prime_list[i] > newsize) {
+			newbuckets = prime_list[i];
+			break;
 		}
 	}
+	if(newbuckets <= hash->buckets) {
+		errno = ERANGE;
+		return -1;
+	}
 
-	newhash->entries = oldhash->entries;
+	CALLOC(newtable, newbuckets, sizeof(alpm_pkghash_bucket_t), return -1);
 
-	_alpm_pkghash_free(oldhash);
+	hash->old_table = hash->hash_table;
+	hash->old_buckets = hash->buckets;
+	hash->old_entries = hash->entries;
+	hash->migrate_pos = 0;
 
-	return newhash;
+	hash->hash_table = newtable;
+	hash->buckets = newbuckets;
+	hash->limit = newbuckets * max_hash_load;
+
+	return 0;
 }
 
 static alpm_pkghash_t *pkghash_add_pkg(alpm_pkghash_t **hashref, alpm_pkg_t *pkg,
@@ -167,15 +212,18 @@ static alpm_pkghash_t *pkghash_add_pkg(alpm_pkghash_t **hashref, alpm_pkg_t *pkg
 	}
 	hash = *hashref;
 
+	if(hash->old_table) {
+		migrate_some(hash);
+	}
+
 	if(hash->entries >= hash->limit) {
-		if((hash = rehash(hash)) == NULL) {
+		if(rehash(hash) != 0) {
 			/* resizing failed and there are no more open buckets */
 			return NULL;
 		}
-		*hashref = hash;
 	}
 
-	position = get_hash_position(pkg->name_hash, hash);
+	position = get_hash_position(pkg->name_hash, hash->hash_table, hash->buckets);
 
 	MALLOC(ptr, sizeof(alpm_list_t), return NULL);
 
@@ -183,7 +231,8 @@ static alpm_pkghash_t *pkghash_add_pkg(alpm_pkghash_t **hashref, alpm_pkg_t *pkg
 	ptr->prev = ptr;
 	ptr->next = NULL;
 
-	hash->hash_table[position] = ptr;
+	hash->hash_table[position].cell = ptr;
+	hash->hash_table[position].name_hash = pkg->name_hash;
 	if(!sorted) {
 		hash->list = alpm_list_join(hash->list, ptr);
 	} else {
@@ -204,8 +253,8 @@ alpm_pkghash_t *_alpm_pkghash_add_sorted(alpm_pkghash_t **hash, alpm_pkg_t *pkg)
 	return pkghash_add_pkg(hash, pkg, 1);
 }
 
-static unsigned int move_one_entry(alpm_pkghash_t *hash,
-		unsigned int start, unsigned int end)
+static unsigned int move_one_entry(alpm_pkghash_bucket_t *table,
+		unsigned int buckets, unsigned int start, unsigned int end)
 {
 	/* Iterate backwards from 'end' to 'start', seeing if any of the items
 	 * would hash to 'start'. If we find one, we move it there and break.  If
@@ -215,52 +264,37 @@ static unsigned int move_one_entry(alpm_pkghash_t *hash,
 	 * return value is our current iteration location; if this is equal to
 	 * 'start' we can stop this madness. */
 	while(end != start) {
-		alpm_list_t *i = hash->hash_table[end];
-		alpm_pkg_t *info = i->data;
-		unsigned int new_position = get_hash_position(info->name_hash, hash);
+		unsigned int new_position = get_hash_position(table[end].name_hash,
+				table, buckets);
 
 		if(new_position == start) {
-			hash->hash_table[start] = i;
-			hash->hash_table[end] = NULL;
+			table[start] = table[end];
+			table[end].cell = NULL;
 			break;
 		}
 
 		/* the odd math ensures we are always positive, e.g.
 		 * e.g. (0 - 1) % 47      == -1
 		 * e.g. (47 + 0 - 1) % 47 == 46 */
-		end = (hash->buckets + end - stride) % hash->buckets;
+		end = (buckets + end - stride) % buckets;
 	}
 	return end;
 }
 
-/**
- * @brief Remove a package from a pkghash.
- *
- * @param hash     the hash to remove the package from
- * @param pkg      the package we are removing
- * @param data     output parameter containing the removed item
- *
- * @return the resultant hash
- */
-alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg,
-		alpm_pkg_t **data)
+/* Remove pkg from one bucket array, plugging the hole left behind so the
+ * open addressing probe chains stay intact. Returns 1 if it was found. */
+static int pkghash_remove_from(alpm_pkghash_t *hash,
+		alpm_pkghash_bucket_t *table, unsigned int buckets,
+		alpm_pkg_t *pkg, alpm_pkg_t **data)
 {
 	alpm_list_t *i;
 	unsigned int position;
 
-	if(data) {
-		*data = NULL;
-	}
-
-	if(pkg == NULL || hash == NULL) {
-		return hash;
-	}
-
-	position = pkg->name_hash % hash->buckets;
-	while((i = hash->hash_table[position]) != NULL) {
+	position = pkg->name_hash % buckets;
+	while((i = table[position].cell) != NULL) {
 		alpm_pkg_t *info = i->data;
 
-		if(info->name_hash == pkg->name_hash &&
+		if(table[position].name_hash == pkg->name_hash &&
 					strcmp(info->name, pkg->name) == 0) {
 			unsigned int stop, prev;
 
@@ -269,7 +303,7 @@ alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg,
 			if(data) {
 				*data = info;
 			}
-			hash->hash_table[position] = NULL;
+			table[position].cell = NULL;
 			free(i);
 			hash->entries -= 1;
 
@@ -277,34 +311,65 @@ alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg,
 			 * addressing collision resolution working. We start by finding the
 			 * next null bucket to know how far we have to look. */
 			stop = position + stride;
-			while(stop >= hash->buckets) {
-				stop -= hash->buckets;
+			while(stop >= buckets) {
+				stop -= buckets;
 			}
-			while(hash->hash_table[stop] != NULL && stop != position) {
+			while(table[stop].cell != NULL && stop != position) {
 				stop += stride;
-				while(stop >= hash->buckets) {
-					stop -= hash->buckets;
+				while(stop >= buckets) {
+					stop -= buckets;
 				}
 			}
-			stop = (hash->buckets + stop - stride) % hash->buckets;
+			stop = (buckets + stop - stride) % buckets;
 
 			/* We now search backwards from stop to position. If we find an
 			 * item that now hashes to position, we will move it, and then try
 			 * to plug the new hole we just opened up, until we finally don't
 			 * move anything. */
-			while((prev = move_one_entry(hash, position, stop)) != position) {
+			while((prev = move_one_entry(table, buckets, position, stop)) != position) {
 				position = prev;
 			}
 
-			return hash;
+			return 1;
 		}
 
 		position += stride;
-		while(position >= hash->buckets) {
-			position -= hash->buckets;
+		while(position >= buckets) {
+			position -= buckets;
 		}
 	}
 
+	return 0;
+}
+
+/**
+ * @brief Remove a package from a pkghash.
+ *
+ * @param hash     the hash to remove the package from
+ * @param pkg      the package we are removing
+ * @param data     output parameter containing the removed item
+ *
+ * @return the resultant hash
+ */
+alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg,
+		alpm_pkg_t **data)
+{
+	if(data) {
+		*data = NULL;
+	}
+
+	if(pkg == NULL || hash == NULL) {
+		return hash;
+	}
+
+	if(pkghash_remove_from(hash, hash->hash_table, hash->buckets, pkg, data)) {
+		return hash;
+	}
+	if(hash->old_table && pkghash_remove_from(hash, hash->old_table,
+				hash->old_buckets, pkg, data)) {
+		hash->old_entries -= 1;
+	}
+
 	return hash;
 }
 
@@ -313,39 +378,60 @@ void _alpm_pkghash_free(alpm_pkghash_t *hash)
 	if(hash != NULL) {
 		unsigned int i;
 		for(i = 0; i < hash->buckets; i++) {
-			free(hash->hash_table[i]);
+			free(hash->hash_table[i].cell);
 		}
 		free(hash->hash_table);
+		if(hash->old_table) {
+			for(i = 0; i < hash->old_buckets; i++) {
+				free(hash->old_table[i].cell);
+			}
+			free(hash->old_table);
+		}
 	}
 	free(hash);
 }
 
-alpm_pkg_t *_alpm_pkghash_find(alpm_pkghash_t *hash, const char *name)
+static alpm_pkg_t *pkghash_find_in(alpm_pkghash_bucket_t *table,
+		unsigned int buckets, unsigned long name_hash, const char *name)
 {
-	alpm_list_t *lp;
-	unsigned long name_hash;
 	unsigned int position;
 
-	if(name == NULL || hash == NULL) {
-		return NULL;
-	}
-
-	name_hash = _alpm_hash_sdbm(name);
+	position = name_hash % buckets;
 
-	position = name_hash % hash->buckets;
+	while(table[position].cell != NULL) {
+		if(table[position].name_hash == name_hash) {
+			alpm_pkg_t *info = table[position].cell->data;
 
-	while((lp = hash->hash_table[position]) != NULL) {
-		alpm_pkg_t *info = lp->data;
-
-		if(info->name_hash == name_hash && strcmp(info->name, name) == 0) {
-			return info;
+			if(strcmp(info->name, name) == 0) {
+				return info;
+			}
 		}
 
 		position += stride;
-		while(position >= hash->buckets) {
-			position -= hash->buckets;
+		while(position >= buckets) {
+			position -= buckets;
 		}
 	}
 
 	return NULL;
 }
+
+alpm_pkg_t *_alpm_pkghash_find(alpm_pkghash_t *hash, const char *name)
+{
+	alpm_pkg_t *info;
+	unsigned long name_hash;
+
+	if(name == NULL || hash == NULL) {
+		return NULL;
+	}
+
+	name_hash = _alpm_hash_sdbm(name);
+
+	info = pkghash_find_in(hash->hash_table, hash->buckets, name_hash, name);
+	if(!info && hash->old_table) {
+		info = pkghash_find_in(hash->old_table, hash->old_buckets,
+				name_hash, name);
+	}
+
+	return info;
+}
@@ -26,21 +26,47 @@
 #include "alpm_list.h"
 
 
+/**
+ * @brief A single open addressing bucket.
+ *
+ * The package name hash is cached beside the cell pointer so probe
+ * sequences compare hashes from the flat array without dereferencing
+ * each list cell.
+ */
+struct __alpm_pkghash_bucket_t {
+	/** list cell holding the package, NULL if the bucket is empty */
+	alpm_list_t *cell;
+	/** cached hash of the package name */
+	unsigned long name_hash;
+};
+
+typedef struct __alpm_pkghash_bucket_t alpm_pkghash_bucket_t;
+
 /**
  * @brief A hash table for holding alpm_pkg_t objects.
  *
  * A combination of a hash table and a list, allowing for fast look-up
- * by package name but also iteration over the packages.
+ * by package name but also iteration over the packages. Resizes are
+ * performed incrementally: the previous bucket array is kept and
+ * drained a few entries at a time on subsequent inserts.
  */
 struct __alpm_pkghash_t {
 	/** data held by the hash table */
-	alpm_list_t **hash_table;
+	alpm_pkghash_bucket_t *hash_table;
+	/** previous bucket array still being drained after a resize */
+	alpm_pkghash_bucket_t *old_table;
 	/** head node of the hash table data in normal list format */
 	alpm_list_t *list;
 	/** number of buckets in hash table */
 	unsigned int buckets;
-	/** number of entries in hash table */
+	/** number of buckets in old_table */
+	unsigned int old_buckets;
+	/** next bucket of old_table to migrate */
+	unsigned int migrate_pos;
+	/** number of entries in hash table, including old_table */
 	unsigned int entries;
+	/** number of entries remaining in old_table */
+	unsigned int old_entries;
 	/** max number of entries before a resize is needed */
 	unsigned int limit;
 };
@@ -49,7 +75,13 @@ typedef struct __alpm_pkghash_t alpm_pkghash_t;
 
 alpm_pkghash_t *_alpm_pkghash_create(unsigned int size);
 
+/* appends to the package list without keeping it sorted; bulk loaders
+ * (db populate) use this and run one alpm_list_msort() pass before the
+ * cache is handed out */
 alpm_pkghash_t *_alpm_pkghash_add(alpm_pkghash_t **hash, alpm_pkg_t *pkg);
+/* merges into an already-sorted package list; used for incremental
+ * inserts into a published cache, e.g. registering an installed package
+ * during a transaction */
 alpm_pkghash_t *_alpm_pkghash_add_sorted(alpm_pkghash_t **hash, alpm_pkg_t *pkg);
 alpm_pkghash_t *_alpm_pkghash_remove(alpm_pkghash_t *hash, alpm_pkg_t *pkg, alpm_pkg_t **data);
 
@@ -45,6 +45,7 @@
 #include "deps.h"
 #include "handle.h"
 #include "filelist.h"
+#include "thread.h"
 
 int SYMEXPORT alpm_remove_pkg(alpm_handle_t *handle, alpm_pkg_t *pkg)
 {
@@ -72,7 +73,7 @@ int SYMEXPORT alpm_remove_pkg(alpm_handle_t *handle, alpm_pkg_t *pkg)
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "adding package %s to the transaction remove list\n",
 			pkgname);
-	if(_alpm_pkg_dup(pkg, &copy) == -1) {
+	if(_alpm_pkg_dup_shared(pkg, &copy) == -1) {
 		return -1;
 	}
 	trans->remove = alpm_list_add(trans->remove, copy);
@@ -101,7 +102,7 @@ static int remove_prepare_cascade(alpm_handle_t *handle, alpm_list_t *lp)
 				if(!alpm_pkg_find(trans->remove, info->name)) {
 					_alpm_log(handle, ALPM_LOG_DEBUG, "pulling %s in target list\n",
 							info->name);
-					if(_alpm_pkg_dup(info, &copy) == -1) {
+					if(_alpm_pkg_dup_shared(info, &copy) == -1) {
 						return -1;
 					}
 					trans->remove = alpm_list_add(trans->remove, copy);
@@ -561,24 +562,144 @@ static int unlink_file(alpm_handle_t *handle, alpm_pkg_t *oldpkg,
 	return 0;
 }
 
+/* open-addressed set over the transaction's skip_remove list; built once per
+ * package so the per-file lookup is a probe instead of a full list walk */
+struct skip_remove_set {
+	const char **names;
+	size_t nbuckets;
+};
+
+static struct skip_remove_set *skip_remove_set_build(alpm_list_t *names)
+{
+	struct skip_remove_set *set;
+	alpm_list_t *i;
+	size_t count = alpm_list_count(names);
+
+	if(count == 0 || (set = malloc(sizeof(struct skip_remove_set))) == NULL) {
+		return NULL;
+	}
+	set->nbuckets = 32;
+	while(set->nbuckets < count * 2) {
+		set->nbuckets *= 2;
+	}
+	if((set->names = calloc(set->nbuckets, sizeof(char *))) == NULL) {
+		free(set);
+		return NULL;
+	}
+	for(i = names; i; i = i->next) {
+		size_t b = _alpm_hash_sdbm(i->data) & (set->nbuckets - 1);
+		while(set->names[b] != NULL) {
+			b = (b + 1) & (set->nbuckets - 1);
+		}
+		set->names[b] = i->data;
+	}
+	return set;
+}
+
+static int skip_remove_set_contains(const struct skip_remove_set *set,
+		const char *path)
+{
+	size_t b = _alpm_hash_sdbm(path) & (set->nbuckets - 1);
+	while(set->names[b] != NULL) {
+		if(strcmp(set->names[b], path) == 0) {
+			return 1;
+		}
+		b = (b + 1) & (set->nbuckets - 1);
+	}
+	return 0;
+}
+
+static void skip_remove_set_free(struct skip_remove_set *set)
+{
+	if(set) {
+		free(set->names);
+		free(set);
+	}
+}
+
 /**
  * @brief Check if a package file should be removed.
  *
  * @param handle the context handle
  * @param newpkg the package replacing the current owner of \a path
  * @param path file to be removed
+ * @param skip set built from the transaction's skip_remove list, or NULL to
+ * search the list directly
  *
  * @return 1 if the file should be skipped, 0 if it should be removed
  */
 static int should_skip_file(alpm_handle_t *handle,
-		alpm_pkg_t *newpkg, const char *path)
+		alpm_pkg_t *newpkg, const char *path,
+		const struct skip_remove_set *skip)
 {
 	return _alpm_fnmatch_patterns(handle->noupgrade, path) == 0
-		|| alpm_list_find_str(handle->trans->skip_remove, path)
+		|| (skip ? skip_remove_set_contains(skip, path)
+				: alpm_list_find_str(handle->trans->skip_remove, path) != NULL)
 		|| (newpkg && _alpm_needbackup(path, newpkg)
 				&& alpm_filelist_contains(alpm_pkg_get_files(newpkg), path));
 }
 
+/* files smaller removals unlink serially; below this count the setup cost of
+ * the worker pool outweighs the syscalls it spreads out */
+#define PARALLEL_UNLINK_MIN 512
+
+enum {
+	/* eligible for the parallel phase, not yet processed */
+	UNLINK_PENDING = 0,
+	/* unlinked by a worker; calling thread still owes the debug log */
+	UNLINK_DONE,
+	/* file was already gone */
+	UNLINK_MISSING,
+	/* needs the full serial treatment (directory, skip list, backup) */
+	UNLINK_DEFER,
+	/* unlink failed; errno recorded for the calling thread to report */
+	UNLINK_FAILED
+};
+
+struct parallel_unlink {
+	alpm_handle_t *handle;
+	alpm_filelist_t *filelist;
+	unsigned char *status;
+	int *errnos;
+};
+
+/* Unlink one plain file; must not touch handle callbacks or pm_errno, so all
+ * logging and event delivery is left to the calling thread. */
+static void parallel_unlink_worker(void *ctx, size_t index)
+{
+	struct parallel_unlink *pu = ctx;
+	const alpm_file_t *fileobj = pu->filelist->files + index;
+	char path[PATH_MAX];
+	struct stat buf;
+	int len;
+
+	if(pu->status[index] != UNLINK_PENDING) {
+		return;
+	}
+
+	len = snprintf(path, PATH_MAX, "%s%s", pu->handle->root, fileobj->name);
+	if(len <= 0 || len >= PATH_MAX) {
+		pu->status[index] = UNLINK_DEFER;
+		return;
+	}
+	if(llstat(path, &buf) != 0) {
+		pu->status[index] = UNLINK_MISSING;
+		return;
+	}
+	if(S_ISDIR(buf.st_mode)) {
+		/* a plain filelist entry backed by a directory on disk; hand it to
+		 * the serial directory logic */
+		pu->status[index] = UNLINK_DEFER;
+		return;
+	}
+	if(unlink(path) == -1) {
+		pu->errnos[index] = errno;
+		pu->status[index] = UNLINK_FAILED;
+		return;
+	}
+	pu->status[index] = UNLINK_DONE;
+}
+
 /**
  * @brief Remove a package's files, optionally skipping its replacement's
  * files.
@@ -597,17 +718,23 @@ static int remove_package_files(alpm_handle_t *handle,
 		size_t targ_count, size_t pkg_count)
 {
 	alpm_filelist_t *filelist;
-	size_t i;
+	struct skip_remove_set *skip;
+	unsigned char *status = NULL;
+	int *errnos = NULL;
+	size_t i, nthreads;
 	int err = 0;
 	int nosave = handle->trans->flags & ALPM_TRANS_FLAG_NOSAVE;
 
 	filelist = alpm_pkg_get_files(oldpkg);
+	skip = skip_remove_set_build(handle->trans->skip_remove);
+
 	for(i = 0; i < filelist->count; i++) {
 		alpm_file_t *file = filelist->files + i;
-		if(!should_skip_file(handle, newpkg, file->name)) {
+		if(!should_skip_file(handle, newpkg, file->name, skip)) {
 			_alpm_log(handle, ALPM_LOG_DEBUG,
 					"not removing package '%s', can't remove all files\n",
 					oldpkg->name);
+			skip_remove_set_free(skip);
 			RET_ERR(handle, ALPM_ERR_PKG_CANT_REMOVE, -1);
 		}
 	}
@@ -620,21 +747,76 @@ static int remove_package_files(alpm_handle_t *handle,
 				pkg_count, targ_count);
 	}
 
+	/* unlink plain files from a worker pool first; directories, skip list
+	 * entries and files needing .pacsave handling are deferred to the serial
+	 * pass below, which also delivers all logs and events for the batch */
+	nthreads = _alpm_parallel_nthreads(handle, filelist->count);
+	if(nthreads > 1 && filelist->count >= PARALLEL_UNLINK_MIN) {
+		status = calloc(filelist->count, sizeof(unsigned char));
+		errnos = calloc(filelist->count, sizeof(int));
+	}
+	if(status && errnos) {
+		struct parallel_unlink pu = { handle, filelist, status, errnos };
+		size_t npending = 0;
+		for(i = 0; i < filelist->count; i++) {
+			alpm_file_t *file = filelist->files + i;
+			size_t namelen = strlen(file->name);
+			if((namelen && file->name[namelen - 1] == '/')
+					|| should_skip_file(handle, newpkg, file->name, skip)
+					|| _alpm_needbackup(file->name, oldpkg)) {
+				status[i] = UNLINK_DEFER;
+			} else {
+				npending++;
+			}
+		}
+		if(npending >= PARALLEL_UNLINK_MIN) {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					"unlinking %zu plain files with %zu threads\n",
+					npending, nthreads);
+			_alpm_parallel_for(nthreads, filelist->count,
+					parallel_unlink_worker, &pu);
+		} else {
+			FREE(status);
+			FREE(errnos);
+		}
+	} else {
+		FREE(status);
+		FREE(errnos);
+	}
+
 	/* iterate through the list backwards, unlinking files */
 	for(i = filelist->count; i > 0; i--) {
 		alpm_file_t *file = filelist->files + i - 1;
+		unsigned char st = status ? status[i - 1] : UNLINK_DEFER;
+
+		if(st == UNLINK_DONE || st == UNLINK_MISSING || st == UNLINK_FAILED) {
+			char path[PATH_MAX];
+			snprintf(path, PATH_MAX, "%s%s", handle->root, file->name);
+			if(st == UNLINK_DONE) {
+				_alpm_log(handle, ALPM_LOG_DEBUG, "unlinking %s\n", path);
+			} else if(st == UNLINK_MISSING) {
+				_alpm_log(handle, ALPM_LOG_DEBUG, "file %s does not exist\n", path);
+			} else {
+				_alpm_log(handle, ALPM_LOG_ERROR, _("cannot remove %s (%s)\n"),
+						path, strerror(errnos[i - 1]));
+				alpm_logaction(handle, ALPM_CALLER_PREFIX,
+						"error: cannot remove %s (%s)\n",
+						path, strerror(errnos[i - 1]));
+				err++;
+			}
+		} else {
+			/* check the remove skip list before removing the file.
+			 * see the big comment block in db_find_fileconflicts() for an
+			 * explanation. */
+			if(should_skip_file(handle, newpkg, file->name, skip)) {
+				_alpm_log(handle, ALPM_LOG_DEBUG,
+						"%s is in skip_remove, skipping removal\n", file->name);
+				continue;
+			}
 
-		/* check the remove skip list before removing the file.
-		 * see the big comment block in db_find_fileconflicts() for an
-		 * explanation. */
-		if(should_skip_file(handle, newpkg, file->name)) {
-			_alpm_log(handle, ALPM_LOG_DEBUG,
-					"%s is in skip_remove, skipping removal\n", file->name);
-			continue;
-		}
-
-		if(unlink_file(handle, oldpkg, newpkg, file, nosave) < 0) {
-			err++;
+			if(unlink_file(handle, oldpkg, newpkg, file, nosave) < 0) {
+				err++;
+			}
 		}
 
 		if(!newpkg) {
@@ -651,6 +833,9 @@ static int remove_package_files(alpm_handle_t *handle,
 				pkg_count, targ_count);
 	}
 
+	skip_remove_set_free(skip);
+	FREE(status);
+	FREE(errnos);
 	return err;
 }
 
@@ -23,6 +23,7 @@
 
 #ifdef HAVE_LIBGPGME
 #include <locale.h> /* setlocale() */
+#include <pthread.h>
 #include <gpgme.h>
 #endif
 
@@ -34,6 +35,7 @@
 #include "log.h"
 #include "alpm.h"
 #include "handle.h"
+#include "thread.h"
 
 int SYMEXPORT alpm_decode_signature(const char *base64_data,
 		unsigned char **data, size_t *data_len)
@@ -137,19 +139,24 @@ static alpm_list_t *list_sigsum(gpgme_sigsum_t sigsum)
 
 /**
  * Initialize the GPGME library.
- * This can be safely called multiple times; however it is not thread-safe.
+ * This can be safely called multiple times and from concurrent
+ * verification workers; the library is only set up once.
  * @param handle the context handle
  * @return 0 on success, -1 on error
  */
 static int init_gpgme(alpm_handle_t *handle)
 {
+	static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 	static int init = 0;
+	int ret = -1;
 	const char *version, *sigdir;
 	gpgme_error_t gpg_err;
 	gpgme_engine_info_t enginfo;
 
+	pthread_mutex_lock(&init_lock);
 	if(init) {
 		/* we already successfully initialized the library */
+		pthread_mutex_unlock(&init_lock);
 		return 0;
 	}
 
@@ -193,11 +200,85 @@ static int init_gpgme(alpm_handle_t *handle)
 			enginfo->file_name, enginfo->home_dir);
 
 	init = 1;
-	return 0;
+	ret = 0;
+	goto done;
 
 gpg_error:
 	_alpm_log(handle, ALPM_LOG_ERROR, _("GPGME error: %s\n"), gpgme_strerror(gpg_err));
-	RET_ERR(handle, ALPM_ERR_GPGME, -1);
+	GOTO_ERR(handle, ALPM_ERR_GPGME, done);
+
+done:
+	pthread_mutex_unlock(&init_lock);
+	return ret;
+}
+
+/* Warm up the signing backend ahead of a verification phase. gpgme setup
+ * is deliberately lazy - operations that never verify anything must not
+ * pay for library initialization and keyring checks - so callers about
+ * to fan verification out to worker threads use this to run the one-time
+ * initialization serially, where its cost shows up as a tracing span
+ * instead of being raced for inside the workers. */
+int _alpm_signing_prepare(alpm_handle_t *handle)
+{
+	int ret;
+	TRACE_BEGIN(handle, ALPM_TRACE_SIGNING_INIT, NULL);
+	ret = init_gpgme(handle);
+	TRACE_END(handle, ALPM_TRACE_SIGNING_INIT, NULL);
+	return ret;
+}
+
+/* Creating a gpgme context re-reads engine configuration and is far from
+ * free; verifying several hundred packages pays that cost per signature.
+ * Released contexts are parked on the handle and handed back out, so each
+ * verification thread ends up reusing one long-lived context. Verify
+ * results are consumed before a context is returned to the pool, and keys
+ * stashed in a siglist are reference counted independently of the context
+ * they were looked up with. */
+static int gpgme_ctx_acquire(alpm_handle_t *handle, gpgme_ctx_t *ctx)
+{
+	gpgme_error_t gpg_err;
+	alpm_list_t *head = NULL;
+
+	pthread_mutex_lock(&handle->gpgme_ctx_lock);
+	if(handle->gpgme_ctxs) {
+		head = handle->gpgme_ctxs;
+		handle->gpgme_ctxs = alpm_list_remove_item(handle->gpgme_ctxs, head);
+	}
+	pthread_mutex_unlock(&handle->gpgme_ctx_lock);
+
+	if(head) {
+		*ctx = head->data;
+		free(head);
+		return 0;
+	}
+
+	gpg_err = gpgme_new(ctx);
+	if(gpg_err_code(gpg_err) != GPG_ERR_NO_ERROR) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("GPGME error: %s\n"),
+				gpgme_strerror(gpg_err));
+		RET_ERR(handle, ALPM_ERR_GPGME, -1);
+	}
+	return 0;
+}
+
+static void gpgme_ctx_release(alpm_handle_t *handle, gpgme_ctx_t ctx)
+{
+	if(ctx == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&handle->gpgme_ctx_lock);
+	handle->gpgme_ctxs = alpm_list_add(handle->gpgme_ctxs, ctx);
+	pthread_mutex_unlock(&handle->gpgme_ctx_lock);
+}
+
+void _alpm_gpgme_release_ctxs(alpm_handle_t *handle)
+{
+	alpm_list_t *i;
+	for(i = handle->gpgme_ctxs; i; i = i->next) {
+		gpgme_release(i->data);
+	}
+	alpm_list_free(handle->gpgme_ctxs);
+	handle->gpgme_ctxs = NULL;
 }
 
 /**
@@ -223,8 +304,10 @@ int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr)
 		goto error;
 	}
 
-	gpg_err = gpgme_new(&ctx);
-	CHECK_ERR();
+	if(gpgme_ctx_acquire(handle, &ctx)) {
+		/* pm_errno was set in gpgme_ctx_acquire() */
+		goto error;
+	}
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "looking up key %s locally\n", fpr);
 
@@ -242,7 +325,7 @@ int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr)
 	gpgme_key_unref(key);
 
 gpg_error:
-	gpgme_release(ctx);
+	gpgme_ctx_release(handle, ctx);
 
 error:
 	return ret;
@@ -486,26 +569,60 @@ static int email_from_uid(const char *uid, char **email)
 }
 
 /**
- * Import a key defined by a fingerprint into the local keyring.
+ * Fetch and import a key from WKD or a keyserver.
+ * This is the network half of a key import; the frontend must already
+ * have approved the fetch. Safe to run from a worker thread: only
+ * private gpgme contexts are used and gpg serializes keyring writes
+ * itself.
  * @param handle the context handle
  * @param uid a user ID of the key to import
  * @param fpr the fingerprint key ID to import
  * @return 0 on success, -1 on error
  */
-int _alpm_key_import(alpm_handle_t *handle, const char *uid, const char *fpr)
+static int key_fetch(alpm_handle_t *handle, const char *uid, const char *fpr)
 {
 	int ret = -1;
 	alpm_pgpkey_t fetch_key = {0};
 	char *email;
 
-	if(_alpm_access(handle, handle->gpgdir, "pubring.gpg", W_OK)) {
-		/* no chance of import succeeding if pubring isn't writable */
-		_alpm_log(handle, ALPM_LOG_ERROR, _("keyring is not writable\n"));
-		return -1;
+	/* Try to import the key from a WKD first */
+	if(email_from_uid(uid, &email) == 0) {
+		ret = key_import_wkd(handle, email);
+		free(email);
 	}
 
-	STRDUP(fetch_key.uid, uid, return -1);
-	STRDUP(fetch_key.fingerprint, fpr, return -1);
+	/* If importing from the WKD fails, fall back to keyserver lookup */
+	if(ret != 0) {
+		if(key_search_keyserver(handle, fpr, &fetch_key) == 1) {
+			_alpm_log(handle, ALPM_LOG_DEBUG,
+					_("key \"%s\" on keyserver\n"), fetch_key.uid);
+			if(key_import_keyserver(handle, &fetch_key) == 0) {
+				ret = 0;
+			} else {
+				_alpm_log(handle, ALPM_LOG_ERROR,
+						_("key \"%s\" could not be imported\n"), fetch_key.uid);
+			}
+		} else {
+			_alpm_log(handle, ALPM_LOG_ERROR,
+					_("key \"%s\" could not be looked up remotely\n"), fpr);
+		}
+	}
+	gpgme_key_unref(fetch_key.data);
+
+	return ret;
+}
+
+/* Ask the frontend whether 'uid'/'fpr' should be imported; returns 1 on
+ * approval. Split from the fetch so a batch can ask serially and fetch
+ * concurrently. */
+static int key_import_approved(alpm_handle_t *handle, const char *uid,
+		const char *fpr)
+{
+	alpm_pgpkey_t fetch_key = {0};
+	int import;
+
+	STRDUP(fetch_key.uid, uid, return 0);
+	STRDUP(fetch_key.fingerprint, fpr, free(fetch_key.uid); return 0);
 
 	alpm_question_import_key_t question = {
 				.type = ALPM_QUESTION_IMPORT_KEY,
@@ -513,31 +630,116 @@ int _alpm_key_import(alpm_handle_t *handle, const char *uid, const char *fpr)
 				.key = &fetch_key
 			};
 	QUESTION(handle, &question);
-	if(question.import) {
-		/* Try to import the key from a WKD first */
-		if(email_from_uid(uid, &email) == 0) {
-			ret = key_import_wkd(handle, email);
+	import = question.import;
+
+	free(fetch_key.uid);
+	free(fetch_key.fingerprint);
+	return import;
+}
+
+/**
+ * Import a key defined by a fingerprint into the local keyring.
+ * @param handle the context handle
+ * @param uid a user ID of the key to import
+ * @param fpr the fingerprint key ID to import
+ * @return 0 on success, -1 on error
+ */
+int _alpm_key_import(alpm_handle_t *handle, const char *uid, const char *fpr)
+{
+	if(_alpm_access(handle, handle->gpgdir, "pubring.gpg", W_OK)) {
+		/* no chance of import succeeding if pubring isn't writable */
+		_alpm_log(handle, ALPM_LOG_ERROR, _("keyring is not writable\n"));
+		return -1;
+	}
+
+	if(!key_import_approved(handle, uid, fpr)) {
+		return -1;
+	}
+
+	return key_fetch(handle, uid, fpr);
+}
+
+struct key_fetch_job {
+	const char *uid;
+	const char *fpr;
+	int result;
+};
+
+struct key_fetch_ctx {
+	alpm_handle_t *handle;
+	struct key_fetch_job *jobs;
+};
+
+static void key_fetch_worker(void *ctx, size_t index)
+{
+	struct key_fetch_ctx *fctx = ctx;
+	struct key_fetch_job *job = &fctx->jobs[index];
+	job->result = key_fetch(fctx->handle, job->uid, job->fpr);
+}
+
+/**
+ * Import a batch of keys into the local keyring.
+ * The frontend is asked about every key first, then the approved keys
+ * are fetched concurrently: each fetch is a full WKD or keyserver round
+ * trip, so a transaction missing several packager keys pays for one
+ * lookup instead of one per key.
+ * @param handle the context handle
+ * @param count number of keys
+ * @param uids user IDs of the keys to import
+ * @param fprs fingerprint key IDs to import
+ * @return 0 if every approved key was imported, -1 otherwise
+ */
+int _alpm_key_import_many(alpm_handle_t *handle, size_t count,
+		char * const *uids, char * const *fprs)
+{
+	struct key_fetch_job *jobs;
+	struct key_fetch_ctx ctx;
+	size_t i, njobs = 0, nthreads;
+	int ret = 0;
+
+	if(count == 0) {
+		return 0;
+	}
+
+	if(_alpm_access(handle, handle->gpgdir, "pubring.gpg", W_OK)) {
+		/* no chance of import succeeding if pubring isn't writable */
+		_alpm_log(handle, ALPM_LOG_ERROR, _("keyring is not writable\n"));
+		return -1;
+	}
+
+	CALLOC(jobs, count, sizeof(struct key_fetch_job),
+			RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+
+	for(i = 0; i < count; i++) {
+		if(key_import_approved(handle, uids[i], fprs[i])) {
+			jobs[njobs].uid = uids[i];
+			jobs[njobs].fpr = fprs[i];
+			njobs++;
+		} else {
+			ret = -1;
 		}
+	}
 
-		/* If importing from the WKD fails, fall back to keyserver lookup */
-		if(ret != 0) {
-			if(key_search_keyserver(handle, fpr, &fetch_key) == 1) {
-				_alpm_log(handle, ALPM_LOG_DEBUG,
-						_("key \"%s\" on keyserver\n"), fetch_key.uid);
-				if(key_import_keyserver(handle, &fetch_key) == 0) {
-					ret = 0;
-				} else {
-					_alpm_log(handle, ALPM_LOG_ERROR,
-							_("key \"%s\" could not be imported\n"), fetch_key.uid);
-				}
-			} else {
-				_alpm_log(handle, ALPM_LOG_ERROR,
-						_("key \"%s\" could not be looked up remotely\n"), fpr);
-			}
+	ctx.handle = handle;
+	ctx.jobs = jobs;
+	nthreads = _alpm_parallel_nthreads(handle, njobs);
+	if(nthreads > 1) {
+		_alpm_log_defer_begin(handle);
+		_alpm_parallel_for(nthreads, njobs, key_fetch_worker, &ctx);
+		_alpm_log_defer_end(handle);
+	} else {
+		for(i = 0; i < njobs; i++) {
+			key_fetch_worker(&ctx, i);
 		}
 	}
-	gpgme_key_unref(fetch_key.data);
 
+	for(i = 0; i < njobs; i++) {
+		if(jobs[i].result != 0) {
+			ret = -1;
+		}
+	}
+
+	free(jobs);
 	return ret;
 }
 
@@ -603,8 +805,10 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "checking signature for %s\n", path);
 
-	gpg_err = gpgme_new(&ctx);
-	CHECK_ERR();
+	if(gpgme_ctx_acquire(handle, &ctx)) {
+		/* pm_errno was set in gpgme_ctx_acquire() */
+		goto error;
+	}
 
 	/* create our necessary data objects to verify the signature */
 	gpg_err = gpgme_data_new_from_stream(&filedata, file);
@@ -748,7 +952,7 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char *path,
 gpg_error:
 	gpgme_data_release(sigdata);
 	gpgme_data_release(filedata);
-	gpgme_release(ctx);
+	gpgme_ctx_release(handle, ctx);
 
 error:
 	if(sigfile) {
@@ -780,6 +984,13 @@ int _alpm_key_import(alpm_handle_t *handle, const char UNUSED *uid,
 	return -1;
 }
 
+int _alpm_key_import_many(alpm_handle_t *handle, size_t UNUSED count,
+		char * const UNUSED *uids, char * const UNUSED *fprs)
+{
+	handle->pm_errno = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
+	return -1;
+}
+
 int _alpm_gpgme_checksig(alpm_handle_t *handle, const char UNUSED *path,
 		const char UNUSED *base64_sig, alpm_siglist_t *siglist)
 {
@@ -787,6 +998,11 @@ int _alpm_gpgme_checksig(alpm_handle_t *handle, const char UNUSED *path,
 	handle->pm_errno = ALPM_ERR_MISSING_CAPABILITY_SIGNATURES;
 	return -1;
 }
+
+int _alpm_signing_prepare(alpm_handle_t UNUSED *handle)
+{
+	return 0;
+}
 #endif /* HAVE_LIBGPGME */
 
 /**
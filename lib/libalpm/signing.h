@@ -31,7 +31,14 @@ int _alpm_check_pgp_helper(alpm_handle_t *handle, const char *path,
 int _alpm_process_siglist(alpm_handle_t *handle, const char *identifier,
 		alpm_siglist_t *siglist, int optional, int marginal, int unknown);
 
+int _alpm_signing_prepare(alpm_handle_t *handle);
 int _alpm_key_in_keychain(alpm_handle_t *handle, const char *fpr);
 int _alpm_key_import(alpm_handle_t *handle, const char *uid, const char *fpr);
+int _alpm_key_import_many(alpm_handle_t *handle, size_t count,
+		char * const *uids, char * const *fprs);
+
+#ifdef HAVE_LIBGPGME
+void _alpm_gpgme_release_ctxs(alpm_handle_t *handle);
+#endif
 
 #endif /* ALPM_SIGNING_H */
@@ -0,0 +1,147 @@
+/*
+ *  strpool.c
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* libalpm */
+#include "strpool.h"
+#include "util.h"
+
+#define STRPOOL_SLAB_SIZE (64 * 1024)
+#define STRPOOL_INITIAL_BUCKETS 256
+
+struct strpool_slab {
+	struct strpool_slab *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+struct __alpm_strpool_t {
+	struct strpool_slab *slabs;
+	/* open addressed set of interned strings */
+	const char **table;
+	size_t buckets;
+	size_t entries;
+};
+
+_alpm_strpool_t *_alpm_strpool_new(void)
+{
+	_alpm_strpool_t *pool;
+	CALLOC(pool, 1, sizeof(_alpm_strpool_t), return NULL);
+	pool->buckets = STRPOOL_INITIAL_BUCKETS;
+	CALLOC(pool->table, pool->buckets, sizeof(const char *),
+			free(pool); return NULL);
+	return pool;
+}
+
+static char *strpool_copy(_alpm_strpool_t *pool, const char *str, size_t len)
+{
+	struct strpool_slab *slab = pool->slabs;
+	char *copy;
+
+	if(slab == NULL || slab->size - slab->used < len + 1) {
+		size_t size = len + 1 > STRPOOL_SLAB_SIZE ? len + 1 : STRPOOL_SLAB_SIZE;
+		MALLOC(slab, sizeof(struct strpool_slab) + size, return NULL);
+		slab->used = 0;
+		slab->size = size;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+	}
+
+	copy = slab->data + slab->used;
+	memcpy(copy, str, len + 1);
+	slab->used += len + 1;
+	return copy;
+}
+
+static int strpool_grow(_alpm_strpool_t *pool)
+{
+	const char **newtable;
+	size_t newbuckets = pool->buckets * 2, i;
+
+	CALLOC(newtable, newbuckets, sizeof(const char *), return -1);
+	for(i = 0; i < pool->buckets; i++) {
+		const char *str = pool->table[i];
+		if(str) {
+			size_t pos = _alpm_hash_sdbm(str) & (newbuckets - 1);
+			while(newtable[pos]) {
+				pos = (pos + 1) & (newbuckets - 1);
+			}
+			newtable[pos] = str;
+		}
+	}
+	free(pool->table);
+	pool->table = newtable;
+	pool->buckets = newbuckets;
+	return 0;
+}
+
+/* Return the pool's copy of str, adding it on first sight. On memory
+ * exhaustion NULL is returned and the caller should keep its own copy. */
+const char *_alpm_strpool_intern(_alpm_strpool_t *pool, const char *str)
+{
+	size_t pos;
+	const char *copy;
+
+	if(pool == NULL || str == NULL) {
+		return NULL;
+	}
+
+	pos = _alpm_hash_sdbm(str) & (pool->buckets - 1);
+	while(pool->table[pos]) {
+		if(strcmp(pool->table[pos], str) == 0) {
+			return pool->table[pos];
+		}
+		pos = (pos + 1) & (pool->buckets - 1);
+	}
+
+	/* keep the load factor under 3/4 */
+	if((pool->entries + 1) * 4 > pool->buckets * 3) {
+		if(strpool_grow(pool) != 0) {
+			return NULL;
+		}
+		pos = _alpm_hash_sdbm(str) & (pool->buckets - 1);
+		while(pool->table[pos]) {
+			pos = (pos + 1) & (pool->buckets - 1);
+		}
+	}
+
+	if((copy = strpool_copy(pool, str, strlen(str))) == NULL) {
+		return NULL;
+	}
+	pool->table[pos] = copy;
+	pool->entries++;
+	return copy;
+}
+
+void _alpm_strpool_free(_alpm_strpool_t *pool)
+{
+	struct strpool_slab *slab, *next;
+	if(pool == NULL) {
+		return;
+	}
+	for(slab = pool->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	free(pool->table);
+	free(pool);
+}
@@ -0,0 +1,35 @@
+/*
+ *  strpool.h
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_STRPOOL_H
+#define ALPM_STRPOOL_H
+
+#include <stddef.h>
+
+/* An interning pool for package metadata strings. Interned strings live
+ * in large shared slabs and are deduplicated, so the heavily repeated
+ * values (arch, licenses, groups, packagers) are stored once per
+ * database instead of once per package. Interned strings are owned by
+ * the pool and valid until _alpm_strpool_free(). */
+typedef struct __alpm_strpool_t _alpm_strpool_t;
+
+_alpm_strpool_t *_alpm_strpool_new(void);
+const char *_alpm_strpool_intern(_alpm_strpool_t *pool, const char *str);
+void _alpm_strpool_free(_alpm_strpool_t *pool);
+
+#endif /* ALPM_STRPOOL_H */
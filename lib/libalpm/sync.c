@@ -46,6 +46,7 @@
 #include "remove.h"
 #include "diskspace.h"
 #include "signing.h"
+#include "thread.h"
 
 struct keyinfo_t {
        char* uid;
@@ -196,10 +197,55 @@ static alpm_list_t *check_replacers(alpm_handle_t *handle, alpm_pkg_t *lpkg,
 	return replacers;
 }
 
+/* Does any package in sdb carry a Replaces entry literally matching
+ * lpkg? This is the pure subset of check_replacers(): no ignore checks,
+ * no questions, no mutation, so it is safe to run on worker threads. A
+ * database without a candidate can never produce a replacement. */
+static int has_replacer_candidate(alpm_pkg_t *lpkg, alpm_db_t *sdb)
+{
+	alpm_list_t *k, *l;
+	for(k = _alpm_db_get_pkgcache(sdb); k; k = k->next) {
+		alpm_pkg_t *spkg = k->data;
+		for(l = alpm_pkg_get_replaces(spkg); l; l = l->next) {
+			if(_alpm_depcmp_literal(lpkg, l->data)) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+struct sysupgrade_scan_ctx {
+	alpm_pkg_t **lpkgs;
+	alpm_db_t **sdbs;
+	size_t ndbs;
+	/* both indexed [lpkg * ndbs + sdb] */
+	unsigned char *cand;
+	alpm_pkg_t **literal;
+};
+
+static void sysupgrade_scan_worker(void *ctx, size_t index)
+{
+	struct sysupgrade_scan_ctx *sctx = ctx;
+	alpm_pkg_t *lpkg = sctx->lpkgs[index];
+	size_t j;
+
+	for(j = 0; j < sctx->ndbs; j++) {
+		sctx->cand[index * sctx->ndbs + j] =
+			has_replacer_candidate(lpkg, sctx->sdbs[j]);
+		sctx->literal[index * sctx->ndbs + j] =
+			_alpm_db_get_pkgfromcache(sctx->sdbs[j], lpkg->name);
+	}
+}
+
 int SYMEXPORT alpm_sync_sysupgrade(alpm_handle_t *handle, int enable_downgrade)
 {
 	alpm_list_t *i, *j;
 	alpm_trans_t *trans;
+	alpm_db_t **sdbs = NULL;
+	alpm_pkg_t **lpkgs = NULL, **literal = NULL;
+	unsigned char *cand = NULL;
+	size_t n, count, ndbs = 0, nthreads;
 
 	CHECK_HANDLE(handle, return -1);
 	trans = handle->trans;
@@ -207,8 +253,55 @@ int SYMEXPORT alpm_sync_sysupgrade(alpm_handle_t *handle, int enable_downgrade)
 	ASSERT(trans->state == STATE_INITIALIZED, RET_ERR(handle, ALPM_ERR_TRANS_NOT_INITIALIZED, -1));
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "checking for package upgrades\n");
-	for(i = _alpm_db_get_pkgcache(handle->db_local); i; i = i->next) {
+
+	count = alpm_list_count(_alpm_db_get_pkgcache(handle->db_local));
+	for(j = handle->dbs_sync; j; j = j->next) {
+		alpm_db_t *sdb = j->data;
+		if(sdb->usage & ALPM_DB_USAGE_UPGRADE) {
+			/* warm the cache from this thread; workers only read it */
+			_alpm_db_get_pkgcache(sdb);
+			ndbs++;
+		}
+	}
+
+	/* shard the expensive part of the scan - the per-package replacer
+	 * sweep and literal lookups - across worker threads, then process
+	 * the results in cache order so questions, warnings and target list
+	 * changes happen exactly as in the serial scan */
+	nthreads = _alpm_parallel_nthreads(handle, count);
+	if(nthreads > 1 && ndbs > 0 && count > 0) {
+		MALLOC(sdbs, ndbs * sizeof(*sdbs), goto scan_done);
+		MALLOC(lpkgs, count * sizeof(*lpkgs), goto scan_done);
+		CALLOC(cand, count * ndbs, sizeof(*cand), goto scan_done);
+		CALLOC(literal, count * ndbs, sizeof(*literal), goto scan_done);
+
+		for(j = handle->dbs_sync, n = 0; j; j = j->next) {
+			alpm_db_t *sdb = j->data;
+			if(sdb->usage & ALPM_DB_USAGE_UPGRADE) {
+				sdbs[n++] = sdb;
+			}
+		}
+		for(i = _alpm_db_get_pkgcache(handle->db_local), n = 0; i;
+				i = i->next, n++) {
+			lpkgs[n] = i->data;
+		}
+
+		struct sysupgrade_scan_ctx ctx = { lpkgs, sdbs, ndbs, cand, literal };
+		_alpm_log_defer_begin(handle);
+		_alpm_parallel_for(nthreads, count, sysupgrade_scan_worker, &ctx);
+		_alpm_log_defer_end(handle);
+	}
+scan_done:
+	if(cand == NULL || literal == NULL) {
+		/* allocation failure: fall back to scanning inline */
+		FREE(cand);
+		FREE(literal);
+	}
+
+	for(i = _alpm_db_get_pkgcache(handle->db_local), n = 0; i;
+			i = i->next, n++) {
 		alpm_pkg_t *lpkg = i->data;
+		size_t jn = 0;
 
 		if(alpm_pkg_find(trans->remove, lpkg->name)) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "%s is marked for removal -- skipping\n", lpkg->name);
@@ -223,20 +316,23 @@ int SYMEXPORT alpm_sync_sysupgrade(alpm_handle_t *handle, int enable_downgrade)
 		/* Search for replacers then literal (if no replacer) in each sync database. */
 		for(j = handle->dbs_sync; j; j = j->next) {
 			alpm_db_t *sdb = j->data;
-			alpm_list_t *replacers;
+			alpm_list_t *replacers = NULL;
 
 			if(!(sdb->usage & ALPM_DB_USAGE_UPGRADE)) {
 				continue;
 			}
 
 			/* Check sdb */
-			replacers = check_replacers(handle, lpkg, sdb);
+			if(cand == NULL || cand[n * ndbs + jn]) {
+				replacers = check_replacers(handle, lpkg, sdb);
+			}
 			if(replacers) {
 				trans->add = alpm_list_join(trans->add, replacers);
 				/* jump to next local package */
 				break;
 			} else {
-				alpm_pkg_t *spkg = _alpm_db_get_pkgfromcache(sdb, lpkg->name);
+				alpm_pkg_t *spkg = literal ? literal[n * ndbs + jn]
+						: _alpm_db_get_pkgfromcache(sdb, lpkg->name);
 				if(spkg) {
 					if(check_literal(handle, lpkg, spkg, enable_downgrade)) {
 						trans->add = alpm_list_add(trans->add, spkg);
@@ -245,9 +341,15 @@ int SYMEXPORT alpm_sync_sysupgrade(alpm_handle_t *handle, int enable_downgrade)
 					break;
 				}
 			}
+			jn++;
 		}
 	}
 
+	free(sdbs);
+	free(lpkgs);
+	free(cand);
+	free(literal);
+
 	return 0;
 }
 
@@ -423,8 +525,12 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 		   building up a list of packages which could not be resolved. */
 		for(i = trans->add; i; i = i->next) {
 			alpm_pkg_t *pkg = i->data;
-			if(_alpm_resolvedeps(handle, localpkgs, pkg, trans->add,
-						&resolved, remove, data) == -1) {
+			int resolve_ret;
+			TRACE_BEGIN(handle, ALPM_TRACE_RESOLVEDEPS, pkg->name);
+			resolve_ret = _alpm_resolvedeps(handle, localpkgs, pkg, trans->add,
+						&resolved, remove, data);
+			TRACE_END(handle, ALPM_TRACE_RESOLVEDEPS, pkg->name);
+			if(resolve_ret == -1) {
 				unresolvable = alpm_list_add(unresolvable, pkg);
 			}
 			/* Else, [resolved] now additionally contains [pkg] and all of its
@@ -617,7 +723,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 			if(!alpm_pkg_find(trans->remove, rpkg->name)) {
 				alpm_pkg_t *copy;
 				_alpm_log(handle, ALPM_LOG_DEBUG, "adding '%s' to remove list\n", rpkg->name);
-				if(_alpm_pkg_dup(rpkg, &copy) == -1) {
+				if(_alpm_pkg_dup_shared(rpkg, &copy) == -1) {
 					return -1;
 				}
 				trans->remove = alpm_list_add(trans->remove, copy);
@@ -650,7 +756,7 @@ int _alpm_sync_prepare(alpm_handle_t *handle, alpm_list_t **data)
 			ret = -1;
 			goto cleanup;
 		}
-		if(lpkg && _alpm_pkg_dup(lpkg, &spkg->oldpkg) != 0) {
+		if(lpkg && _alpm_pkg_dup_shared(lpkg, &spkg->oldpkg) != 0) {
 			ret = -1;
 			goto cleanup;
 		}
@@ -726,6 +832,80 @@ static int find_dl_candidates(alpm_handle_t *handle, alpm_list_t **files)
 	return 0;
 }
 
+/* per-payload context for the pipelined commit: the trans->add node whose
+ * package the payload delivers */
+struct dload_pipeline {
+	alpm_handle_t *handle;
+	alpm_list_t *node;
+};
+
+/* Runs from the download loop as each package file lands: take over the
+ * streamed digests, then opportunistically verify and load the package
+ * while the remaining payloads are still downloading. Any failure leaves
+ * the target untouched, so the integrity and load phases afterwards
+ * re-examine it and report through the usual event stream; extraction
+ * itself still waits for the file conflict check, which needs every
+ * package loaded. */
+static void download_complete_pipeline(void *ctxp,
+		struct dload_payload *payload, int result)
+{
+	struct dload_pipeline *pipe = ctxp;
+	alpm_handle_t *handle = pipe->handle;
+	alpm_pkg_t *spkg = pipe->node->data, *pkgfile;
+	alpm_siglist_t *siglist = NULL;
+	alpm_errno_t saved_errno = handle->pm_errno;
+	int validation = 0, siglevel;
+
+	if(result != 0) {
+		return;
+	}
+
+	/* hand over digests streamed during the transfer */
+	spkg->dl_md5sum = payload->dl_md5sum;
+	spkg->dl_sha256sum = payload->dl_sha256sum;
+	payload->dl_md5sum = NULL;
+	payload->dl_sha256sum = NULL;
+
+	if(handle->trans->flags & ALPM_TRANS_FLAG_DOWNLOADONLY
+			|| payload->destfile_name == NULL) {
+		return;
+	}
+
+	siglevel = alpm_db_get_siglevel(alpm_pkg_get_db(spkg));
+	if(_alpm_pkg_validate_internal(handle, payload->destfile_name, spkg,
+				siglevel, &siglist, &validation) != 0) {
+		/* missing keys and damaged files go through check_validity() later */
+		alpm_siglist_cleanup(siglist);
+		free(siglist);
+		handle->pm_errno = saved_errno;
+		return;
+	}
+	alpm_siglist_cleanup(siglist);
+	free(siglist);
+	spkg->validation = validation;
+
+	pkgfile = _alpm_pkg_load_internal(handle, payload->destfile_name, 1);
+	if(pkgfile == NULL) {
+		handle->pm_errno = saved_errno;
+		return;
+	}
+	if(strcmp(spkg->name, pkgfile->name) != 0
+			|| strcmp(spkg->version, pkgfile->version) != 0) {
+		_alpm_pkg_free(pkgfile);
+		return;
+	}
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"pipelined verify and load of %s while downloads continue\n",
+			spkg->name);
+	pkgfile->reason = spkg->reason;
+	pkgfile->validation = spkg->validation;
+	pkgfile->oldpkg = spkg->oldpkg;
+	spkg->oldpkg = NULL;
+	pipe->node->data = pkgfile;
+	_alpm_pkg_free_trans(spkg);
+}
+
 static int download_files(alpm_handle_t *handle)
 {
 	const char *cachedir;
@@ -733,6 +913,8 @@ static int download_files(alpm_handle_t *handle)
 	int errors = 0;
 	alpm_event_t event;
 	alpm_list_t *payloads = NULL;
+	struct dload_pipeline *pipes = NULL;
+	size_t npayloads = 0;
 
 	cachedir = _alpm_filecache_setup(handle);
 	handle->trans->state = STATE_DOWNLOADING;
@@ -780,6 +962,9 @@ static int download_files(alpm_handle_t *handle)
 
 		event.type = ALPM_EVENT_PKG_RETRIEVE_START;
 		EVENT(handle, &event);
+		/* optional; a failed allocation only loses the download/install
+		 * overlap, not the downloads themselves */
+		pipes = calloc(alpm_list_count(files), sizeof(struct dload_pipeline));
 		for(i = files; i; i = i->next) {
 			const alpm_pkg_t *pkg = i->data;
 			struct dload_payload *payload = NULL;
@@ -790,10 +975,27 @@ static int download_files(alpm_handle_t *handle)
 				FREE(payload->remote_name); FREE(payload);
 				GOTO_ERR(handle, ALPM_ERR_MEMORY, finish));
 			payload->max_size = pkg->size;
+			/* unlike the database caps above, pkg->size is the exact
+			 * compressed size, which permits ranged segmentation */
+			payload->content_size = pkg->size;
 			payload->servers = pkg->origin_data.db->servers;
 			payload->handle = handle;
 			payload->allow_resume = 1;
 
+			if(pipes) {
+				alpm_list_t *node = handle->trans->add;
+				while(node && node->data != pkg) {
+					node = node->next;
+				}
+				if(node) {
+					pipes[npayloads].handle = handle;
+					pipes[npayloads].node = node;
+					payload->on_complete = download_complete_pipeline;
+					payload->on_complete_ctx = &pipes[npayloads];
+				}
+			}
+			npayloads++;
+
 			payloads = alpm_list_add(payloads, payload);
 		}
 		event.type = ALPM_EVENT_PKG_RETRIEVE_DONE;
@@ -803,6 +1005,26 @@ static int download_files(alpm_handle_t *handle)
 			_alpm_log(handle, ALPM_LOG_WARNING, _("failed to retrieve some files\n"));
 		}
 		EVENT(handle, &event);
+
+		/* hand digests streamed during download over to the packages so
+		 * integrity checking can skip re-reading the files; the payload
+		 * list was built from 'files' so the two run in lockstep */
+		{
+			alpm_list_t *j;
+			for(i = files, j = payloads; i && j; i = i->next, j = j->next) {
+				alpm_pkg_t *pkg = i->data;
+				struct dload_payload *payload = j->data;
+				if(!payload->dl_md5sum && !payload->dl_sha256sum) {
+					/* failed transfer, or the pipeline hook already took the
+					 * digests and replaced (freed) the package behind 'pkg' */
+					continue;
+				}
+				pkg->dl_md5sum = payload->dl_md5sum;
+				pkg->dl_sha256sum = payload->dl_sha256sum;
+				payload->dl_md5sum = NULL;
+				payload->dl_sha256sum = NULL;
+			}
+		}
 	}
 
 finish:
@@ -814,6 +1036,7 @@ finish:
 	if(files) {
 		alpm_list_free(files);
 	}
+	free(pipes);
 
 	for(i = handle->trans->add; i; i = i->next) {
 		alpm_pkg_t *pkg = i->data;
@@ -902,16 +1125,30 @@ static int check_keyring(alpm_handle_t *handle)
 		event.type = ALPM_EVENT_KEY_DOWNLOAD_START;
 		EVENT(handle, &event);
 		int fail = 0;
+		size_t nkeys = alpm_list_count(errors), n = 0;
+		char **uids, **keyids;
 		alpm_list_t *k;
+		MALLOC(uids, nkeys * sizeof(char *), fail = 1);
+		MALLOC(keyids, nkeys * sizeof(char *), free(uids); uids = NULL; fail = 1);
 		for(k = errors; k; k = k->next) {
 			keyinfo = k->data;
-			if(_alpm_key_import(handle, keyinfo->uid, keyinfo->keyid) == -1) {
-				fail = 1;
+			if(uids && keyids) {
+				uids[n] = keyinfo->uid;
+				keyids[n] = keyinfo->keyid;
+				n++;
 			}
+		}
+		/* import the whole batch at once so the remote lookups overlap */
+		if(uids && keyids && _alpm_key_import_many(handle, n, uids, keyids) == -1) {
+			fail = 1;
+		}
+		for(k = errors; k; k = k->next) {
+			keyinfo = k->data;
 			free(keyinfo->uid);
 			free(keyinfo->keyid);
-
 		}
+		free(uids);
+		free(keyids);
 		event.type = ALPM_EVENT_KEY_DOWNLOAD_DONE;
 		EVENT(handle, &event);
 		if(fail) {
@@ -924,55 +1161,197 @@ static int check_keyring(alpm_handle_t *handle)
 }
 #endif /* HAVE_LIBGPGME */
 
+struct validity {
+	alpm_pkg_t *pkg;
+	alpm_list_t *node;
+	alpm_pkg_t *pkgfile;
+	char *path;
+	alpm_siglist_t *siglist;
+	int siglevel;
+	int validation;
+	int preload;
+	alpm_errno_t error;
+};
+
+struct validity_ctx {
+	alpm_handle_t *handle;
+	struct validity *v;
+	int *results;
+};
+
+/* single-pass integrity + load: read the package archive once, computing
+ * its digests from the raw bytes while building the loaded package. The
+ * validation below then compares the sums instead of re-reading the file,
+ * and load_packages() finds the target already replaced. A failed load
+ * simply leaves the slow paths to re-read and report as they always have. */
+static void preload_with_digests(alpm_handle_t *handle, struct validity *v)
+{
+	char *md5sum, *sha256sum;
+
+	v->pkgfile = _alpm_pkg_load_digests(handle, v->path, 1, &md5sum, &sha256sum);
+	if(v->pkgfile == NULL) {
+		return;
+	}
+	v->pkg->dl_md5sum = md5sum;
+	v->pkg->dl_sha256sum = sha256sum;
+}
+
+/* worker for the parallel integrity check; entries with a NULL pkg have
+ * nothing to verify. Events and pm_errno are handled by the caller. */
+static void check_validity_worker(void *ctx, size_t index)
+{
+	struct validity_ctx *vctx = ctx;
+	struct validity *v = &vctx->v[index];
+
+	if(v->pkg == NULL) {
+		return;
+	}
+	if(v->preload) {
+		preload_with_digests(vctx->handle, v);
+	}
+	vctx->results[index] = _alpm_pkg_validate_internal(vctx->handle, v->path,
+			v->pkg, v->siglevel, &v->siglist, &v->validation);
+}
+
 static int check_validity(alpm_handle_t *handle,
 		size_t total, uint64_t total_bytes)
 {
-	struct validity {
-		alpm_pkg_t *pkg;
-		char *path;
-		alpm_siglist_t *siglist;
-		int siglevel;
-		int validation;
-		alpm_errno_t error;
-	};
-	size_t current = 0;
+	size_t current = 0, count, n, nthreads = 1;
 	uint64_t current_bytes = 0;
 	alpm_list_t *i, *errors = NULL;
 	alpm_event_t event;
+	struct validity *v = NULL;
+	int *results = NULL;
 
 	/* Check integrity of packages */
 	event.type = ALPM_EVENT_INTEGRITY_START;
 	EVENT(handle, &event);
 
-	for(i = handle->trans->add; i; i = i->next, current++) {
-		struct validity v = { i->data, NULL, NULL, 0, 0, 0 };
-		int percent = (int)(((double)current_bytes / total_bytes) * 100);
+	count = alpm_list_count(handle->trans->add);
+	if(count == 0) {
+		goto done;
+	}
+	CALLOC(v, count, sizeof(struct validity),
+			RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	CALLOC(results, count, sizeof(int),
+			free(v); RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+
+	/* gather paths and signature levels up front so workers never touch
+	 * handle state */
+	for(i = handle->trans->add, n = 0; i; i = i->next, n++) {
+		alpm_pkg_t *pkg = i->data;
+		if(pkg->origin == ALPM_PKG_FROM_FILE) {
+			/* pkg_load() has been already called, this package is valid */
+			continue;
+		}
+		v[n].pkg = pkg;
+		v[n].node = i;
+		v[n].path = _alpm_filecache_find(handle, pkg->filename);
+		v[n].siglevel = alpm_db_get_siglevel(alpm_pkg_get_db(pkg));
+		/* the load phase will read this file anyway; combining it with the
+		 * digest computation turns three file reads into one. Packages that
+		 * came down this transaction already carry streamed digests. */
+		v[n].preload = !(handle->trans->flags & ALPM_TRANS_FLAG_DOWNLOADONLY)
+				&& pkg->dl_md5sum == NULL && pkg->dl_sha256sum == NULL;
+	}
 
-		PROGRESS(handle, ALPM_PROGRESS_INTEGRITY_START, "", percent,
-				total, current);
-		if(v.pkg->origin == ALPM_PKG_FROM_FILE) {
-			continue; /* pkg_load() has been already called, this package is valid */
+	/* the one-time signing backend setup belongs on this thread, where it
+	 * is traced, rather than raced for inside the workers */
+	for(n = 0; n < count; n++) {
+		if(v[n].pkg && (v[n].siglevel & ALPM_SIG_PACKAGE)) {
+			_alpm_signing_prepare(handle);
+			break;
 		}
+	}
 
-		current_bytes += v.pkg->size;
-		v.path = _alpm_filecache_find(handle, v.pkg->filename);
-		v.siglevel = alpm_db_get_siglevel(alpm_pkg_get_db(v.pkg));
+	nthreads = _alpm_parallel_nthreads(handle, count);
+	if(nthreads > 1) {
+		struct validity_ctx ctx = { handle, v, results };
+		_alpm_log_defer_begin(handle);
+		_alpm_parallel_for(nthreads, count, check_validity_worker, &ctx);
+		_alpm_log_defer_end(handle);
+		/* deliver progress in order now that the work is done */
+		for(n = 0; n < count; n++, current++) {
+			int percent = (int)(((double)current_bytes / total_bytes) * 100);
+			PROGRESS(handle, ALPM_PROGRESS_INTEGRITY_START, "", percent,
+					total, current);
+			if(v[n].pkg) {
+				current_bytes += v[n].pkg->size;
+			}
+		}
+	} else {
+		for(n = 0; n < count; n++, current++) {
+			int percent = (int)(((double)current_bytes / total_bytes) * 100);
+			PROGRESS(handle, ALPM_PROGRESS_INTEGRITY_START, "", percent,
+					total, current);
+			if(v[n].pkg == NULL) {
+				continue;
+			}
+			current_bytes += v[n].pkg->size;
+			if(v[n].preload) {
+				preload_with_digests(handle, &v[n]);
+			}
+			results[n] = _alpm_pkg_validate_internal(handle, v[n].path, v[n].pkg,
+					v[n].siglevel, &v[n].siglist, &v[n].validation);
+			if(results[n] == -1) {
+				v[n].error = handle->pm_errno;
+			}
+		}
+	}
 
-		if(_alpm_pkg_validate_internal(handle, v.path, v.pkg,
-					v.siglevel, &v.siglist, &v.validation) == -1) {
+	for(n = 0; n < count; n++) {
+		if(v[n].pkg == NULL) {
+			continue;
+		}
+		if(results[n] == 0) {
+			alpm_siglist_cleanup(v[n].siglist);
+			free(v[n].siglist);
+			free(v[n].path);
+			v[n].pkg->validation = v[n].validation;
+			if(v[n].pkgfile) {
+				alpm_pkg_t *spkg = v[n].pkg;
+				if(strcmp(spkg->name, v[n].pkgfile->name) == 0
+						&& strcmp(spkg->version, v[n].pkgfile->version) == 0) {
+					_alpm_log(handle, ALPM_LOG_DEBUG,
+							"replacing pkgcache entry with preloaded package file for target %s\n",
+							spkg->name);
+					v[n].pkgfile->reason = spkg->reason;
+					v[n].pkgfile->validation = spkg->validation;
+					v[n].pkgfile->oldpkg = spkg->oldpkg;
+					spkg->oldpkg = NULL;
+					v[n].node->data = v[n].pkgfile;
+					_alpm_pkg_free_trans(spkg);
+				} else {
+					/* load_packages() will hit the same mismatch and report it */
+					_alpm_pkg_free(v[n].pkgfile);
+				}
+			}
+		} else {
 			struct validity *invalid;
-			v.error = handle->pm_errno;
-			MALLOC(invalid, sizeof(struct validity), return -1);
-			memcpy(invalid, &v, sizeof(struct validity));
+			_alpm_pkg_free(v[n].pkgfile);
+			v[n].pkgfile = NULL;
+			if(nthreads > 1) {
+				/* concurrent workers share pm_errno, so re-verify failed
+				 * packages serially to capture an accurate error and siglist;
+				 * failures are rare enough that this costs nothing overall */
+				alpm_siglist_cleanup(v[n].siglist);
+				free(v[n].siglist);
+				v[n].siglist = NULL;
+				_alpm_pkg_validate_internal(handle, v[n].path, v[n].pkg,
+						v[n].siglevel, &v[n].siglist, &v[n].validation);
+				v[n].error = handle->pm_errno;
+			}
+			MALLOC(invalid, sizeof(struct validity),
+					free(results); free(v); RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+			memcpy(invalid, &v[n], sizeof(struct validity));
 			errors = alpm_list_add(errors, invalid);
-		} else {
-			alpm_siglist_cleanup(v.siglist);
-			free(v.siglist);
-			free(v.path);
-			v.pkg->validation = v.validation;
 		}
 	}
 
+	free(results);
+	free(v);
+
+done:
 	PROGRESS(handle, ALPM_PROGRESS_INTEGRITY_START, "", 100,
 			total, current);
 	event.type = ALPM_EVENT_INTEGRITY_DONE;
@@ -980,34 +1359,34 @@ static int check_validity(alpm_handle_t *handle,
 
 	if(errors) {
 		for(i = errors; i; i = i->next) {
-			struct validity *v = i->data;
-			switch(v->error) {
+			struct validity *invalid = i->data;
+			switch(invalid->error) {
 				case ALPM_ERR_PKG_MISSING_SIG:
 					_alpm_log(handle, ALPM_LOG_ERROR,
-							_("%s: missing required signature\n"), v->pkg->name);
+							_("%s: missing required signature\n"), invalid->pkg->name);
 					break;
 				case ALPM_ERR_PKG_INVALID_SIG:
-					_alpm_process_siglist(handle, v->pkg->name, v->siglist,
-							v->siglevel & ALPM_SIG_PACKAGE_OPTIONAL,
-							v->siglevel & ALPM_SIG_PACKAGE_MARGINAL_OK,
-							v->siglevel & ALPM_SIG_PACKAGE_UNKNOWN_OK);
+					_alpm_process_siglist(handle, invalid->pkg->name, invalid->siglist,
+							invalid->siglevel & ALPM_SIG_PACKAGE_OPTIONAL,
+							invalid->siglevel & ALPM_SIG_PACKAGE_MARGINAL_OK,
+							invalid->siglevel & ALPM_SIG_PACKAGE_UNKNOWN_OK);
 					/* fallthrough */
 				case ALPM_ERR_PKG_INVALID_CHECKSUM:
-					prompt_to_delete(handle, v->path, v->error);
+					prompt_to_delete(handle, invalid->path, invalid->error);
 					break;
 				case ALPM_ERR_PKG_NOT_FOUND:
 				case ALPM_ERR_BADPERMS:
 				case ALPM_ERR_PKG_OPEN:
-					_alpm_log(handle, ALPM_LOG_ERROR, _("failed to read file %s: %s\n"), v->path, alpm_strerror(v->error));
+					_alpm_log(handle, ALPM_LOG_ERROR, _("failed to read file %s: %s\n"), invalid->path, alpm_strerror(invalid->error));
 					break;
 				default:
 					/* ignore */
 					break;
 			}
-			alpm_siglist_cleanup(v->siglist);
-			free(v->siglist);
-			free(v->path);
-			free(v);
+			alpm_siglist_cleanup(invalid->siglist);
+			free(invalid->siglist);
+			free(invalid->path);
+			free(invalid);
 		}
 		alpm_list_free(errors);
 
@@ -1161,8 +1540,10 @@ int _alpm_sync_check(alpm_handle_t *handle, alpm_list_t **data)
 		EVENT(handle, &event);
 
 		_alpm_log(handle, ALPM_LOG_DEBUG, "looking for file conflicts\n");
+		TRACE_BEGIN(handle, ALPM_TRACE_FILECONFLICTS, NULL);
 		alpm_list_t *conflict = _alpm_db_find_fileconflicts(handle,
 				trans->add, trans->remove);
+		TRACE_END(handle, ALPM_TRACE_FILECONFLICTS, NULL);
 		if(conflict) {
 			if(data) {
 				*data = conflict;
@@ -0,0 +1,116 @@
+/*
+ *  thread.c
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+/* libalpm */
+#include "thread.h"
+#include "util.h"
+#include "log.h"
+
+struct parallel_state {
+	_alpm_parallel_fn fn;
+	void *ctx;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+};
+
+static void *parallel_worker(void *arg)
+{
+	struct parallel_state *state = arg;
+
+	while(1) {
+		size_t index;
+		pthread_mutex_lock(&state->lock);
+		index = state->next;
+		if(index < state->count) {
+			state->next++;
+		}
+		pthread_mutex_unlock(&state->lock);
+		if(index >= state->count) {
+			break;
+		}
+		state->fn(state->ctx, index);
+	}
+
+	return NULL;
+}
+
+int _alpm_parallel_for(size_t nthreads, size_t count,
+		_alpm_parallel_fn fn, void *ctx)
+{
+	struct parallel_state state;
+	pthread_t *threads = NULL;
+	size_t started = 0, t;
+
+	if(count == 0) {
+		return 0;
+	}
+
+	if(nthreads > count) {
+		nthreads = count;
+	}
+	if(nthreads <= 1) {
+		size_t index;
+		for(index = 0; index < count; index++) {
+			fn(ctx, index);
+		}
+		return 0;
+	}
+
+	state.fn = fn;
+	state.ctx = ctx;
+	state.count = count;
+	state.next = 0;
+	pthread_mutex_init(&state.lock, NULL);
+
+	/* the calling thread acts as one of the workers */
+	MALLOC(threads, (nthreads - 1) * sizeof(pthread_t),
+			parallel_worker(&state); pthread_mutex_destroy(&state.lock); return 0);
+	for(t = 0; t < nthreads - 1; t++) {
+		if(pthread_create(&threads[t], NULL, parallel_worker, &state) != 0) {
+			/* remaining items are picked up by the threads we do have */
+			break;
+		}
+		started++;
+	}
+
+	parallel_worker(&state);
+
+	for(t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	free(threads);
+	pthread_mutex_destroy(&state.lock);
+	return 0;
+}
+
+size_t _alpm_parallel_nthreads(alpm_handle_t *handle, size_t count)
+{
+	size_t nthreads = handle->worker_threads;
+	if(nthreads < 1) {
+		nthreads = 1;
+	}
+	if(nthreads > count) {
+		nthreads = count;
+	}
+	return nthreads;
+}
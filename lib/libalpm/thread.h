@@ -0,0 +1,42 @@
+/*
+ *  thread.h
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_THREAD_H
+#define ALPM_THREAD_H
+
+#include <stddef.h>
+
+#include "handle.h"
+
+/* Worker function invoked once per work item; 'index' identifies the item.
+ * Workers must not touch handle callbacks or pm_errno - deliver events and
+ * errors from the calling thread after _alpm_parallel_for() returns. */
+typedef void (*_alpm_parallel_fn)(void *ctx, size_t index);
+
+/* Run 'fn' for each index in [0, count) across up to 'nthreads' worker
+ * threads, the calling thread included. With nthreads <= 1, or if thread
+ * creation fails, all items run on the calling thread. Returns when every
+ * item has been processed. */
+int _alpm_parallel_for(size_t nthreads, size_t count,
+		_alpm_parallel_fn fn, void *ctx);
+
+/* Number of worker threads to use for a phase of 'count' independent items,
+ * clamped by the handle's worker_threads option. */
+size_t _alpm_parallel_nthreads(alpm_handle_t *handle, size_t count);
+
+#endif /* ALPM_THREAD_H */
@@ -32,6 +32,7 @@
 /* libalpm */
 #include "trans.h"
 #include "alpm_list.h"
+#include "db.h"
 #include "package.h"
 #include "util.h"
 #include "log.h"
@@ -49,6 +50,7 @@ int SYMEXPORT alpm_trans_init(alpm_handle_t *handle, int flags)
 	/* Sanity checks */
 	CHECK_HANDLE(handle, return -1);
 	ASSERT(handle->trans == NULL, RET_ERR(handle, ALPM_ERR_TRANS_NOT_NULL, -1));
+	ASSERT(!handle->readonly, RET_ERR(handle, ALPM_ERR_HANDLE_READONLY, -1));
 
 	/* lock db */
 	if(!(flags & ALPM_TRANS_FLAG_NOLOCK)) {
@@ -58,11 +60,19 @@ int SYMEXPORT alpm_trans_init(alpm_handle_t *handle, int flags)
 	}
 
 	CALLOC(trans, 1, sizeof(alpm_trans_t), RET_ERR(handle, ALPM_ERR_MEMORY, -1));
+	if((trans->arena = _alpm_arena_new()) == NULL) {
+		free(trans);
+		RET_ERR(handle, ALPM_ERR_MEMORY, -1);
+	}
 	trans->flags = flags;
 	trans->state = STATE_INITIALIZED;
 
 	handle->trans = trans;
 
+	/* collect local db journal records for the whole transaction so they
+	 * hit the disk in one append when the transaction is released */
+	_alpm_local_db_journal_batch_begin(handle->db_local);
+
 	return 0;
 }
 
@@ -218,6 +228,10 @@ int SYMEXPORT alpm_trans_commit(alpm_handle_t *handle, alpm_list_t **data)
 		EVENT(handle, (void *)&event);
 		alpm_logaction(handle, ALPM_CALLER_PREFIX, "transaction completed\n");
 		_alpm_hook_run(handle, ALPM_HOOK_POST_TRANSACTION);
+		/* refresh the owner index; failure only disables fast owner lookups */
+		if(_alpm_local_db_owners_rebuild(handle->db_local) != 0) {
+			_alpm_log(handle, ALPM_LOG_DEBUG, "could not rebuild owner index\n");
+		}
 	}
 
 	trans->state = STATE_COMMITED;
@@ -255,9 +269,17 @@ int SYMEXPORT alpm_trans_release(alpm_handle_t *handle)
 
 	int nolock_flag = trans->flags & ALPM_TRANS_FLAG_NOLOCK;
 
+	/* flush the journal records collected during the transaction while
+	 * the db lock is still held */
+	_alpm_local_db_journal_batch_end(handle->db_local);
+
 	_alpm_trans_free(trans);
 	handle->trans = NULL;
 
+	/* make sure the transaction's log entries are on disk before the db
+	 * lock is released */
+	_alpm_logaction_flush(handle);
+
 	/* unlock db */
 	if(!nolock_flag) {
 		_alpm_handle_unlock(handle);
@@ -282,7 +304,9 @@ void _alpm_trans_free(alpm_trans_t *trans)
 	alpm_list_free_inner(trans->remove, (alpm_list_fn_free)_alpm_pkg_free);
 	alpm_list_free(trans->remove);
 
-	FREELIST(trans->skip_remove);
+	/* skip_remove strings live in the arena */
+	alpm_list_free(trans->skip_remove);
+	_alpm_arena_free(trans->arena);
 
 	FREE(trans);
 }
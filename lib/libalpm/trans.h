@@ -24,6 +24,7 @@
 #define ALPM_TRANS_H
 
 #include "alpm.h"
+#include "arena.h"
 
 typedef enum _alpm_transstate_t {
 	STATE_IDLE = 0,
@@ -43,7 +44,12 @@ struct __alpm_trans_t {
 	alpm_list_t *unresolvable;  /* list of (alpm_pkg_t *) */
 	alpm_list_t *add;           /* list of (alpm_pkg_t *) */
 	alpm_list_t *remove;        /* list of (alpm_pkg_t *) */
-	alpm_list_t *skip_remove;   /* list of (char *) */
+	alpm_list_t *skip_remove;   /* list of (char *, arena-owned) */
+	/* backs transaction-lifetime scratch allocations; released wholesale
+	 * by _alpm_trans_free(). Objects handed back to the caller (dep-miss
+	 * and conflict records) must not come from here, they are freed
+	 * individually through the public API. */
+	_alpm_arena_t *arena;
 };
 
 void _alpm_trans_free(alpm_trans_t *trans);
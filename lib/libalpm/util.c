@@ -34,6 +34,11 @@
 #include <fnmatch.h>
 #include <poll.h>
 
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h> /* FICLONE */
+#endif
+
 /* libarchive */
 #include <archive.h>
 #include <archive_entry.h>
@@ -168,6 +173,39 @@ int _alpm_copyfile(const char *src, const char *dest)
 		goto cleanup;
 	}
 
+#ifdef FICLONE
+	/* share the extents instead of copying on CoW filesystems */
+	if(ioctl(out, FICLONE, in) == 0) {
+		ret = 0;
+		goto cleanup;
+	}
+#endif
+
+#if HAVE_COPY_FILE_RANGE
+	/* in-kernel copy; the file offsets advance in lockstep, so on any
+	 * failure the byte loop below simply continues where this left off */
+	{
+		off_t remaining = st.st_size;
+		while(remaining > 0) {
+			ssize_t ncopy = copy_file_range(in, NULL, out, NULL, remaining, 0);
+			if(ncopy < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				break;
+			}
+			if(ncopy == 0) {
+				break;
+			}
+			remaining -= ncopy;
+		}
+		if(remaining == 0) {
+			ret = 0;
+			goto cleanup;
+		}
+	}
+#endif
+
 	/* do the actual file copy */
 	while((nread = read(in, buf, ALPM_BUFFER_SIZE)) > 0 || errno == EINTR) {
 		ssize_t nwrite = 0;
@@ -219,6 +257,40 @@ size_t _alpm_strip_newline(char *str, size_t len)
 
 /* Compression functions */
 
+/* read callback state for _alpm_open_archive_digest(): hashes the raw file
+ * bytes as libarchive pulls them in, so one traversal yields both the
+ * package contents and its checksums */
+struct archive_digest_reader {
+	int fd;
+	struct _alpm_digest_ctx *digest;
+	size_t bufsize;
+	char buf[];
+};
+
+static la_ssize_t archive_digest_read(struct archive UNUSED *a,
+		void *client_data, const void **buffer)
+{
+	struct archive_digest_reader *reader = client_data;
+	ssize_t nread;
+
+	do {
+		nread = read(reader->fd, reader->buf, reader->bufsize);
+	} while(nread == -1 && errno == EINTR);
+
+	if(nread > 0) {
+		_alpm_digest_update(reader->digest, reader->buf, nread);
+	}
+	*buffer = reader->buf;
+	return nread;
+}
+
+static int archive_digest_close(struct archive UNUSED *a, void *client_data)
+{
+	/* the caller owns both the fd and the digest context */
+	free(client_data);
+	return ARCHIVE_OK;
+}
+
 /** Open an archive for reading and perform the necessary boilerplate.
  * This takes care of creating the libarchive 'archive' struct, setting up
  * compression and format options, opening a file descriptor, setting up the
@@ -230,10 +302,12 @@ size_t _alpm_strip_newline(char *str, size_t len)
  * @param buf space for a stat buffer for the given path
  * @param archive pointer to place the created archive object
  * @param error error code to set on failure to open archive
+ * @param digest optional digest context fed with every raw byte read
  * @return -1 on failure, >=0 file descriptor on success
  */
-int _alpm_open_archive(alpm_handle_t *handle, const char *path,
-		struct stat *buf, struct archive **archive, alpm_errno_t error)
+int _alpm_open_archive_digest(alpm_handle_t *handle, const char *path,
+		struct stat *buf, struct archive **archive, alpm_errno_t error,
+		struct _alpm_digest_ctx *digest)
 {
 	int fd;
 	size_t bufsize = ALPM_BUFFER_SIZE;
@@ -246,6 +320,18 @@ int _alpm_open_archive(alpm_handle_t *handle, const char *path,
 	_alpm_archive_read_support_filter_all(*archive);
 	archive_read_support_format_all(*archive);
 
+	/* Ask the decompressor for worker threads when the user has enabled
+	 * them; large zstd packages are decompression-bound. Whether this has
+	 * any effect depends on the libarchive and filter in use, so a refused
+	 * or unknown option is quietly ignored. */
+	if(handle->worker_threads > 1) {
+		char opts[32];
+		snprintf(opts, sizeof(opts), "zstd:threads=%u", handle->worker_threads);
+		if(archive_read_set_options(*archive, opts) != ARCHIVE_OK) {
+			archive_clear_error(*archive);
+		}
+	}
+
 	_alpm_log(handle, ALPM_LOG_DEBUG, "opening archive %s\n", path);
 	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
 	if(fd < 0) {
@@ -265,7 +351,19 @@ int _alpm_open_archive(alpm_handle_t *handle, const char *path,
 	}
 #endif
 
-	if(archive_read_open_fd(*archive, fd, bufsize) != ARCHIVE_OK) {
+	if(digest) {
+		struct archive_digest_reader *reader;
+		MALLOC(reader, sizeof(*reader) + bufsize, goto error);
+		reader->fd = fd;
+		reader->digest = digest;
+		reader->bufsize = bufsize;
+		if(archive_read_open(*archive, reader, NULL,
+					archive_digest_read, archive_digest_close) != ARCHIVE_OK) {
+			_alpm_log(handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
+					path, archive_error_string(*archive));
+			goto error;
+		}
+	} else if(archive_read_open_fd(*archive, fd, bufsize) != ARCHIVE_OK) {
 		_alpm_log(handle, ALPM_LOG_ERROR, _("could not open file %s: %s\n"),
 				path, archive_error_string(*archive));
 		goto error;
@@ -282,6 +380,12 @@ error:
 	RET_ERR(handle, error, -1);
 }
 
+int _alpm_open_archive(alpm_handle_t *handle, const char *path,
+		struct stat *buf, struct archive **archive, alpm_errno_t error)
+{
+	return _alpm_open_archive_digest(handle, path, buf, archive, error, NULL);
+}
+
 /** Unpack a specific file in an archive.
  * @param handle the context handle
  * @param archive the archive to unpack
@@ -450,6 +554,31 @@ ssize_t _alpm_files_in_directory(alpm_handle_t *handle, const char *path,
 	return files;
 }
 
+/** Queue asynchronous readahead for a file's contents.
+ * POSIX_FADV_WILLNEED returns once the requests are batched, so callers
+ * can overlap the cold-cache disk reads with the work leading up to
+ * them. Best-effort; missing files and unsupported platforms are
+ * silently ignored.
+ * @param path the file to prefetch, or NULL for a no-op
+ */
+void _alpm_readahead_file(const char *path)
+{
+#ifdef POSIX_FADV_WILLNEED
+	int fd;
+
+	if(path == NULL) {
+		return;
+	}
+	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
+	if(fd >= 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+#else
+	(void)path;
+#endif
+}
+
 static int should_retry(int errnum)
 {
 	return errnum == EAGAIN
@@ -576,54 +705,55 @@ static void _alpm_reset_signals(void)
  * @param stdin_ctx context to be passed to @a stdin_cb
  * @return 0 on success, 1 on error
  */
-int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
-		_alpm_cb_io stdin_cb, void *stdin_ctx)
-{
+/* parent-side state for one child of a chroot batch */
+struct chroot_child {
+	struct _alpm_chroot_job *job;
 	pid_t pid;
-	int child2parent_pipefd[2], parent2child_pipefd[2];
-	int cwdfd;
-	int retval = 0;
+	int child2parent; /* -1 once closed */
+	int parent2child;
+	char obuf[PIPE_BUF]; /* writes <= PIPE_BUF are guaranteed atomic */
+	char ibuf[LINE_MAX];
+	ssize_t olen, ilen;
+};
 
 #define HEAD 1
 #define TAIL 0
 
-	/* save the cwd so we can restore it later */
-	OPEN(cwdfd, ".", O_RDONLY | O_CLOEXEC);
-	if(cwdfd < 0) {
-		_alpm_log(handle, ALPM_LOG_ERROR, _("could not get current working directory\n"));
-	}
-
-	/* just in case our cwd was removed in the upgrade operation */
-	if(chdir(handle->root) != 0) {
-		_alpm_log(handle, ALPM_LOG_ERROR, _("could not change directory to %s (%s)\n"),
-				handle->root, strerror(errno));
-		goto cleanup;
-	}
+/* Fork and exec one job under the chroot; the caller has already changed
+ * into handle->root. Parent-side pipe ends are close-on-exec so children
+ * spawned later in the batch do not hold them open. */
+static int chroot_child_spawn(alpm_handle_t *handle, struct chroot_child *child)
+{
+	int child2parent_pipefd[2], parent2child_pipefd[2];
+	pid_t pid;
 
 	_alpm_log(handle, ALPM_LOG_DEBUG, "executing \"%s\" under chroot \"%s\"\n",
-			cmd, handle->root);
+			child->job->cmd, handle->root);
 
 	/* Flush open fds before fork() to avoid cloning buffers */
 	fflush(NULL);
 
-	if(socketpair(AF_UNIX, SOCK_STREAM, 0, child2parent_pipefd) == -1) {
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, child2parent_pipefd) == -1) {
 		_alpm_log(handle, ALPM_LOG_ERROR, _("could not create pipe (%s)\n"), strerror(errno));
-		retval = 1;
-		goto cleanup;
+		return -1;
 	}
 
-	if(socketpair(AF_UNIX, SOCK_STREAM, 0, parent2child_pipefd) == -1) {
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, parent2child_pipefd) == -1) {
 		_alpm_log(handle, ALPM_LOG_ERROR, _("could not create pipe (%s)\n"), strerror(errno));
-		retval = 1;
-		goto cleanup;
+		close(child2parent_pipefd[TAIL]);
+		close(child2parent_pipefd[HEAD]);
+		return -1;
 	}
 
 	/* fork- parent and child each have separate code blocks below */
 	pid = fork();
 	if(pid == -1) {
 		_alpm_log(handle, ALPM_LOG_ERROR, _("could not fork a new process (%s)\n"), strerror(errno));
-		retval = 1;
-		goto cleanup;
+		close(child2parent_pipefd[TAIL]);
+		close(child2parent_pipefd[HEAD]);
+		close(parent2child_pipefd[TAIL]);
+		close(parent2child_pipefd[HEAD]);
+		return -1;
 	}
 
 	if(pid == 0) {
@@ -638,9 +768,6 @@ int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
 		close(parent2child_pipefd[HEAD]);
 		close(child2parent_pipefd[TAIL]);
 		close(child2parent_pipefd[HEAD]);
-		if(cwdfd >= 0) {
-			close(cwdfd);
-		}
 
 		/* use fprintf instead of _alpm_log to send output through the parent */
 		if(chroot(handle->root) != 0) {
@@ -654,50 +781,105 @@ int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
 		}
 		umask(0022);
 		_alpm_reset_signals();
-		execv(cmd, argv);
+		execv(child->job->cmd, child->job->argv);
 		/* execv only returns if there was an error */
 		fprintf(stderr, _("call to execv failed (%s)\n"), strerror(errno));
 		exit(1);
+	}
+
+	/* this code runs for the parent only */
+	child->pid = pid;
+	child->child2parent = child2parent_pipefd[TAIL];
+	fcntl(child->child2parent, F_SETFL, O_NONBLOCK);
+	close(child2parent_pipefd[HEAD]);
+	close(parent2child_pipefd[TAIL]);
+
+	if(child->job->stdin_cb) {
+		child->parent2child = parent2child_pipefd[HEAD];
+		fcntl(child->parent2child, F_SETFL, O_NONBLOCK);
 	} else {
-		/* this code runs for the parent only (wait on the child) */
-		int status;
-		char obuf[PIPE_BUF]; /* writes <= PIPE_BUF are guaranteed atomic */
-		char ibuf[LINE_MAX];
-		ssize_t olen = 0, ilen = 0;
-		nfds_t nfds = 2;
-		struct pollfd fds[2], *child2parent = &(fds[0]), *parent2child = &(fds[1]);
-		int poll_ret;
-
-		child2parent->fd = child2parent_pipefd[TAIL];
-		child2parent->events = POLLIN;
-		fcntl(child2parent->fd, F_SETFL, O_NONBLOCK);
-		close(child2parent_pipefd[HEAD]);
-		close(parent2child_pipefd[TAIL]);
+		child->parent2child = -1;
+		close(parent2child_pipefd[HEAD]);
+	}
 
-		if(stdin_cb) {
-			parent2child->fd = parent2child_pipefd[HEAD];
-			parent2child->events = POLLOUT;
-			fcntl(parent2child->fd, F_SETFL, O_NONBLOCK);
-		} else {
-			parent2child->fd = -1;
-			parent2child->events = 0;
-			close(parent2child_pipefd[HEAD]);
+	return 0;
+}
+
+/** Execute a batch of commands under the chroot concurrently.
+ * The children run in parallel but all of their output is read and
+ * dispatched from the calling thread, so log and event callbacks are
+ * never invoked concurrently. Per-command exit status is reported in
+ * each job's retval field.
+ * @param handle the context handle
+ * @param count number of jobs
+ * @param jobs the commands to run
+ * @return 0 if every job succeeded, 1 otherwise
+ */
+int _alpm_run_chroot_batch(alpm_handle_t *handle, size_t count,
+		struct _alpm_chroot_job *jobs)
+{
+	struct chroot_child *children = NULL;
+	struct pollfd *fds = NULL;
+	int cwdfd;
+	int retval = 0;
+	size_t n, open_fds;
+
+	/* save the cwd so we can restore it later */
+	OPEN(cwdfd, ".", O_RDONLY | O_CLOEXEC);
+	if(cwdfd < 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not get current working directory\n"));
+	}
+
+	/* just in case our cwd was removed in the upgrade operation */
+	if(chdir(handle->root) != 0) {
+		_alpm_log(handle, ALPM_LOG_ERROR, _("could not change directory to %s (%s)\n"),
+				handle->root, strerror(errno));
+		retval = 1;
+		goto cleanup;
+	}
+
+	CALLOC(children, count, sizeof(struct chroot_child),
+			retval = 1; goto cleanup);
+	MALLOC(fds, 2 * count * sizeof(struct pollfd),
+			FREE(children); retval = 1; goto cleanup);
+
+	open_fds = 0;
+	for(n = 0; n < count; n++) {
+		struct chroot_child *child = &children[n];
+		child->job = &jobs[n];
+		child->pid = -1;
+		if(chroot_child_spawn(handle, child) != 0) {
+			child->child2parent = -1;
+			child->parent2child = -1;
+			child->job->retval = 1;
+			retval = 1;
 		}
+		fds[2 * n].fd = child->child2parent;
+		fds[2 * n].events = POLLIN;
+		fds[2 * n + 1].fd = child->parent2child;
+		fds[2 * n + 1].events = POLLOUT;
+		open_fds += (child->child2parent != -1) + (child->parent2child != -1);
+	}
 
-#define STOP_POLLING(p) do { close(p->fd); p->fd = -1; } while(0)
+#define STOP_POLLING(p) do { close((p)->fd); (p)->fd = -1; open_fds--; } while(0)
 
-		while((child2parent->fd != -1 || parent2child->fd != -1)
-				&& (poll_ret = poll(fds, nfds, -1)) != 0) {
-			if(poll_ret == -1) {
-				if(errno == EINTR) {
-					continue;
-				} else {
-					break;
-				}
+	while(open_fds) {
+		int poll_ret = poll(fds, 2 * count, -1);
+		if(poll_ret == -1) {
+			if(errno == EINTR) {
+				continue;
+			} else {
+				break;
 			}
+		}
+		for(n = 0; n < count; n++) {
+			struct chroot_child *child = &children[n];
+			struct pollfd *child2parent = &fds[2 * n];
+			struct pollfd *parent2child = &fds[2 * n + 1];
+
 			if(child2parent->revents & POLLIN) {
 				if(_alpm_chroot_read_from_child(handle, child2parent->fd,
-							ibuf, &ilen, sizeof(ibuf)) != 0) {
+							child->ibuf, &child->ilen, sizeof(child->ibuf)) != 0) {
 					/* we encountered end-of-file or an error */
 					STOP_POLLING(child2parent);
 				}
@@ -706,8 +888,9 @@ int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
 				STOP_POLLING(child2parent);
 			}
 			if(parent2child->revents & POLLOUT) {
-				if(_alpm_chroot_write_to_child(handle, parent2child->fd, obuf, &olen,
-							sizeof(obuf), stdin_cb, stdin_ctx) != 0) {
+				if(_alpm_chroot_write_to_child(handle, parent2child->fd,
+							child->obuf, &child->olen, sizeof(child->obuf),
+							child->job->stdin_cb, child->job->stdin_ctx) != 0) {
 					STOP_POLLING(parent2child);
 				}
 			} else if(parent2child->revents) {
@@ -715,38 +898,49 @@ int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
 				STOP_POLLING(parent2child);
 			}
 		}
-		/* process anything left in the input buffer */
-		if(ilen) {
-			/* buffer would have already been flushed if it had a newline */
-			strcpy(ibuf + ilen, "\n");
-			_alpm_chroot_process_output(handle, ibuf);
-		}
+	}
 
 #undef STOP_POLLING
-#undef HEAD
-#undef TAIL
 
-		if(parent2child->fd != -1) {
-			close(parent2child->fd);
+	for(n = 0; n < count; n++) {
+		struct chroot_child *child = &children[n];
+		int status;
+
+		if(fds[2 * n].fd != -1) {
+			close(fds[2 * n].fd);
 		}
-		if(child2parent->fd != -1) {
-			close(child2parent->fd);
+		if(fds[2 * n + 1].fd != -1) {
+			close(fds[2 * n + 1].fd);
+		}
+		if(child->pid == -1) {
+			continue;
 		}
 
-		while(waitpid(pid, &status, 0) == -1) {
+		/* process anything left in the input buffer */
+		if(child->ilen) {
+			/* buffer would have already been flushed if it had a newline */
+			strcpy(child->ibuf + child->ilen, "\n");
+			_alpm_chroot_process_output(handle, child->ibuf);
+		}
+
+		while(waitpid(child->pid, &status, 0) == -1) {
 			if(errno != EINTR) {
 				_alpm_log(handle, ALPM_LOG_ERROR, _("call to waitpid failed (%s)\n"), strerror(errno));
-				retval = 1;
-				goto cleanup;
+				child->job->retval = 1;
+				status = -1;
+				break;
 			}
 		}
+		if(status == -1) {
+			continue;
+		}
 
 		/* check the return status, make sure it is 0 (success) */
 		if(WIFEXITED(status)) {
 			_alpm_log(handle, ALPM_LOG_DEBUG, "call to waitpid succeeded\n");
 			if(WEXITSTATUS(status) != 0) {
 				_alpm_log(handle, ALPM_LOG_ERROR, _("command failed to execute correctly\n"));
-				retval = 1;
+				child->job->retval = 1;
 			}
 		} else if(WIFSIGNALED(status) != 0) {
 			char *signal_description = strsignal(WTERMSIG(status));
@@ -756,11 +950,25 @@ int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
 			}
 			_alpm_log(handle, ALPM_LOG_ERROR, _("command terminated by signal %d: %s\n"),
 						WTERMSIG(status), signal_description);
+			child->job->retval = 1;
+		}
+	}
+
+	for(n = 0; n < count; n++) {
+		if(jobs[n].retval != 0) {
 			retval = 1;
 		}
 	}
 
 cleanup:
+	if(retval != 0 && children == NULL) {
+		/* we failed before any child could start */
+		for(n = 0; n < count; n++) {
+			jobs[n].retval = 1;
+		}
+	}
+	free(children);
+	free(fds);
 	if(cwdfd >= 0) {
 		if(fchdir(cwdfd) != 0) {
 			_alpm_log(handle, ALPM_LOG_ERROR,
@@ -772,6 +980,16 @@ cleanup:
 	return retval;
 }
 
+#undef HEAD
+#undef TAIL
+
+int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
+		_alpm_cb_io stdin_cb, void *stdin_ctx)
+{
+	struct _alpm_chroot_job job = { cmd, argv, stdin_cb, stdin_ctx, 0 };
+	return _alpm_run_chroot_batch(handle, 1, &job);
+}
+
 /** Run ldconfig in a chroot.
  * @param handle the context handle
  * @return 0 on success, 1 on error
@@ -808,6 +1026,134 @@ int _alpm_str_cmp(const void *s1, const void *s2)
 	return strcmp(s1, s2);
 }
 
+/* Snapshot of one cachedir's contents, used to answer filecache lookups
+ * without an access()/stat() round trip per candidate directory. Names are
+ * stored in a single buffer and looked up via a sorted pointer array. */
+struct filecache_index_dir {
+	char *names;     /* nul-separated name storage */
+	char **sorted;   /* name pointers sorted for bsearch */
+	size_t count;
+	int complete;    /* 0 if the directory could not be fully read */
+};
+
+static void filecache_index_dir_free(struct filecache_index_dir *dir)
+{
+	if(dir) {
+		free(dir->names);
+		free(dir->sorted);
+		free(dir);
+	}
+}
+
+static int filecache_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static struct filecache_index_dir *filecache_index_dir_new(
+		alpm_handle_t *handle, const char *path)
+{
+	struct filecache_index_dir *dir;
+	struct dirent *ent;
+	DIR *dirp;
+	size_t used = 0, capacity = 8192;
+	size_t n;
+
+	CALLOC(dir, 1, sizeof(struct filecache_index_dir), return NULL);
+
+	if((dirp = opendir(path)) == NULL) {
+		/* missing or unreadable dirs fall back to per-file stat calls */
+		_alpm_log(handle, ALPM_LOG_DEBUG,
+				"could not read cachedir for index: %s\n", path);
+		return dir;
+	}
+
+	MALLOC(dir->names, capacity, closedir(dirp);
+			filecache_index_dir_free(dir); return NULL);
+
+	errno = 0;
+	while((ent = readdir(dirp)) != NULL) {
+		size_t len = strlen(ent->d_name) + 1;
+		if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+			continue;
+		}
+		while(used + len > capacity) {
+			char *newnames = realloc(dir->names, capacity * 2);
+			if(newnames == NULL) {
+				closedir(dirp);
+				filecache_index_dir_free(dir);
+				return NULL;
+			}
+			dir->names = newnames;
+			capacity *= 2;
+		}
+		memcpy(dir->names + used, ent->d_name, len);
+		used += len;
+		dir->count++;
+		errno = 0;
+	}
+	if(errno != 0) {
+		closedir(dirp);
+		filecache_index_dir_free(dir);
+		return NULL;
+	}
+	closedir(dirp);
+
+	if(dir->count) {
+		char *name = dir->names;
+		MALLOC(dir->sorted, dir->count * sizeof(char *),
+				filecache_index_dir_free(dir); return NULL);
+		for(n = 0; n < dir->count; n++) {
+			dir->sorted[n] = name;
+			name += strlen(name) + 1;
+		}
+		qsort(dir->sorted, dir->count, sizeof(char *), filecache_name_cmp);
+	}
+	dir->complete = 1;
+
+	_alpm_log(handle, ALPM_LOG_DEBUG,
+			"indexed cachedir %s (%zu entries)\n", path, dir->count);
+	return dir;
+}
+
+static int filecache_index_build(alpm_handle_t *handle)
+{
+	alpm_list_t *i;
+
+	for(i = handle->cachedirs; i; i = i->next) {
+		struct filecache_index_dir *dir =
+			filecache_index_dir_new(handle, i->data);
+		if(dir == NULL) {
+			_alpm_filecache_invalidate(handle);
+			return -1;
+		}
+		handle->filecache_index = alpm_list_add(handle->filecache_index, dir);
+	}
+	handle->filecache_index_valid = 1;
+	return 0;
+}
+
+static int filecache_index_dir_contains(struct filecache_index_dir *dir,
+		const char *filename)
+{
+	return bsearch(&filename, dir->sorted, dir->count, sizeof(char *),
+			filecache_name_cmp) != NULL;
+}
+
+/** Drop the cachedir contents index; it is rebuilt on the next lookup.
+ * Called whenever files are added to a cachedir or the cachedir list
+ * changes.
+ * @param handle the context handle
+ */
+void _alpm_filecache_invalidate(alpm_handle_t *handle)
+{
+	alpm_list_free_inner(handle->filecache_index,
+			(alpm_list_fn_free)filecache_index_dir_free);
+	alpm_list_free(handle->filecache_index);
+	handle->filecache_index = NULL;
+	handle->filecache_index_valid = 0;
+}
+
 /** Find a filename in a registered alpm cachedir.
  * @param handle the context handle
  * @param filename name of file to find
@@ -817,11 +1163,26 @@ char *_alpm_filecache_find(alpm_handle_t *handle, const char *filename)
 {
 	char path[PATH_MAX];
 	char *retpath;
-	alpm_list_t *i;
+	alpm_list_t *i, *idx;
 	struct stat buf;
 
-	/* Loop through the cache dirs until we find a matching file */
+	if(!handle->filecache_index_valid) {
+		filecache_index_build(handle);
+	}
+
+	/* Loop through the cache dirs until we find a matching file. The index
+	 * skips directories that are known not to hold the file; hits are still
+	 * confirmed with a stat so a stale index can never produce a false
+	 * positive. */
+	idx = handle->filecache_index;
 	for(i = handle->cachedirs; i; i = i->next) {
+		struct filecache_index_dir *dir = idx ? idx->data : NULL;
+		if(idx) {
+			idx = idx->next;
+		}
+		if(dir && dir->complete && !filecache_index_dir_contains(dir, filename)) {
+			continue;
+		}
 		snprintf(path, PATH_MAX, "%s%s", (char *)i->data,
 				filename);
 		if(stat(path, &buf) == 0 && S_ISREG(buf.st_mode)) {
@@ -887,6 +1248,35 @@ const char *_alpm_filecache_setup(alpm_handle_t *handle)
 }
 
 #if defined  HAVE_LIBSSL || defined HAVE_LIBNETTLE
+/* Whole-file hashing is fed to the crypto backend's runtime-dispatched
+ * block kernels (SHA-NI, AVX2, ARMv8 crypto where the backend supports
+ * them); keep those kernels busy with large cacheline-aligned reads
+ * instead of BUFSIZ-sized chunks. */
+#define HASH_BUFFER_SIZE (256 * 1024)
+
+static unsigned char *hash_buffer_new(void)
+{
+	void *buf;
+
+	if(posix_memalign(&buf, 64, HASH_BUFFER_SIZE) != 0) {
+		return NULL;
+	}
+	return buf;
+}
+
+static int hash_file_open(const char *path)
+{
+	int fd;
+
+	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
+#ifdef POSIX_FADV_SEQUENTIAL
+	if(fd >= 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
+	return fd;
+}
+
 /** Compute the MD5 message digest of a file.
  * @param path file path of file to compute  MD5 digest of
  * @param output string to hold computed MD5 digest
@@ -903,10 +1293,11 @@ static int md5_file(const char *path, unsigned char output[16])
 	ssize_t n;
 	int fd;
 
-	MALLOC(buf, (size_t)ALPM_BUFFER_SIZE, return 1);
+	if((buf = hash_buffer_new()) == NULL) {
+		return 1;
+	}
 
-	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
-	if(fd < 0) {
+	if((fd = hash_file_open(path)) < 0) {
 		free(buf);
 		return 1;
 	}
@@ -917,7 +1308,7 @@ static int md5_file(const char *path, unsigned char output[16])
 	md5_init(&ctx);
 #endif
 
-	while((n = read(fd, buf, ALPM_BUFFER_SIZE)) > 0 || errno == EINTR) {
+	while((n = read(fd, buf, HASH_BUFFER_SIZE)) > 0 || errno == EINTR) {
 		if(n < 0) {
 			continue;
 		}
@@ -959,10 +1350,11 @@ static int sha256_file(const char *path, unsigned char output[32])
 	ssize_t n;
 	int fd;
 
-	MALLOC(buf, (size_t)ALPM_BUFFER_SIZE, return 1);
+	if((buf = hash_buffer_new()) == NULL) {
+		return 1;
+	}
 
-	OPEN(fd, path, O_RDONLY | O_CLOEXEC);
-	if(fd < 0) {
+	if((fd = hash_file_open(path)) < 0) {
 		free(buf);
 		return 1;
 	}
@@ -973,7 +1365,7 @@ static int sha256_file(const char *path, unsigned char output[32])
 	sha256_init(&ctx);
 #endif
 
-	while((n = read(fd, buf, ALPM_BUFFER_SIZE)) > 0 || errno == EINTR) {
+	while((n = read(fd, buf, HASH_BUFFER_SIZE)) > 0 || errno == EINTR) {
 		if(n < 0) {
 			continue;
 		}
@@ -1083,6 +1475,105 @@ int _alpm_test_checksum(const char *filepath, const char *expected,
 	return ret;
 }
 
+#if defined  HAVE_LIBSSL || defined HAVE_LIBNETTLE
+struct _alpm_digest_ctx {
+#if HAVE_LIBSSL
+	MD5_CTX md5;
+	SHA256_CTX sha256;
+#else /* HAVE_LIBNETTLE */
+	struct md5_ctx md5;
+	struct sha256_ctx sha256;
+#endif
+};
+
+_alpm_digest_ctx_t *_alpm_digest_new(void)
+{
+	_alpm_digest_ctx_t *ctx;
+	CALLOC(ctx, 1, sizeof(*ctx), return NULL);
+#if HAVE_LIBSSL
+	MD5_Init(&ctx->md5);
+	SHA256_Init(&ctx->sha256);
+#else /* HAVE_LIBNETTLE */
+	md5_init(&ctx->md5);
+	sha256_init(&ctx->sha256);
+#endif
+	return ctx;
+}
+
+void _alpm_digest_update(_alpm_digest_ctx_t *ctx, const void *data, size_t len)
+{
+	if(ctx == NULL || len == 0) {
+		return;
+	}
+#if HAVE_LIBSSL
+	MD5_Update(&ctx->md5, data, len);
+	SHA256_Update(&ctx->sha256, data, len);
+#else /* HAVE_LIBNETTLE */
+	md5_update(&ctx->md5, len, data);
+	sha256_update(&ctx->sha256, len, data);
+#endif
+}
+
+/** Finish a streaming digest and return both sums in hexadecimal.
+ * The context is freed in all cases.
+ * @return 0 on success, -1 on error with both outputs set to NULL
+ */
+int _alpm_digest_final(_alpm_digest_ctx_t *ctx, char **md5sum, char **sha256sum)
+{
+	unsigned char md5[16], sha256[32];
+
+	*md5sum = NULL;
+	*sha256sum = NULL;
+	if(ctx == NULL) {
+		return -1;
+	}
+#if HAVE_LIBSSL
+	MD5_Final(md5, &ctx->md5);
+	SHA256_Final(sha256, &ctx->sha256);
+#else /* HAVE_LIBNETTLE */
+	md5_digest(&ctx->md5, MD5_DIGEST_SIZE, md5);
+	sha256_digest(&ctx->sha256, SHA256_DIGEST_SIZE, sha256);
+#endif
+	free(ctx);
+
+	*md5sum = hex_representation(md5, 16);
+	*sha256sum = hex_representation(sha256, 32);
+	if(*md5sum == NULL || *sha256sum == NULL) {
+		FREE(*md5sum);
+		FREE(*sha256sum);
+		return -1;
+	}
+	return 0;
+}
+
+void _alpm_digest_free(_alpm_digest_ctx_t *ctx)
+{
+	free(ctx);
+}
+#else /* no usable crypto backend */
+_alpm_digest_ctx_t *_alpm_digest_new(void)
+{
+	return NULL;
+}
+
+void _alpm_digest_update(_alpm_digest_ctx_t UNUSED *ctx,
+		const void UNUSED *data, size_t UNUSED len)
+{
+}
+
+int _alpm_digest_final(_alpm_digest_ctx_t UNUSED *ctx, char **md5sum,
+		char **sha256sum)
+{
+	*md5sum = NULL;
+	*sha256sum = NULL;
+	return -1;
+}
+
+void _alpm_digest_free(_alpm_digest_ctx_t UNUSED *ctx)
+{
+}
+#endif /* HAVE_LIBSSL || HAVE_LIBNETTLE */
+
 /* Note: does NOT handle sparse files on purpose for speed. */
 /** TODO.
  * Does not handle sparse files on purpose for speed.
@@ -1093,7 +1584,8 @@ int _alpm_test_checksum(const char *filepath, const char *expected,
 int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b)
 {
 	/* ensure we start populating our line buffer at the beginning */
-	b->line_offset = b->line;
+	b->line_offset = b->line_buf;
+	b->line = b->line_buf;
 
 	while(1) {
 		size_t block_remaining;
@@ -1127,17 +1619,36 @@ int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b)
 			eol = memchr(b->block_offset, '\0', block_remaining);
 		}
 
+		/* fast path: a complete line sits inside the current block and no
+		 * partial line is carried over, so terminate it in place and hand
+		 * out a view into the block instead of copying. The block stays
+		 * valid until the next archive_read_data_block() call and nothing
+		 * downstream of the decompressor reads it back. */
+		if(eol && b->line_offset == b->line_buf) {
+			size_t len = (size_t)(eol - b->block_offset);
+			if(len + 1 > b->max_line_size) {
+				b->ret = -ERANGE;
+				goto cleanup;
+			}
+			*eol = '\0';
+			b->line = b->block_offset;
+			b->real_line_size = len;
+			b->block_offset = eol + 1;
+			/* this is the main return point; from here you can read b->line */
+			return ARCHIVE_OK;
+		}
+
 		/* allocate our buffer, or ensure our existing one is big enough */
-		if(!b->line) {
+		if(!b->line_buf) {
 			/* set the initial buffer to the read block_size */
-			CALLOC(b->line, b->block_size + 1, sizeof(char), b->ret = -ENOMEM; goto cleanup);
+			CALLOC(b->line_buf, b->block_size + 1, sizeof(char), b->ret = -ENOMEM; goto cleanup);
 			b->line_size = b->block_size + 1;
-			b->line_offset = b->line;
+			b->line_offset = b->line_buf;
 		} else {
-			/* note: we know eol > b->block_offset and b->line_offset > b->line,
+			/* note: we know eol > b->block_offset and b->line_offset > b->line_buf,
 			 * so we know the result is unsigned and can fit in size_t */
 			size_t new = eol ? (size_t)(eol - b->block_offset) : block_remaining;
-			size_t needed = (size_t)((b->line_offset - b->line) + new + 1);
+			size_t needed = (size_t)((b->line_offset - b->line_buf) + new + 1);
 			if(needed > b->max_line_size) {
 				b->ret = -ERANGE;
 				goto cleanup;
@@ -1146,11 +1657,11 @@ int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b)
 				/* need to realloc + copy data to fit total length */
 				char *new_line;
 				CALLOC(new_line, needed, sizeof(char), b->ret = -ENOMEM; goto cleanup);
-				memcpy(new_line, b->line, b->line_size);
+				memcpy(new_line, b->line_buf, b->line_size);
 				b->line_size = needed;
-				b->line_offset = new_line + (b->line_offset - b->line);
-				free(b->line);
-				b->line = new_line;
+				b->line_offset = new_line + (b->line_offset - b->line_buf);
+				free(b->line_buf);
+				b->line_buf = new_line;
 			}
 		}
 
@@ -1159,7 +1670,8 @@ int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b)
 			memcpy(b->line_offset, b->block_offset, len);
 			b->line_offset[len] = '\0';
 			b->block_offset = eol + 1;
-			b->real_line_size = b->line_offset + len - b->line;
+			b->line = b->line_buf;
+			b->real_line_size = b->line_offset + len - b->line_buf;
 			/* this is the main return point; from here you can read b->line */
 			return ARCHIVE_OK;
 		} else {
@@ -1172,7 +1684,8 @@ int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b)
 			 * returned on next call */
 			if(len == 0) {
 				b->line_offset[0] = '\0';
-				b->real_line_size = b->line_offset - b->line;
+				b->line = b->line_buf;
+				b->real_line_size = b->line_offset - b->line_buf;
 				return ARCHIVE_OK;
 			}
 		}
@@ -1181,7 +1694,7 @@ int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b)
 cleanup:
 	{
 		int ret = b->ret;
-		FREE(b->line);
+		FREE(b->line_buf);
 		*b = (struct archive_read_buffer){0};
 		return ret;
 	}
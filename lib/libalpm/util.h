@@ -102,7 +102,11 @@ void _alpm_alloc_fail(size_t size);
  * Used as a buffer/state holder for _alpm_archive_fgets().
  */
 struct archive_read_buffer {
+	/* the current line; usually a zero-copy view into the archive block,
+	 * valid until the next call. Never free this. */
 	char *line;
+	/* owned storage, only used when a line spans multiple blocks */
+	char *line_buf;
 	char *line_offset;
 	size_t line_size;
 	size_t max_line_size;
@@ -115,6 +119,18 @@ struct archive_read_buffer {
 	int ret;
 };
 
+/* Integer dispatch key for %FIELD% lines in the db entry parsers: the first
+ * two characters of the field plus the line length are unique across every
+ * known field, so a parser can reject all but the right branch with one
+ * integer compare and confirm the match with a single strcmp. */
+#define ALPM_FIELD_KEY(c1, c2, len) \
+	(((unsigned int)(unsigned char)(c1) << 20) \
+	 | ((unsigned int)(unsigned char)(c2) << 12) \
+	 | (unsigned int)(len))
+#define ALPM_FIELD_LIT(s) ALPM_FIELD_KEY((s)[1], (s)[2], sizeof(s) - 1)
+#define ALPM_FIELD_MATCH(line, key, s) \
+	((key) == ALPM_FIELD_LIT(s) && strcmp(line, s) == 0)
+
 int _alpm_makepath(const char *path);
 int _alpm_makepath_mode(const char *path, mode_t mode);
 int _alpm_copyfile(const char *src, const char *dest);
@@ -122,24 +138,53 @@ size_t _alpm_strip_newline(char *str, size_t len);
 
 int _alpm_open_archive(alpm_handle_t *handle, const char *path,
 		struct stat *buf, struct archive **archive, alpm_errno_t error);
+/* as _alpm_open_archive(), but when digest is non-NULL every raw byte read
+ * from the file is fed into it, so callers can hash the package while
+ * traversing it instead of re-reading the file afterwards */
+struct _alpm_digest_ctx;
+int _alpm_open_archive_digest(alpm_handle_t *handle, const char *path,
+		struct stat *buf, struct archive **archive, alpm_errno_t error,
+		struct _alpm_digest_ctx *digest);
 int _alpm_unpack_single(alpm_handle_t *handle, const char *archive,
 		const char *prefix, const char *filename);
 int _alpm_unpack(alpm_handle_t *handle, const char *archive, const char *prefix,
 		alpm_list_t *list, int breakfirst);
 
 ssize_t _alpm_files_in_directory(alpm_handle_t *handle, const char *path, int full_count);
+void _alpm_readahead_file(const char *path);
 
 typedef ssize_t (*_alpm_cb_io)(void *buf, ssize_t len, void *ctx);
 
+/* one command in a _alpm_run_chroot_batch() invocation */
+struct _alpm_chroot_job {
+	const char *cmd;
+	char *const *argv;
+	_alpm_cb_io stdin_cb;
+	void *stdin_ctx;
+	int retval;
+};
+
 int _alpm_run_chroot(alpm_handle_t *handle, const char *cmd, char *const argv[],
 		_alpm_cb_io in_cb, void *in_ctx);
+int _alpm_run_chroot_batch(alpm_handle_t *handle, size_t count,
+		struct _alpm_chroot_job *jobs);
 int _alpm_ldconfig(alpm_handle_t *handle);
 int _alpm_str_cmp(const void *s1, const void *s2);
 char *_alpm_filecache_find(alpm_handle_t *handle, const char *filename);
+void _alpm_filecache_invalidate(alpm_handle_t *handle);
 const char *_alpm_filecache_setup(alpm_handle_t *handle);
 /* Unlike many uses of alpm_pkgvalidation_t, _alpm_test_checksum expects
  * an enum value rather than a bitfield. */
 int _alpm_test_checksum(const char *filepath, const char *expected, alpm_pkgvalidation_t type);
+/* Streaming MD5 + SHA-256 digester used to hash a download as it is
+ * written, so checksum validation does not have to re-read the file.
+ * _alpm_digest_new() returns NULL when no crypto backend is available;
+ * the other functions accept a NULL context and do nothing. */
+typedef struct _alpm_digest_ctx _alpm_digest_ctx_t;
+_alpm_digest_ctx_t *_alpm_digest_new(void);
+void _alpm_digest_update(_alpm_digest_ctx_t *ctx, const void *data, size_t len);
+int _alpm_digest_final(_alpm_digest_ctx_t *ctx, char **md5sum, char **sha256sum);
+void _alpm_digest_free(_alpm_digest_ctx_t *ctx);
 int _alpm_archive_fgets(struct archive *a, struct archive_read_buffer *b);
 int _alpm_splitname(const char *target, char **name, char **version,
 		unsigned long *name_hash);
@@ -0,0 +1,72 @@
+/*
+ *  vector.c
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+/* libalpm */
+#include "vector.h"
+#include "util.h"
+
+void _alpm_vector_init(_alpm_vector_t *vec)
+{
+	vec->data = NULL;
+	vec->count = 0;
+	vec->capacity = 0;
+}
+
+int _alpm_vector_add(_alpm_vector_t *vec, void *item)
+{
+	if(vec->count == vec->capacity) {
+		size_t newcap = vec->capacity ? vec->capacity * 2 : 8;
+		REALLOC(vec->data, newcap * sizeof(void *), return -1);
+		vec->capacity = newcap;
+	}
+	vec->data[vec->count++] = item;
+	return 0;
+}
+
+void _alpm_vector_sort(_alpm_vector_t *vec,
+		int (*cmp)(const void *, const void *))
+{
+	qsort(vec->data, vec->count, sizeof(void *), cmp);
+}
+
+/* Build an alpm_list_t view of the vector for callers that must hand lists
+ * across API boundaries; the list shares the vector's items. */
+alpm_list_t *_alpm_vector_to_list(const _alpm_vector_t *vec)
+{
+	alpm_list_t *list = NULL;
+	size_t i;
+	for(i = 0; i < vec->count; i++) {
+		list = alpm_list_add(list, vec->data[i]);
+	}
+	return list;
+}
+
+void _alpm_vector_release(_alpm_vector_t *vec, alpm_list_fn_free fn)
+{
+	if(fn) {
+		size_t i;
+		for(i = 0; i < vec->count; i++) {
+			fn(vec->data[i]);
+		}
+	}
+	free(vec->data);
+	_alpm_vector_init(vec);
+}
@@ -0,0 +1,45 @@
+/*
+ *  vector.h
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ALPM_VECTOR_H
+#define ALPM_VECTOR_H
+
+#include <stddef.h>
+
+#include "alpm_list.h"
+
+/* Contiguous pointer array for hot paths where alpm_list_t's heap-scattered
+ * cells cost too many cache misses: counting is O(1), iteration is dense and
+ * items can be sorted or binary searched in place. Items are not owned by
+ * the vector unless a free function is passed at release time. */
+typedef struct __alpm_vector_t {
+	void **data;
+	size_t count;
+	size_t capacity;
+} _alpm_vector_t;
+
+#define VECTOR_INIT { NULL, 0, 0 }
+
+void _alpm_vector_init(_alpm_vector_t *vec);
+int _alpm_vector_add(_alpm_vector_t *vec, void *item);
+void _alpm_vector_sort(_alpm_vector_t *vec,
+		int (*cmp)(const void *, const void *));
+alpm_list_t *_alpm_vector_to_list(const _alpm_vector_t *vec);
+void _alpm_vector_release(_alpm_vector_t *vec, alpm_list_fn_free fn);
+
+#endif /* ALPM_VECTOR_H */
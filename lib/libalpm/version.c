@@ -16,185 +16,179 @@
  */
 
 #include <string.h>
-#include <ctype.h>
 
 /* libalpm */
 #include "util.h"
 
 /**
- * Some functions in this file have been adopted from the rpm source, notably
- * 'rpmvercmp' located at lib/rpmvercmp.c and 'parseEVR' located at
- * lib/rpmds.c. It was most recently updated against rpm version 4.8.1. Small
- * modifications have been made to make it more consistent with the libalpm
- * coding style.
+ * The comparison rules in this file have been adopted from the rpm source,
+ * notably 'rpmvercmp' located at lib/rpmvercmp.c and 'parseEVR' located at
+ * lib/rpmds.c. It was most recently updated against rpm version 4.8.1. The
+ * implementation has since been rewritten to work on bounded spans of the
+ * input strings: provider scans and sysupgrade comparisons call this for
+ * every candidate, and the original's per-call string duplication and
+ * in-place segment termination dominated its profile. The segment ordering
+ * rules are unchanged.
  */
 
+/* character classes driving the segment scanner; a 256-entry table is both
+ * faster than the ctype calls it replaces and immune to locale surprises */
+enum {
+	VC_OTHER = 0, /* separator; any non-alphanumeric byte */
+	VC_DIGIT,
+	VC_ALPHA
+};
+
+static const unsigned char vc_class[256] = {
+	['0' ... '9'] = VC_DIGIT,
+	['A' ... 'Z'] = VC_ALPHA,
+	['a' ... 'z'] = VC_ALPHA,
+};
+
+#define VC(ch) (vc_class[(unsigned char)(ch)])
+
+/* [epoch:]version[-release] split into read-only spans; release is NULL
+ * when the input carries no release at all */
+struct evr_spans {
+	const char *epoch;
+	const char *version;
+	const char *release;
+	size_t epoch_len;
+	size_t version_len;
+	size_t release_len;
+};
+
 /**
- * Split EVR into epoch, version, and release components.
+ * Split EVR into epoch, version, and release spans without modifying or
+ * copying the input.
  * @param evr		[epoch:]version[-release] string
- * @retval *ep		pointer to epoch
- * @retval *vp		pointer to version
- * @retval *rp		pointer to release
+ * @retval spans	filled with pointers into evr (or the static "0" epoch)
  */
-static void parseEVR(char *evr, const char **ep, const char **vp,
-		const char **rp)
+static void parseEVR(const char *evr, struct evr_spans *spans)
 {
-	const char *epoch;
-	const char *version;
-	const char *release;
-	char *s, *se;
+	const char *s = evr;
+	const char *end = evr + strlen(evr);
+	const char *se;
 
-	s = evr;
 	/* s points to epoch terminator */
-	while (*s && isdigit(*s)) s++;
+	while(s < end && VC(*s) == VC_DIGIT) s++;
 	/* se points to version terminator */
 	se = strrchr(s, '-');
 
-	if(*s == ':') {
-		epoch = evr;
-		*s++ = '\0';
-		version = s;
-		if(*epoch == '\0') {
-			epoch = "0";
+	if(s < end && *s == ':') {
+		spans->epoch = evr;
+		spans->epoch_len = s - evr;
+		spans->version = s + 1;
+		if(spans->epoch_len == 0) {
+			spans->epoch = "0";
+			spans->epoch_len = 1;
 		}
 	} else {
 		/* different from RPM- always assume 0 epoch */
-		epoch = "0";
-		version = evr;
+		spans->epoch = "0";
+		spans->epoch_len = 1;
+		spans->version = evr;
 	}
 	if(se) {
-		*se++ = '\0';
-		release = se;
+		spans->release = se + 1;
+		spans->release_len = end - spans->release;
+		spans->version_len = se - spans->version;
 	} else {
-		release = NULL;
+		spans->release = NULL;
+		spans->release_len = 0;
+		spans->version_len = end - spans->version;
 	}
-
-	if(ep) *ep = epoch;
-	if(vp) *vp = version;
-	if(rp) *rp = release;
 }
 
 /**
- * Compare alpha and numeric segments of two versions.
+ * Compare alpha and numeric segments of two version spans.
  * return 1: a is newer than b
  *        0: a and b are the same version
  *       -1: b is newer than a
  */
-static int rpmvercmp(const char *a, const char *b)
+static int rpmvercmp(const char *a, size_t alen, const char *b, size_t blen)
 {
-	char oldch1, oldch2;
-	char *str1, *str2;
-	char *ptr1, *ptr2;
-	char *one, *two;
-	int rc;
-	int isnum;
-	int ret = 0;
+	const char *one = a, *two = b;
+	const char *aend = a + alen, *bend = b + blen;
+	int one_alpha, two_alpha;
 
 	/* easy comparison to see if versions are identical */
-	if(strcmp(a, b) == 0) return 0;
-
-	str1 = strdup(a);
-	str2 = strdup(b);
+	if(alen == blen && memcmp(a, b, alen) == 0) return 0;
 
-	one = ptr1 = str1;
-	two = ptr2 = str2;
+	/* loop through each version segment of a and b and compare them */
+	while(one < aend && two < bend) {
+		const char *p1 = one, *p2 = two;
+		size_t len1, len2, minlen;
+		int isnum, rc;
 
-	/* loop through each version segment of str1 and str2 and compare them */
-	while (*one && *two) {
-		while (*one && !isalnum((int)*one)) one++;
-		while (*two && !isalnum((int)*two)) two++;
+		while(one < aend && VC(*one) == VC_OTHER) one++;
+		while(two < bend && VC(*two) == VC_OTHER) two++;
 
 		/* If we ran to the end of either, we are finished with the loop */
-		if (!(*one && *two)) break;
+		if(!(one < aend && two < bend)) break;
 
 		/* If the separator lengths were different, we are also finished */
-		if ((one - ptr1) != (two - ptr2)) {
-			ret = (one - ptr1) < (two - ptr2) ? -1 : 1;
-			goto cleanup;
+		if((one - p1) != (two - p2)) {
+			return (one - p1) < (two - p2) ? -1 : 1;
 		}
 
-		ptr1 = one;
-		ptr2 = two;
-
-		/* grab first completely alpha or completely numeric segment */
-		/* leave one and two pointing to the start of the alpha or numeric */
-		/* segment and walk ptr1 and ptr2 to end of segment */
-		if (isdigit((int)*ptr1)) {
-			while (*ptr1 && isdigit((int)*ptr1)) ptr1++;
-			while (*ptr2 && isdigit((int)*ptr2)) ptr2++;
+		/* grab first completely alpha or completely numeric segment;
+		 * one and two stay at the start, p1 and p2 walk to the end */
+		p1 = one;
+		p2 = two;
+		if(VC(*p1) == VC_DIGIT) {
+			while(p1 < aend && VC(*p1) == VC_DIGIT) p1++;
+			while(p2 < bend && VC(*p2) == VC_DIGIT) p2++;
 			isnum = 1;
 		} else {
-			while (*ptr1 && isalpha((int)*ptr1)) ptr1++;
-			while (*ptr2 && isalpha((int)*ptr2)) ptr2++;
+			while(p1 < aend && VC(*p1) == VC_ALPHA) p1++;
+			while(p2 < bend && VC(*p2) == VC_ALPHA) p2++;
 			isnum = 0;
 		}
 
-		/* save character at the end of the alpha or numeric segment */
-		/* so that they can be restored after the comparison */
-		oldch1 = *ptr1;
-		*ptr1 = '\0';
-		oldch2 = *ptr2;
-		*ptr2 = '\0';
-
-		/* this cannot happen, as we previously tested to make sure that */
-		/* the first string has a non-null segment */
-		if (one == ptr1) {
-			ret = -1;	/* arbitrary */
-			goto cleanup;
-		}
-
 		/* take care of the case where the two version segments are */
 		/* different types: one numeric, the other alpha (i.e. empty) */
 		/* numeric segments are always newer than alpha segments */
 		/* XXX See patch #60884 (and details) from bugzilla #50977. */
-		if (two == ptr2) {
-			ret = isnum ? 1 : -1;
-			goto cleanup;
+		if(two == p2) {
+			return isnum ? 1 : -1;
 		}
 
-		if (isnum) {
-			/* this used to be done by converting the digit segments */
-			/* to ints using atoi() - it's changed because long  */
-			/* digit segments can overflow an int - this should fix that. */
-
+		if(isnum) {
 			/* throw away any leading zeros - it's a number, right? */
-			while (*one == '0') one++;
-			while (*two == '0') two++;
+			while(one < p1 && *one == '0') one++;
+			while(two < p2 && *two == '0') two++;
 
 			/* whichever number has more digits wins */
-			if (strlen(one) > strlen(two)) {
-				ret = 1;
-				goto cleanup;
-			}
-			if (strlen(two) > strlen(one)) {
-				ret = -1;
-				goto cleanup;
+			if((p1 - one) != (p2 - two)) {
+				return (p1 - one) > (p2 - two) ? 1 : -1;
 			}
 		}
 
-		/* strcmp will return which one is greater - even if the two */
+		/* an ordinary bytewise comparison decides - even if the two */
 		/* segments are alpha or if they are numeric.  don't return  */
 		/* if they are equal because there might be more segments to */
 		/* compare */
-		rc = strcmp(one, two);
-		if (rc) {
-			ret = rc < 1 ? -1 : 1;
-			goto cleanup;
+		len1 = p1 - one;
+		len2 = p2 - two;
+		minlen = len1 < len2 ? len1 : len2;
+		rc = memcmp(one, two, minlen);
+		if(rc == 0 && len1 != len2) {
+			rc = len1 < len2 ? -1 : 1;
+		}
+		if(rc) {
+			return rc < 0 ? -1 : 1;
 		}
 
-		/* restore character that was replaced by null above */
-		*ptr1 = oldch1;
-		one = ptr1;
-		*ptr2 = oldch2;
-		two = ptr2;
+		one = p1;
+		two = p2;
 	}
 
 	/* this catches the case where all numeric and alpha segments have */
 	/* compared identically but the segment separating characters were */
 	/* different */
-	if ((!*one) && (!*two)) {
-		ret = 0;
-		goto cleanup;
+	if(one == aend && two == bend) {
+		return 0;
 	}
 
 	/* the final showdown. we never want a remaining alpha string to
@@ -203,24 +197,17 @@ static int rpmvercmp(const char *a, const char *b)
 	 * - if one is an alpha, two is newer.
 	 * - otherwise one is newer.
 	 * */
-	if ( (!*one && !isalpha((int)*two))
-			|| isalpha((int)*one) ) {
-		ret = -1;
-	} else {
-		ret = 1;
+	one_alpha = one < aend && VC(*one) == VC_ALPHA;
+	two_alpha = two < bend && VC(*two) == VC_ALPHA;
+	if((one == aend && !two_alpha) || one_alpha) {
+		return -1;
 	}
-
-cleanup:
-	free(str1);
-	free(str2);
-	return ret;
+	return 1;
 }
 
 int SYMEXPORT alpm_pkg_vercmp(const char *a, const char *b)
 {
-	char *full1, *full2;
-	const char *epoch1, *ver1, *rel1;
-	const char *epoch2, *ver2, *rel2;
+	struct evr_spans evr1, evr2;
 	int ret;
 
 	/* ensure our strings are not null */
@@ -239,22 +226,18 @@ int SYMEXPORT alpm_pkg_vercmp(const char *a, const char *b)
 	/* Parse both versions into [epoch:]version[-release] triplets. We probably
 	 * don't need epoch and release to support all the same magic, but it is
 	 * easier to just run it all through the same code. */
-	full1 = strdup(a);
-	full2 = strdup(b);
-
-	/* parseEVR modifies passed in version, so have to dupe it first */
-	parseEVR(full1, &epoch1, &ver1, &rel1);
-	parseEVR(full2, &epoch2, &ver2, &rel2);
+	parseEVR(a, &evr1);
+	parseEVR(b, &evr2);
 
-	ret = rpmvercmp(epoch1, epoch2);
+	ret = rpmvercmp(evr1.epoch, evr1.epoch_len, evr2.epoch, evr2.epoch_len);
 	if(ret == 0) {
-		ret = rpmvercmp(ver1, ver2);
-		if(ret == 0 && rel1 && rel2) {
-			ret = rpmvercmp(rel1, rel2);
+		ret = rpmvercmp(evr1.version, evr1.version_len,
+				evr2.version, evr2.version_len);
+		if(ret == 0 && evr1.release && evr2.release) {
+			ret = rpmvercmp(evr1.release, evr1.release_len,
+					evr2.release, evr2.release_len);
 		}
 	}
 
-	free(full1);
-	free(full2);
 	return ret;
 }
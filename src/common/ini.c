@@ -18,51 +18,60 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <string.h> /* strdup */
+#include <string.h> /* strsep */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ini.h"
 #include "util-common.h"
 
 /**
- * @brief Parse a pacman-style INI config file.
+ * @brief Parse an in-memory INI buffer, modifying it in place.
  *
- * @param file path to the config file
+ * Lines are terminated and trimmed directly inside @a buf, so the key and
+ * value handed to the callback are views into the buffer rather than copies;
+ * the callback must duplicate whatever it wants to keep.
+ *
+ * @param file path of the originating file, passed through to the callback
+ * @param buf writable buffer holding the file contents
+ * @param size number of bytes in @a buf
  * @param cb callback for key/value pairs
  * @param data caller defined data to be passed to the callback
  *
  * @return the callback return value
- *
- * @note The callback will be called at the beginning of each section with an
- * empty key and value and for each key/value pair.
- *
- * @note If the parser encounters an error the callback will be called with
- * section, key, and value set to NULL and errno set by fopen, fgets, or
- * strdup.
- *
- * @note The @a key and @a value passed to @ cb will be overwritten between
- * calls.  The section name will remain valid until after @a cb is called to
- * begin a new section.
- *
- * @note Parsing will immediately stop if the callback returns non-zero.
  */
-int parse_ini(const char *file, ini_parser_fn cb, void *data)
+static int parse_ini_buffer(const char *file, char *buf, size_t size,
+		ini_parser_fn cb, void *data)
 {
-	char line[PATH_MAX], *section_name = NULL;
-	FILE *fp = NULL;
+	char *section_name = NULL, *tail = NULL;
+	size_t offset = 0;
 	int linenum = 0;
 	int ret = 0;
 
-	fp = fopen(file, "r");
-	if(fp == NULL) {
-		return cb(file, 0, NULL, NULL, NULL, data);
-	}
-
-	while(safe_fgets(line, PATH_MAX, fp)) {
+	while(offset < size) {
+		char *line = buf + offset;
+		char *eol = memchr(line, '\n', size - offset);
 		char *key, *value;
 		size_t line_len;
 
+		if(eol) {
+			*eol = '\0';
+			offset = (size_t)(eol - buf) + 1;
+		} else {
+			/* final line without a trailing newline; it may end flush against
+			 * the mapping boundary, so terminate a private copy instead */
+			if((tail = strndup(line, size - offset)) == NULL) {
+				return cb(file, 0, NULL, NULL, NULL, data);
+			}
+			line = tail;
+			offset = size;
+		}
+
 		linenum++;
 
 		line_len = strtrim(line);
@@ -72,16 +81,12 @@ int parse_ini(const char *file, ini_parser_fn cb, void *data)
 		}
 
 		if(line[0] == '[' && line[line_len - 1] == ']') {
-			char *name;
-			/* new config section, skip the '[' */
-			name = strdup(line + 1);
-			name[line_len - 2] = '\0';
-
-			ret = cb(file, linenum, name, NULL, NULL, data);
-			free(section_name);
-			section_name = name;
+			/* new config section, skip the '[' and terminate over the ']' */
+			line[line_len - 1] = '\0';
+			section_name = line + 1;
 
 			/* we're at a new section; perform any post-actions for the prior */
+			ret = cb(file, linenum, section_name, NULL, NULL, data);
 			if(ret) {
 				goto cleanup;
 			}
@@ -102,7 +107,100 @@ int parse_ini(const char *file, ini_parser_fn cb, void *data)
 	}
 
 cleanup:
-	fclose(fp);
-	free(section_name);
+	free(tail);
 	return ret;
 }
+
+/**
+ * @brief Parse a pacman-style INI config file.
+ *
+ * The file is mapped (or, for files mmap cannot handle, read) into memory in
+ * one go and parsed in place, so a config fragmented across many Include
+ * files costs one read syscall and no per-line copies per file.
+ *
+ * @param file path to the config file
+ * @param cb callback for key/value pairs
+ * @param data caller defined data to be passed to the callback
+ *
+ * @return the callback return value
+ *
+ * @note The callback will be called at the beginning of each section with an
+ * empty key and value and for each key/value pair.
+ *
+ * @note If the parser encounters an error the callback will be called with
+ * section, key, and value set to NULL and errno set by open, fstat, read, or
+ * malloc.
+ *
+ * @note The @a key and @a value passed to @ cb will be overwritten between
+ * calls.  The section name will remain valid until after @a cb is called to
+ * begin a new section.
+ *
+ * @note Parsing will immediately stop if the callback returns non-zero.
+ */
+int parse_ini(const char *file, ini_parser_fn cb, void *data)
+{
+	char *buf = MAP_FAILED;
+	struct stat st;
+	size_t size;
+	int fd, ret;
+
+	if((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0) {
+		if(fd >= 0) {
+			close(fd);
+		}
+		return cb(file, 0, NULL, NULL, NULL, data);
+	}
+
+	size = st.st_size;
+	if(S_ISREG(st.st_mode) && size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	if(S_ISREG(st.st_mode)) {
+		/* private mapping so lines can be terminated and trimmed in place */
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	if(buf != MAP_FAILED) {
+		close(fd);
+		ret = parse_ini_buffer(file, buf, size, cb, data);
+		munmap(buf, size);
+		return ret;
+	}
+
+	/* pipes and other special files; slurp them the hard way */
+	{
+		ssize_t nread;
+		size_t total = 0, capacity = size ? size : BUFSIZ;
+
+		if((buf = malloc(capacity)) == NULL) {
+			close(fd);
+			return cb(file, 0, NULL, NULL, NULL, data);
+		}
+		while((nread = read(fd, buf + total, capacity - total)) != 0) {
+			if(nread < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				free(buf);
+				close(fd);
+				return cb(file, 0, NULL, NULL, NULL, data);
+			}
+			total += nread;
+			if(total == capacity) {
+				char *newbuf = realloc(buf, capacity * 2);
+				if(newbuf == NULL) {
+					free(buf);
+					close(fd);
+					return cb(file, 0, NULL, NULL, NULL, data);
+				}
+				buf = newbuf;
+				capacity *= 2;
+			}
+		}
+		close(fd);
+		ret = parse_ini_buffer(file, buf, total, cb, data);
+		free(buf);
+		return ret;
+	}
+}
@@ -50,6 +50,10 @@ static alpm_list_t *output = NULL;
 /* update speed for the fill_progress based functions */
 #define UPDATE_SPEED_MS 200
 
+/* draw at most one progress frame per interval; events that arrive faster
+ * than this only update state and are coalesced into the next frame */
+#define UPDATE_FRAME_MS 50
+
 #if !defined(CLOCK_MONOTONIC_COARSE) && defined(CLOCK_MONOTONIC)
 #define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
 #endif
@@ -113,31 +117,22 @@ static int64_t get_time_ms(void)
 }
 
 /**
- * Silly little helper function, determines if the caller needs a visual update
- * since the last time this function was called.
- * This is made for the two progress bar functions, to prevent flicker.
- * @param first_call 1 on first call for initialization purposes, 0 otherwise
- * @return number of milliseconds since last call
+ * Silly little helper function, determines if the caller should render a new
+ * progress frame. The frame clock is shared by all progress bars so that
+ * rapid event bursts - extraction of many small files, several parallel
+ * downloads - collapse into a fixed redraw rate with one flush per frame.
+ * @return 1 when a frame is due (stamping the clock), 0 to skip the redraw
  */
-static int64_t get_update_timediff(int first_call)
+static int frame_due(void)
 {
-	int64_t retval = 0;
-	static int64_t last_time = 0;
-
-	/* on first call, simply set the last time and return */
-	if(first_call) {
-		last_time = get_time_ms();
-	} else {
-		int64_t this_time = get_time_ms();
-		retval = this_time - last_time;
+	static int64_t last_frame = 0;
+	int64_t this_time = get_time_ms();
 
-		/* do not update last_time if interval was too short */
-		if(retval < 0 || retval >= UPDATE_SPEED_MS) {
-			last_time = this_time;
-		}
+	if(this_time - last_frame >= 0 && this_time - last_frame < UPDATE_FRAME_MS) {
+		return 0;
 	}
-
-	return retval;
+	last_frame = this_time;
+	return 1;
 }
 
 /* refactored from cb_trans_progress */
@@ -554,20 +549,26 @@ void cb_progress(alpm_progress_t event, const char *pkgname, int percent,
 	}
 
 	if(percent == 0) {
-		get_update_timediff(1);
+		/* only the 100% line is mandatory; for a package that completes
+		 * within a frame the initial draw can be coalesced away */
+		if(!frame_due()) {
+			prevpercent = 0;
+			prevcurrent = current;
+			return;
+		}
 	} else if(percent == 100) {
-		/* no need for timediff update, but unconditionally continue unless we
-		 * already completed on a previous call */
+		/* always draw the completed frame so the final numbers are exact,
+		 * unless we already completed on a previous call */
 		if(prevpercent == 100) {
 			return;
 		}
 	} else {
-		if(current != prevcurrent) {
-			/* update always */
-		} else if(!pkgname || percent == prevpercent ||
-				get_update_timediff(0) < UPDATE_SPEED_MS) {
-			/* only update the progress bar when we have a package name, the
-			 * percentage has changed, and it has been long enough. */
+		if(!pkgname || (percent == prevpercent && current == prevcurrent)) {
+			/* nothing changed; skip the event entirely */
+			return;
+		}
+		if(!frame_due()) {
+			/* state is picked up by whichever event renders the next frame */
 			return;
 		}
 	}
@@ -893,6 +894,11 @@ static void dload_progress_event(const char *filename, alpm_download_event_progr
 	bar->total_size = data->total;
 	bar->xfered = data->downloaded;
 
+	if(!frame_due()) {
+		/* coalesce with the other bars; drawn with the next frame */
+		return;
+	}
+
 	cursor_goto_bar(index);
 	draw_pacman_progress_bar(bar);
 	fflush(stdout);
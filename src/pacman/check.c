@@ -18,6 +18,7 @@
  */
 
 #include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <errno.h>
 
@@ -26,8 +27,79 @@
 #include "conf.h"
 #include "util.h"
 
+/* Buffered output for one package so checks can run on worker threads
+ * without interleaving their messages. A NULL buffer prints directly. */
+struct check_line {
+	alpm_loglevel_t level;
+	char *msg;
+};
+
+struct check_output {
+	struct check_line *lines;
+	size_t count;
+	size_t capacity;
+};
+
+__attribute__((format(printf, 3, 4)))
+static void check_printf(struct check_output *out, alpm_loglevel_t level,
+		const char *format, ...)
+{
+	va_list args;
+	char *msg = NULL;
+	int len;
+
+	va_start(args, format);
+	if(out == NULL) {
+		if(level) {
+			pm_vfprintf(stderr, level, format, args);
+		} else {
+			vprintf(format, args);
+		}
+		va_end(args);
+		return;
+	}
+
+	if(level) {
+		len = pm_vasprintf(&msg, level, format, args);
+	} else {
+		len = vasprintf(&msg, format, args);
+	}
+	va_end(args);
+	if(len < 0 || msg == NULL) {
+		/* message allocation failed or was filtered by the logmask */
+		return;
+	}
+
+	if(out->count == out->capacity) {
+		size_t newcap = out->capacity ? out->capacity * 2 : 8;
+		struct check_line *newlines = realloc(out->lines,
+				newcap * sizeof(struct check_line));
+		if(newlines == NULL) {
+			free(msg);
+			return;
+		}
+		out->lines = newlines;
+		out->capacity = newcap;
+	}
+	out->lines[out->count].level = level;
+	out->lines[out->count].msg = msg;
+	out->count++;
+}
+
+static void check_output_flush(struct check_output *out)
+{
+	size_t i;
+	for(i = 0; i < out->count; i++) {
+		fputs(out->lines[i].msg, out->lines[i].level ? stderr : stdout);
+		free(out->lines[i].msg);
+	}
+	free(out->lines);
+	out->lines = NULL;
+	out->count = out->capacity = 0;
+}
+
 static int check_file_exists(const char *pkgname, char *filepath, size_t rootlen,
-		struct stat *st)
+		struct stat *st, struct check_output *out)
 {
 	/* use lstat to prevent errors from symlinks */
 	if(llstat(filepath, st) != 0) {
@@ -36,9 +108,9 @@ static int check_file_exists(const char *pkgname, char *filepath, size_t rootlen
 			return -1;
 		} else {
 			if(config->quiet) {
-				printf("%s %s\n", pkgname, filepath);
+				check_printf(out, 0, "%s %s\n", pkgname, filepath);
 			} else {
-				pm_printf(ALPM_LOG_WARNING, "%s: %s (%s)\n",
+				check_printf(out, ALPM_LOG_WARNING, "%s: %s (%s)\n",
 						pkgname, filepath, strerror(errno));
 			}
 			return 1;
@@ -49,7 +121,7 @@ static int check_file_exists(const char *pkgname, char *filepath, size_t rootlen
 }
 
 static int check_file_type(const char *pkgname, const char *filepath,
-		struct stat *st, struct archive_entry *entry)
+		struct stat *st, struct archive_entry *entry, struct check_output *out)
 {
 	mode_t archive_type = archive_entry_filetype(entry);
 	mode_t file_type = st->st_mode;
@@ -58,9 +130,9 @@ static int check_file_type(const char *pkgname, const char *filepath,
 			(archive_type == AE_IFDIR && !S_ISDIR(file_type)) ||
 			(archive_type == AE_IFLNK && !S_ISLNK(file_type))) {
 		if(config->quiet) {
-			printf("%s %s\n", pkgname, filepath);
+			check_printf(out, 0, "%s %s\n", pkgname, filepath);
 		} else {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (File type mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (File type mismatch)\n"),
 					pkgname, filepath);
 		}
 		return 1;
@@ -70,7 +142,7 @@ static int check_file_type(const char *pkgname, const char *filepath,
 }
 
 static int check_file_permissions(const char *pkgname, const char *filepath,
-		struct stat *st, struct archive_entry *entry)
+		struct stat *st, struct archive_entry *entry, struct check_output *out)
 {
 	int errors = 0;
 	mode_t fsmode;
@@ -79,7 +151,7 @@ static int check_file_permissions(const char *pkgname, const char *filepath,
 	if(st->st_uid != archive_entry_uid(entry)) {
 		errors++;
 		if(!config->quiet) {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (UID mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (UID mismatch)\n"),
 					pkgname, filepath);
 		}
 	}
@@ -88,7 +160,7 @@ static int check_file_permissions(const char *pkgname, const char *filepath,
 	if(st->st_gid != archive_entry_gid(entry)) {
 		errors++;
 		if(!config->quiet) {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (GID mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (GID mismatch)\n"),
 					pkgname, filepath);
 		}
 	}
@@ -98,7 +170,7 @@ static int check_file_permissions(const char *pkgname, const char *filepath,
 	if(fsmode != (~AE_IFMT & archive_entry_mode(entry))) {
 		errors++;
 		if(!config->quiet) {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (Permissions mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (Permissions mismatch)\n"),
 					pkgname, filepath);
 		}
 	}
@@ -107,20 +179,21 @@ static int check_file_permissions(const char *pkgname, const char *filepath,
 }
 
 static int check_file_time(const char *pkgname, const char *filepath,
-		struct stat *st, struct archive_entry *entry, int backup)
+		struct stat *st, struct archive_entry *entry, int backup,
+		struct check_output *out)
 {
 	if(st->st_mtime != archive_entry_mtime(entry)) {
 		if(backup) {
 			if(!config->quiet) {
-				printf("%s%s%s: ", config->colstr.title, _("backup file"),
+				check_printf(out, 0, "%s%s%s: ", config->colstr.title, _("backup file"),
 						config->colstr.nocolor);
-				printf(_("%s: %s (Modification time mismatch)\n"),
+				check_printf(out, 0, _("%s: %s (Modification time mismatch)\n"),
 						pkgname, filepath);
 			}
 			return 0;
 		}
 		if(!config->quiet) {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (Modification time mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (Modification time mismatch)\n"),
 					pkgname, filepath);
 		}
 		return 1;
@@ -130,21 +203,21 @@ static int check_file_time(const char *pkgname, const char *filepath,
 }
 
 static int check_file_link(const char *pkgname, const char *filepath,
-		struct stat *st, struct archive_entry *entry)
+		struct stat *st, struct archive_entry *entry, struct check_output *out)
 {
 	size_t length = st->st_size + 1;
 	char link[length];
 
 	if(readlink(filepath, link, length) != st->st_size) {
 		/* this should not happen */
-		pm_printf(ALPM_LOG_ERROR, _("unable to read symlink contents: %s\n"), filepath);
+		check_printf(out, ALPM_LOG_ERROR, _("unable to read symlink contents: %s\n"), filepath);
 		return 1;
 	}
 	link[length - 1] = '\0';
 
 	if(strcmp(link, archive_entry_symlink(entry)) != 0) {
 		if(!config->quiet) {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (Symlink path mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (Symlink path mismatch)\n"),
 					pkgname, filepath);
 		}
 		return 1;
@@ -154,20 +227,21 @@ static int check_file_link(const char *pkgname, const char *filepath,
 }
 
 static int check_file_size(const char *pkgname, const char *filepath,
-		struct stat *st, struct archive_entry *entry, int backup)
+		struct stat *st, struct archive_entry *entry, int backup,
+		struct check_output *out)
 {
 	if(st->st_size != archive_entry_size(entry)) {
 		if(backup) {
 			if(!config->quiet) {
-				printf("%s%s%s: ", config->colstr.title, _("backup file"),
+				check_printf(out, 0, "%s%s%s: ", config->colstr.title, _("backup file"),
 						config->colstr.nocolor);
-				printf(_("%s: %s (Size mismatch)\n"),
+				check_printf(out, 0, _("%s: %s (Size mismatch)\n"),
 						pkgname, filepath);
 			}
 			return 0;
 		}
 		if(!config->quiet) {
-			pm_printf(ALPM_LOG_WARNING, _("%s: %s (Size mismatch)\n"),
+			check_printf(out, ALPM_LOG_WARNING, _("%s: %s (Size mismatch)\n"),
 					pkgname, filepath);
 		}
 		return 1;
@@ -191,7 +265,7 @@ static int check_file_sha256sum(const char *pkgname, const char *filepath,
 */
 
 /* Loop through the files of the package to check if they exist. */
-int check_pkg_fast(alpm_pkg_t *pkg)
+static int check_pkg_fast_out(alpm_pkg_t *pkg, struct check_output *out)
 {
 	const char *root, *pkgname;
 	size_t errors = 0;
@@ -219,17 +293,17 @@ int check_pkg_fast(alpm_pkg_t *pkg)
 		size_t plen = strlen(path);
 
 		if(rootlen + 1 + plen > PATH_MAX) {
-			pm_printf(ALPM_LOG_WARNING, _("path too long: %s%s\n"), root, path);
+			check_printf(out, ALPM_LOG_WARNING, _("path too long: %s%s\n"), root, path);
 			continue;
 		}
 		strcpy(filepath + rootlen, path);
 
-		exists = check_file_exists(pkgname, filepath, rootlen, &st);
+		exists = check_file_exists(pkgname, filepath, rootlen, &st, out);
 		if(exists == 0) {
 			int expect_dir = path[plen - 1] == '/' ? 1 : 0;
 			int is_dir = S_ISDIR(st.st_mode) ? 1 : 0;
 			if(expect_dir != is_dir) {
-				pm_printf(ALPM_LOG_WARNING, _("%s: %s (File type mismatch)\n"),
+				check_printf(out, ALPM_LOG_WARNING, _("%s: %s (File type mismatch)\n"),
 						pkgname, filepath);
 				++errors;
 			}
@@ -239,17 +313,22 @@ int check_pkg_fast(alpm_pkg_t *pkg)
 	}
 
 	if(!config->quiet) {
-		printf(_n("%s: %jd total file, ", "%s: %jd total files, ",
+		check_printf(out, 0, _n("%s: %jd total file, ", "%s: %jd total files, ",
 					(unsigned long)filelist->count), pkgname, (intmax_t)filelist->count);
-		printf(_n("%jd missing file\n", "%jd missing files\n",
+		check_printf(out, 0, _n("%jd missing file\n", "%jd missing files\n",
 					(unsigned long)errors), (intmax_t)errors);
 	}
 
 	return (errors != 0 ? 1 : 0);
 }
 
+int check_pkg_fast(alpm_pkg_t *pkg)
+{
+	return check_pkg_fast_out(pkg, NULL);
+}
+
 /* Loop though files in a package and perform full file property checking. */
-int check_pkg_full(alpm_pkg_t *pkg)
+static int check_pkg_full_out(alpm_pkg_t *pkg, struct check_output *out)
 {
 	const char *root, *pkgname;
 	size_t errors = 0;
@@ -272,7 +351,7 @@ int check_pkg_full(alpm_pkg_t *pkg)
 	if(mtree == NULL) {
 		/* TODO: check error to confirm failure due to no mtree file */
 		if(!config->quiet) {
-			printf(_("%s: no mtree file\n"), pkgname);
+			check_printf(out, 0, _("%s: no mtree file\n"), pkgname);
 		}
 		return 0;
 	}
@@ -309,7 +388,7 @@ int check_pkg_full(alpm_pkg_t *pkg)
 					alpm_option_get_dbpath(config->handle),
 					pkgname, alpm_pkg_get_version(pkg), dbfile);
 			if(filepath_len >= PATH_MAX) {
-				pm_printf(ALPM_LOG_WARNING, _("path too long: %slocal/%s-%s/%s\n"),
+				check_printf(out, ALPM_LOG_WARNING, _("path too long: %slocal/%s-%s/%s\n"),
 						alpm_option_get_dbpath(config->handle),
 						pkgname, alpm_pkg_get_version(pkg), dbfile);
 				continue;
@@ -317,14 +396,14 @@ int check_pkg_full(alpm_pkg_t *pkg)
 		} else {
 			filepath_len = snprintf(filepath, PATH_MAX, "%s%s", root, path);
 			if(filepath_len >= PATH_MAX) {
-				pm_printf(ALPM_LOG_WARNING, _("path too long: %s%s\n"), root, path);
+				check_printf(out, ALPM_LOG_WARNING, _("path too long: %s%s\n"), root, path);
 				continue;
 			}
 		}
 
 		file_count++;
 
-		exists = check_file_exists(pkgname, filepath, rootlen, &st);
+		exists = check_file_exists(pkgname, filepath, rootlen, &st, out);
 		if(exists == 1) {
 			errors++;
 			continue;
@@ -336,19 +415,19 @@ int check_pkg_full(alpm_pkg_t *pkg)
 		type = archive_entry_filetype(entry);
 
 		if(type != AE_IFDIR && type != AE_IFREG && type != AE_IFLNK) {
-			pm_printf(ALPM_LOG_WARNING, _("file type not recognized: %s%s\n"), root, path);
+			check_printf(out, ALPM_LOG_WARNING, _("file type not recognized: %s%s\n"), root, path);
 			continue;
 		}
 
-		if(check_file_type(pkgname, filepath, &st, entry) == 1) {
+		if(check_file_type(pkgname, filepath, &st, entry, out) == 1) {
 			errors++;
 			continue;
 		}
 
-		file_errors += check_file_permissions(pkgname, filepath, &st, entry);
+		file_errors += check_file_permissions(pkgname, filepath, &st, entry, out);
 
 		if(type == AE_IFLNK) {
-			file_errors += check_file_link(pkgname, filepath, &st, entry);
+			file_errors += check_file_link(pkgname, filepath, &st, entry, out);
 		}
 
 		/* the following checks are expected to fail if a backup file has been
@@ -364,16 +443,16 @@ int check_pkg_full(alpm_pkg_t *pkg)
 
 		if(type != AE_IFDIR) {
 			/* file or symbolic link */
-			file_errors += check_file_time(pkgname, filepath, &st, entry, backup);
+			file_errors += check_file_time(pkgname, filepath, &st, entry, backup, out);
 		}
 
 		if(type == AE_IFREG) {
-			file_errors += check_file_size(pkgname, filepath, &st, entry, backup);
+			file_errors += check_file_size(pkgname, filepath, &st, entry, backup, out);
 			/* file_errors += check_file_md5sum(pkgname, filepath, &st, entry, backup); */
 		}
 
 		if(config->quiet && file_errors) {
-			printf("%s %s\n", pkgname, filepath);
+			check_printf(out, 0, "%s %s\n", pkgname, filepath);
 		}
 
 		errors += (file_errors != 0 ? 1 : 0);
@@ -382,11 +461,136 @@ int check_pkg_full(alpm_pkg_t *pkg)
 	alpm_pkg_mtree_close(pkg, mtree);
 
 	if(!config->quiet) {
-		printf(_n("%s: %jd total file, ", "%s: %jd total files, ",
+		check_printf(out, 0, _n("%s: %jd total file, ", "%s: %jd total files, ",
 					(unsigned long)file_count), pkgname, (intmax_t)file_count);
-		printf(_n("%jd altered file\n", "%jd altered files\n",
+		check_printf(out, 0, _n("%jd altered file\n", "%jd altered files\n",
 					(unsigned long)errors), (intmax_t)errors);
 	}
 
 	return (errors != 0 ? 1 : 0);
 }
+
+int check_pkg_full(alpm_pkg_t *pkg)
+{
+	return check_pkg_full_out(pkg, NULL);
+}
+
+struct check_pool {
+	alpm_pkg_t **pkgs;
+	size_t count;
+	size_t next;
+	size_t errors;
+	pthread_mutex_t lock;
+	pthread_mutex_t output_lock;
+};
+
+static void *check_worker(void *arg)
+{
+	struct check_pool *pool = arg;
+
+	while(1) {
+		struct check_output out = { NULL, 0, 0 };
+		alpm_pkg_t *pkg;
+		size_t index;
+		int ret;
+
+		pthread_mutex_lock(&pool->lock);
+		index = pool->next;
+		if(index < pool->count) {
+			pool->next++;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if(index >= pool->count) {
+			break;
+		}
+
+		pkg = pool->pkgs[index];
+		if(config->op_q_check == 1) {
+			ret = check_pkg_fast_out(pkg, &out);
+		} else {
+			ret = check_pkg_full_out(pkg, &out);
+		}
+
+		/* stream this package's results as soon as it completes */
+		pthread_mutex_lock(&pool->output_lock);
+		check_output_flush(&out);
+		if(ret != 0) {
+			pool->errors++;
+		}
+		pthread_mutex_unlock(&pool->output_lock);
+	}
+
+	return NULL;
+}
+
+/* Check a list of packages, sharding them across worker threads. The check
+ * itself is stat/read heavy, so overlapping I/O across packages hides most
+ * of the latency of a full -Qk sweep. */
+int check_pkgs(alpm_list_t *pkgs)
+{
+	struct check_pool pool;
+	pthread_t *threads = NULL;
+	size_t nthreads = config->worker_threads;
+	size_t started = 0, i;
+	alpm_list_t *p;
+	int ret;
+
+	pool.count = alpm_list_count(pkgs);
+	if(pool.count == 0) {
+		return 0;
+	}
+	if(nthreads > pool.count) {
+		nthreads = pool.count;
+	}
+
+	pool.pkgs = malloc(pool.count * sizeof(alpm_pkg_t *));
+	if(pool.pkgs == NULL) {
+		nthreads = 1;
+	}
+
+	if(nthreads <= 1 || pool.pkgs == NULL) {
+		free(pool.pkgs);
+		ret = 0;
+		for(p = pkgs; p; p = alpm_list_next(p)) {
+			int value = config->op_q_check == 1
+				? check_pkg_fast(p->data) : check_pkg_full(p->data);
+			if(value != 0) {
+				ret = 1;
+			}
+		}
+		return ret;
+	}
+
+	for(i = 0, p = pkgs; p; p = alpm_list_next(p)) {
+		pool.pkgs[i++] = p->data;
+	}
+	pool.next = 0;
+	pool.errors = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_mutex_init(&pool.output_lock, NULL);
+
+	/* the calling thread acts as one of the workers */
+	threads = malloc((nthreads - 1) * sizeof(pthread_t));
+	if(threads) {
+		for(i = 0; i < nthreads - 1; i++) {
+			if(pthread_create(&threads[i], NULL, check_worker, &pool) != 0) {
+				/* remaining packages are picked up by the threads we do have */
+				break;
+			}
+			started++;
+		}
+	}
+
+	check_worker(&pool);
+
+	for(i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+	ret = (pool.errors != 0 ? 1 : 0);
+	pthread_mutex_destroy(&pool.lock);
+	pthread_mutex_destroy(&pool.output_lock);
+	free(pool.pkgs);
+	return ret;
+}
@@ -116,6 +116,8 @@ config_t *config_new(void)
 
 	/* by default use 1 download stream */
 	newconfig->parallel_downloads = 1;
+	/* by default do library work on a single thread */
+	newconfig->worker_threads = 1;
 	newconfig->colstr.colon   = ":: ";
 	newconfig->colstr.title   = "";
 	newconfig->colstr.repo    = "";
@@ -606,6 +608,15 @@ static int _parse_options(const char *key, char *value,
 			pm_printf(ALPM_LOG_DEBUG, "config: totaldownload\n");
 		} else if(strcmp(key, "CheckSpace") == 0) {
 			config->checkspace = 1;
+		} else if(strcmp(key, "LocalDBJournal") == 0) {
+			config->localdb_journal = 1;
+			pm_printf(ALPM_LOG_DEBUG, "config: localdbjournal\n");
+		} else if(strcmp(key, "VerifyExtraction") == 0) {
+			config->verify_extraction = 1;
+			pm_printf(ALPM_LOG_DEBUG, "config: verifyextraction\n");
+		} else if(strcmp(key, "DatabaseDeltas") == 0) {
+			config->db_deltas = 1;
+			pm_printf(ALPM_LOG_DEBUG, "config: databasedeltas\n");
 		} else if(strcmp(key, "Color") == 0) {
 			if(config->color == PM_COLOR_UNSET) {
 				config->color = isatty(fileno(stdout)) ? PM_COLOR_ON : PM_COLOR_OFF;
@@ -738,6 +749,33 @@ static int _parse_options(const char *key, char *value,
 			}
 
 			config->parallel_downloads = number;
+		} else if(strcmp(key, "WorkerThreads") == 0) {
+			long number;
+			int err;
+
+			err = parse_number(value, &number);
+			if(err) {
+				pm_printf(ALPM_LOG_ERROR,
+						_("config file %s, line %d: invalid value for '%s' : '%s'\n"),
+						file, linenum, "WorkerThreads", value);
+				return 1;
+			}
+
+			if(number < 0) {
+				pm_printf(ALPM_LOG_ERROR,
+						_("config file %s, line %d: value for '%s' cannot be negative : '%s'\n"),
+						file, linenum, "WorkerThreads", value);
+				return 1;
+			}
+
+			if(number > INT_MAX) {
+				pm_printf(ALPM_LOG_ERROR,
+						_("config file %s, line %d: value for '%s' is too large : '%s'\n"),
+						file, linenum, "WorkerThreads", value);
+				return 1;
+			}
+
+			config->worker_threads = number;
 		} else {
 			pm_printf(ALPM_LOG_WARNING,
 					_("config file %s, line %d: directive '%s' in section '%s' not recognized.\n"),
@@ -898,6 +936,9 @@ static int setup_libalpm(void)
 
 	alpm_option_set_arch(handle, config->arch);
 	alpm_option_set_checkspace(handle, config->checkspace);
+	alpm_option_set_localdb_journal(handle, config->localdb_journal);
+	alpm_option_set_verify_extraction(handle, config->verify_extraction);
+	alpm_option_set_db_deltas(handle, config->db_deltas);
 	alpm_option_set_usesyslog(handle, config->usesyslog);
 
 	alpm_option_set_ignorepkgs(handle, config->ignorepkg);
@@ -907,6 +948,7 @@ static int setup_libalpm(void)
 
 	alpm_option_set_disable_dl_timeout(handle, config->disable_dl_timeout);
 	alpm_option_set_parallel_downloads(handle, config->parallel_downloads);
+	alpm_option_set_worker_threads(handle, config->worker_threads);
 
 	for(i = config->assumeinstalled; i; i = i->next) {
 		char *entry = i->data;
@@ -54,6 +54,9 @@ typedef struct __config_t {
 	unsigned short logmask;
 	unsigned short print;
 	unsigned short checkspace;
+	unsigned short localdb_journal;
+	unsigned short verify_extraction;
+	unsigned short db_deltas;
 	unsigned short usesyslog;
 	unsigned short color;
 	unsigned short disable_dl_timeout;
@@ -118,6 +121,8 @@ typedef struct __config_t {
 	unsigned short totaldownload;
 	/* number of parallel download streams */
 	unsigned int parallel_downloads;
+	/* number of worker threads for parallel library phases */
+	unsigned int worker_threads;
 	/* select -Sc behavior */
 	unsigned short cleanmethod;
 	alpm_list_t *holdpkg;
@@ -106,9 +106,121 @@ static void filetarget_free(struct filetarget *ftarg) {
 	free(ftarg);
 }
 
+/* Flat index over every path of every sync db package, built once per
+ * invocation and shared by all search targets. Entries are stored in
+ * repo/package/file order so a linear walk reproduces the traditional output
+ * order, and a second view sorted by basename makes exact-name lookups a
+ * binary search instead of a scan over millions of paths. */
+
+struct fileindex_entry {
+	alpm_db_t *db;
+	alpm_pkg_t *pkg;
+	const char *path;
+	const char *base; /* basename within 'path', NULL for directories */
+};
+
+struct fileindex {
+	struct fileindex_entry *entries;
+	struct fileindex_entry **by_base; /* basename-bearing entries, sorted */
+	size_t count;
+	size_t base_count;
+};
+
+static int fileindex_base_cmp(const void *e1, const void *e2)
+{
+	const struct fileindex_entry *entry1 = *(struct fileindex_entry *const *)e1;
+	const struct fileindex_entry *entry2 = *(struct fileindex_entry *const *)e2;
+	int cmp = strcmp(entry1->base, entry2->base);
+	if(cmp != 0) {
+		return cmp;
+	}
+	/* ties keep original order so matches group per package */
+	if(entry1 < entry2) {
+		return -1;
+	}
+	return entry1 > entry2;
+}
+
+static int fileindex_build(alpm_list_t *syncs, struct fileindex *index)
+{
+	alpm_list_t *s;
+	size_t n = 0, b = 0;
+
+	index->entries = NULL;
+	index->by_base = NULL;
+	index->count = 0;
+	index->base_count = 0;
+
+	for(s = syncs; s; s = alpm_list_next(s)) {
+		alpm_list_t *p;
+		for(p = alpm_db_get_pkgcache(s->data); p; p = alpm_list_next(p)) {
+			index->count += alpm_pkg_get_files(p->data)->count;
+		}
+	}
+	if(index->count == 0) {
+		return 0;
+	}
+
+	index->entries = malloc(index->count * sizeof(struct fileindex_entry));
+	index->by_base = malloc(index->count * sizeof(struct fileindex_entry *));
+	if(!index->entries || !index->by_base) {
+		free(index->entries);
+		free(index->by_base);
+		index->entries = NULL;
+		index->by_base = NULL;
+		return -1;
+	}
+
+	for(s = syncs; s; s = alpm_list_next(s)) {
+		alpm_list_t *p;
+		alpm_db_t *repo = s->data;
+		for(p = alpm_db_get_pkgcache(repo); p; p = alpm_list_next(p)) {
+			alpm_pkg_t *pkg = p->data;
+			alpm_filelist_t *files = alpm_pkg_get_files(pkg);
+			for(size_t f = 0; f < files->count; f++) {
+				struct fileindex_entry *entry = &index->entries[n++];
+				char *c = strrchr(files->files[f].name, '/');
+				entry->db = repo;
+				entry->pkg = pkg;
+				entry->path = files->files[f].name;
+				entry->base = (c && *(c + 1)) ? c + 1 : NULL;
+				if(entry->base) {
+					index->by_base[b++] = entry;
+				}
+			}
+		}
+	}
+	index->base_count = b;
+	qsort(index->by_base, index->base_count, sizeof(struct fileindex_entry *),
+			fileindex_base_cmp);
+	return 0;
+}
+
+static void fileindex_free(struct fileindex *index)
+{
+	free(index->entries);
+	free(index->by_base);
+}
+
+/* position of the first basename >= targ */
+static size_t fileindex_lower_bound(struct fileindex *index, const char *targ)
+{
+	size_t low = 0, high = index->base_count;
+	while(low < high) {
+		size_t mid = low + (high - low) / 2;
+		if(strcmp(index->by_base[mid]->base, targ) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
 static int files_search(alpm_list_t *syncs, alpm_list_t *targets, int regex) {
 	int ret = 0;
 	alpm_list_t *t, *filetargs = NULL;
+	struct fileindex index;
 
 	for(t = targets; t; t = alpm_list_next(t)) {
 		char *targ = t->data;
@@ -144,62 +256,87 @@ static int files_search(alpm_list_t *syncs, alpm_list_t *targets, int regex) {
 		goto cleanup;
 	}
 
+	if(fileindex_build(syncs, &index) != 0) {
+		ret = 1;
+		goto cleanup;
+	}
+
 	for(t = filetargs; t; t = alpm_list_next(t)) {
 		struct filetarget *ftarg = t->data;
 		char *targ = ftarg->targ;
 		regex_t *reg = &ftarg->reg;
 		int exact_file = ftarg->exact_file;
-		alpm_list_t *s;
 		int found = 0;
 
-		for(s = syncs; s; s = alpm_list_next(s)) {
-			alpm_list_t *p;
-			alpm_db_t *repo = s->data;
-			alpm_list_t *packages = alpm_db_get_pkgcache(repo);
-			int m;
-
-			for(p = packages; p; p = alpm_list_next(p)) {
-				alpm_pkg_t *pkg = p->data;
-				alpm_filelist_t *files = alpm_pkg_get_files(pkg);
-				alpm_list_t *match = NULL;
-
-				if(exact_file) {
-					if (regex) {
-						for(size_t f = 0; f < files->count; f++) {
-							char *c = files->files[f].name;
-							if(regexec(reg, c, 0, 0, 0) == 0) {
-								match = alpm_list_add(match, files->files[f].name);
-								found = 1;
-							}
-						}
-					} else {
-						if(alpm_filelist_contains(files, targ)) {
-							match = alpm_list_add(match, targ);
-							found = 1;
-						}
-					}
-				} else {
-					for(size_t f = 0; f < files->count; f++) {
-						char *c = strrchr(files->files[f].name, '/');
-						if(c && *(c + 1)) {
-							if(regex) {
-								m = regexec(reg, (c + 1), 0, 0, 0);
-							} else {
-								m = strcmp(c + 1, targ);
-							}
-							if(m == 0) {
-								match = alpm_list_add(match, files->files[f].name);
-								found = 1;
-							}
-						}
+		if(exact_file && !regex) {
+			/* full-path lookups bsearch each package's sorted filelist */
+			alpm_list_t *s;
+			for(s = syncs; s; s = alpm_list_next(s)) {
+				alpm_list_t *p;
+				alpm_db_t *repo = s->data;
+
+				for(p = alpm_db_get_pkgcache(repo); p; p = alpm_list_next(p)) {
+					alpm_pkg_t *pkg = p->data;
+					if(alpm_filelist_contains(alpm_pkg_get_files(pkg), targ)) {
+						alpm_list_t *match = alpm_list_add(NULL, targ);
+						found = 1;
+						print_match(match, repo, pkg, exact_file);
+						alpm_list_free(match);
 					}
 				}
-
-				if(match != NULL) {
-					print_match(match, repo, pkg, exact_file);
+			}
+		} else if(!regex) {
+			/* exact basename: binary search the sorted view; ties are kept in
+			 * original order, so matches arrive grouped per package */
+			size_t pos = fileindex_lower_bound(&index, targ);
+			alpm_list_t *match = NULL;
+			alpm_pkg_t *lastpkg = NULL;
+			alpm_db_t *lastdb = NULL;
+
+			for(; pos < index.base_count
+					&& strcmp(index.by_base[pos]->base, targ) == 0; pos++) {
+				struct fileindex_entry *entry = index.by_base[pos];
+				if(entry->pkg != lastpkg && match) {
+					print_match(match, lastdb, lastpkg, exact_file);
+					alpm_list_free(match);
+					match = NULL;
+				}
+				lastpkg = entry->pkg;
+				lastdb = entry->db;
+				match = alpm_list_add(match, (char *)entry->path);
+				found = 1;
+			}
+			if(match) {
+				print_match(match, lastdb, lastpkg, exact_file);
+				alpm_list_free(match);
+			}
+		} else {
+			/* regex: one dense pass over the corpus */
+			alpm_list_t *match = NULL;
+			alpm_pkg_t *lastpkg = NULL;
+			alpm_db_t *lastdb = NULL;
+
+			for(size_t n = 0; n < index.count; n++) {
+				struct fileindex_entry *entry = &index.entries[n];
+				const char *subject = exact_file ? entry->path : entry->base;
+
+				if(entry->pkg != lastpkg && match) {
+					print_match(match, lastdb, lastpkg, exact_file);
 					alpm_list_free(match);
+					match = NULL;
+				}
+				lastpkg = entry->pkg;
+				lastdb = entry->db;
+
+				if(subject && regexec(reg, subject, 0, 0, 0) == 0) {
+					match = alpm_list_add(match, (char *)entry->path);
+					found = 1;
 				}
 			}
+			if(match) {
+				print_match(match, lastdb, lastpkg, exact_file);
+				alpm_list_free(match);
+			}
 		}
 
 		if(!found) {
@@ -207,6 +344,8 @@ static int files_search(alpm_list_t *syncs, alpm_list_t *targets, int regex) {
 		}
 	}
 
+	fileindex_free(&index);
+
 cleanup:
 	alpm_list_free_inner(filetargs, (alpm_list_fn_free) filetarget_free);
 	alpm_list_free(filetargs);
@@ -233,7 +372,7 @@ static void dump_file_list(alpm_pkg_t *pkg) {
 		printf("%s\n", file->name);
 	}
 
-	fflush(stdout);
+	bulk_output_flush();
 }
 
 static int files_list(alpm_list_t *syncs, alpm_list_t *targets) {
@@ -309,6 +448,7 @@ static int files_list(alpm_list_t *syncs, alpm_list_t *targets) {
 int pacman_files(alpm_list_t *targets)
 {
 	alpm_list_t *files_dbs = NULL;
+	int ret;
 
 	if(check_syncdbs(1, 0)) {
 		return 1;
@@ -328,7 +468,10 @@ int pacman_files(alpm_list_t *targets)
 
 	/* get a listing of files in sync DBs */
 	if(config->op_q_list) {
-		return files_list(files_dbs, targets);
+		bulk_output_begin();
+		ret = files_list(files_dbs, targets);
+		bulk_output_end();
+		return ret;
 	}
 
 	if(targets == NULL && !config->op_s_sync) {
@@ -337,5 +480,8 @@ int pacman_files(alpm_list_t *targets)
 	}
 
 	/* search for a file */
-	return files_search(files_dbs, targets, config->op_f_regex);
+	bulk_output_begin();
+	ret = files_search(files_dbs, targets, config->op_f_regex);
+	bulk_output_end();
+	return ret;
 }
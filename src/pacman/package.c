@@ -447,7 +447,7 @@ void dump_pkg_files(alpm_pkg_t *pkg, int quiet)
 		printf("%s%s\n", root, file->name);
 	}
 
-	fflush(stdout);
+	bulk_output_flush();
 }
 
 /* Display the changelog of a package
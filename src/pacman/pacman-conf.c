@@ -27,7 +27,7 @@ const char *myname = "pacman-conf", *myver = "1.0.0";
 alpm_list_t *directives = NULL;
 char sep = '\n', *repo_name = NULL;
 const char *config_file = NULL;
-int repo_list = 0, verbose = 0;
+int repo_list = 0, verbose = 0, batch = 0;
 
 static void cleanup(void)
 {
@@ -45,6 +45,7 @@ static void usage(int ret)
 	fputs(_("  -c, --config=<path>  set an alternate configuration file\n"), stream);
 	fputs(_("  -R, --rootdir=<path> set an alternate installation root\n"), stream);
 	fputs(_("  -r, --repo=<remote>  query options for a specific repo\n"), stream);
+	fputs(_("  -b, --batch          answer directives read from stdin\n"), stream);
 	fputs(_("  -v, --verbose        always show directive names\n"), stream);
 	fputs(_("  -l, --repo-list      list configured repositories\n"), stream);
 	fputs(_("  -h, --help           display this help information\n"), stream);
@@ -58,8 +59,9 @@ static void parse_opts(int argc, char **argv)
 	int c;
 	config_file = CONFFILE;
 
-	const char *short_opts = "c:hlR:r:Vv";
+	const char *short_opts = "bc:hlR:r:Vv";
 	struct option long_opts[] = {
+		{ "batch"     , no_argument       , NULL , 'b' },
 		{ "config"    , required_argument , NULL , 'c' },
 		{ "rootdir"   , required_argument , NULL , 'R' },
 		{ "repo"      , required_argument , NULL , 'r' },
@@ -72,6 +74,9 @@ static void parse_opts(int argc, char **argv)
 
 	while((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'b':
+				batch = 1;
+				break;
 			case 'c':
 				config_file = optarg;
 				break;
@@ -264,12 +269,15 @@ static void dump_config(void)
 	show_bool("Color", config->color);
 	show_bool("TotalDownload", config->totaldownload);
 	show_bool("CheckSpace", config->checkspace);
+	show_bool("LocalDBJournal", config->localdb_journal);
+	show_bool("DatabaseDeltas", config->db_deltas);
 	show_bool("VerbosePkgLists", config->verbosepkglists);
 	show_bool("DisableDownloadTimeout", config->disable_dl_timeout);
 	show_bool("ILoveCandy", config->chomp);
 	show_bool("NoProgressBar", config->noprogressbar);
 
 	show_int("ParallelDownloads", config->parallel_downloads);
+	show_int("WorkerThreads", config->worker_threads);
 
 	show_cleanmethod("CleanMethod", config->cleanmethod);
 
@@ -375,6 +383,10 @@ static int list_directives(void)
 			show_bool("TotalDownload", config->totaldownload);
 		} else if(strcasecmp(i->data, "CheckSpace") == 0) {
 			show_bool("CheckSpace", config->checkspace);
+		} else if(strcasecmp(i->data, "LocalDBJournal") == 0) {
+			show_bool("LocalDBJournal", config->localdb_journal);
+		} else if(strcasecmp(i->data, "DatabaseDeltas") == 0) {
+			show_bool("DatabaseDeltas", config->db_deltas);
 		} else if(strcasecmp(i->data, "VerbosePkgLists") == 0) {
 			show_bool("VerbosePkgLists", config->verbosepkglists);
 		} else if(strcasecmp(i->data, "DisableDownloadTimeout") == 0) {
@@ -387,6 +399,9 @@ static int list_directives(void)
 		} else if(strcasecmp(i->data, "ParallelDownloads") == 0) {
 			show_int("ParallelDownloads", config->parallel_downloads);
 
+		} else if(strcasecmp(i->data, "WorkerThreads") == 0) {
+			show_int("WorkerThreads", config->worker_threads);
+
 		} else if(strcasecmp(i->data, "CleanMethod") == 0) {
 			show_cleanmethod("CleanMethod", config->cleanmethod);
 
@@ -409,6 +424,50 @@ static int list_directives(void)
 	return ret;
 }
 
+/* Answer directives read from stdin, one query per line, so callers
+ * with many questions (makepkg and friends) parse the config once per
+ * build instead of once per invocation. A "repo.directive" line queries
+ * a repository section. Every answer is terminated by an empty line, so
+ * a coprocess reading our output knows when a query is fully answered,
+ * including queries with no or multiple values. */
+static int run_batch(void)
+{
+	int ret = 0;
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+
+	while((len = getline(&line, &linesz, stdin)) != -1) {
+		char *dot;
+
+		if(len > 0 && line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+		if(line[0] == '\0') {
+			continue;
+		}
+
+		directives = alpm_list_add(NULL, line);
+		if((dot = strchr(line, '.'))) {
+			*dot = '\0';
+			repo_name = line;
+			directives->data = dot + 1;
+			ret |= list_repo_directives();
+			repo_name = NULL;
+		} else {
+			ret |= list_directives();
+		}
+		alpm_list_free(directives);
+		directives = NULL;
+
+		printf("%c", sep);
+		fflush(stdout);
+	}
+
+	free(line);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	int ret = 0;
@@ -432,7 +491,7 @@ int main(int argc, char **argv)
 		directives = alpm_list_add(directives, argv[optind]);
 	}
 
-	if(alpm_list_count(directives) != 1) {
+	if(!batch && alpm_list_count(directives) != 1) {
 		verbose = 1;
 	}
 
@@ -443,6 +502,13 @@ int main(int argc, char **argv)
 			goto cleanup;
 		}
 		list_repos();
+	} else if(batch) {
+		if(directives) {
+			fprintf(stderr, _("error: directives may not be specified with %s\n"), "--batch");
+			ret = 1;
+			goto cleanup;
+		}
+		ret = run_batch();
 	} else if(repo_name) {
 		ret = list_repo_directives();
 	} else {
@@ -209,11 +209,21 @@ static int query_fileowner(alpm_list_t *targets)
 			strcat(rpath + rlen, "/");
 		}
 
-		for(i = packages; i && (!found || is_dir); i = alpm_list_next(i)) {
-			if(alpm_filelist_contains(alpm_pkg_get_files(i->data), rel_path)) {
+		alpm_list_t *owners = NULL;
+		if(alpm_db_find_file_owners(db_local, rel_path, &owners) == 0) {
+			/* owner index answered; no filelist scan required */
+			for(i = owners; i && (!found || is_dir); i = alpm_list_next(i)) {
 				print_query_fileowner(rpath, i->data);
 				found = 1;
 			}
+			alpm_list_free(owners);
+		} else {
+			for(i = packages; i && (!found || is_dir); i = alpm_list_next(i)) {
+				if(alpm_filelist_contains(alpm_pkg_get_files(i->data), rel_path)) {
+					print_query_fileowner(rpath, i->data);
+					found = 1;
+				}
+			}
 		}
 		if(!found) {
 			pm_printf(ALPM_LOG_ERROR, _("No package owns %s\n"), filename);
@@ -405,14 +415,22 @@ int pacman_query(alpm_list_t *targets)
 	int ret = 0;
 	int match = 0;
 	alpm_list_t *i;
+	alpm_list_t *check_queue = NULL;
 	alpm_pkg_t *pkg = NULL;
 	alpm_db_t *db_local;
+	/* when checking is the only display operation, queue the packages and
+	 * shard them across worker threads instead of checking them inline */
+	int queue_checks = config->op_q_check && config->worker_threads > 1 &&
+			!config->op_q_info && !config->op_q_list &&
+			!config->op_q_changelog && !config->op_q_isfile;
 
 	/* First: operations that do not require targets */
 
 	/* search for a package */
 	if(config->op_q_search) {
+		bulk_output_begin();
 		ret = query_search(targets);
+		bulk_output_end();
 		return ret;
 	}
 
@@ -439,16 +457,26 @@ int pacman_query(alpm_list_t *targets)
 			return 1;
 		}
 
+		bulk_output_begin();
 		for(i = alpm_db_get_pkgcache(db_local); i; i = alpm_list_next(i)) {
 			pkg = i->data;
 			if(filter(pkg)) {
-				int value = display(pkg);
-				if(value != 0) {
-					ret = 1;
+				if(queue_checks) {
+					check_queue = alpm_list_add(check_queue, pkg);
+				} else {
+					int value = display(pkg);
+					if(value != 0) {
+						ret = 1;
+					}
 				}
 				match = 1;
 			}
 		}
+		if(check_pkgs(check_queue) != 0) {
+			ret = 1;
+		}
+		alpm_list_free(check_queue);
+		bulk_output_end();
 		if(!match) {
 			ret = 1;
 		}
@@ -465,6 +493,7 @@ int pacman_query(alpm_list_t *targets)
 
 	/* operations on named packages in the local DB
 	 * valid: no-op (plain -Q), list, info, check */
+	bulk_output_begin();
 	for(i = targets; i; i = alpm_list_next(i)) {
 		const char *strname = i->data;
 
@@ -504,9 +533,13 @@ int pacman_query(alpm_list_t *targets)
 		}
 
 		if(filter(pkg)) {
-			int value = display(pkg);
-			if(value != 0) {
-				ret = 1;
+			if(queue_checks) {
+				check_queue = alpm_list_add(check_queue, pkg);
+			} else {
+				int value = display(pkg);
+				if(value != 0) {
+					ret = 1;
+				}
 			}
 			match = 1;
 		}
@@ -517,6 +550,12 @@ int pacman_query(alpm_list_t *targets)
 		}
 	}
 
+	if(check_pkgs(check_queue) != 0) {
+		ret = 1;
+	}
+	alpm_list_free(check_queue);
+	bulk_output_end();
+
 	if(!match) {
 		ret = 1;
 	}
@@ -310,6 +310,9 @@ static int sync_search(alpm_list_t *syncs, alpm_list_t *targets)
 	alpm_list_t *i;
 	int found = 0;
 
+	/* every db gets touched; load them together instead of one by one */
+	alpm_dbs_populate_async(config->handle);
+
 	for(i = syncs; i; i = alpm_list_next(i)) {
 		alpm_db_t *db = i->data;
 		int ret = dump_pkg_search(db, targets, 1);
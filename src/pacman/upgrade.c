@@ -85,32 +85,57 @@ int pacman_upgrade(alpm_list_t *targets)
 	}
 
 	printf(_("loading packages...\n"));
-	/* add targets to the created transaction */
-	for(i = targets, n = 0; i; i = alpm_list_next(i), n++) {
-		const char *targ = i->data;
-		alpm_pkg_t *pkg;
-		int siglevel;
-
-		if(file_is_remote[n]) {
-			siglevel = alpm_option_get_remote_file_siglevel(config->handle);
-		} else {
-			siglevel = alpm_option_get_local_file_siglevel(config->handle);
+	/* load the target files across the configured worker threads, then
+	 * add the results to the transaction in argument order */
+	{
+		const char **filenames;
+		alpm_pkg_t **pkgs;
+		int *siglevels;
+
+		filenames = malloc(num_targets * sizeof(char *));
+		pkgs = malloc(num_targets * sizeof(alpm_pkg_t *));
+		siglevels = malloc(num_targets * sizeof(int));
+		if(filenames == NULL || pkgs == NULL || siglevels == NULL) {
+			pm_printf(ALPM_LOG_ERROR, _("memory exhausted\n"));
+			free(filenames);
+			free(pkgs);
+			free(siglevels);
+			retval = 1;
+			goto fail_release;
 		}
 
-		if(alpm_pkg_load(config->handle, targ, 1, siglevel, &pkg) != 0) {
-			pm_printf(ALPM_LOG_ERROR, "'%s': %s\n",
-					targ, alpm_strerror(alpm_errno(config->handle)));
-			retval = 1;
-			continue;
+		for(i = targets, n = 0; i; i = alpm_list_next(i), n++) {
+			filenames[n] = i->data;
+			if(file_is_remote[n]) {
+				siglevels[n] = alpm_option_get_remote_file_siglevel(config->handle);
+			} else {
+				siglevels[n] = alpm_option_get_local_file_siglevel(config->handle);
+			}
 		}
-		if(alpm_add_pkg(config->handle, pkg) == -1) {
-			pm_printf(ALPM_LOG_ERROR, "'%s': %s\n",
-					targ, alpm_strerror(alpm_errno(config->handle)));
-			alpm_pkg_free(pkg);
-			retval = 1;
-			continue;
+
+		alpm_pkg_load_many(config->handle, num_targets, filenames, 1,
+				siglevels, pkgs);
+
+		for(n = 0; n < num_targets; n++) {
+			if(pkgs[n] == NULL) {
+				pm_printf(ALPM_LOG_ERROR, "'%s': %s\n",
+						filenames[n], alpm_strerror(alpm_errno(config->handle)));
+				retval = 1;
+				continue;
+			}
+			if(alpm_add_pkg(config->handle, pkgs[n]) == -1) {
+				pm_printf(ALPM_LOG_ERROR, "'%s': %s\n",
+						filenames[n], alpm_strerror(alpm_errno(config->handle)));
+				alpm_pkg_free(pkgs[n]);
+				retval = 1;
+				continue;
+			}
+			config->explicit_adds = alpm_list_add(config->explicit_adds, pkgs[n]);
 		}
-		config->explicit_adds = alpm_list_add(config->explicit_adds, pkg);
+
+		free(filenames);
+		free(pkgs);
+		free(siglevels);
 	}
 
 	if(retval) {
@@ -238,6 +238,46 @@ unsigned short getcols(void)
 	return c;
 }
 
+/* While dumping long machine-consumed lists (-Ql, -Fl, search results),
+ * collect stdout into one large buffer so the results go out in a few
+ * big writes instead of one syscall every few lines. On a TTY the stream
+ * is left alone so interactive output still appears immediately. */
+#define BULK_OUTPUT_SIZE (256 * 1024)
+
+static char *bulk_output_buf = NULL;
+
+void bulk_output_begin(void)
+{
+	if(bulk_output_buf != NULL || isatty(fileno(stdout))) {
+		return;
+	}
+	if((bulk_output_buf = malloc(BULK_OUTPUT_SIZE)) == NULL) {
+		return;
+	}
+	fflush(stdout);
+	setvbuf(stdout, bulk_output_buf, _IOFBF, BULK_OUTPUT_SIZE);
+}
+
+void bulk_output_end(void)
+{
+	if(bulk_output_buf == NULL) {
+		return;
+	}
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+	free(bulk_output_buf);
+	bulk_output_buf = NULL;
+}
+
+/* Flush points inside the dump loops: a no-op while the bulk buffer is
+ * active, an immediate flush otherwise. */
+void bulk_output_flush(void)
+{
+	if(bulk_output_buf == NULL) {
+		fflush(stdout);
+	}
+}
+
 /* does the same thing as 'rm -rf' */
 int rmrf(const char *path)
 {
@@ -56,6 +56,9 @@ int check_syncdbs(size_t need_repos, int check_valid);
 int sync_syncdbs(int level, alpm_list_t *syncs);
 unsigned short getcols(void);
 void columns_cache_reset(void);
+void bulk_output_begin(void);
+void bulk_output_end(void);
+void bulk_output_flush(void);
 int rmrf(const char *path);
 void indentprint(const char *str, unsigned short indent, unsigned short cols);
 char *strreplace(const char *str, const char *needle, const char *replace);
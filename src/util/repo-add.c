@@ -0,0 +1,581 @@
+/*
+ *  repo-add.c : native package repository database generator
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <alpm.h>
+#include <alpm_list.h>
+
+/* Metadata extraction (alpm_pkg_load of the .PKGINFO, checksumming the
+ * package file) dominates repo generation time, so packages are
+ * processed by a pool of worker threads; each worker drives its own
+ * alpm handle since a handle is single-threaded. The db archive itself
+ * is then written in one pass: entries copied from the previous db for
+ * packages that were not replaced, followed by the new entries. */
+
+struct pkg_meta {
+	const char *path;     /* package file argument */
+	char *name;
+	char *entryname;      /* "name-version" archive directory */
+	char *desc;           /* formatted desc file contents */
+	size_t desc_len;
+	int result;
+};
+
+struct pool_ctx {
+	struct pkg_meta *pkgs;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+	int quiet;
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "repo-add-native (pacman) v" PACKAGE_VERSION "\n\n");
+	fprintf(stderr, "Update a package repository database.\n\n");
+	fprintf(stderr, "Usage: repo-add-native [options] <path-to-db> <package> ...\n\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -q, --quiet        minimize output\n");
+	fprintf(stderr, "  -t, --threads <n>  worker thread count (default: online CPUs)\n\n");
+	fprintf(stderr, "Only sync ('desc') databases are supported; use repo-add for\n");
+	fprintf(stderr, "files databases and for removing packages.\n");
+}
+
+static const char *base_name(const char *path)
+{
+	const char *base = strrchr(path, '/');
+	return base ? base + 1 : path;
+}
+
+static void write_entry_str(FILE *f, const char *key, const char *value)
+{
+	if(value && *value) {
+		fprintf(f, "%%%s%%\n%s\n\n", key, value);
+	}
+}
+
+static void write_entry_strlist(FILE *f, const char *key, alpm_list_t *values)
+{
+	alpm_list_t *i;
+	if(!values) {
+		return;
+	}
+	fprintf(f, "%%%s%%\n", key);
+	for(i = values; i; i = i->next) {
+		fprintf(f, "%s\n", (const char *)i->data);
+	}
+	fputc('\n', f);
+}
+
+static void write_entry_deplist(FILE *f, const char *key, alpm_list_t *deps)
+{
+	alpm_list_t *i;
+	if(!deps) {
+		return;
+	}
+	fprintf(f, "%%%s%%\n", key);
+	for(i = deps; i; i = i->next) {
+		char *depstring = alpm_dep_compute_string(i->data);
+		if(depstring) {
+			fprintf(f, "%s\n", depstring);
+			free(depstring);
+		}
+	}
+	fputc('\n', f);
+}
+
+/* base64 of the detached signature, matching the %PGPSIG% entries
+ * repo-add.sh emits via openssl */
+static char *base64_encode(const unsigned char *data, size_t len)
+{
+	static const char set[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t outlen = ((len + 2) / 3) * 4;
+	char *out, *p;
+	size_t i;
+
+	if((out = malloc(outlen + 1)) == NULL) {
+		return NULL;
+	}
+	p = out;
+	for(i = 0; i + 2 < len; i += 3) {
+		unsigned long v = (unsigned long)data[i] << 16 |
+			(unsigned long)data[i + 1] << 8 | data[i + 2];
+		*p++ = set[v >> 18];
+		*p++ = set[(v >> 12) & 0x3f];
+		*p++ = set[(v >> 6) & 0x3f];
+		*p++ = set[v & 0x3f];
+	}
+	if(i < len) {
+		unsigned long v = (unsigned long)data[i] << 16;
+		if(i + 1 < len) {
+			v |= (unsigned long)data[i + 1] << 8;
+		}
+		*p++ = set[v >> 18];
+		*p++ = set[(v >> 12) & 0x3f];
+		*p++ = (i + 1 < len) ? set[(v >> 6) & 0x3f] : '=';
+		*p++ = '=';
+	}
+	*p = '\0';
+	return out;
+}
+
+static char *read_signature(const char *pkgpath)
+{
+	char sigpath[4096];
+	unsigned char *buf = NULL;
+	char *encoded = NULL;
+	struct stat st;
+	FILE *f;
+
+	if(snprintf(sigpath, sizeof(sigpath), "%s.sig", pkgpath) >=
+			(int)sizeof(sigpath)) {
+		return NULL;
+	}
+	if((f = fopen(sigpath, "rb")) == NULL) {
+		return NULL;
+	}
+	if(fstat(fileno(f), &st) != 0 || st.st_size <= 0 ||
+			(buf = malloc(st.st_size)) == NULL ||
+			fread(buf, 1, st.st_size, f) != (size_t)st.st_size) {
+		goto cleanup;
+	}
+	encoded = base64_encode(buf, st.st_size);
+
+cleanup:
+	free(buf);
+	fclose(f);
+	return encoded;
+}
+
+static int load_package(alpm_handle_t *handle, struct pkg_meta *meta)
+{
+	alpm_pkg_t *pkg = NULL;
+	struct stat st;
+	char *md5sum = NULL, *sha256sum = NULL, *pgpsig = NULL;
+	char *descbuf = NULL;
+	size_t desclen = 0;
+	FILE *f = NULL;
+	int ret = -1;
+
+	if(stat(meta->path, &st) != 0) {
+		fprintf(stderr, "error: could not stat '%s': %s\n",
+				meta->path, strerror(errno));
+		return -1;
+	}
+
+	/* metadata only; checksums cover the file contents */
+	if(alpm_pkg_load(handle, meta->path, 0, 0, &pkg) != 0 || pkg == NULL) {
+		fprintf(stderr, "error: could not read package '%s' (%s)\n",
+				meta->path, alpm_strerror(alpm_errno(handle)));
+		return -1;
+	}
+
+	md5sum = alpm_compute_md5sum(meta->path);
+	sha256sum = alpm_compute_sha256sum(meta->path);
+	if(md5sum == NULL || sha256sum == NULL) {
+		fprintf(stderr, "error: could not checksum '%s'\n", meta->path);
+		goto cleanup;
+	}
+	pgpsig = read_signature(meta->path);
+
+	if((meta->name = strdup(alpm_pkg_get_name(pkg))) == NULL) {
+		goto cleanup;
+	}
+	if(asprintf(&meta->entryname, "%s-%s",
+				alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg)) < 0) {
+		meta->entryname = NULL;
+		goto cleanup;
+	}
+
+	if((f = open_memstream(&descbuf, &desclen)) == NULL) {
+		goto cleanup;
+	}
+	write_entry_str(f, "FILENAME", base_name(meta->path));
+	write_entry_str(f, "NAME", alpm_pkg_get_name(pkg));
+	write_entry_str(f, "BASE", alpm_pkg_get_base(pkg));
+	write_entry_str(f, "VERSION", alpm_pkg_get_version(pkg));
+	write_entry_str(f, "DESC", alpm_pkg_get_desc(pkg));
+	write_entry_strlist(f, "GROUPS", alpm_pkg_get_groups(pkg));
+	fprintf(f, "%%CSIZE%%\n%jd\n\n", (intmax_t)st.st_size);
+	if(alpm_pkg_get_isize(pkg) > 0) {
+		fprintf(f, "%%ISIZE%%\n%jd\n\n", (intmax_t)alpm_pkg_get_isize(pkg));
+	}
+	write_entry_str(f, "MD5SUM", md5sum);
+	write_entry_str(f, "SHA256SUM", sha256sum);
+	write_entry_str(f, "PGPSIG", pgpsig);
+	write_entry_str(f, "URL", alpm_pkg_get_url(pkg));
+	write_entry_strlist(f, "LICENSE", alpm_pkg_get_licenses(pkg));
+	write_entry_str(f, "ARCH", alpm_pkg_get_arch(pkg));
+	if(alpm_pkg_get_builddate(pkg) > 0) {
+		fprintf(f, "%%BUILDDATE%%\n%jd\n\n",
+				(intmax_t)alpm_pkg_get_builddate(pkg));
+	}
+	write_entry_str(f, "PACKAGER", alpm_pkg_get_packager(pkg));
+	write_entry_deplist(f, "REPLACES", alpm_pkg_get_replaces(pkg));
+	write_entry_deplist(f, "CONFLICTS", alpm_pkg_get_conflicts(pkg));
+	write_entry_deplist(f, "PROVIDES", alpm_pkg_get_provides(pkg));
+	write_entry_deplist(f, "DEPENDS", alpm_pkg_get_depends(pkg));
+	write_entry_deplist(f, "OPTDEPENDS", alpm_pkg_get_optdepends(pkg));
+	write_entry_deplist(f, "MAKEDEPENDS", alpm_pkg_get_makedepends(pkg));
+	write_entry_deplist(f, "CHECKDEPENDS", alpm_pkg_get_checkdepends(pkg));
+	if(fclose(f) != 0) {
+		f = NULL;
+		goto cleanup;
+	}
+	f = NULL;
+
+	meta->desc = descbuf;
+	meta->desc_len = desclen;
+	descbuf = NULL;
+	ret = 0;
+
+cleanup:
+	if(f) {
+		fclose(f);
+	}
+	free(descbuf);
+	free(md5sum);
+	free(sha256sum);
+	free(pgpsig);
+	alpm_pkg_free(pkg);
+	return ret;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool_ctx *pool = arg;
+	alpm_handle_t *handle;
+	alpm_errno_t err;
+
+	if((handle = alpm_initialize(ROOTDIR, DBPATH, &err)) == NULL) {
+		fprintf(stderr, "error: cannot initialize alpm: %s\n",
+				alpm_strerror(err));
+		return NULL;
+	}
+
+	while(1) {
+		struct pkg_meta *meta;
+		size_t n;
+
+		pthread_mutex_lock(&pool->lock);
+		n = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if(n >= pool->count) {
+			break;
+		}
+
+		meta = &pool->pkgs[n];
+		meta->result = load_package(handle, meta);
+		if(meta->result == 0 && !pool->quiet) {
+			printf("adding '%s'\n", meta->entryname);
+		}
+	}
+
+	alpm_release(handle);
+	return NULL;
+}
+
+/* match "name-version/..." archive paths against the set of packages
+ * being added; version strings contain dashes, so compare against the
+ * known entry names rather than re-parsing */
+static int entry_is_replaced(const char *entrypath, struct pkg_meta *pkgs,
+		size_t count)
+{
+	size_t dirlen = strcspn(entrypath, "/");
+	size_t n;
+
+	for(n = 0; n < count; n++) {
+		const char *name = pkgs[n].name;
+		size_t namelen = strlen(name);
+		/* same entry name, or same pkgname with any version: the package
+		 * directory is "name-version-rel", so the character after a
+		 * matching name prefix must be the version separator */
+		if(strncmp(entrypath, name, namelen) == 0 &&
+				(entrypath[namelen] == '-' || entrypath[namelen] == '/')) {
+			size_t entlen = strlen(pkgs[n].entryname);
+			if(strncmp(entrypath, pkgs[n].entryname, entlen) == 0 &&
+					entrypath[entlen] == '/') {
+				return 1;
+			}
+			/* differing version of the same name: count the dashes to make
+			 * sure "foo-bar" does not shadow package "foo" */
+			{
+				const char *p = entrypath + namelen;
+				int dashes = 0;
+				while(p < entrypath + dirlen) {
+					if(*p == '-') {
+						dashes++;
+					}
+					p++;
+				}
+				if(dashes == 2) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static int set_compression(struct archive *archive, const char *dbpath)
+{
+	const char *filter = "gzip";
+	size_t len = strlen(dbpath);
+
+	if(len > 3 && strcmp(dbpath + len - 3, ".xz") == 0) {
+		filter = "xz";
+	} else if(len > 4 && strcmp(dbpath + len - 4, ".bz2") == 0) {
+		filter = "bzip2";
+	} else if(len > 4 && strcmp(dbpath + len - 4, ".zst") == 0) {
+		filter = "zstd";
+	} else if(len > 4 && strcmp(dbpath + len - 4, ".tar") == 0) {
+		filter = "none";
+	}
+
+	if(strcmp(filter, "none") != 0 &&
+			archive_write_add_filter_by_name(archive, filter) != ARCHIVE_OK) {
+		return -1;
+	}
+	/* use every core for filters that support threaded compression;
+	 * unknown options are not fatal */
+	archive_write_set_filter_option(archive, NULL, "threads", "0");
+	return 0;
+}
+
+static int write_db(const char *dbpath, struct pkg_meta *pkgs, size_t count)
+{
+	struct archive *olddb = NULL, *newdb;
+	struct archive_entry *entry;
+	char *tmppath = NULL;
+	time_t now = time(NULL);
+	size_t n;
+	int ret = -1;
+
+	if(asprintf(&tmppath, "%s.part", dbpath) < 0) {
+		return -1;
+	}
+
+	newdb = archive_write_new();
+	if(newdb == NULL ||
+			archive_write_set_format_pax_restricted(newdb) != ARCHIVE_OK ||
+			set_compression(newdb, dbpath) != 0 ||
+			archive_write_open_filename(newdb, tmppath) != ARCHIVE_OK) {
+		fprintf(stderr, "error: could not create db archive '%s'\n", tmppath);
+		goto cleanup;
+	}
+
+	/* carry over entries for packages that are not being replaced */
+	olddb = archive_read_new();
+	archive_read_support_filter_all(olddb);
+	archive_read_support_format_all(olddb);
+	if(archive_read_open_filename(olddb, dbpath, 65536) != ARCHIVE_OK) {
+		/* no previous db; start from scratch */
+		archive_read_free(olddb);
+		olddb = NULL;
+	}
+
+	while(olddb && archive_read_next_header(olddb, &entry) == ARCHIVE_OK) {
+		const char *path = archive_entry_pathname(entry);
+		char buf[65536];
+		ssize_t got;
+
+		if(entry_is_replaced(path, pkgs, count)) {
+			archive_read_data_skip(olddb);
+			continue;
+		}
+		if(archive_write_header(newdb, entry) != ARCHIVE_OK) {
+			fprintf(stderr, "error: could not copy db entry '%s'\n", path);
+			goto cleanup;
+		}
+		while((got = archive_read_data(olddb, buf, sizeof(buf))) > 0) {
+			if(archive_write_data(newdb, buf, got) < 0) {
+				fprintf(stderr, "error: could not copy db entry '%s'\n", path);
+				goto cleanup;
+			}
+		}
+		if(got < 0) {
+			fprintf(stderr, "error: could not read db entry '%s'\n", path);
+			goto cleanup;
+		}
+	}
+
+	for(n = 0; n < count; n++) {
+		char path[4096];
+
+		if((entry = archive_entry_new()) == NULL) {
+			goto cleanup;
+		}
+		snprintf(path, sizeof(path), "%s/desc", pkgs[n].entryname);
+		archive_entry_set_pathname(entry, path);
+		archive_entry_set_filetype(entry, AE_IFREG);
+		archive_entry_set_perm(entry, 0644);
+		archive_entry_set_size(entry, pkgs[n].desc_len);
+		archive_entry_set_mtime(entry, now, 0);
+		if(archive_write_header(newdb, entry) != ARCHIVE_OK ||
+				archive_write_data(newdb, pkgs[n].desc,
+					pkgs[n].desc_len) < 0) {
+			fprintf(stderr, "error: could not write db entry '%s'\n", path);
+			archive_entry_free(entry);
+			goto cleanup;
+		}
+		archive_entry_free(entry);
+	}
+
+	if(archive_write_close(newdb) != ARCHIVE_OK) {
+		fprintf(stderr, "error: could not finish db archive '%s'\n", tmppath);
+		goto cleanup;
+	}
+	if(rename(tmppath, dbpath) != 0) {
+		fprintf(stderr, "error: could not rename '%s' to '%s': %s\n",
+				tmppath, dbpath, strerror(errno));
+		goto cleanup;
+	}
+	ret = 0;
+
+cleanup:
+	if(olddb) {
+		archive_read_free(olddb);
+	}
+	if(newdb) {
+		archive_write_free(newdb);
+	}
+	if(ret != 0) {
+		unlink(tmppath);
+	}
+	free(tmppath);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pool_ctx pool;
+	pthread_t *threads = NULL;
+	const char *dbpath;
+	long nthreads, nproc;
+	long t, started;
+	size_t n;
+	int ret = 1;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = nproc > 0 ? nproc : 1;
+
+	for(; argc > 1; argc--, argv++) {
+		if(strcmp(argv[1], "-q") == 0 || strcmp(argv[1], "--quiet") == 0) {
+			pool.quiet = 1;
+		} else if((strcmp(argv[1], "-t") == 0 ||
+					strcmp(argv[1], "--threads") == 0) && argc > 2) {
+			nthreads = strtol(argv[2], NULL, 10);
+			if(nthreads < 1) {
+				nthreads = 1;
+			}
+			argc--;
+			argv++;
+		} else if(strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+			usage();
+			return 0;
+		} else {
+			break;
+		}
+	}
+
+	if(argc < 3) {
+		usage();
+		return 1;
+	}
+
+	dbpath = argv[1];
+	/* the writer only emits desc entries; running against a files db
+	 * would silently drop the file lists of every added or replaced
+	 * package, so hand those to the repo-add script */
+	if(strstr(base_name(dbpath), ".files") != NULL) {
+		fprintf(stderr, "error: '%s' is a files database; "
+				"only sync databases are supported, use repo-add instead\n",
+				dbpath);
+		return 1;
+	}
+	pool.count = argc - 2;
+	if((pool.pkgs = calloc(pool.count, sizeof(struct pkg_meta))) == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	for(n = 0; n < pool.count; n++) {
+		pool.pkgs[n].path = argv[n + 2];
+		pool.pkgs[n].result = -1;
+	}
+
+	if((size_t)nthreads > pool.count) {
+		nthreads = pool.count;
+	}
+	if((threads = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		goto cleanup;
+	}
+
+	started = 0;
+	for(t = 0; t < nthreads; t++) {
+		if(pthread_create(&threads[t], NULL, pool_worker, &pool) != 0) {
+			break;
+		}
+		started++;
+	}
+	if(started == 0) {
+		/* no threads available; process everything on this one */
+		pool_worker(&pool);
+	}
+	for(t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	for(n = 0; n < pool.count; n++) {
+		if(pool.pkgs[n].result != 0) {
+			fprintf(stderr, "error: package '%s' could not be added\n",
+					pool.pkgs[n].path);
+			goto cleanup;
+		}
+	}
+
+	if(write_db(dbpath, pool.pkgs, pool.count) == 0) {
+		ret = 0;
+	}
+
+cleanup:
+	free(threads);
+	for(n = 0; n < pool.count; n++) {
+		free(pool.pkgs[n].name);
+		free(pool.pkgs[n].entryname);
+		free(pool.pkgs[n].desc);
+	}
+	free(pool.pkgs);
+	pthread_mutex_destroy(&pool.lock);
+	return ret;
+}
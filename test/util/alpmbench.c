@@ -0,0 +1,288 @@
+/*
+ *  alpmbench.c - microbenchmarks for libalpm hot paths
+ *
+ *  Copyright (c) 2020 Pacman Development Team <pacman-dev@archlinux.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Usage: alpmbench <vercmp|filelist|localdb|satisfier> [size]
+ *
+ * Each benchmark builds synthetic input of the requested size (default
+ * below, also settable via $ALPMBENCH_SIZE), times the hot path with a
+ * monotonic clock and prints ns/op so runs can be compared across commits.
+ * Run via `meson test --benchmark`. */
+
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <alpm.h>
+#include <alpm_list.h>
+
+#define DEFAULT_SIZE 2000
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *name, size_t ops, long long elapsed_ns)
+{
+	printf("%s: %zu ops in %.2f ms, %.1f ns/op\n", name, ops,
+			elapsed_ns / 1e6, ops ? (double)elapsed_ns / ops : 0.0);
+}
+
+/* deterministic generator so runs are comparable */
+static unsigned int prng_state = 0x5eed;
+static unsigned int prng(void)
+{
+	prng_state = prng_state * 1103515245 + 12345;
+	return (prng_state >> 16) & 0x7fff;
+}
+
+static int bench_vercmp(size_t size)
+{
+	char **versions;
+	size_t i, ops = 0;
+	long long start;
+	volatile int sink = 0;
+
+	if((versions = calloc(size, sizeof(char *))) == NULL) {
+		return 1;
+	}
+	for(i = 0; i < size; i++) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%u.%u.%u%s-%u", prng() % 20, prng() % 50,
+				prng() % 100, (prng() % 4) ? "" : "rc1", prng() % 5 + 1);
+		if((versions[i] = strdup(buf)) == NULL) {
+			return 1;
+		}
+	}
+
+	start = now_ns();
+	for(i = 0; i < size; i++) {
+		size_t j;
+		for(j = 0; j < size; j += 7) {
+			sink += alpm_pkg_vercmp(versions[i], versions[j]);
+			ops++;
+		}
+	}
+	report("vercmp", ops, now_ns() - start);
+
+	for(i = 0; i < size; i++) {
+		free(versions[i]);
+	}
+	free(versions);
+	(void)sink;
+	return 0;
+}
+
+static int bench_filelist(size_t size)
+{
+	alpm_filelist_t filelist = {0};
+	size_t i, ops = 0;
+	long long start;
+	volatile const void *sink = NULL;
+
+	/* generated in ascending order, as a real filelist would be sorted */
+	if((filelist.files = calloc(size, sizeof(alpm_file_t))) == NULL) {
+		return 1;
+	}
+	filelist.count = size;
+	for(i = 0; i < size; i++) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "usr/share/bench/dir%05zu/file%05zu",
+				i / 16, i);
+		if((filelist.files[i].name = strdup(buf)) == NULL) {
+			return 1;
+		}
+	}
+
+	start = now_ns();
+	for(i = 0; i < size * 20; i++) {
+		char buf[64];
+		size_t n = prng() % size;
+		/* every other lookup misses */
+		snprintf(buf, sizeof(buf), "usr/share/bench/dir%05zu/%s%05zu",
+				n / 16, (i % 2) ? "file" : "none", n);
+		sink = alpm_filelist_contains(&filelist, buf);
+		ops++;
+	}
+	report("filelist_contains", ops, now_ns() - start);
+
+	for(i = 0; i < size; i++) {
+		free(filelist.files[i].name);
+	}
+	free(filelist.files);
+	(void)sink;
+	return 0;
+}
+
+/* Write a synthetic local database of <size> packages under <root>/db/,
+ * each depending on its predecessor to give the dep matchers real work. */
+static int write_local_db(const char *root, size_t size)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	size_t i;
+
+	snprintf(path, sizeof(path), "%s/db/local", root);
+	if(mkdir(path, 0755) != 0) {
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/db/local/ALPM_DB_VERSION", root);
+	if((fp = fopen(path, "w")) == NULL) {
+		return 1;
+	}
+	fputs("9\n", fp);
+	fclose(fp);
+
+	for(i = 0; i < size; i++) {
+		snprintf(path, sizeof(path), "%s/db/local/pkg%05zu-1.0-1", root, i);
+		if(mkdir(path, 0755) != 0) {
+			return 1;
+		}
+		snprintf(path, sizeof(path), "%s/db/local/pkg%05zu-1.0-1/desc",
+				root, i);
+		if((fp = fopen(path, "w")) == NULL) {
+			return 1;
+		}
+		fprintf(fp, "%%NAME%%\npkg%05zu\n\n%%VERSION%%\n1.0-1\n\n"
+				"%%DESC%%\nsynthetic benchmark package\n\n"
+				"%%PROVIDES%%\nbench%05zu=1.0\n\n", i, i);
+		if(i > 0) {
+			fprintf(fp, "%%DEPENDS%%\npkg%05zu\n\n", i - 1);
+		}
+		fclose(fp);
+	}
+	return 0;
+}
+
+static int rm_cb(const char *path, const struct stat *st, int type,
+		struct FTW *ftw)
+{
+	(void)st;
+	(void)type;
+	(void)ftw;
+	return remove(path);
+}
+
+static int bench_db(size_t size, int satisfier)
+{
+	char root[] = "/tmp/alpmbench.XXXXXX";
+	char dbpath[PATH_MAX];
+	alpm_errno_t err;
+	alpm_handle_t *handle = NULL;
+	alpm_db_t *localdb;
+	alpm_list_t *i;
+	long long start;
+	size_t ops = 0;
+	int ret = 1;
+
+	if(mkdtemp(root) == NULL) {
+		return 1;
+	}
+	snprintf(dbpath, sizeof(dbpath), "%s/db/", root);
+	if(mkdir(dbpath, 0755) != 0 || write_local_db(root, size) != 0) {
+		goto cleanup;
+	}
+
+	if((handle = alpm_initialize(root, dbpath, &err)) == NULL) {
+		fprintf(stderr, "alpm_initialize: %s\n", alpm_strerror(err));
+		goto cleanup;
+	}
+	localdb = alpm_get_localdb(handle);
+
+	if(satisfier) {
+		alpm_list_t *dbs = alpm_list_add(NULL, localdb);
+		size_t n;
+		volatile const void *sink = NULL;
+		/* populate outside the timed region */
+		alpm_db_get_pkgcache(localdb);
+		start = now_ns();
+		for(n = 0; n < size * 10; n++) {
+			char dep[32];
+			/* alternate direct names and provided names */
+			snprintf(dep, sizeof(dep), "%s%05u%s",
+					(n % 2) ? "pkg" : "bench", prng() % (unsigned int)size,
+					(n % 2) ? "" : ">=1.0");
+			sink = alpm_find_dbs_satisfier(handle, dbs, dep);
+			ops++;
+		}
+		report("find_dbs_satisfier", ops, now_ns() - start);
+		alpm_list_free(dbs);
+		(void)sink;
+	} else {
+		start = now_ns();
+		/* the pkgcache loads lazily; touch the description of every
+		 * package so the whole desc parse is inside the timed region */
+		for(i = alpm_db_get_pkgcache(localdb); i; i = i->next) {
+			alpm_pkg_get_desc(i->data);
+			ops++;
+		}
+		report("local_db_populate", ops, now_ns() - start);
+		if(ops != size) {
+			fprintf(stderr, "expected %zu packages, loaded %zu\n", size, ops);
+			goto cleanup;
+		}
+	}
+	ret = 0;
+
+cleanup:
+	if(handle) {
+		alpm_release(handle);
+	}
+	nftw(root, rm_cb, 16, FTW_DEPTH | FTW_PHYS);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = DEFAULT_SIZE;
+	const char *env;
+
+	if((env = getenv("ALPMBENCH_SIZE")) != NULL) {
+		size = strtoul(env, NULL, 10);
+	}
+	if(argc > 2) {
+		size = strtoul(argv[2], NULL, 10);
+	}
+	if(argc < 2 || size == 0) {
+		fprintf(stderr, "usage: %s <vercmp|filelist|localdb|satisfier> [size]\n",
+				argv[0]);
+		return 2;
+	}
+
+	if(strcmp(argv[1], "vercmp") == 0) {
+		return bench_vercmp(size);
+	} else if(strcmp(argv[1], "filelist") == 0) {
+		return bench_filelist(size);
+	} else if(strcmp(argv[1], "localdb") == 0) {
+		return bench_db(size, 0);
+	} else if(strcmp(argv[1], "satisfier") == 0) {
+		return bench_db(size, 1);
+	}
+
+	fprintf(stderr, "unknown benchmark '%s'\n", argv[1]);
+	return 2;
+}